@@ -30,12 +30,22 @@
 #include "meta_data.h"
 #include "plugin.h"
 #include "utils_cache.h" /* for uc_get_rate() */
+#include "utils_sketch.h"
 #include "utils_subst.h"
 #include "utils_vl_lookup.h"
 
 #define AGG_MATCHES_ALL(str) (strcmp("/.*/", str) == 0)
 #define AGG_FUNC_PLACEHOLDER "%{aggregation}"
 
+/* Number of partial aggregates kept per instance. Each thread sticks to one
+ * stripe, so as long as there are no more write threads than stripes, updates
+ * never contend with each other; only the read callback touches all of them. */
+#define AGG_STRIPES 16
+#define AGG_STRIPE_SIZE 128
+
+/* Relative error of the reported percentiles. */
+#define AGG_PERCENTILE_ACCURACY 0.01
+
 struct aggregation_s /* {{{ */
 {
   lookup_identifier_t ident;
@@ -54,31 +64,76 @@ struct aggregation_s /* {{{ */
   _Bool calc_min;
   _Bool calc_max;
   _Bool calc_stddev;
+
+  double *percentiles;
+  size_t percentiles_num;
 }; /* }}} */
 typedef struct aggregation_s aggregation_t;
 
+enum agg_func_e {
+  AGG_FUNC_NUM,
+  AGG_FUNC_SUM,
+  AGG_FUNC_AVERAGE,
+  AGG_FUNC_MIN,
+  AGG_FUNC_MAX,
+  AGG_FUNC_STDDEV,
+  AGG_FUNC_PERCENTILE
+};
+
+/* One derived value list per aggregation function. The plugin instance is
+ * substituted once, when the aggregation instance is created. */
+struct agg_output_s /* {{{ */
+{
+  enum agg_func_e func;
+  double percent;
+  char plugin_instance[DATA_MAX_NAME_LEN];
+  rate_to_value_state_t state;
+}; /* }}} */
+typedef struct agg_output_s agg_output_t;
+
+/* Partial aggregate of the values seen by the threads mapped to one stripe. */
+struct agg_partial_s /* {{{ */
+{
+  pthread_mutex_t lock;
+
+  derive_t num;
+  gauge_t sum;
+  gauge_t squares_sum;
+
+  gauge_t min;
+  gauge_t max;
+
+  sketch_t *sketch; /* allocated on first use if percentiles are configured */
+}; /* }}} */
+typedef struct agg_partial_s agg_partial_t;
+
+/* Keeps stripes on separate cache lines. */
+union agg_stripe_u {
+  agg_partial_t partial;
+  char pad[AGG_STRIPE_SIZE];
+};
+typedef union agg_stripe_u agg_stripe_t;
+
 struct agg_instance_s;
 typedef struct agg_instance_s agg_instance_t;
 struct agg_instance_s /* {{{ */
 {
+  agg_stripe_t stripes[AGG_STRIPES];
+
+  /* Everything below is only used by the read callback. */
   pthread_mutex_t lock;
   lookup_identifier_t ident;
 
   int ds_type;
 
-  derive_t num;
-  gauge_t sum;
-  gauge_t squares_sum;
+  /* Template for the dispatched value lists. Only the time, plugin instance
+   * and value change between dispatches. */
+  value_list_t vl;
 
-  gauge_t min;
-  gauge_t max;
+  agg_output_t *outputs;
+  size_t outputs_num;
 
-  rate_to_value_state_t *state_num;
-  rate_to_value_state_t *state_sum;
-  rate_to_value_state_t *state_average;
-  rate_to_value_state_t *state_min;
-  rate_to_value_state_t *state_max;
-  rate_to_value_state_t *state_stddev;
+  sketch_t *sketch; /* merged from the stripes; NULL without percentiles */
 
   agg_instance_t *next;
 }; /* }}} */
@@ -88,6 +143,12 @@ static lookup_t *lookup = NULL;
 static pthread_mutex_t agg_instance_list_lock = PTHREAD_MUTEX_INITIALIZER;
 static agg_instance_t *agg_instance_list_head = NULL;
 
+/* Maps each thread to its stripe. The key holds the stripe number plus one,
+ * so that NULL means "not assigned yet". */
+static pthread_key_t agg_stripe_key;
+static _Bool agg_stripe_key_created = 0;
+static unsigned int agg_stripe_next = 0;
+
 static _Bool agg_is_regex(char const *str) /* {{{ */
 {
   size_t len;
@@ -107,9 +168,41 @@ static _Bool agg_is_regex(char const *str) /* {{{ */
 
 static void agg_destroy(aggregation_t *agg) /* {{{ */
 {
+  if (agg == NULL)
+    return;
+
+  sfree(agg->set_host);
+  sfree(agg->set_plugin);
+  sfree(agg->set_plugin_instance);
+  sfree(agg->set_type_instance);
+  sfree(agg->percentiles);
   sfree(agg);
 } /* }}} void agg_destroy */
 
+static agg_partial_t *agg_thread_partial(agg_instance_t *inst) /* {{{ */
+{
+  uintptr_t stripe = (uintptr_t)pthread_getspecific(agg_stripe_key);
+
+  if (stripe == 0) {
+    stripe = 1 + (__atomic_fetch_add(&agg_stripe_next, 1, __ATOMIC_RELAXED) %
+                  AGG_STRIPES);
+    pthread_setspecific(agg_stripe_key, (void *)stripe);
+  }
+
+  return &inst->stripes[stripe - 1].partial;
+} /* }}} agg_partial_t *agg_thread_partial */
+
+static void agg_partial_reset(agg_partial_t *p) /* {{{ */
+{
+  p->num = 0;
+  p->sum = 0.0;
+  p->squares_sum = 0.0;
+  p->min = NAN;
+  p->max = NAN;
+  if (p->sketch != NULL)
+    sketch_reset(p->sketch);
+} /* }}} void agg_partial_reset */
+
 /* Frees all dynamically allocated memory within the instance. */
 static void agg_instance_destroy(agg_instance_t *inst) /* {{{ */
 {
@@ -129,17 +222,19 @@ static void agg_instance_destroy(agg_instance_t *inst) /* {{{ */
   }
   pthread_mutex_unlock(&agg_instance_list_lock);
 
-  sfree(inst->state_num);
-  sfree(inst->state_sum);
-  sfree(inst->state_average);
-  sfree(inst->state_min);
-  sfree(inst->state_max);
-  sfree(inst->state_stddev);
+  for (size_t i = 0; i < AGG_STRIPES; i++) {
+    agg_partial_t *p = &inst->stripes[i].partial;
+    pthread_mutex_destroy(&p->lock);
+    sketch_destroy(p->sketch);
+  }
+  pthread_mutex_destroy(&inst->lock);
+
+  meta_data_destroy(inst->vl.meta);
+  sfree(inst->outputs);
+  sketch_destroy(inst->sketch);
 
   memset(inst, 0, sizeof(*inst));
   inst->ds_type = -1;
-  inst->min = NAN;
-  inst->max = NAN;
 } /* }}} void agg_instance_destroy */
 
 static int agg_instance_create_name(agg_instance_t *inst, /* {{{ */
@@ -223,6 +318,75 @@ static int agg_instance_create_name(agg_instance_t *inst, /* {{{ */
   return 0;
 } /* }}} int agg_instance_create_name */
 
+static int agg_instance_add_output(agg_instance_t *inst, /* {{{ */
+                                   enum agg_func_e func, char const *name,
+                                   double percent) {
+  agg_output_t *out = inst->outputs + inst->outputs_num;
+
+  memset(out, 0, sizeof(*out));
+  out->func = func;
+  out->percent = percent;
+
+  if (inst->ident.plugin_instance[0] != 0)
+    subst_string(out->plugin_instance, sizeof(out->plugin_instance),
+                 inst->ident.plugin_instance, AGG_FUNC_PLACEHOLDER, name);
+  else
+    sstrncpy(out->plugin_instance, name, sizeof(out->plugin_instance));
+
+  inst->outputs_num++;
+  return 0;
+} /* }}} int agg_instance_add_output */
+
+/* Pre-builds everything that is dispatched by agg_instance_read(), so that
+ * no names need to be formatted while reading. */
+static int agg_instance_create_outputs(agg_instance_t *inst, /* {{{ */
+                                       aggregation_t const *agg) {
+  inst->outputs = calloc(6 + agg->percentiles_num, sizeof(*inst->outputs));
+  if (inst->outputs == NULL)
+    return ENOMEM;
+
+  if (agg->calc_num)
+    agg_instance_add_output(inst, AGG_FUNC_NUM, "num", NAN);
+  if (agg->calc_sum)
+    agg_instance_add_output(inst, AGG_FUNC_SUM, "sum", NAN);
+  if (agg->calc_average)
+    agg_instance_add_output(inst, AGG_FUNC_AVERAGE, "average", NAN);
+  if (agg->calc_min)
+    agg_instance_add_output(inst, AGG_FUNC_MIN, "min", NAN);
+  if (agg->calc_max)
+    agg_instance_add_output(inst, AGG_FUNC_MAX, "max", NAN);
+  if (agg->calc_stddev)
+    agg_instance_add_output(inst, AGG_FUNC_STDDEV, "stddev", NAN);
+
+  for (size_t i = 0; i < agg->percentiles_num; i++) {
+    char name[DATA_MAX_NAME_LEN];
+    snprintf(name, sizeof(name), "percentile-%g", agg->percentiles[i]);
+    agg_instance_add_output(inst, AGG_FUNC_PERCENTILE, name,
+                            agg->percentiles[i]);
+  }
+
+  if (agg->percentiles_num > 0) {
+    inst->sketch = sketch_create(AGG_PERCENTILE_ACCURACY);
+    if (inst->sketch == NULL)
+      return ENOMEM;
+  }
+
+  value_list_t *vl = &inst->vl;
+  vl->meta = meta_data_create();
+  if (vl->meta == NULL)
+    return ENOMEM;
+  meta_data_add_boolean(vl->meta, "aggregation:created", 1);
+
+  sstrncpy(vl->host, inst->ident.host, sizeof(vl->host));
+  sstrncpy(vl->plugin, inst->ident.plugin, sizeof(vl->plugin));
+  sstrncpy(vl->type, inst->ident.type, sizeof(vl->type));
+  sstrncpy(vl->type_instance, inst->ident.type_instance,
+           sizeof(vl->type_instance));
+  vl->interval = 0;
+
+  return 0;
+} /* }}} int agg_instance_create_outputs */
+
 /* Create a new aggregation instance. */
 static agg_instance_t *agg_instance_create(data_set_t const *ds, /* {{{ */
                                            value_list_t const *vl,
@@ -237,36 +401,22 @@ static agg_instance_t *agg_instance_create(data_set_t const *ds, /* {{{ */
     return NULL;
   }
   pthread_mutex_init(&inst->lock, /* attr = */ NULL);
+  for (size_t i = 0; i < AGG_STRIPES; i++) {
+    agg_partial_t *p = &inst->stripes[i].partial;
+    pthread_mutex_init(&p->lock, /* attr = */ NULL);
+    agg_partial_reset(p);
+  }
 
   inst->ds_type = ds->ds[0].type;
 
   agg_instance_create_name(inst, vl, agg);
 
-  inst->min = NAN;
-  inst->max = NAN;
-
-#define INIT_STATE(field)                                                      \
-  do {                                                                         \
-    inst->state_##field = NULL;                                                \
-    if (agg->calc_##field) {                                                   \
-      inst->state_##field = calloc(1, sizeof(*inst->state_##field));           \
-      if (inst->state_##field == NULL) {                                       \
-        agg_instance_destroy(inst);                                            \
-        free(inst);                                                            \
-        ERROR("aggregation plugin: calloc() failed.");                         \
-        return NULL;                                                           \
-      }                                                                        \
-    }                                                                          \
-  } while (0)
-
-  INIT_STATE(num);
-  INIT_STATE(sum);
-  INIT_STATE(average);
-  INIT_STATE(min);
-  INIT_STATE(max);
-  INIT_STATE(stddev);
-
-#undef INIT_STATE
+  if (agg_instance_create_outputs(inst, agg) != 0) {
+    agg_instance_destroy(inst);
+    free(inst);
+    ERROR("aggregation plugin: Allocating memory for a new instance failed.");
+    return NULL;
+  }
 
   pthread_mutex_lock(&agg_instance_list_lock);
   inst->next = agg_instance_list_head;
@@ -276,13 +426,13 @@ static agg_instance_t *agg_instance_create(data_set_t const *ds, /* {{{ */
   return inst;
 } /* }}} agg_instance_t *agg_instance_create */
 
-/* Update the num, sum, min, max, ... fields of the aggregation instance, if
- * the rate of the value list is available. Value lists with more than one data
- * source are not supported and will return an error. Returns zero on success
- * and non-zero otherwise. */
+/* Update the num, sum, min, max, ... fields of the calling thread's partial
+ * aggregate, if the rate of the value list is available. Value lists with more
+ * than one data source are not supported and will return an error. Returns
+ * zero on success and non-zero otherwise. */
 static int agg_instance_update(agg_instance_t *inst, /* {{{ */
                                data_set_t const *ds, value_list_t const *vl) {
-  gauge_t *rate;
+  gauge_t rate;
 
   if (ds->ds_num != 1) {
     ERROR("aggregation plugin: The \"%s\" type (data set) has more than one "
@@ -292,52 +442,65 @@ static int agg_instance_update(agg_instance_t *inst, /* {{{ */
     return EINVAL;
   }
 
-  rate = uc_get_rate(ds, vl);
-  if (rate == NULL) {
-    char ident[6 * DATA_MAX_NAME_LEN];
-    FORMAT_VL(ident, sizeof(ident), vl);
-    ERROR("aggregation plugin: Unable to read the current rate of \"%s\".",
-          ident);
-    return ENOENT;
+  /* The cache stores gauges as they are, so skip the lookup for them. */
+  if (ds->ds[0].type == DS_TYPE_GAUGE)
+    rate = vl->values[0].gauge;
+  else {
+    gauge_t *cached = uc_get_rate(ds, vl);
+    if (cached == NULL) {
+      char ident[6 * DATA_MAX_NAME_LEN];
+      FORMAT_VL(ident, sizeof(ident), vl);
+      ERROR("aggregation plugin: Unable to read the current rate of \"%s\".",
+            ident);
+      return ENOENT;
+    }
+    rate = cached[0];
+    sfree(cached);
   }
 
-  if (isnan(rate[0])) {
-    sfree(rate);
+  if (isnan(rate))
     return 0;
-  }
 
-  pthread_mutex_lock(&inst->lock);
+  agg_partial_t *p = agg_thread_partial(inst);
+  int status = 0;
 
-  inst->num++;
-  inst->sum += rate[0];
-  inst->squares_sum += (rate[0] * rate[0]);
+  pthread_mutex_lock(&p->lock);
 
-  if (isnan(inst->min) || (inst->min > rate[0]))
-    inst->min = rate[0];
-  if (isnan(inst->max) || (inst->max < rate[0]))
-    inst->max = rate[0];
+  p->num++;
+  p->sum += rate;
+  p->squares_sum += (rate * rate);
 
-  pthread_mutex_unlock(&inst->lock);
+  if (isnan(p->min) || (p->min > rate))
+    p->min = rate;
+  if (isnan(p->max) || (p->max < rate))
+    p->max = rate;
 
-  sfree(rate);
-  return 0;
+  /* The sketch only takes finite values. */
+  if ((inst->sketch != NULL) && isfinite(rate)) {
+    if (p->sketch == NULL)
+      p->sketch = sketch_create(AGG_PERCENTILE_ACCURACY);
+    if (p->sketch != NULL)
+      status = sketch_add(p->sketch, rate);
+    else
+      status = ENOMEM;
+  }
+
+  pthread_mutex_unlock(&p->lock);
+
+  if (status != 0)
+    ERROR("aggregation plugin: Adding a value to the percentile sketch "
+          "failed.");
+  return status;
 } /* }}} int agg_instance_update */
 
 static int agg_instance_read_func(agg_instance_t *inst, /* {{{ */
-                                  char const *func, gauge_t rate,
-                                  rate_to_value_state_t *state,
-                                  value_list_t *vl, char const *pi_prefix,
+                                  agg_output_t *out, gauge_t rate,
                                   cdtime_t t) {
+  value_list_t *vl = &inst->vl;
   value_t v;
   int status;
 
-  if (pi_prefix[0] != 0)
-    subst_string(vl->plugin_instance, sizeof(vl->plugin_instance), pi_prefix,
-                 AGG_FUNC_PLACEHOLDER, func);
-  else
-    sstrncpy(vl->plugin_instance, func, sizeof(vl->plugin_instance));
-
-  status = rate_to_value(&v, rate, state, inst->ds_type, t);
+  status = rate_to_value(&v, rate, &out->state, inst->ds_type, t);
   if (status != 0) {
     /* If this is the first iteration and rate_to_value() was asked to return a
      * COUNTER or a DERIVE, it will return EAGAIN. Catch this and handle
@@ -349,6 +512,9 @@ static int agg_instance_read_func(agg_instance_t *inst, /* {{{ */
     return -1;
   }
 
+  sstrncpy(vl->plugin_instance, out->plugin_instance,
+           sizeof(vl->plugin_instance));
+  vl->time = t;
   vl->values = &v;
   vl->values_len = 1;
 
@@ -362,65 +528,82 @@ static int agg_instance_read_func(agg_instance_t *inst, /* {{{ */
 
 static int agg_instance_read(agg_instance_t *inst, cdtime_t t) /* {{{ */
 {
-  value_list_t vl = VALUE_LIST_INIT;
-
-  /* Pre-set all the fields in the value list that will not change per
-   * aggregation type (sum, average, ...). The struct will be re-used and must
-   * therefore be dispatched using the "secure" function. */
+  derive_t num = 0;
+  gauge_t sum = 0.0;
+  gauge_t squares_sum = 0.0;
+  gauge_t min = NAN;
+  gauge_t max = NAN;
 
-  vl.time = t;
-  vl.interval = 0;
+  pthread_mutex_lock(&inst->lock);
 
-  vl.meta = meta_data_create();
-  if (vl.meta == NULL) {
-    ERROR("aggregation plugin: meta_data_create failed.");
-    return -1;
+  /* Collect and reset the partial aggregates. Each stripe is only locked for
+   * as long as it takes to merge it. */
+  for (size_t i = 0; i < AGG_STRIPES; i++) {
+    agg_partial_t *p = &inst->stripes[i].partial;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->num > 0) {
+      num += p->num;
+      sum += p->sum;
+      squares_sum += p->squares_sum;
+      if (isnan(min) || (min > p->min))
+        min = p->min;
+      if (isnan(max) || (max < p->max))
+        max = p->max;
+
+      if ((inst->sketch != NULL) && (p->sketch != NULL) &&
+          (sketch_merge(inst->sketch, p->sketch) != 0))
+        ERROR("aggregation plugin: Merging percentile sketches failed.");
+
+      agg_partial_reset(p);
+    }
+    pthread_mutex_unlock(&p->lock);
   }
-  meta_data_add_boolean(vl.meta, "aggregation:created", 1);
 
-  sstrncpy(vl.host, inst->ident.host, sizeof(vl.host));
-  sstrncpy(vl.plugin, inst->ident.plugin, sizeof(vl.plugin));
-  sstrncpy(vl.type, inst->ident.type, sizeof(vl.type));
-  sstrncpy(vl.type_instance, inst->ident.type_instance,
-           sizeof(vl.type_instance));
+  for (size_t i = 0; i < inst->outputs_num; i++) {
+    agg_output_t *out = inst->outputs + i;
+    gauge_t rate;
 
-#define READ_FUNC(func, rate)                                                  \
-  do {                                                                         \
-    if (inst->state_##func != NULL) {                                          \
-      agg_instance_read_func(inst, #func, rate, inst->state_##func, &vl,       \
-                             inst->ident.plugin_instance, t);                  \
-    }                                                                          \
-  } while (0)
+    /* All aggregations but "num" are only defined when there have been any
+     * values at all. */
+    if ((num == 0) && (out->func != AGG_FUNC_NUM))
+      continue;
 
-  pthread_mutex_lock(&inst->lock);
+    switch (out->func) {
+    case AGG_FUNC_NUM:
+      rate = (gauge_t)num;
+      break;
+    case AGG_FUNC_SUM:
+      rate = sum;
+      break;
+    case AGG_FUNC_AVERAGE:
+      rate = sum / ((gauge_t)num);
+      break;
+    case AGG_FUNC_MIN:
+      rate = min;
+      break;
+    case AGG_FUNC_MAX:
+      rate = max;
+      break;
+    case AGG_FUNC_STDDEV:
+      rate = sqrt((((gauge_t)num) * squares_sum) - (sum * sum)) /
+             ((gauge_t)num);
+      break;
+    case AGG_FUNC_PERCENTILE:
+      rate = sketch_percentile(inst->sketch, out->percent);
+      break;
+    default:
+      continue;
+    }
 
-  READ_FUNC(num, (gauge_t)inst->num);
-
-  /* All other aggregations are only defined when there have been any values
-   * at all. */
-  if (inst->num > 0) {
-    READ_FUNC(sum, inst->sum);
-    READ_FUNC(average, (inst->sum / ((gauge_t)inst->num)));
-    READ_FUNC(min, inst->min);
-    READ_FUNC(max, inst->max);
-    READ_FUNC(stddev,
-              sqrt((((gauge_t)inst->num) * inst->squares_sum) -
-                   (inst->sum * inst->sum)) /
-                  ((gauge_t)inst->num));
+    agg_instance_read_func(inst, out, rate, t);
   }
 
-  /* Reset internal state. */
-  inst->num = 0;
-  inst->sum = 0.0;
-  inst->squares_sum = 0.0;
-  inst->min = NAN;
-  inst->max = NAN;
+  if (inst->sketch != NULL)
+    sketch_reset(inst->sketch);
 
   pthread_mutex_unlock(&inst->lock);
 
-  meta_data_destroy(vl.meta);
-  vl.meta = NULL;
-
   return 0;
 } /* }}} int agg_instance_read */
 
@@ -450,6 +633,7 @@ static void agg_lookup_free_class_callback(void *user_class) /* {{{ */
 static void agg_lookup_free_obj_callback(void *user_obj) /* {{{ */
 {
   agg_instance_destroy((agg_instance_t *)user_obj);
+  sfree(user_obj);
 } /* }}} void agg_lookup_free_obj_callback */
 
 /*
@@ -467,6 +651,7 @@ static void agg_lookup_free_obj_callback(void *user_obj) /* {{{ */
  *     CalculateMinimum true
  *     CalculateMaximum true
  *     CalculateStddev true
+ *     CalculatePercentile 99
  *   </Aggregation>
  * </Plugin>
  */
@@ -503,6 +688,34 @@ static int agg_config_handle_group_by(oconfig_item_t const *ci, /* {{{ */
   return 0;
 } /* }}} int agg_config_handle_group_by */
 
+static int agg_config_handle_percentile(oconfig_item_t *ci, /* {{{ */
+                                        aggregation_t *agg) {
+  double percent;
+
+  int status = cf_util_get_double(ci, &percent);
+  if (status != 0)
+    return status;
+
+  if ((percent <= 0.0) || (percent >= 100.0)) {
+    ERROR("aggregation plugin: The value for \"%s\" must be between 0 and "
+          "100, exclusively.",
+          ci->key);
+    return ERANGE;
+  }
+
+  double *tmp = realloc(agg->percentiles,
+                        (agg->percentiles_num + 1) * sizeof(*agg->percentiles));
+  if (tmp == NULL) {
+    ERROR("aggregation plugin: realloc failed.");
+    return ENOMEM;
+  }
+  agg->percentiles = tmp;
+  agg->percentiles[agg->percentiles_num] = percent;
+  agg->percentiles_num++;
+
+  return 0;
+} /* }}} int agg_config_handle_percentile */
+
 static int agg_config_aggregation(oconfig_item_t *ci) /* {{{ */
 {
   aggregation_t *agg = calloc(1, sizeof(*agg));
@@ -559,13 +772,15 @@ static int agg_config_aggregation(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_boolean(child, &agg->calc_max);
     else if (strcasecmp("CalculateStddev", child->key) == 0)
       status = cf_util_get_boolean(child, &agg->calc_stddev);
+    else if (strcasecmp("CalculatePercentile", child->key) == 0)
+      status = agg_config_handle_percentile(child, agg);
     else
       WARNING("aggregation plugin: The \"%s\" key is not allowed inside "
               "<Aggregation /> blocks and will be ignored.",
               child->key);
 
     if (status != 0) {
-      sfree(agg);
+      agg_destroy(agg);
       return status;
     }
   } /* for (int i = 0; i < ci->children_num; i++) */
@@ -624,7 +839,8 @@ static int agg_config_aggregation(oconfig_item_t *ci) /* {{{ */
   } /* }}} */
 
   if (!agg->calc_num && !agg->calc_sum && !agg->calc_average /* {{{ */
-      && !agg->calc_min && !agg->calc_max && !agg->calc_stddev) {
+      && !agg->calc_min && !agg->calc_max && !agg->calc_stddev &&
+      (agg->percentiles_num == 0)) {
     ERROR("aggregation plugin: No aggregation function has been specified. "
           "Without this, I don't know what I should be calculating. "
           "(Host \"%s\", Plugin \"%s\", PluginInstance \"%s\", "
@@ -635,14 +851,14 @@ static int agg_config_aggregation(oconfig_item_t *ci) /* {{{ */
   } /* }}} */
 
   if (!is_valid) { /* {{{ */
-    sfree(agg);
+    agg_destroy(agg);
     return -1;
   } /* }}} */
 
   int status = lookup_add(lookup, &agg->ident, agg->group_by, agg);
   if (status != 0) {
     ERROR("aggregation plugin: lookup_add failed with status %i.", status);
-    sfree(agg);
+    agg_destroy(agg);
     return -1;
   }
 
@@ -685,6 +901,19 @@ static int agg_config(oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int agg_config */
 
+static int agg_init(void) /* {{{ */
+{
+  if (!agg_stripe_key_created) {
+    if (pthread_key_create(&agg_stripe_key, NULL) != 0) {
+      ERROR("aggregation plugin: pthread_key_create failed.");
+      return -1;
+    }
+    agg_stripe_key_created = 1;
+  }
+
+  return 0;
+} /* }}} int agg_init */
+
 static int agg_read(void) /* {{{ */
 {
   cdtime_t t;
@@ -749,6 +978,7 @@ static int agg_write(data_set_t const *ds, value_list_t const *vl, /* {{{ */
 
 void module_register(void) {
   plugin_register_complex_config("aggregation", agg_config);
+  plugin_register_init("aggregation", agg_init);
   plugin_register_read("aggregation", agg_read);
   plugin_register_write("aggregation", agg_write, /* user_data = */ NULL);
 }
@@ -25,18 +25,57 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
 
+#include <sys/resource.h>
+
+/*
+ * Private types
+ */
+/* An open CSV file. Files are kept open and locked between writes; the least
+ * recently used one is closed when more than `max_open_files' are open. */
+struct csv_file_s {
+  char *key;      /* file name without the date, key of `files' */
+  char *filename; /* name of the currently open file */
+  char date[16];  /* date part of `filename', e.g. "-2013-07-12" */
+  int fd;
+
+  char *buffer;
+  size_t buffer_fill;
+  cdtime_t buffer_time; /* time the first buffered line was added */
+
+  /* LRU list, most recently used first */
+  struct csv_file_s *prev;
+  struct csv_file_s *next;
+};
+typedef struct csv_file_s csv_file_t;
+
 /*
  * Private variables
  */
-static const char *config_keys[] = {"DataDir", "StoreRates"};
+static const char *config_keys[] = {"DataDir", "StoreRates", "MaxOpenFiles",
+                                    "BufferSize", "FlushInterval"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static char *datadir = NULL;
 static int store_rates = 0;
 static int use_stdio = 0;
 
+static size_t max_open_files = 0; /* 0: half of RLIMIT_NOFILE */
+static size_t write_buffer_size = 0;
+static cdtime_t flush_interval = TIME_T_TO_CDTIME_T_STATIC(10);
+
+static c_avl_tree_t *files = NULL;
+static csv_file_t *files_head = NULL;
+static csv_file_t *files_tail = NULL;
+static size_t files_num = 0;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* localtime_r() is expensive, so the date is only computed once a second. */
+static time_t date_time = 0;
+static char date_str[16];
+
 static int value_list_to_string(char *buffer, int buffer_len,
                                 const data_set_t *ds, const value_list_t *vl) {
   int offset;
@@ -102,8 +141,6 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
 
   char *ptr = buffer;
   size_t ptr_size = buffer_size;
-  time_t now;
-  struct tm struct_tm;
 
   if (datadir != NULL) {
     size_t len = strlen(datadir) + 1;
@@ -121,37 +158,40 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
   if (status != 0)
     return status;
 
-  /* Skip all the time formatting stuff when printing to STDOUT or
-   * STDERR. */
-  if (use_stdio)
-    return 0;
-
-  ptr_size -= strlen(ptr);
-  ptr += strlen(ptr);
-
   /* "-2013-07-12" => 11 bytes */
-  if (ptr_size < 12) {
+  if (!use_stdio && ((ptr_size - strlen(ptr)) < 12)) {
     ERROR("csv plugin: Buffer too small.");
     return ENOMEM;
   }
 
-  /* TODO: Find a way to minimize the calls to `localtime_r',
-   * since they are pretty expensive.. */
-  now = time(NULL);
+  return 0;
+} /* int value_list_to_filename */
+
+/* Returns the date suffix of today's files. Must hold files_lock when
+ * calling. */
+static char const *csv_date(void) /* {{{ */
+{
+  time_t now = time(NULL);
+  struct tm struct_tm;
+
+  if ((now == date_time) && (date_str[0] != 0))
+    return date_str;
+
   if (localtime_r(&now, &struct_tm) == NULL) {
     ERROR("csv plugin: localtime_r failed");
-    return -1;
+    return NULL;
   }
 
-  status = strftime(ptr, ptr_size, "-%Y-%m-%d", &struct_tm);
-  if (status == 0) /* yep, it returns zero on error. */
-  {
+  if (strftime(date_str, sizeof(date_str), "-%Y-%m-%d", &struct_tm) == 0) {
+    /* yep, it returns zero on error. */
     ERROR("csv plugin: strftime failed");
-    return -1;
+    date_str[0] = 0;
+    return NULL;
   }
 
-  return 0;
-} /* int value_list_to_filename */
+  date_time = now;
+  return date_str;
+} /* }}} char const *csv_date */
 
 static int csv_create_file(const char *filename, const data_set_t *ds) {
   FILE *csv;
@@ -177,6 +217,220 @@ static int csv_create_file(const char *filename, const data_set_t *ds) {
   return 0;
 } /* int csv_create_file */
 
+/* Writes the buffered lines to the file. */
+static int csv_file_flush(csv_file_t *f) /* {{{ */
+{
+  if (f->buffer_fill == 0)
+    return 0;
+
+  int status = swrite(f->fd, f->buffer, f->buffer_fill);
+  if (status != 0) {
+    char errbuf[1024];
+    ERROR("csv plugin: write (%s) failed: %s", f->filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+  }
+
+  f->buffer_fill = 0;
+  return status;
+} /* }}} int csv_file_flush */
+
+static void csv_file_close(csv_file_t *f) /* {{{ */
+{
+  if (f->fd < 0)
+    return;
+
+  csv_file_flush(f);
+
+  /* Closing the file releases the lock. */
+  close(f->fd);
+  f->fd = -1;
+  sfree(f->filename);
+} /* }}} void csv_file_close */
+
+/* Opens today's file for `f', creating it with a header line if needed, and
+ * locks it. */
+static int csv_file_open(csv_file_t *f, char const *date, /* {{{ */
+                         const data_set_t *ds) {
+  struct stat statbuf;
+  struct flock fl = {0};
+  size_t filename_size = strlen(f->key) + strlen(date) + 1;
+
+  f->filename = malloc(filename_size);
+  if (f->filename == NULL)
+    return ENOMEM;
+  snprintf(f->filename, filename_size, "%s%s", f->key, date);
+  sstrncpy(f->date, date, sizeof(f->date));
+
+  if (stat(f->filename, &statbuf) == -1) {
+    if (errno == ENOENT) {
+      if (csv_create_file(f->filename, ds)) {
+        sfree(f->filename);
+        return -1;
+      }
+    } else {
+      char errbuf[1024];
+      ERROR("stat(%s) failed: %s", f->filename,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      sfree(f->filename);
+      return -1;
+    }
+  } else if (!S_ISREG(statbuf.st_mode)) {
+    ERROR("stat(%s): Not a regular file!", f->filename);
+    sfree(f->filename);
+    return -1;
+  }
+
+  f->fd = open(f->filename, O_WRONLY | O_APPEND);
+  if (f->fd < 0) {
+    char errbuf[1024];
+    ERROR("csv plugin: open (%s) failed: %s", f->filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    sfree(f->filename);
+    return -1;
+  }
+
+  fl.l_pid = getpid();
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+
+  if (fcntl(f->fd, F_SETLK, &fl) != 0) {
+    char errbuf[1024];
+    ERROR("csv plugin: flock (%s) failed: %s", f->filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    close(f->fd);
+    f->fd = -1;
+    sfree(f->filename);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int csv_file_open */
+
+static void csv_file_unlink(csv_file_t *f) /* {{{ */
+{
+  if (f->prev != NULL)
+    f->prev->next = f->next;
+  else
+    files_head = f->next;
+  if (f->next != NULL)
+    f->next->prev = f->prev;
+  else
+    files_tail = f->prev;
+  f->prev = f->next = NULL;
+} /* }}} void csv_file_unlink */
+
+static void csv_file_push(csv_file_t *f) /* {{{ */
+{
+  f->prev = NULL;
+  f->next = files_head;
+  if (files_head != NULL)
+    files_head->prev = f;
+  files_head = f;
+  if (files_tail == NULL)
+    files_tail = f;
+} /* }}} void csv_file_push */
+
+static void csv_file_destroy(csv_file_t *f) /* {{{ */
+{
+  csv_file_close(f);
+  c_avl_remove(files, f->key, NULL, NULL);
+  csv_file_unlink(f);
+  files_num--;
+
+  sfree(f->key);
+  sfree(f->buffer);
+  sfree(f);
+} /* }}} void csv_file_destroy */
+
+/* Returns the open file for `key', opening it if necessary. When the date
+ * changed since the file was opened, it is closed and the new day's file is
+ * opened instead. Must hold files_lock when calling. */
+static csv_file_t *csv_file_get(char const *key, /* {{{ */
+                                const data_set_t *ds) {
+  csv_file_t *f = NULL;
+
+  char const *date = csv_date();
+  if (date == NULL)
+    return NULL;
+
+  if (c_avl_get(files, key, (void *)&f) == 0) {
+    if ((f->fd >= 0) && (strcmp(f->date, date) != 0))
+      csv_file_close(f);
+
+    if ((f->fd < 0) && (csv_file_open(f, date, ds) != 0)) {
+      csv_file_destroy(f);
+      return NULL;
+    }
+
+    csv_file_unlink(f);
+    csv_file_push(f);
+    return f;
+  }
+
+  f = calloc(1, sizeof(*f));
+  if (f == NULL)
+    return NULL;
+  f->fd = -1;
+
+  f->key = strdup(key);
+  if ((write_buffer_size > 0) && (f->key != NULL))
+    f->buffer = malloc(write_buffer_size);
+  if ((f->key == NULL) || ((write_buffer_size > 0) && (f->buffer == NULL))) {
+    ERROR("csv plugin: malloc failed.");
+    sfree(f->key);
+    sfree(f);
+    return NULL;
+  }
+
+  if (csv_file_open(f, date, ds) != 0) {
+    sfree(f->key);
+    sfree(f->buffer);
+    sfree(f);
+    return NULL;
+  }
+
+  if (c_avl_insert(files, f->key, f) != 0) {
+    ERROR("csv plugin: c_avl_insert failed.");
+    csv_file_close(f);
+    sfree(f->key);
+    sfree(f->buffer);
+    sfree(f);
+    return NULL;
+  }
+  csv_file_push(f);
+  files_num++;
+
+  while ((files_num > max_open_files) && (files_tail != f))
+    csv_file_destroy(files_tail);
+
+  return f;
+} /* }}} csv_file_t *csv_file_get */
+
+/* Appends a line to the file's buffer. The buffer is written when it is full
+ * or older than `flush_interval'; csv_read() catches buffers of files which
+ * are not written to any more. Must hold files_lock when calling. */
+static int csv_file_append(csv_file_t *f, char const *line, /* {{{ */
+                           size_t line_len) {
+  if (line_len > write_buffer_size - f->buffer_fill) {
+    int status = csv_file_flush(f);
+    if (status != 0)
+      return status;
+  }
+
+  if (line_len > write_buffer_size)
+    return swrite(f->fd, line, line_len);
+
+  if (f->buffer_fill == 0)
+    f->buffer_time = cdtime();
+  memcpy(f->buffer + f->buffer_fill, line, line_len);
+  f->buffer_fill += line_len;
+
+  if ((cdtime() - f->buffer_time) >= flush_interval)
+    return csv_file_flush(f);
+
+  return 0;
+} /* }}} int csv_file_append */
+
 static int csv_config(const char *key, const char *value) {
   if (strcasecmp("DataDir", key) == 0) {
     if (datadir != NULL) {
@@ -207,6 +461,27 @@ static int csv_config(const char *key, const char *value) {
       store_rates = 1;
     else
       store_rates = 0;
+  } else if (strcasecmp("MaxOpenFiles", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      ERROR("csv plugin: \"MaxOpenFiles\" must be greater than zero.");
+      return 1;
+    }
+    max_open_files = (size_t)tmp;
+  } else if (strcasecmp("BufferSize", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 0) {
+      ERROR("csv plugin: \"BufferSize\" must not be negative.");
+      return 1;
+    }
+    write_buffer_size = (size_t)tmp;
+  } else if (strcasecmp("FlushInterval", key) == 0) {
+    double tmp = atof(value);
+    if (tmp < 0.0) {
+      ERROR("csv plugin: \"FlushInterval\" must not be negative.");
+      return 1;
+    }
+    flush_interval = DOUBLE_TO_CDTIME_T(tmp);
   } else {
     return -1;
   }
@@ -215,12 +490,8 @@ static int csv_config(const char *key, const char *value) {
 
 static int csv_write(const data_set_t *ds, const value_list_t *vl,
                      user_data_t __attribute__((unused)) * user_data) {
-  struct stat statbuf;
   char filename[512];
   char values[4096];
-  FILE *csv;
-  int csv_fd;
-  struct flock fl = {0};
   int status;
 
   if (0 != strcmp(ds->type, vl->type)) {
@@ -253,53 +524,116 @@ static int csv_write(const data_set_t *ds, const value_list_t *vl,
     return 0;
   }
 
-  if (stat(filename, &statbuf) == -1) {
-    if (errno == ENOENT) {
-      if (csv_create_file(filename, ds))
-        return -1;
-    } else {
-      char errbuf[1024];
-      ERROR("stat(%s) failed: %s", filename,
-            sstrerror(errno, errbuf, sizeof(errbuf)));
+  pthread_mutex_lock(&files_lock);
+
+  if (files == NULL) {
+    files = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (files == NULL) {
+      pthread_mutex_unlock(&files_lock);
+      ERROR("csv plugin: c_avl_create failed.");
       return -1;
     }
-  } else if (!S_ISREG(statbuf.st_mode)) {
-    ERROR("stat(%s): Not a regular file!", filename);
-    return -1;
   }
 
-  csv = fopen(filename, "a");
-  if (csv == NULL) {
-    char errbuf[1024];
-    ERROR("csv plugin: fopen (%s) failed: %s", filename,
-          sstrerror(errno, errbuf, sizeof(errbuf)));
+  csv_file_t *f = csv_file_get(filename, ds);
+  if (f == NULL) {
+    pthread_mutex_unlock(&files_lock);
     return -1;
   }
-  csv_fd = fileno(csv);
 
-  fl.l_pid = getpid();
-  fl.l_type = F_WRLCK;
-  fl.l_whence = SEEK_SET;
+  size_t values_len = strlen(values);
+  values[values_len] = '\n';
+  status = csv_file_append(f, values, values_len + 1);
 
-  status = fcntl(csv_fd, F_SETLK, &fl);
-  if (status != 0) {
-    char errbuf[1024];
-    ERROR("csv plugin: flock (%s) failed: %s", filename,
-          sstrerror(errno, errbuf, sizeof(errbuf)));
-    fclose(csv);
-    return -1;
+  pthread_mutex_unlock(&files_lock);
+  return status;
+} /* int csv_write */
+
+static int csv_flush(cdtime_t timeout, /* {{{ */
+                     const char *identifier,
+                     user_data_t __attribute__((unused)) * user_data) {
+  char key[512];
+  cdtime_t now = cdtime();
+  int status = 0;
+
+  if (identifier != NULL) {
+    if (datadir != NULL)
+      snprintf(key, sizeof(key), "%s/%s", datadir, identifier);
+    else
+      sstrncpy(key, identifier, sizeof(key));
   }
 
-  fprintf(csv, "%s\n", values);
+  pthread_mutex_lock(&files_lock);
+  for (csv_file_t *f = files_head; f != NULL; f = f->next) {
+    if ((identifier != NULL) && (strcmp(key, f->key) != 0))
+      continue;
+    /* timeout == 0  =>  flush everything */
+    if ((timeout != 0) && ((now - f->buffer_time) < timeout))
+      continue;
 
-  /* The lock is implicitely released. I we don't release it explicitely
-   * because the `FILE *' may need to flush a cache first */
-  fclose(csv);
+    if (csv_file_flush(f) != 0)
+      status = -1;
+  }
+  pthread_mutex_unlock(&files_lock);
+
+  return status;
+} /* }}} int csv_flush */
+
+/* Writes buffers older than `flush_interval'. Registered as a read callback
+ * with that interval when buffering is enabled. */
+static int csv_read(user_data_t __attribute__((unused)) * user_data) /* {{{ */
+{
+  return csv_flush(flush_interval, /* identifier = */ NULL,
+                   /* user_data = */ NULL);
+} /* }}} int csv_read */
+
+static int csv_init(void) /* {{{ */
+{
+  if (max_open_files == 0) {
+    struct rlimit rl;
+
+    /* Leave half of the descriptors to the rest of the daemon. */
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+      char errbuf[1024];
+      WARNING("csv plugin: getrlimit (RLIMIT_NOFILE) failed: %s",
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+      max_open_files = 128;
+    } else if (rl.rlim_cur == RLIM_INFINITY) {
+      max_open_files = 65536;
+    } else {
+      max_open_files = (size_t)(rl.rlim_cur / 2);
+    }
+
+    if (max_open_files < 1)
+      max_open_files = 1;
+  }
+
+  if ((write_buffer_size > 0) && (flush_interval > 0))
+    return plugin_register_complex_read(/* group = */ NULL, "csv", csv_read,
+                                        flush_interval,
+                                        /* user_data = */ NULL);
 
   return 0;
-} /* int csv_write */
+} /* }}} int csv_init */
+
+static int csv_shutdown(void) /* {{{ */
+{
+  pthread_mutex_lock(&files_lock);
+  while (files_head != NULL)
+    csv_file_destroy(files_head);
+  if (files != NULL) {
+    c_avl_destroy(files);
+    files = NULL;
+  }
+  pthread_mutex_unlock(&files_lock);
+
+  return 0;
+} /* }}} int csv_shutdown */
 
 void module_register(void) {
   plugin_register_config("csv", csv_config, config_keys, config_keys_num);
+  plugin_register_init("csv", csv_init);
   plugin_register_write("csv", csv_write, /* user_data = */ NULL);
+  plugin_register_flush("csv", csv_flush, /* user_data = */ NULL);
+  plugin_register_shutdown("csv", csv_shutdown);
 } /* void module_register */
@@ -855,6 +855,82 @@ int format_name(char *ret, int ret_len, const char *hostname,
   return 0;
 } /* int format_name */
 
+/* FNV-1a, which can be fed piecewise, followed by a 64 bit finalizer so that
+ * all bits are usable for sharding. */
+#define SERIES_ID_INIT 14695981039346656037ULL
+
+static uint64_t series_id_add(uint64_t h, const char *str) /* {{{ */
+{
+  for (const unsigned char *p = (const unsigned char *)str; *p != 0; p++) {
+    h ^= (uint64_t)*p;
+    h *= 1099511628211ULL;
+  }
+  return h;
+} /* }}} uint64_t series_id_add */
+
+static uint64_t series_id_finish(uint64_t h) /* {{{ */
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return (h != 0) ? h : 1;
+} /* }}} uint64_t series_id_finish */
+
+uint64_t series_id_name(const char *name) /* {{{ */
+{
+  return series_id_finish(series_id_add(SERIES_ID_INIT, name));
+} /* }}} uint64_t series_id_name */
+
+uint64_t series_id_vl(const value_list_t *vl) /* {{{ */
+{
+  uint64_t h = SERIES_ID_INIT;
+
+  /* Must hash exactly the bytes format_name() writes. */
+  h = series_id_add(h, vl->host);
+  h = series_id_add(h, "/");
+  h = series_id_add(h, vl->plugin);
+  if (vl->plugin_instance[0] != 0) {
+    h = series_id_add(h, "-");
+    h = series_id_add(h, vl->plugin_instance);
+  }
+  h = series_id_add(h, "/");
+  h = series_id_add(h, vl->type);
+  if (vl->type_instance[0] != 0) {
+    h = series_id_add(h, "-");
+    h = series_id_add(h, vl->type_instance);
+  }
+
+  return series_id_finish(h);
+} /* }}} uint64_t series_id_vl */
+
+_Bool series_name_matches(const char *name, const value_list_t *vl) /* {{{ */
+{
+#define MATCH(str)                                                             \
+  do {                                                                         \
+    size_t l = strlen(str);                                                    \
+    if (strncmp(name, (str), l) != 0)                                          \
+      return 0;                                                                \
+    name += l;                                                                 \
+  } while (0)
+
+  MATCH(vl->host);
+  MATCH("/");
+  MATCH(vl->plugin);
+  if (vl->plugin_instance[0] != 0) {
+    MATCH("-");
+    MATCH(vl->plugin_instance);
+  }
+  MATCH("/");
+  MATCH(vl->type);
+  if (vl->type_instance[0] != 0) {
+    MATCH("-");
+    MATCH(vl->type_instance);
+  }
+
+#undef MATCH
+  return name[0] == 0;
+} /* }}} _Bool series_name_matches */
+
 int format_values(char *ret, size_t ret_len, /* {{{ */
                   const data_set_t *ds, const value_list_t *vl,
                   _Bool store_rates) {
@@ -311,6 +311,18 @@ int format_name(char *ret, int ret_len, const char *hostname,
 int format_values(char *ret, size_t ret_len, const data_set_t *ds,
                   const value_list_t *vl, _Bool store_rates);
 
+/* Series IDs: a 64 bit hash of the name format_name() would produce, computed
+ * without building the string. series_id_name() of a formatted name equals
+ * series_id_vl() of the value list it was formatted from. Zero is never
+ * returned. */
+uint64_t series_id_name(const char *name);
+uint64_t series_id_vl(const value_list_t *vl);
+/* Returns true if `name' is what FORMAT_VL would produce for `vl'. */
+_Bool series_name_matches(const char *name, const value_list_t *vl);
+/* Uses the ID computed at dispatch time if there is one. */
+#define VL_SERIES_ID(vl)                                                       \
+  (((vl)->series_id != 0) ? (vl)->series_id : series_id_vl(vl))
+
 int parse_identifier(char *str, char **ret_host, char **ret_plugin,
                      char **ret_plugin_instance, char **ret_type,
                      char **ret_type_instance, char *default_host);
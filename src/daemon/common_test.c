@@ -357,6 +357,43 @@ DEF_TEST(value_to_rate) {
   return 0;
 }
 
+DEF_TEST(series_id) {
+  struct {
+    char *plugin_instance;
+    char *type_instance;
+  } cases[] = {
+      {NULL, NULL}, {"sda", NULL}, {NULL, "used"}, {"sda", "used"},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    value_list_t vl = {
+        .host = "example.com", .plugin = "df", .type = "df_complex",
+    };
+    char name[6 * DATA_MAX_NAME_LEN];
+
+    if (cases[i].plugin_instance != NULL)
+      sstrncpy(vl.plugin_instance, cases[i].plugin_instance,
+               sizeof(vl.plugin_instance));
+    if (cases[i].type_instance != NULL)
+      sstrncpy(vl.type_instance, cases[i].type_instance,
+               sizeof(vl.type_instance));
+
+    CHECK_ZERO(FORMAT_VL(name, sizeof(name), &vl));
+    EXPECT_EQ_UINT64(series_id_name(name), series_id_vl(&vl));
+    EXPECT_EQ_UINT64(series_id_vl(&vl), VL_SERIES_ID(&vl));
+    OK(series_name_matches(name, &vl));
+
+    /* A prefix or an extension of the name must not match. */
+    name[strlen(name) - 1] = 0;
+    OK(!series_name_matches(name, &vl));
+    OK(series_id_name(name) != series_id_vl(&vl));
+    strncat(name, "xx", sizeof(name) - strlen(name) - 1);
+    OK(!series_name_matches(name, &vl));
+  }
+
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(sstrncpy);
   RUN_TEST(sstrdup);
@@ -367,6 +404,7 @@ int main(void) {
   RUN_TEST(strunescape);
   RUN_TEST(parse_values);
   RUN_TEST(value_to_rate);
+  RUN_TEST(series_id);
 
   END_TEST;
 }
@@ -67,12 +67,71 @@ struct fc_rule_s {
   fc_rule_t *next;
 }; /* }}} */
 
+/* Instructions of a compiled chain. Calls to the built-in `stop', `return'
+ * and `jump' targets are replaced by their own opcodes, so that they don't
+ * need a function call or a lookup of the chain by name. */
+#define FC_OP_MATCH 0
+#define FC_OP_INVOKE 1
+#define FC_OP_JUMP 2
+#define FC_OP_STOP 3
+#define FC_OP_RETURN 4
+
+struct fc_insn_s;
+typedef struct fc_insn_s fc_insn_t; /* {{{ */
+struct fc_insn_s {
+  int op;
+  const char *name;
+  void **user_data;
+  int (*match)(const data_set_t *ds, const value_list_t *vl,
+               notification_meta_t **meta, void **user_data);
+  int (*invoke)(const data_set_t *ds, value_list_t *vl,
+                notification_meta_t **meta, void **user_data);
+  fc_chain_t *chain; /* FC_OP_JUMP */
+}; /* }}} */
+
+/* A rule's matches, immediately followed by its targets. */
+struct fc_rule_prog_s;
+typedef struct fc_rule_prog_s fc_rule_prog_t; /* {{{ */
+struct fc_rule_prog_s {
+  const char *name;
+  fc_insn_t *insns;
+  size_t matches_num;
+  size_t targets_num;
+  fc_match_hint_t hint;
+}; /* }}} */
+
+/* Maps a plugin or type name to the bitmap of rules that may match it. Names
+ * without a slot use the `fallback' bitmap, i.e. the rules without a hint. */
+struct fc_dispatch_s;
+typedef struct fc_dispatch_s fc_dispatch_t; /* {{{ */
+struct fc_dispatch_s {
+  size_t size; /* power of two */
+  const char **keys;
+  uint64_t *bits; /* `size' bitmaps of `words' each */
+  uint64_t *fallback;
+}; /* }}} */
+
+struct fc_program_s;
+typedef struct fc_program_s fc_program_t; /* {{{ */
+struct fc_program_s {
+  fc_rule_prog_t *rules;
+  size_t rules_num;
+  fc_insn_t *defaults;
+  size_t defaults_num;
+
+  /* NULL if no rule is restricted to a plugin or type, respectively. */
+  fc_dispatch_t *by_plugin;
+  fc_dispatch_t *by_type;
+  size_t words;
+}; /* }}} */
+
 /* List of chains, used for `chain_list_head' */
 struct fc_chain_s /* {{{ */
 {
   char name[DATA_MAX_NAME_LEN];
   fc_rule_t *rules;
   fc_target_t *targets;
+  fc_program_t *program;
   fc_chain_t *next;
 }; /* }}} */
 
@@ -80,7 +139,7 @@ struct fc_chain_s /* {{{ */
 struct fc_writer_s;
 typedef struct fc_writer_s fc_writer_t; /* {{{ */
 struct fc_writer_s {
-  char *plugin;
+  plugin_write_ref_t ref;
   c_complain_t complaint;
 }; /* }}} */
 
@@ -91,9 +150,32 @@ static fc_match_t *match_list_head;
 static fc_target_t *target_list_head;
 static fc_chain_t *chain_list_head;
 
+static int fc_chain_compile(fc_chain_t *chain);
+static void fc_resolve_jumps(void);
+
 /*
  * Private functions
  */
+static void fc_free_dispatch(fc_dispatch_t *d) /* {{{ */
+{
+  if (d == NULL)
+    return;
+
+  free(d->keys);
+  free(d->bits);
+  free(d);
+} /* }}} void fc_free_dispatch */
+
+static void fc_free_program(fc_program_t *prog) /* {{{ */
+{
+  if (prog == NULL)
+    return;
+
+  fc_free_dispatch(prog->by_plugin);
+  fc_free_dispatch(prog->by_type);
+  free(prog);
+} /* }}} void fc_free_program */
+
 static void fc_free_matches(fc_match_t *m) /* {{{ */
 {
   if (m == NULL)
@@ -151,6 +233,7 @@ static void fc_free_chains(fc_chain_t *c) /* {{{ */
   if (c == NULL)
     return;
 
+  fc_free_program(c->program);
   fc_free_rules(c->rules);
   fc_free_targets(c->targets);
 
@@ -440,14 +523,19 @@ static int fc_config_add_chain(const oconfig_item_t *ci) /* {{{ */
       break;
   } /* for (ci->children) */
 
+  if (status == 0)
+    status = fc_chain_compile(chain);
+
   if (status != 0) {
     fc_free_chains(chain);
     return -1;
   }
 
   if (chain_list_head != NULL) {
-    if (!new_chain)
+    if (!new_chain) {
+      fc_resolve_jumps();
       return 0;
+    }
 
     fc_chain_t *ptr;
 
@@ -460,6 +548,9 @@ static int fc_config_add_chain(const oconfig_item_t *ci) /* {{{ */
     chain_list_head = chain;
   }
 
+  /* Jumps to this chain from chains configured earlier can be resolved now. */
+  fc_resolve_jumps();
+
   return 0;
 } /* }}} int fc_config_add_chain */
 
@@ -593,14 +684,14 @@ static int fc_bit_write_create(const oconfig_item_t *ci, /* {{{ */
       }
       plugin_list = temp;
 
-      plugin_list[plugin_list_len].plugin = fc_strdup(plugin);
-      if (plugin_list[plugin_list_len].plugin == NULL) {
+      memset(plugin_list + plugin_list_len, 0, 2 * sizeof(*plugin_list));
+      plugin_list[plugin_list_len].ref.plugin = fc_strdup(plugin);
+      if (plugin_list[plugin_list_len].ref.plugin == NULL) {
         ERROR("fc_bit_write_create: fc_strdup failed.");
         continue;
       }
       C_COMPLAIN_INIT(&plugin_list[plugin_list_len].complaint);
       plugin_list_len++;
-      plugin_list[plugin_list_len].plugin = NULL;
     } /* for (j = 0; j < child->values_num; j++) */
   }   /* for (i = 0; i < ci->children_num; i++) */
 
@@ -618,8 +709,8 @@ static int fc_bit_write_destroy(void **user_data) /* {{{ */
 
   plugin_list = *user_data;
 
-  for (size_t i = 0; plugin_list[i].plugin != NULL; i++)
-    free(plugin_list[i].plugin);
+  for (size_t i = 0; plugin_list[i].ref.plugin != NULL; i++)
+    free(plugin_list[i].ref.plugin);
   free(plugin_list);
 
   return 0;
@@ -637,7 +728,7 @@ static int fc_bit_write_invoke(const data_set_t *ds, /* {{{ */
   if (user_data != NULL)
     plugin_list = *user_data;
 
-  if ((plugin_list == NULL) || (plugin_list[0].plugin == NULL)) {
+  if ((plugin_list == NULL) || (plugin_list[0].ref.plugin == NULL)) {
     static c_complain_t write_complaint = C_COMPLAIN_INIT_STATIC;
 
     status = plugin_write(/* plugin = */ NULL, ds, vl);
@@ -668,14 +759,14 @@ static int fc_bit_write_invoke(const data_set_t *ds, /* {{{ */
                 "operation. `write' succeeded.");
     }
   } else {
-    for (size_t i = 0; plugin_list[i].plugin != NULL; i++) {
-      status = plugin_write(plugin_list[i].plugin, ds, vl);
+    for (size_t i = 0; plugin_list[i].ref.plugin != NULL; i++) {
+      status = plugin_write_ref(&plugin_list[i].ref, ds, vl);
       if (status != 0) {
         c_complain(
             LOG_INFO, &plugin_list[i].complaint,
             "Filter subsystem: Built-in target `write': Dispatching value to "
             "the `%s' plugin failed with status %i.",
-            plugin_list[i].plugin, status);
+            plugin_list[i].ref.plugin, status);
 
         plugin_log_available_writers();
       } else {
@@ -683,7 +774,7 @@ static int fc_bit_write_invoke(const data_set_t *ds, /* {{{ */
             LOG_INFO, &plugin_list[i].complaint,
             "Filter subsystem: Built-in target `write': Plugin `%s' is back "
             "to normal operation. `write' succeeded.",
-            plugin_list[i].plugin);
+            plugin_list[i].ref.plugin);
       }
     } /* for (i = 0; plugin_list[i] != NULL; i++) */
   }
@@ -691,6 +782,244 @@ static int fc_bit_write_invoke(const data_set_t *ds, /* {{{ */
   return FC_TARGET_CONTINUE;
 } /* }}} int fc_bit_write_invoke */
 
+/*
+ * Compilation
+ *
+ * Each chain is compiled into a fc_program_t when its configuration has been
+ * read: the lists of rules, matches and targets are flattened into arrays,
+ * and rules which are restricted to one plugin or type by the hints of their
+ * matches are indexed, so that fc_process_chain() only tests the rules that
+ * can possibly match a value list.
+ */
+static uint32_t fc_hash(const char *str) /* {{{ */
+{
+  uint32_t hash = 2166136261u;
+
+  for (const unsigned char *ptr = (const unsigned char *)str; *ptr != 0;
+       ptr++) {
+    hash ^= *ptr;
+    hash *= 16777619u;
+  }
+
+  return hash;
+} /* }}} uint32_t fc_hash */
+
+static const uint64_t *fc_dispatch_lookup(const fc_dispatch_t *d, /* {{{ */
+                                          const char *key, size_t words) {
+  size_t mask = d->size - 1;
+
+  for (size_t i = fc_hash(key) & mask; d->keys[i] != NULL;
+       i = (i + 1) & mask) {
+    if (strcmp(d->keys[i], key) == 0)
+      return d->bits + i * words;
+  }
+
+  return d->fallback;
+} /* }}} const uint64_t *fc_dispatch_lookup */
+
+/* Builds the index for the `plugin' (field == 0) or `type' (field == 1) hints
+ * of the rules in `prog'. Returns NULL in `ret' if no rule has such a hint. */
+static int fc_dispatch_create(fc_program_t *prog, int field, /* {{{ */
+                              fc_dispatch_t **ret) {
+  fc_dispatch_t *d;
+  size_t keys_num = 0;
+  size_t words = prog->words;
+
+  *ret = NULL;
+
+  for (size_t i = 0; i < prog->rules_num; i++) {
+    fc_match_hint_t *hint = &prog->rules[i].hint;
+    if (((field == 0) ? hint->plugin : hint->type)[0] != 0)
+      keys_num++;
+  }
+  if (keys_num == 0)
+    return 0;
+
+  d = calloc(1, sizeof(*d));
+  if (d == NULL)
+    return -1;
+
+  d->size = 4;
+  while (d->size < 2 * keys_num)
+    d->size *= 2;
+
+  d->keys = calloc(d->size, sizeof(*d->keys));
+  d->bits = calloc((d->size + 1) * words, sizeof(*d->bits));
+  if ((d->keys == NULL) || (d->bits == NULL)) {
+    fc_free_dispatch(d);
+    return -1;
+  }
+  d->fallback = d->bits + d->size * words;
+
+  for (size_t i = 0; i < prog->rules_num; i++) {
+    fc_match_hint_t *hint = &prog->rules[i].hint;
+    if (((field == 0) ? hint->plugin : hint->type)[0] == 0)
+      d->fallback[i / 64] |= ((uint64_t)1) << (i % 64);
+  }
+
+  /* Rules without a hint may match any value list, so every key's bitmap
+   * starts out as a copy of the fallback. */
+  for (size_t i = 0; i < prog->rules_num; i++) {
+    fc_match_hint_t *hint = &prog->rules[i].hint;
+    const char *key = (field == 0) ? hint->plugin : hint->type;
+    size_t mask = d->size - 1;
+    size_t slot;
+
+    if (key[0] == 0)
+      continue;
+
+    for (slot = fc_hash(key) & mask; d->keys[slot] != NULL;
+         slot = (slot + 1) & mask)
+      if (strcmp(d->keys[slot], key) == 0)
+        break;
+
+    if (d->keys[slot] == NULL) {
+      d->keys[slot] = key;
+      memcpy(d->bits + slot * words, d->fallback, words * sizeof(*d->bits));
+    }
+    d->bits[slot * words + i / 64] |= ((uint64_t)1) << (i % 64);
+  }
+
+  *ret = d;
+  return 0;
+} /* }}} int fc_dispatch_create */
+
+static void fc_compile_target(fc_insn_t *insn, fc_target_t *t) /* {{{ */
+{
+  insn->op = FC_OP_INVOKE;
+  insn->name = t->name;
+  insn->user_data = &t->user_data;
+  insn->invoke = t->proc.invoke;
+
+  if (t->proc.invoke == fc_bit_stop_invoke)
+    insn->op = FC_OP_STOP;
+  else if (t->proc.invoke == fc_bit_return_invoke)
+    insn->op = FC_OP_RETURN;
+  /* Jumps are resolved by fc_resolve_jumps() once the chain exists. */
+} /* }}} void fc_compile_target */
+
+static int fc_chain_compile(fc_chain_t *chain) /* {{{ */
+{
+  fc_program_t *prog;
+  fc_insn_t *insn;
+  size_t rules_num = 0;
+  size_t insns_num = 0;
+
+  for (fc_rule_t *r = chain->rules; r != NULL; r = r->next) {
+    rules_num++;
+    for (fc_match_t *m = r->matches; m != NULL; m = m->next)
+      insns_num++;
+    for (fc_target_t *t = r->targets; t != NULL; t = t->next)
+      insns_num++;
+  }
+  for (fc_target_t *t = chain->targets; t != NULL; t = t->next)
+    insns_num++;
+
+  /* The program, its rules and its instructions share one allocation. */
+  prog = calloc(1, sizeof(*prog) + rules_num * sizeof(*prog->rules) +
+                       insns_num * sizeof(*insn));
+  if (prog == NULL) {
+    ERROR("fc_chain_compile: calloc failed.");
+    return -1;
+  }
+  prog->rules = (fc_rule_prog_t *)(prog + 1);
+  prog->rules_num = rules_num;
+  prog->words = (rules_num + 63) / 64;
+  insn = (fc_insn_t *)(prog->rules + rules_num);
+
+  rules_num = 0;
+  for (fc_rule_t *r = chain->rules; r != NULL; r = r->next) {
+    fc_rule_prog_t *pr = prog->rules + rules_num++;
+
+    pr->name = r->name;
+    pr->insns = insn;
+
+    for (fc_match_t *m = r->matches; m != NULL; m = m->next) {
+      insn->op = FC_OP_MATCH;
+      insn->name = m->name;
+      insn->user_data = &m->user_data;
+      insn->match = m->proc.match;
+      insn++;
+      pr->matches_num++;
+
+      if (m->proc.hint != NULL) {
+        fc_match_hint_t hint = {{0}};
+
+        if ((*m->proc.hint)(&m->user_data, &hint) != 0)
+          continue;
+        /* All matches have to match, so any one restriction applies to the
+         * entire rule. */
+        if ((pr->hint.plugin[0] == 0) && (hint.plugin[0] != 0))
+          sstrncpy(pr->hint.plugin, hint.plugin, sizeof(pr->hint.plugin));
+        if ((pr->hint.type[0] == 0) && (hint.type[0] != 0))
+          sstrncpy(pr->hint.type, hint.type, sizeof(pr->hint.type));
+      }
+    }
+
+    for (fc_target_t *t = r->targets; t != NULL; t = t->next) {
+      fc_compile_target(insn++, t);
+      pr->targets_num++;
+    }
+  }
+
+  prog->defaults = insn;
+  for (fc_target_t *t = chain->targets; t != NULL; t = t->next) {
+    fc_compile_target(insn++, t);
+    prog->defaults_num++;
+  }
+
+  if ((fc_dispatch_create(prog, /* field = plugin */ 0, &prog->by_plugin) !=
+       0) ||
+      (fc_dispatch_create(prog, /* field = type */ 1, &prog->by_type) != 0)) {
+    ERROR("fc_chain_compile: Building the dispatch tables failed.");
+    fc_free_program(prog);
+    return -1;
+  }
+
+  fc_free_program(chain->program);
+  chain->program = prog;
+
+  DEBUG("fc_chain_compile (%s): %zu rules, %zu instructions, "
+        "dispatch by plugin: %s, by type: %s.",
+        chain->name, prog->rules_num, insns_num,
+        (prog->by_plugin != NULL) ? "yes" : "no",
+        (prog->by_type != NULL) ? "yes" : "no");
+  return 0;
+} /* }}} int fc_chain_compile */
+
+static void fc_resolve_jumps_insns(fc_insn_t *insns, size_t num) /* {{{ */
+{
+  for (size_t i = 0; i < num; i++) {
+    fc_insn_t *insn = insns + i;
+
+    if ((insn->op != FC_OP_INVOKE) || (insn->invoke != fc_bit_jump_invoke))
+      continue;
+
+    insn->chain = fc_chain_get_by_name(*insn->user_data);
+    if (insn->chain != NULL)
+      insn->op = FC_OP_JUMP;
+  }
+} /* }}} void fc_resolve_jumps_insns */
+
+/* Replaces calls to the `jump' target by direct jumps to the chain, if it
+ * exists. Jumps to unknown chains remain calls to fc_bit_jump_invoke(), which
+ * reports the error. */
+static void fc_resolve_jumps(void) /* {{{ */
+{
+  for (fc_chain_t *chain = chain_list_head; chain != NULL;
+       chain = chain->next) {
+    fc_program_t *prog = chain->program;
+
+    if (prog == NULL)
+      continue;
+
+    for (size_t i = 0; i < prog->rules_num; i++)
+      fc_resolve_jumps_insns(prog->rules[i].insns + prog->rules[i].matches_num,
+                             prog->rules[i].targets_num);
+    fc_resolve_jumps_insns(prog->defaults, prog->defaults_num);
+  }
+} /* }}} void fc_resolve_jumps */
+
 static int fc_init_once(void) /* {{{ */
 {
   static int done = 0;
@@ -799,119 +1128,168 @@ fc_chain_t *fc_chain_get_by_name(const char *chain_name) /* {{{ */
   return NULL;
 } /* }}} int fc_chain_get_by_name */
 
-int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
-                     fc_chain_t *chain) {
-  fc_target_t *target;
+static int fc_insn_invoke(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                          fc_insn_t *insn) {
+  int status;
+
+  switch (insn->op) {
+  case FC_OP_STOP:
+    return FC_TARGET_STOP;
+  case FC_OP_RETURN:
+    return FC_TARGET_RETURN;
+  case FC_OP_JUMP:
+    status = fc_process_chain(ds, vl, insn->chain);
+    if (status < 0)
+      return status;
+    else if (status == FC_TARGET_STOP)
+      return FC_TARGET_STOP;
+    else
+      return FC_TARGET_CONTINUE;
+  default:
+    /* FIXME: Pass the meta-data to match targets here (when implemented). */
+    return (*insn->invoke)(ds, vl, /* meta = */ NULL, insn->user_data);
+  }
+} /* }}} int fc_insn_invoke */
+
+/* Executes targets until one of them signals `stop' or `return'. Returns the
+ * status of the last target executed. */
+static int fc_run_targets(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                          const fc_chain_t *chain, fc_insn_t *targets,
+                          size_t targets_num, const char *what) {
   int status = FC_TARGET_CONTINUE;
 
-  if (chain == NULL)
-    return -1;
+  for (size_t i = 0; i < targets_num; i++) {
+    status = fc_insn_invoke(ds, vl, targets + i);
+    if (status < 0) {
+      WARNING("fc_process_chain (%s): %s failed.", chain->name, what);
+      continue;
+    } else if (status == FC_TARGET_CONTINUE)
+      continue;
+    else if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN)) {
+      DEBUG("fc_process_chain (%s): Target `%s' signaled the %s condition.",
+            chain->name, targets[i].name,
+            (status == FC_TARGET_STOP) ? "stop" : "return");
+      break;
+    } else {
+      WARNING("fc_process_chain (%s): Unknown return value "
+              "from target `%s': %i",
+              chain->name, targets[i].name, status);
+    }
+  }
 
-  DEBUG("fc_process_chain (chain = %s);", chain->name);
+  return status;
+} /* }}} int fc_run_targets */
+
+/* Sets `invoked' if the rule matched and its targets, which may have modified
+ * the value list, were executed. */
+static int fc_run_rule(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                       const fc_chain_t *chain, fc_rule_prog_t *rule,
+                       _Bool *invoked) {
+  if (rule->name[0] != 0) {
+    DEBUG("fc_process_chain (%s): Testing the `%s' rule.", chain->name,
+          rule->name);
+  }
 
-  for (fc_rule_t *rule = chain->rules; rule != NULL; rule = rule->next) {
-    fc_match_t *match;
-    status = FC_TARGET_CONTINUE;
+  /* N. B.: rule->matches_num may be zero. */
+  for (size_t i = 0; i < rule->matches_num; i++) {
+    fc_insn_t *match = rule->insns + i;
+    /* FIXME: Pass the meta-data to match targets here (when implemented). */
+    int status = (*match->match)(ds, vl, /* meta = */ NULL, match->user_data);
+    if (status < 0) {
+      WARNING("fc_process_chain (%s): A match failed.", chain->name);
+      return FC_TARGET_CONTINUE;
+    } else if (status != FC_MATCH_MATCHES)
+      return FC_TARGET_CONTINUE;
+  }
 
-    if (rule->name[0] != 0) {
-      DEBUG("fc_process_chain (%s): Testing the `%s' rule.", chain->name,
-            rule->name);
-    }
+  if (rule->name[0] != 0) {
+    DEBUG("fc_process_chain (%s): Rule `%s' matches.", chain->name,
+          rule->name);
+  }
 
-    /* N. B.: rule->matches may be NULL. */
-    for (match = rule->matches; match != NULL; match = match->next) {
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status =
-          (*match->proc.match)(ds, vl, /* meta = */ NULL, &match->user_data);
-      if (status < 0) {
-        WARNING("fc_process_chain (%s): A match failed.", chain->name);
-        break;
-      } else if (status != FC_MATCH_MATCHES)
-        break;
+  /* If we get here, all matches have matched the value. Execute the
+   * targets. */
+  *invoked = 1;
+  return fc_run_targets(ds, vl, chain, rule->insns + rule->matches_num,
+                        rule->targets_num, "A target");
+} /* }}} int fc_run_rule */
+
+/* Returns the index of the first rule at or after `start' which is set in
+ * both bitmaps (NULL bitmaps allow all rules), or `rules_num' if none is. */
+static size_t fc_next_rule(const fc_program_t *prog, /* {{{ */
+                           const uint64_t *by_plugin, const uint64_t *by_type,
+                           size_t start) {
+  for (size_t w = start / 64; w < prog->words; w++) {
+    uint64_t bits = UINT64_MAX;
+
+    if (w == start / 64)
+      bits <<= start % 64;
+    if (by_plugin != NULL)
+      bits &= by_plugin[w];
+    if (by_type != NULL)
+      bits &= by_type[w];
+
+    if (bits != 0) {
+      size_t i = 64 * w + (size_t)__builtin_ctzll(bits);
+      return (i < prog->rules_num) ? i : prog->rules_num;
     }
+  }
 
-    /* for-loop has been aborted: Either error or no match. */
-    if (match != NULL) {
-      status = FC_TARGET_CONTINUE;
-      continue;
-    }
+  return prog->rules_num;
+} /* }}} size_t fc_next_rule */
 
-    if (rule->name[0] != 0) {
-      DEBUG("fc_process_chain (%s): Rule `%s' matches.", chain->name,
-            rule->name);
-    }
+int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                     fc_chain_t *chain) {
+  fc_program_t *prog;
+  int status = FC_TARGET_CONTINUE;
 
-    for (target = rule->targets; target != NULL; target = target->next) {
-      /* If we get here, all matches have matched the value. Execute the
-       * target. */
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status =
-          (*target->proc.invoke)(ds, vl, /* meta = */ NULL, &target->user_data);
-      if (status < 0) {
-        WARNING("fc_process_chain (%s): A target failed.", chain->name);
-        continue;
-      } else if (status == FC_TARGET_CONTINUE)
-        continue;
-      else if (status == FC_TARGET_STOP)
-        break;
-      else if (status == FC_TARGET_RETURN)
-        break;
-      else {
-        WARNING("fc_process_chain (%s): Unknown return value "
-                "from target `%s': %i",
-                chain->name, target->name, status);
-      }
-    }
+  if ((chain == NULL) || (chain->program == NULL))
+    return -1;
 
-    if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN)) {
-      if (rule->name[0] != 0) {
-        DEBUG("fc_process_chain (%s): Rule `%s' signaled "
-              "the %s condition.",
-              chain->name, rule->name,
-              (status == FC_TARGET_STOP) ? "stop" : "return");
-      }
-      break;
-    }
-  } /* for (rule) */
+  DEBUG("fc_process_chain (chain = %s);", chain->name);
 
-  if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN))
-    return status;
+  prog = chain->program;
+  if ((prog->by_plugin == NULL) && (prog->by_type == NULL)) {
+    for (size_t i = 0; i < prog->rules_num; i++) {
+      _Bool invoked = 0;
+      status = fc_run_rule(ds, vl, chain, prog->rules + i, &invoked);
+      if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN))
+        return status;
+    }
+  } else {
+    /* Rules not in the bitmaps can't match, so skipping them is the same as
+     * testing them. Targets may change the plugin or type, so the bitmaps are
+     * looked up again after a rule's targets ran. */
+    const uint64_t *by_plugin = NULL;
+    const uint64_t *by_type = NULL;
+    _Bool invoked = 1;
+
+    for (size_t i = 0; i < prog->rules_num; i++) {
+      if (invoked) {
+        if (prog->by_plugin != NULL)
+          by_plugin =
+              fc_dispatch_lookup(prog->by_plugin, vl->plugin, prog->words);
+        if (prog->by_type != NULL)
+          by_type = fc_dispatch_lookup(prog->by_type, vl->type, prog->words);
+        invoked = 0;
+      }
 
-  DEBUG("fc_process_chain (%s): Executing the default targets.", chain->name);
+      i = fc_next_rule(prog, by_plugin, by_type, i);
+      if (i >= prog->rules_num)
+        break;
 
-  status = FC_TARGET_CONTINUE;
-  for (target = chain->targets; target != NULL; target = target->next) {
-    /* If we get here, all matches have matched the value. Execute the
-     * target. */
-    /* FIXME: Pass the meta-data to match targets here (when implemented). */
-    status =
-        (*target->proc.invoke)(ds, vl, /* meta = */ NULL, &target->user_data);
-    if (status < 0) {
-      WARNING("fc_process_chain (%s): The default target failed.", chain->name);
-    } else if (status == FC_TARGET_CONTINUE)
-      continue;
-    else if (status == FC_TARGET_STOP)
-      break;
-    else if (status == FC_TARGET_RETURN)
-      break;
-    else {
-      WARNING("fc_process_chain (%s): Unknown return value "
-              "from target `%s': %i",
-              chain->name, target->name, status);
+      status = fc_run_rule(ds, vl, chain, prog->rules + i, &invoked);
+      if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN))
+        return status;
     }
   }
 
-  if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN)) {
-    assert(target != NULL);
-    DEBUG("fc_process_chain (%s): Default target `%s' signaled "
-          "the %s condition.",
-          chain->name, target->name,
-          (status == FC_TARGET_STOP) ? "stop" : "return");
-    if (status == FC_TARGET_STOP)
-      return FC_TARGET_STOP;
-    else
-      return FC_TARGET_CONTINUE;
-  }
+  DEBUG("fc_process_chain (%s): Executing the default targets.", chain->name);
+
+  status = fc_run_targets(ds, vl, chain, prog->defaults, prog->defaults_num,
+                          "The default target");
+  if (status == FC_TARGET_STOP)
+    return FC_TARGET_STOP;
 
   DEBUG("fc_process_chain (%s): Signaling `continue' at end of chain.",
         chain->name);
@@ -41,11 +41,22 @@
 /*
  * Match functions
  */
+/* Filled in by a match's optional `hint' callback: if `plugin' or `type' is
+ * set, the match can only ever match value lists with exactly that plugin or
+ * type, and rules using it are skipped for all others without calling
+ * `match'. Leave a member empty if there is no such restriction. */
+struct fc_match_hint_s {
+  char plugin[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+};
+typedef struct fc_match_hint_s fc_match_hint_t;
+
 struct match_proc_s {
   int (*create)(const oconfig_item_t *ci, void **user_data);
   int (*destroy)(void **user_data);
   int (*match)(const data_set_t *ds, const value_list_t *vl,
                notification_meta_t **meta, void **user_data);
+  int (*hint)(void **user_data, fc_match_hint_t *hint);
 };
 typedef struct match_proc_s match_proc_t;
 
@@ -30,6 +30,8 @@
 #include "meta_data.h"
 #include "plugin.h"
 
+#include <sched.h>
+
 #define MD_MAX_NONSTRING_CHARS 128
 
 /*
@@ -53,8 +55,25 @@ struct meta_entry_s {
   meta_entry_t *next;
 };
 
+/* An immutable snapshot of a meta data list, held in a single allocation:
+ * the entries (linked in insertion order, so they can be walked like the
+ * mutable list), an index sorted by key and the key and string bytes. It is
+ * reference counted and shared by all meta_data_t that were cloned from it. */
+struct md_frozen_s {
+  unsigned int refs;
+  size_t entries_num;
+  uint32_t *sorted;
+  meta_entry_t entries[];
+};
+typedef struct md_frozen_s md_frozen_t;
+
 struct meta_data_s {
   meta_entry_t *head;
+  /* If non-NULL, "head" points into "frozen" and the meta data is read-only
+   * until it is modified, which replaces it by a private copy. */
+  md_frozen_t *frozen;
+  /* Number of readers currently walking "frozen" without the lock. */
+  unsigned int readers;
   pthread_mutex_t lock;
 };
 
@@ -154,6 +173,131 @@ static void md_entry_free(meta_entry_t *e) /* {{{ */
   free(e);
 } /* }}} void md_entry_free */
 
+static meta_entry_t *md_frozen_lookup(md_frozen_t *f, /* {{{ */
+                                      const char *key) {
+  size_t lo = 0;
+  size_t hi = f->entries_num;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    meta_entry_t *e = &f->entries[f->sorted[mid]];
+    int cmp = strcasecmp(key, e->key);
+
+    if (cmp == 0)
+      return e;
+    else if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return NULL;
+} /* }}} meta_entry_t *md_frozen_lookup */
+
+/* Copies the list starting at "head" into a new snapshot with a reference
+ * count of one. Returns NULL if the list is empty or on error. */
+static md_frozen_t *md_frozen_create(const meta_entry_t *head) /* {{{ */
+{
+  size_t entries_num = 0;
+  size_t strings_size = 0;
+
+  for (const meta_entry_t *e = head; e != NULL; e = e->next) {
+    entries_num++;
+    strings_size += strlen(e->key) + 1;
+    if (e->type == MD_TYPE_STRING)
+      strings_size += strlen(e->value.mv_string) + 1;
+  }
+
+  if (entries_num == 0)
+    return NULL;
+
+  size_t entries_size = entries_num * sizeof(meta_entry_t);
+  size_t sorted_size = entries_num * sizeof(uint32_t);
+  md_frozen_t *f =
+      malloc(sizeof(*f) + entries_size + sorted_size + strings_size);
+  if (f == NULL) {
+    ERROR("md_frozen_create: malloc failed.");
+    return NULL;
+  }
+
+  f->refs = 1;
+  f->entries_num = entries_num;
+  f->sorted = (uint32_t *)((char *)f->entries + entries_size);
+  char *strings = (char *)f->sorted + sorted_size;
+
+  size_t i = 0;
+  for (const meta_entry_t *e = head; e != NULL; e = e->next, i++) {
+    meta_entry_t *copy = &f->entries[i];
+    size_t len = strlen(e->key) + 1;
+
+    copy->key = memcpy(strings, e->key, len);
+    strings += len;
+
+    copy->type = e->type;
+    copy->value = e->value;
+    if (e->type == MD_TYPE_STRING) {
+      len = strlen(e->value.mv_string) + 1;
+      copy->value.mv_string = memcpy(strings, e->value.mv_string, len);
+      strings += len;
+    }
+
+    copy->next = (i + 1 < entries_num) ? &f->entries[i + 1] : NULL;
+    f->sorted[i] = (uint32_t)i;
+  }
+
+  /* Insertion sort: meta data rarely has more than a handful of entries. */
+  for (i = 1; i < entries_num; i++) {
+    uint32_t idx = f->sorted[i];
+    size_t j = i;
+
+    while ((j > 0) && (strcasecmp(f->entries[f->sorted[j - 1]].key,
+                                  f->entries[idx].key) > 0)) {
+      f->sorted[j] = f->sorted[j - 1];
+      j--;
+    }
+    f->sorted[j] = idx;
+  }
+
+  return f;
+} /* }}} md_frozen_t *md_frozen_create */
+
+static void md_frozen_release(md_frozen_t *f) /* {{{ */
+{
+  if (f == NULL)
+    return;
+
+  if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free(f);
+} /* }}} void md_frozen_release */
+
+/* Replaces the shared snapshot by a private, mutable copy of the list. Readers
+ * which pinned the snapshot before it was unpublished are waited for; they
+ * only do a lookup or a short copy.
+ * XXX: The lock on md must be held while calling this function! */
+static int md_thaw(meta_data_t *md) /* {{{ */
+{
+  meta_entry_t *head;
+  md_frozen_t *frozen = md->frozen;
+
+  if (frozen == NULL)
+    return 0;
+
+  head = md_entry_clone(md->head);
+  if (head == NULL) {
+    ERROR("md_thaw: md_entry_clone failed.");
+    return -ENOMEM;
+  }
+
+  md->head = head;
+  __atomic_store_n(&md->frozen, NULL, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&md->readers, __ATOMIC_SEQ_CST) != 0)
+    sched_yield();
+
+  md_frozen_release(frozen);
+
+  return 0;
+} /* }}} int md_thaw */
+
 static int md_entry_insert(meta_data_t *md, meta_entry_t *e) /* {{{ */
 {
   meta_entry_t *this;
@@ -164,6 +308,12 @@ static int md_entry_insert(meta_data_t *md, meta_entry_t *e) /* {{{ */
 
   pthread_mutex_lock(&md->lock);
 
+  if (md_thaw(md) != 0) {
+    pthread_mutex_unlock(&md->lock);
+    md_entry_free(e);
+    return -ENOMEM;
+  }
+
   prev = NULL;
   this = md->head;
   while (this != NULL) {
@@ -257,15 +407,40 @@ static int md_entry_insert_clone(meta_data_t *md, meta_entry_t *orig) /* {{{ */
   return 0;
 } /* }}} int md_entry_insert_clone */
 
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_lookup(meta_data_t *md, /* {{{ */
-                                     const char *key) {
+/* Starts a read of "md". If the meta data is frozen, the snapshot is pinned
+ * and returned in "frozen" and no lock is taken. Otherwise "frozen" is set to
+ * NULL and the lock is held. Returns the head of the list either way. */
+static meta_entry_t *md_read_lock(meta_data_t *md, /* {{{ */
+                                  md_frozen_t **frozen) {
+  /* Announce the reader before looking at "frozen", so that md_thaw() either
+   * sees the reader or this thread sees the NULL it stored. */
+  __atomic_add_fetch(&md->readers, 1, __ATOMIC_SEQ_CST);
+  *frozen = __atomic_load_n(&md->frozen, __ATOMIC_SEQ_CST);
+  if (*frozen != NULL)
+    return (*frozen)->entries;
+  __atomic_sub_fetch(&md->readers, 1, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_lock(&md->lock);
+  return md->head;
+} /* }}} meta_entry_t *md_read_lock */
+
+static void md_read_unlock(meta_data_t *md, md_frozen_t *frozen) /* {{{ */
+{
+  if (frozen != NULL)
+    __atomic_sub_fetch(&md->readers, 1, __ATOMIC_SEQ_CST);
+  else
+    pthread_mutex_unlock(&md->lock);
+} /* }}} void md_read_unlock */
+
+/* "frozen" and "head" are the values returned by md_read_lock(). */
+static meta_entry_t *md_entry_lookup(md_frozen_t *frozen, /* {{{ */
+                                     meta_entry_t *head, const char *key) {
   meta_entry_t *e;
 
-  if ((md == NULL) || (key == NULL))
-    return NULL;
+  if (frozen != NULL)
+    return md_frozen_lookup(frozen, key);
 
-  for (e = md->head; e != NULL; e = e->next)
+  for (e = head; e != NULL; e = e->next)
     if (strcasecmp(key, e->key) == 0)
       break;
 
@@ -281,6 +456,13 @@ static meta_entry_t *md_entry_lookup(meta_data_t *md, /* {{{ */
  * The meta data associated with cache entries are a different story. There, we
  * need to ensure exclusive locking to prevent leaks and other funky business.
  * This is ensured by the uc_meta_data_get_*() functions.
+ *
+ * meta_data_clone() freezes the original into an immutable snapshot which the
+ * clone shares, so enqueueing a value list costs a reference count instead of
+ * a deep copy. The first modification of a frozen meta data object gives it a
+ * private copy again. Readers of a frozen object pin the snapshot instead of
+ * taking the lock; a thread thawing the object waits for pinned readers
+ * before it releases its reference to the snapshot.
  */
 
 /*
@@ -313,7 +495,24 @@ meta_data_t *meta_data_clone(meta_data_t *orig) /* {{{ */
     return NULL;
 
   pthread_mutex_lock(&orig->lock);
-  copy->head = md_entry_clone(orig->head);
+  if ((orig->frozen == NULL) && (orig->head != NULL)) {
+    md_frozen_t *f = md_frozen_create(orig->head);
+    if (f == NULL) {
+      pthread_mutex_unlock(&orig->lock);
+      meta_data_destroy(copy);
+      return NULL;
+    }
+
+    md_entry_free(orig->head);
+    orig->head = f->entries;
+    __atomic_store_n(&orig->frozen, f, __ATOMIC_SEQ_CST);
+  }
+
+  if (orig->frozen != NULL) {
+    __atomic_add_fetch(&orig->frozen->refs, 1, __ATOMIC_RELAXED);
+    copy->frozen = orig->frozen;
+    copy->head = orig->head;
+  }
   pthread_mutex_unlock(&orig->lock);
 
   return copy;
@@ -329,11 +528,22 @@ int meta_data_clone_merge(meta_data_t **dest, meta_data_t *orig) /* {{{ */
     return 0;
   }
 
+  if (*dest == orig)
+    return 0;
+
+  pthread_mutex_lock(&(*dest)->lock);
+  int status = md_thaw(*dest);
+  if (status != 0) {
+    pthread_mutex_unlock(&(*dest)->lock);
+    return status;
+  }
+
   pthread_mutex_lock(&orig->lock);
   for (meta_entry_t *e = orig->head; e != NULL; e = e->next) {
     md_entry_insert_clone((*dest), e);
   }
   pthread_mutex_unlock(&orig->lock);
+  pthread_mutex_unlock(&(*dest)->lock);
 
   return 0;
 } /* }}} int meta_data_clone_merge */
@@ -343,7 +553,10 @@ void meta_data_destroy(meta_data_t *md) /* {{{ */
   if (md == NULL)
     return;
 
-  md_entry_free(md->head);
+  if (md->frozen != NULL)
+    md_frozen_release(md->frozen);
+  else
+    md_entry_free(md->head);
   pthread_mutex_destroy(&md->lock);
   free(md);
 } /* }}} void meta_data_destroy */
@@ -353,16 +566,17 @@ int meta_data_exists(meta_data_t *md, const char *key) /* {{{ */
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next) {
+  for (meta_entry_t *e = head; e != NULL; e = e->next) {
     if (strcasecmp(key, e->key) == 0) {
-      pthread_mutex_unlock(&md->lock);
+      md_read_unlock(md, frozen);
       return 1;
     }
   }
 
-  pthread_mutex_unlock(&md->lock);
+  md_read_unlock(md, frozen);
   return 0;
 } /* }}} int meta_data_exists */
 
@@ -371,16 +585,17 @@ int meta_data_type(meta_data_t *md, const char *key) /* {{{ */
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next) {
+  for (meta_entry_t *e = head; e != NULL; e = e->next) {
     if (strcasecmp(key, e->key) == 0) {
-      pthread_mutex_unlock(&md->lock);
+      md_read_unlock(md, frozen);
       return e->type;
     }
   }
 
-  pthread_mutex_unlock(&md->lock);
+  md_read_unlock(md, frozen);
   return 0;
 } /* }}} int meta_data_type */
 
@@ -391,24 +606,52 @@ int meta_data_toc(meta_data_t *md, char ***toc) /* {{{ */
   if ((md == NULL) || (toc == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next)
+  for (meta_entry_t *e = head; e != NULL; e = e->next)
     ++count;
 
   if (count == 0) {
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return count;
   }
 
   *toc = calloc(count, sizeof(**toc));
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next)
+  for (meta_entry_t *e = head; e != NULL; e = e->next)
     (*toc)[i++] = strdup(e->key);
 
-  pthread_mutex_unlock(&md->lock);
+  md_read_unlock(md, frozen);
   return count;
 } /* }}} int meta_data_toc */
 
+int meta_data_iterate(meta_data_t *md, meta_data_iterate_cb callback, /* {{{ */
+                      void *user_data) {
+  int status = 0;
+
+  if ((md == NULL) || (callback == NULL))
+    return -EINVAL;
+
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
+
+  for (meta_entry_t *e = head; e != NULL; e = e->next) {
+    const void *value;
+
+    if (e->type == MD_TYPE_STRING)
+      value = e->value.mv_string;
+    else
+      value = &e->value;
+
+    status = callback(e->key, e->type, value, user_data);
+    if (status != 0)
+      break;
+  }
+
+  md_read_unlock(md, frozen);
+  return status;
+} /* }}} int meta_data_iterate */
+
 int meta_data_delete(meta_data_t *md, const char *key) /* {{{ */
 {
   meta_entry_t *this;
@@ -419,6 +662,11 @@ int meta_data_delete(meta_data_t *md, const char *key) /* {{{ */
 
   pthread_mutex_lock(&md->lock);
 
+  if (md_thaw(md) != 0) {
+    pthread_mutex_unlock(&md->lock);
+    return -ENOMEM;
+  }
+
   prev = NULL;
   this = md->head;
   while (this != NULL) {
@@ -551,28 +799,29 @@ int meta_data_get_string(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  e = md_entry_lookup(md, key);
+  e = md_entry_lookup(frozen, head, key);
   if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   if (e->type != MD_TYPE_STRING) {
     ERROR("meta_data_get_string: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   temp = md_strdup(e->value.mv_string);
   if (temp == NULL) {
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     ERROR("meta_data_get_string: md_strdup failed.");
     return -ENOMEM;
   }
 
-  pthread_mutex_unlock(&md->lock);
+  md_read_unlock(md, frozen);
 
   *value = temp;
 
@@ -586,23 +835,24 @@ int meta_data_get_signed_int(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  e = md_entry_lookup(md, key);
+  e = md_entry_lookup(frozen, head, key);
   if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   if (e->type != MD_TYPE_SIGNED_INT) {
     ERROR("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   *value = e->value.mv_signed_int;
 
-  pthread_mutex_unlock(&md->lock);
+  md_read_unlock(md, frozen);
   return 0;
 } /* }}} int meta_data_get_signed_int */
 
@@ -613,23 +863,24 @@ int meta_data_get_unsigned_int(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  e = md_entry_lookup(md, key);
+  e = md_entry_lookup(frozen, head, key);
   if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   if (e->type != MD_TYPE_UNSIGNED_INT) {
     ERROR("meta_data_get_unsigned_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   *value = e->value.mv_unsigned_int;
 
-  pthread_mutex_unlock(&md->lock);
+  md_read_unlock(md, frozen);
   return 0;
 } /* }}} int meta_data_get_unsigned_int */
 
@@ -640,23 +891,24 @@ int meta_data_get_double(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  e = md_entry_lookup(md, key);
+  e = md_entry_lookup(frozen, head, key);
   if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   if (e->type != MD_TYPE_DOUBLE) {
     ERROR("meta_data_get_double: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   *value = e->value.mv_double;
 
-  pthread_mutex_unlock(&md->lock);
+  md_read_unlock(md, frozen);
   return 0;
 } /* }}} int meta_data_get_double */
 
@@ -667,23 +919,24 @@ int meta_data_get_boolean(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  e = md_entry_lookup(md, key);
+  e = md_entry_lookup(frozen, head, key);
   if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   if (e->type != MD_TYPE_BOOLEAN) {
     ERROR("meta_data_get_boolean: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
   *value = e->value.mv_boolean;
 
-  pthread_mutex_unlock(&md->lock);
+  md_read_unlock(md, frozen);
   return 0;
 } /* }}} int meta_data_get_boolean */
 
@@ -698,11 +951,12 @@ int meta_data_as_string(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
+  md_frozen_t *frozen;
+  meta_entry_t *head = md_read_lock(md, &frozen);
 
-  e = md_entry_lookup(md, key);
+  e = md_entry_lookup(frozen, head, key);
   if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     return -ENOENT;
   }
 
@@ -728,14 +982,14 @@ int meta_data_as_string(meta_data_t *md, /* {{{ */
     actual = e->value.mv_boolean ? "true" : "false";
     break;
   default:
-    pthread_mutex_unlock(&md->lock);
+    md_read_unlock(md, frozen);
     ERROR("meta_data_as_string: unknown type %d for key `%s'", type, key);
     return -ENOENT;
   }
 
-  pthread_mutex_unlock(&md->lock);
-
+  /* "actual" may point into the entry, so copy it before unlocking. */
   temp = md_strdup(actual);
+  md_read_unlock(md, frozen);
   if (temp == NULL) {
     ERROR("meta_data_as_string: md_strdup failed for key `%s'.", key);
     return -ENOMEM;
@@ -42,6 +42,9 @@ struct meta_data_s;
 typedef struct meta_data_s meta_data_t;
 
 meta_data_t *meta_data_create(void);
+/* Freezes "orig" into an immutable, reference counted snapshot and returns a
+ * new meta data object sharing it. Reads of frozen meta data take no lock.
+ * Either object makes a private copy when it is modified next. */
 meta_data_t *meta_data_clone(meta_data_t *orig);
 int meta_data_clone_merge(meta_data_t **dest, meta_data_t *orig);
 void meta_data_destroy(meta_data_t *md);
@@ -51,6 +54,17 @@ int meta_data_type(meta_data_t *md, const char *key);
 int meta_data_toc(meta_data_t *md, char ***toc);
 int meta_data_delete(meta_data_t *md, const char *key);
 
+/* Calls "callback" for every entry, in insertion order, while holding the
+ * lock or a pin on the frozen snapshot. For MD_TYPE_STRING "value" is the
+ * string itself, otherwise it points to an int64_t, uint64_t, double or _Bool
+ * respectively. Nothing is copied, so "key" and "value" are only valid during
+ * the callback. Iteration stops at the first non-zero return value, which is
+ * then returned. */
+typedef int (*meta_data_iterate_cb)(const char *key, int type,
+                                    const void *value, void *user_data);
+int meta_data_iterate(meta_data_t *md, meta_data_iterate_cb callback,
+                      void *user_data);
+
 int meta_data_add_string(meta_data_t *md, const char *key, const char *value);
 int meta_data_add_signed_int(meta_data_t *md, const char *key, int64_t value);
 int meta_data_add_unsigned_int(meta_data_t *md, const char *key,
@@ -30,6 +30,8 @@
 #include "meta_data.h"
 #include "testing.h"
 
+#include <pthread.h>
+
 DEF_TEST(base) {
   meta_data_t *m;
 
@@ -109,8 +111,180 @@ DEF_TEST(base) {
   return 0;
 }
 
+static int iterate_cb(const char *key, int type, const void *value,
+                      void *user_data) {
+  char *buffer = user_data;
+  size_t len = strlen(buffer);
+
+  if (type == MD_TYPE_STRING)
+    snprintf(buffer + len, 256 - len, "%s=%s;", key, (const char *)value);
+  else if (type == MD_TYPE_SIGNED_INT)
+    snprintf(buffer + len, 256 - len, "%s=%" PRIi64 ";", key,
+             *(const int64_t *)value);
+  else if (type == MD_TYPE_BOOLEAN)
+    snprintf(buffer + len, 256 - len, "%s=%s;", key,
+             *(const _Bool *)value ? "true" : "false");
+
+  return (strcmp(key, "stop") == 0) ? 42 : 0;
+}
+
+DEF_TEST(iterate) {
+  meta_data_t *m;
+  char buffer[256] = "";
+
+  CHECK_NOT_NULL(m = meta_data_create());
+  EXPECT_EQ_INT(0, meta_data_iterate(m, iterate_cb, buffer));
+  EXPECT_EQ_STR("", buffer);
+
+  CHECK_ZERO(meta_data_add_string(m, "string", "foobar"));
+  CHECK_ZERO(meta_data_add_signed_int(m, "signed_int", -1));
+  CHECK_ZERO(meta_data_add_boolean(m, "boolean", 1));
+  /* replacing an entry keeps its position */
+  CHECK_ZERO(meta_data_add_string(m, "string", "barqux"));
+
+  EXPECT_EQ_INT(0, meta_data_iterate(m, iterate_cb, buffer));
+  EXPECT_EQ_STR("string=barqux;signed_int=-1;boolean=true;", buffer);
+
+  /* a non-zero return value stops the iteration */
+  CHECK_ZERO(meta_data_add_string(m, "stop", "here"));
+  CHECK_ZERO(meta_data_add_string(m, "never", "seen"));
+  buffer[0] = 0;
+  EXPECT_EQ_INT(42, meta_data_iterate(m, iterate_cb, buffer));
+  EXPECT_EQ_STR("string=barqux;signed_int=-1;boolean=true;stop=here;", buffer);
+
+  meta_data_destroy(m);
+  return 0;
+}
+
+DEF_TEST(clone) {
+  meta_data_t *m;
+  meta_data_t *c1;
+  meta_data_t *c2;
+  char buffer[256] = "";
+  char key[16];
+  char *s;
+  int64_t si;
+
+  CHECK_NOT_NULL(m = meta_data_create());
+  CHECK_NOT_NULL(c1 = meta_data_clone(m));
+  OK(!meta_data_exists(c1, "string"));
+  meta_data_destroy(c1);
+
+  CHECK_ZERO(meta_data_add_string(m, "string", "foobar"));
+  for (int i = 0; i < 20; i++) {
+    snprintf(key, sizeof(key), "key%02d", 19 - i);
+    CHECK_ZERO(meta_data_add_signed_int(m, key, i));
+  }
+
+  /* The original and both clones share one snapshot. */
+  CHECK_NOT_NULL(c1 = meta_data_clone(m));
+  CHECK_NOT_NULL(c2 = meta_data_clone(c1));
+
+  for (int i = 0; i < 20; i++) {
+    snprintf(key, sizeof(key), "KEY%02d", 19 - i);
+    CHECK_ZERO(meta_data_get_signed_int(c2, key, &si));
+    EXPECT_EQ_INT(i, (int)si);
+  }
+  OK(!meta_data_exists(c2, "key20"));
+  CHECK_ZERO(meta_data_get_string(c2, "String", &s));
+  EXPECT_EQ_STR("foobar", s);
+  sfree(s);
+
+  /* Modifications are private to the modified object. */
+  CHECK_ZERO(meta_data_add_string(c1, "string", "barqux"));
+  CHECK_ZERO(meta_data_delete(m, "key00"));
+
+  CHECK_ZERO(meta_data_get_string(m, "string", &s));
+  EXPECT_EQ_STR("foobar", s);
+  sfree(s);
+  CHECK_ZERO(meta_data_get_string(c1, "string", &s));
+  EXPECT_EQ_STR("barqux", s);
+  sfree(s);
+  OK(!meta_data_exists(m, "key00"));
+  OK(meta_data_exists(c1, "key00"));
+  OK(meta_data_exists(c2, "key00"));
+
+  meta_data_destroy(m);
+  meta_data_destroy(c1);
+
+  /* Merging into a frozen object keeps the insertion order. */
+  CHECK_NOT_NULL(m = meta_data_create());
+  CHECK_ZERO(meta_data_add_boolean(m, "boolean", 1));
+  CHECK_NOT_NULL(c1 = meta_data_clone(m));
+  meta_data_destroy(m);
+  CHECK_NOT_NULL(m = meta_data_create());
+  CHECK_ZERO(meta_data_add_string(m, "string", "foobar"));
+  CHECK_ZERO(meta_data_clone_merge(&c1, m));
+  EXPECT_EQ_INT(0, meta_data_iterate(c1, iterate_cb, buffer));
+  EXPECT_EQ_STR("boolean=true;string=foobar;", buffer);
+
+  meta_data_destroy(m);
+  meta_data_destroy(c1);
+  meta_data_destroy(c2);
+  return 0;
+}
+
+static _Bool readers_stop;
+
+static void *reader_thread(void *arg) {
+  meta_data_t *m = arg;
+  long failed = 0;
+
+  while (!__atomic_load_n(&readers_stop, __ATOMIC_ACQUIRE)) {
+    char *s = NULL;
+    int64_t si;
+
+    if ((meta_data_get_string(m, "string", &s) != 0) ||
+        (strcmp("foobar", s) != 0))
+      failed++;
+    sfree(s);
+    if ((meta_data_get_signed_int(m, "key", &si) != 0) || (si != 42))
+      failed++;
+  }
+
+  return (void *)failed;
+}
+
+DEF_TEST(frozen_readers) {
+  meta_data_t *m;
+  pthread_t readers[2];
+  void *failed;
+  int status = 0;
+
+  CHECK_NOT_NULL(m = meta_data_create());
+  CHECK_ZERO(meta_data_add_string(m, "string", "foobar"));
+  CHECK_ZERO(meta_data_add_signed_int(m, "key", 42));
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(readers); i++)
+    CHECK_ZERO(pthread_create(readers + i, NULL, reader_thread, m));
+
+  /* Freeze and thaw "m" while the readers walk it without the lock. */
+  for (int i = 0; (i < 10000) && (status == 0); i++) {
+    meta_data_t *c = meta_data_clone(m);
+
+    if (c == NULL)
+      status = -1;
+    else
+      status = meta_data_add_signed_int(m, "key", 42);
+    meta_data_destroy(c);
+  }
+  EXPECT_EQ_INT(0, status);
+
+  __atomic_store_n(&readers_stop, 1, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(readers); i++) {
+    pthread_join(readers[i], &failed);
+    EXPECT_EQ_INT(0, (int)(long)failed);
+  }
+
+  meta_data_destroy(m);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(base);
+  RUN_TEST(iterate);
+  RUN_TEST(clone);
+  RUN_TEST(frozen_readers);
 
   END_TEST;
 }
@@ -37,10 +37,11 @@
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
-#include "utils_heap.h"
 #include "utils_llist.h"
+#include "utils_mpmc.h"
 #include "utils_random.h"
 #include "utils_time.h"
+#include "utils_wheel.h"
 
 #if HAVE_PTHREAD_NP_H
 #include <pthread_np.h> /* for pthread_set_name_np(3) */
@@ -74,16 +75,37 @@ struct read_func_s {
   cdtime_t rf_interval;
   cdtime_t rf_effective_interval;
   cdtime_t rf_next_read;
+  c_wheel_entry_t rf_wheel;
+  struct read_func_s *rf_run_next;
 };
 typedef struct read_func_s read_func_t;
 
-struct write_queue_s;
-typedef struct write_queue_s write_queue_t;
+/* Per-thread run queue of read functions that are due. */
+struct read_thread_s {
+  pthread_t thread;
+  size_t id;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  read_func_t *head;
+  read_func_t *tail;
+  _Bool idle;
+  _Bool wakeup;
+};
+typedef struct read_thread_s read_thread_t;
+
+/* Value lists with up to this many values are stored inside the queue entry,
+ * so that the common case needs no allocation at all once the entry pool is
+ * warm. */
+#define WRITE_QUEUE_INLINE_VALUES 4
+#define WRITE_QUEUE_MIN_SIZE 65536
+#define WRITE_QUEUE_POOL_SIZE 4096
+
 struct write_queue_s {
-  value_list_t *vl;
+  value_list_t vl;
   plugin_ctx_t ctx;
-  write_queue_t *next;
+  value_t values[WRITE_QUEUE_INLINE_VALUES];
 };
+typedef struct write_queue_s write_queue_t;
 
 struct flush_callback_s {
   char *name;
@@ -103,6 +125,12 @@ static llist_t *list_missing;
 static llist_t *list_shutdown;
 static llist_t *list_log;
 static llist_t *list_notification;
+static llist_t *list_query;
+
+/* Bumped whenever `list_write' changes, so that plugin_write_ref_t lookups
+ * cached by the filter chain are redone. */
+static unsigned int write_generation = 1;
+static pthread_mutex_t write_ref_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static fc_chain_t *pre_cache_chain = NULL;
 static fc_chain_t *post_cache_chain = NULL;
@@ -114,18 +142,32 @@ static char *plugindir = NULL;
 #ifndef DEFAULT_MAX_READ_INTERVAL
 #define DEFAULT_MAX_READ_INTERVAL TIME_T_TO_CDTIME_T_STATIC(86400)
 #endif
-static c_heap_t *read_heap = NULL;
+/* Read functions wait in `read_wheel' until they are due. One read thread
+ * at a time, the "timekeeper", sleeps on `read_cond' until the next function
+ * is due and hands due functions to the run queues of the read threads,
+ * preferring idle ones. Threads whose queue runs empty steal from the other
+ * queues before going idle. `read_lock' protects the wheel, `read_list' and
+ * the timekeeper state; each run queue has its own lock, which is taken after
+ * `read_lock' if both are needed. */
+#define READ_WHEEL_RESOLUTION (TIME_T_TO_CDTIME_T_STATIC(1) / 1024)
+static c_wheel_t *read_wheel = NULL;
 static llist_t *read_list;
 static int read_loop = 1;
 static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t read_cond = PTHREAD_COND_INITIALIZER;
-static pthread_t *read_threads = NULL;
+static _Bool read_timekeeper = 0;
+static cdtime_t read_timekeeper_wakeup = 0;
+static read_thread_t *read_threads = NULL;
 static size_t read_threads_num = 0;
+static size_t read_threads_next = 0;
 static cdtime_t max_read_interval = DEFAULT_MAX_READ_INTERVAL;
 
-static write_queue_t *write_queue_head;
-static write_queue_t *write_queue_tail;
-static long write_queue_length = 0;
+/* `write_queue' is a lock-free ring shared by all read and write threads;
+ * `write_queue_pool' recycles its entries. `write_lock' and `write_cond' are
+ * only used to put idle write threads to sleep, see plugin_write_dequeue(). */
+static mpmc_queue_t *write_queue = NULL;
+static mpmc_queue_t *write_queue_pool = NULL;
+static unsigned int write_threads_waiting = 0;
 static _Bool write_loop = 1;
 static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t write_cond = PTHREAD_COND_INITIALIZER;
@@ -153,8 +195,16 @@ static const char *plugin_get_dir(void) {
     return plugindir;
 }
 
+static long plugin_write_queue_length(void) /* {{{ */
+{
+  if (write_queue == NULL)
+    return 0;
+
+  return (long)mpmc_size(write_queue);
+} /* }}} long plugin_write_queue_length */
+
 static int plugin_update_internal_statistics(void) { /* {{{ */
-  gauge_t copy_write_queue_length = (gauge_t)write_queue_length;
+  gauge_t copy_write_queue_length = (gauge_t)plugin_write_queue_length();
 
   /* Initialize `vl' */
   value_list_t vl = VALUE_LIST_INIT;
@@ -233,24 +283,26 @@ static void destroy_all_callbacks(llist_t **list) /* {{{ */
   *list = NULL;
 } /* }}} void destroy_all_callbacks */
 
-static void destroy_read_heap(void) /* {{{ */
+static void destroy_read_wheel(void) /* {{{ */
 {
-  if (read_heap == NULL)
+  if (read_wheel == NULL)
     return;
 
   while (42) {
+    c_wheel_entry_t *e;
     read_func_t *rf;
 
-    rf = c_heap_get_root(read_heap);
-    if (rf == NULL)
+    e = c_wheel_get_any(read_wheel);
+    if (e == NULL)
       break;
+    rf = e->data;
     sfree(rf->rf_name);
     destroy_callback((callback_func_t *)rf);
   }
 
-  c_heap_destroy(read_heap);
-  read_heap = NULL;
-} /* }}} void destroy_read_heap */
+  c_wheel_destroy(read_wheel);
+  read_wheel = NULL;
+} /* }}} void destroy_read_wheel */
 
 static int register_callback(llist_t **list, /* {{{ */
                              const char *name, callback_func_t *cf) {
@@ -436,155 +488,289 @@ static int plugin_load_file(const char *file, _Bool global) {
   return 0;
 }
 
-static void *plugin_read_thread(void __attribute__((unused)) * args) {
-  while (read_loop != 0) {
-    read_func_t *rf;
-    plugin_ctx_t old_ctx;
-    cdtime_t start;
-    cdtime_t now;
-    cdtime_t elapsed;
-    int status;
-    int rf_type;
-    int rc;
-
-    /* Get the read function that needs to be read next.
-     * We don't need to hold "read_lock" for the heap, but we need
-     * to call c_heap_get_root() and pthread_cond_wait() in the
-     * same protected block. */
-    pthread_mutex_lock(&read_lock);
-    rf = c_heap_get_root(read_heap);
-    if (rf == NULL) {
-      pthread_cond_wait(&read_cond, &read_lock);
-      pthread_mutex_unlock(&read_lock);
-      continue;
-    }
-    pthread_mutex_unlock(&read_lock);
+/* Puts `rf' back into the wheel, waking the timekeeper if it would
+ * otherwise sleep past the function's next read. */
+static void plugin_read_schedule(read_func_t *rf) /* {{{ */
+{
+  pthread_mutex_lock(&read_lock);
+  c_wheel_insert(read_wheel, &rf->rf_wheel, rf->rf_next_read);
+  if (read_timekeeper && ((read_timekeeper_wakeup == 0) ||
+                          (rf->rf_next_read < read_timekeeper_wakeup)))
+    pthread_cond_signal(&read_cond);
+  pthread_mutex_unlock(&read_lock);
+} /* }}} void plugin_read_schedule */
+
+static void read_queue_push(read_thread_t *t, read_func_t *rf) /* {{{ */
+{
+  rf->rf_run_next = NULL;
+  if (t->tail == NULL)
+    t->head = rf;
+  else
+    t->tail->rf_run_next = rf;
+  t->tail = rf;
+  pthread_cond_signal(&t->cond);
+} /* }}} void read_queue_push */
 
-    if (rf->rf_interval == 0) {
-      /* this should not happen, because the interval is set
-       * for each plugin when loading it
-       * XXX: issue a warning? */
-      rf->rf_interval = plugin_get_interval();
-      rf->rf_effective_interval = rf->rf_interval;
+static read_func_t *read_queue_pop(read_thread_t *t) /* {{{ */
+{
+  read_func_t *rf;
+
+  pthread_mutex_lock(&t->lock);
+  rf = t->head;
+  if (rf != NULL) {
+    t->head = rf->rf_run_next;
+    if (t->head == NULL)
+      t->tail = NULL;
+    rf->rf_run_next = NULL;
+  }
+  pthread_mutex_unlock(&t->lock);
 
-      rf->rf_next_read = cdtime();
+  return rf;
+} /* }}} read_func_t *read_queue_pop */
+
+/* Takes the oldest entry from the first non-empty queue of another thread. */
+static read_func_t *read_queue_steal(read_thread_t *self) /* {{{ */
+{
+  for (size_t i = 1; i < read_threads_num; i++) {
+    read_thread_t *victim = read_threads + ((self->id + i) % read_threads_num);
+    read_func_t *rf = read_queue_pop(victim);
+
+    if (rf != NULL)
+      return rf;
+  }
+
+  return NULL;
+} /* }}} read_func_t *read_queue_steal */
+
+/* Moves all due read functions to the run queues: to idle threads first, the
+ * remainder to the timekeeper itself, from where busy threads will steal
+ * them. `read_lock' must be held. Returns the number of functions moved. */
+static size_t plugin_read_distribute(read_thread_t *self) /* {{{ */
+{
+  cdtime_t now = cdtime();
+  c_wheel_entry_t *e;
+  size_t num = 0;
+
+  while ((e = c_wheel_expire(read_wheel, now)) != NULL) {
+    read_func_t *rf = e->data;
+    _Bool queued = 0;
+
+    for (size_t i = 0; (i < read_threads_num) && !queued; i++) {
+      read_thread_t *t =
+          read_threads + ((read_threads_next + i) % read_threads_num);
+      if (t == self)
+        continue;
+
+      pthread_mutex_lock(&t->lock);
+      if (t->idle && (t->head == NULL)) {
+        read_queue_push(t, rf);
+        read_threads_next = t->id + 1;
+        queued = 1;
+      }
+      pthread_mutex_unlock(&t->lock);
     }
 
-    /* sleep until this entry is due,
-     * using pthread_cond_timedwait */
-    pthread_mutex_lock(&read_lock);
-    /* In pthread_cond_timedwait, spurious wakeups are possible
-     * (and really happen, at least on NetBSD with > 1 CPU), thus
-     * we need to re-evaluate the condition every time
-     * pthread_cond_timedwait returns. */
-    rc = 0;
-    while ((read_loop != 0) && (cdtime() < rf->rf_next_read) && rc == 0) {
-      rc = pthread_cond_timedwait(&read_cond, &read_lock,
-                                  &CDTIME_T_TO_TIMESPEC(rf->rf_next_read));
+    if (!queued) {
+      pthread_mutex_lock(&self->lock);
+      read_queue_push(self, rf);
+      pthread_mutex_unlock(&self->lock);
     }
 
-    /* Must hold `read_lock' when accessing `rf->rf_type'. */
-    rf_type = rf->rf_type;
+    num++;
+  }
+
+  return num;
+} /* }}} size_t plugin_read_distribute */
+
+/* Called by a read thread without work. If no other thread keeps time, this
+ * one does until some read functions are due, then hands the role to an idle
+ * thread. Otherwise it sleeps until work is queued for it. */
+static void plugin_read_wait(read_thread_t *self) /* {{{ */
+{
+  pthread_mutex_lock(&read_lock);
+
+  if (read_timekeeper) {
+    pthread_mutex_lock(&self->lock);
     pthread_mutex_unlock(&read_lock);
 
-    /* Check if we're supposed to stop.. This may have interrupted
-     * the sleep, too. */
-    if (read_loop == 0) {
-      /* Insert `rf' again, so it can be free'd correctly */
-      c_heap_insert(read_heap, rf);
+    self->idle = 1;
+    while ((read_loop != 0) && (self->head == NULL) && !self->wakeup)
+      pthread_cond_wait(&self->cond, &self->lock);
+    self->idle = 0;
+    self->wakeup = 0;
+
+    pthread_mutex_unlock(&self->lock);
+    return;
+  }
+
+  read_timekeeper = 1;
+  while (read_loop != 0) {
+    if (plugin_read_distribute(self) > 0)
       break;
-    }
 
-    /* The entry has been marked for deletion. The linked list
-     * entry has already been removed by `plugin_unregister_read'.
-     * All we have to do here is free the `read_func_t' and
-     * continue. */
-    if (rf_type == RF_REMOVE) {
-      DEBUG("plugin_read_thread: Destroying the `%s' "
-            "callback.",
-            rf->rf_name);
-      sfree(rf->rf_name);
-      destroy_callback((callback_func_t *)rf);
-      rf = NULL;
+    /* In pthread_cond_timedwait, spurious wakeups are possible, so the
+     * wheel is checked again every time. */
+    read_timekeeper_wakeup = c_wheel_next(read_wheel);
+    if (read_timekeeper_wakeup == 0)
+      pthread_cond_wait(&read_cond, &read_lock);
+    else
+      pthread_cond_timedwait(&read_cond, &read_lock,
+                             &CDTIME_T_TO_TIMESPEC(read_timekeeper_wakeup));
+  }
+  read_timekeeper = 0;
+  read_timekeeper_wakeup = 0;
+
+  /* Let an idle thread keep time while this one reads. */
+  for (size_t i = 0; i < read_threads_num; i++) {
+    read_thread_t *t = read_threads + i;
+    _Bool woken = 0;
+
+    if (t == self)
       continue;
+
+    pthread_mutex_lock(&t->lock);
+    if (t->idle && (t->head == NULL)) {
+      t->wakeup = 1;
+      pthread_cond_signal(&t->cond);
+      woken = 1;
     }
+    pthread_mutex_unlock(&t->lock);
 
-    DEBUG("plugin_read_thread: Handling `%s'.", rf->rf_name);
+    if (woken)
+      break;
+  }
 
-    start = cdtime();
+  pthread_mutex_unlock(&read_lock);
+} /* }}} void plugin_read_wait */
 
-    old_ctx = plugin_set_ctx(rf->rf_ctx);
+static void plugin_read_func_run(read_func_t *rf) /* {{{ */
+{
+  plugin_ctx_t old_ctx;
+  cdtime_t start;
+  cdtime_t now;
+  cdtime_t elapsed;
+  int status;
+  int rf_type;
 
-    if (rf_type == RF_SIMPLE) {
-      int (*callback)(void);
+  /* The entry has been marked for deletion. The linked list
+   * entry has already been removed by `plugin_unregister_read'.
+   * All we have to do here is free the `read_func_t'. */
+  rf_type = __atomic_load_n(&rf->rf_type, __ATOMIC_ACQUIRE);
+  if (rf_type == RF_REMOVE) {
+    DEBUG("plugin_read_thread: Destroying the `%s' "
+          "callback.",
+          rf->rf_name);
+    sfree(rf->rf_name);
+    destroy_callback((callback_func_t *)rf);
+    return;
+  }
 
-      callback = rf->rf_callback;
-      status = (*callback)();
-    } else {
-      plugin_read_cb callback;
+  if (rf->rf_interval == 0) {
+    /* this should not happen, because the interval is set
+     * for each plugin when loading it
+     * XXX: issue a warning? */
+    rf->rf_interval = plugin_get_interval();
+    rf->rf_effective_interval = rf->rf_interval;
 
-      assert(rf_type == RF_COMPLEX);
+    rf->rf_next_read = cdtime();
+  }
 
-      callback = rf->rf_callback;
-      status = (*callback)(&rf->rf_udata);
-    }
+  DEBUG("plugin_read_thread: Handling `%s'.", rf->rf_name);
 
-    plugin_set_ctx(old_ctx);
+  start = cdtime();
 
-    /* If the function signals failure, we will increase the
-     * intervals in which it will be called. */
-    if (status != 0) {
-      rf->rf_effective_interval *= 2;
-      if (rf->rf_effective_interval > max_read_interval)
-        rf->rf_effective_interval = max_read_interval;
+  old_ctx = plugin_set_ctx(rf->rf_ctx);
 
-      NOTICE("read-function of plugin `%s' failed. "
-             "Will suspend it for %.3f seconds.",
-             rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
-    } else {
-      /* Success: Restore the interval, if it was changed. */
-      rf->rf_effective_interval = rf->rf_interval;
-    }
+  if (rf_type == RF_SIMPLE) {
+    int (*callback)(void);
 
-    /* update the ``next read due'' field */
-    now = cdtime();
+    callback = rf->rf_callback;
+    status = (*callback)();
+  } else {
+    plugin_read_cb callback;
 
-    /* calculate the time spent in the read function */
-    elapsed = (now - start);
-
-    if (elapsed > rf->rf_effective_interval)
-      WARNING(
-          "plugin_read_thread: read-function of the `%s' plugin took %.3f "
-          "seconds, which is above its read interval (%.3f seconds). You might "
-          "want to adjust the `Interval' or `ReadThreads' settings.",
-          rf->rf_name, CDTIME_T_TO_DOUBLE(elapsed),
-          CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
-
-    DEBUG("plugin_read_thread: read-function of the `%s' plugin took "
-          "%.6f seconds.",
-          rf->rf_name, CDTIME_T_TO_DOUBLE(elapsed));
-
-    DEBUG("plugin_read_thread: Effective interval of the "
-          "`%s' plugin is %.3f seconds.",
-          rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
-
-    /* Calculate the next (absolute) time at which this function
-     * should be called. */
-    rf->rf_next_read += rf->rf_effective_interval;
-
-    /* Check, if `rf_next_read' is in the past. */
-    if (rf->rf_next_read < now) {
-      /* `rf_next_read' is in the past. Insert `now'
-       * so this value doesn't trail off into the
-       * past too much. */
-      rf->rf_next_read = now;
-    }
+    assert(rf_type == RF_COMPLEX);
+
+    callback = rf->rf_callback;
+    status = (*callback)(&rf->rf_udata);
+  }
+
+  plugin_set_ctx(old_ctx);
+
+  /* If the function signals failure, we will increase the
+   * intervals in which it will be called. */
+  if (status != 0) {
+    rf->rf_effective_interval *= 2;
+    if (rf->rf_effective_interval > max_read_interval)
+      rf->rf_effective_interval = max_read_interval;
+
+    NOTICE("read-function of plugin `%s' failed. "
+           "Will suspend it for %.3f seconds.",
+           rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
+  } else {
+    /* Success: Restore the interval, if it was changed. */
+    rf->rf_effective_interval = rf->rf_interval;
+  }
+
+  /* update the ``next read due'' field */
+  now = cdtime();
+
+  /* calculate the time spent in the read function */
+  elapsed = (now - start);
 
-    DEBUG("plugin_read_thread: Next read of the `%s' plugin at %.3f.",
-          rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_next_read));
+  if (elapsed > rf->rf_effective_interval)
+    WARNING(
+        "plugin_read_thread: read-function of the `%s' plugin took %.3f "
+        "seconds, which is above its read interval (%.3f seconds). You might "
+        "want to adjust the `Interval' or `ReadThreads' settings.",
+        rf->rf_name, CDTIME_T_TO_DOUBLE(elapsed),
+        CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
 
-    /* Re-insert this read function into the heap again. */
-    c_heap_insert(read_heap, rf);
+  DEBUG("plugin_read_thread: read-function of the `%s' plugin took "
+        "%.6f seconds.",
+        rf->rf_name, CDTIME_T_TO_DOUBLE(elapsed));
+
+  DEBUG("plugin_read_thread: Effective interval of the "
+        "`%s' plugin is %.3f seconds.",
+        rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
+
+  /* Calculate the next (absolute) time at which this function
+   * should be called. */
+  rf->rf_next_read += rf->rf_effective_interval;
+
+  /* Check, if `rf_next_read' is in the past. */
+  if (rf->rf_next_read < now) {
+    /* `rf_next_read' is in the past. Insert `now'
+     * so this value doesn't trail off into the
+     * past too much. */
+    rf->rf_next_read = now;
+  }
+
+  DEBUG("plugin_read_thread: Next read of the `%s' plugin at %.3f.",
+        rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_next_read));
+
+  /* Re-insert this read function into the wheel again. */
+  plugin_read_schedule(rf);
+} /* }}} void plugin_read_func_run */
+
+static void *plugin_read_thread(void *args) {
+  read_thread_t *self = args;
+
+  /* Wait for start_read_threads() to set up all threads. */
+  pthread_mutex_lock(&read_lock);
+  pthread_mutex_unlock(&read_lock);
+
+  while (read_loop != 0) {
+    read_func_t *rf;
+
+    rf = read_queue_pop(self);
+    if (rf == NULL)
+      rf = read_queue_steal(self);
+
+    if (rf != NULL)
+      plugin_read_func_run(rf);
+    else
+      plugin_read_wait(self);
   } /* while (read_loop) */
 
   pthread_exit(NULL);
@@ -626,31 +812,42 @@ static void start_read_threads(size_t num) /* {{{ */
   if (read_threads != NULL)
     return;
 
-  read_threads = (pthread_t *)calloc(num, sizeof(pthread_t));
+  read_threads = calloc(num, sizeof(*read_threads));
   if (read_threads == NULL) {
     ERROR("plugin: start_read_threads: calloc failed.");
     return;
   }
 
+  for (size_t i = 0; i < num; i++) {
+    read_threads[i].id = i;
+    pthread_mutex_init(&read_threads[i].lock, /* attr = */ NULL);
+    pthread_cond_init(&read_threads[i].cond, /* attr = */ NULL);
+  }
+
+  /* The threads wait for `read_lock' before they start, so
+   * `read_threads_num' is final once they look at it. */
+  pthread_mutex_lock(&read_lock);
   read_threads_num = 0;
   for (size_t i = 0; i < num; i++) {
-    int status = pthread_create(read_threads + read_threads_num,
+    read_thread_t *t = read_threads + read_threads_num;
+    int status = pthread_create(&t->thread,
                                 /* attr = */ NULL, plugin_read_thread,
-                                /* arg = */ NULL);
+                                /* arg = */ t);
     if (status != 0) {
       char errbuf[1024];
       ERROR("plugin: start_read_threads: pthread_create failed "
             "with status %i (%s).",
             status, sstrerror(status, errbuf, sizeof(errbuf)));
-      return;
+      break;
     }
 
     char name[THREAD_NAME_MAX];
     snprintf(name, sizeof(name), "reader#%zu", read_threads_num);
-    set_thread_name(read_threads[read_threads_num], name);
+    set_thread_name(t->thread, name);
 
     read_threads_num++;
   } /* for (i) */
+  pthread_mutex_unlock(&read_lock);
 } /* }}} void start_read_threads */
 
 static void stop_read_threads(void) {
@@ -663,14 +860,32 @@ static void stop_read_threads(void) {
   read_loop = 0;
   DEBUG("plugin: stop_read_threads: Signalling `read_cond'");
   pthread_cond_broadcast(&read_cond);
+  for (size_t i = 0; i < read_threads_num; i++) {
+    pthread_mutex_lock(&read_threads[i].lock);
+    pthread_cond_signal(&read_threads[i].cond);
+    pthread_mutex_unlock(&read_threads[i].lock);
+  }
   pthread_mutex_unlock(&read_lock);
 
   for (size_t i = 0; i < read_threads_num; i++) {
-    if (pthread_join(read_threads[i], NULL) != 0) {
+    if (pthread_join(read_threads[i].thread, NULL) != 0) {
       ERROR("plugin: stop_read_threads: pthread_join failed.");
     }
-    read_threads[i] = (pthread_t)0;
   }
+
+  /* Return queued functions to the wheel, so they can be free'd correctly. */
+  pthread_mutex_lock(&read_lock);
+  for (size_t i = 0; i < read_threads_num; i++) {
+    read_func_t *rf;
+
+    while ((rf = read_queue_pop(read_threads + i)) != NULL)
+      c_wheel_insert(read_wheel, &rf->rf_wheel, rf->rf_next_read);
+
+    pthread_mutex_destroy(&read_threads[i].lock);
+    pthread_cond_destroy(&read_threads[i].cond);
+  }
+  pthread_mutex_unlock(&read_lock);
+
   sfree(read_threads);
   read_threads_num = 0;
 } /* void stop_read_threads */
@@ -742,86 +957,179 @@ plugin_value_list_clone(value_list_t const *vl_orig) /* {{{ */
   return vl;
 } /* }}} value_list_t *plugin_value_list_clone */
 
+static void plugin_write_entry_free(write_queue_t *q) /* {{{ */
+{
+  if (q == NULL)
+    return;
+
+  meta_data_destroy(q->vl.meta);
+  q->vl.meta = NULL;
+  if (q->vl.values != q->values)
+    sfree(q->vl.values);
+  q->vl.values = NULL;
+
+  if ((write_queue_pool == NULL) || (mpmc_push(write_queue_pool, q) != 0))
+    sfree(q);
+} /* }}} void plugin_write_entry_free */
+
+/* Like plugin_value_list_clone(), but copies into a (recycled) queue entry
+ * and keeps small value arrays inline. */
+static write_queue_t *
+plugin_write_entry_create(value_list_t const *vl_orig) /* {{{ */
+{
+  write_queue_t *q = NULL;
+  value_list_t *vl;
+
+  if ((write_queue_pool == NULL) ||
+      (mpmc_pop(write_queue_pool, (void **)&q) != 0)) {
+    q = malloc(sizeof(*q));
+    if (q == NULL)
+      return NULL;
+  }
+
+  vl = &q->vl;
+  memcpy(vl, vl_orig, sizeof(*vl));
+  vl->meta = NULL;
+
+  if (vl->host[0] == 0)
+    sstrncpy(vl->host, hostname_g, sizeof(vl->host));
+
+  if (vl_orig->values_len <= WRITE_QUEUE_INLINE_VALUES) {
+    vl->values = q->values;
+  } else {
+    vl->values = malloc(vl_orig->values_len * sizeof(*vl->values));
+    if (vl->values == NULL) {
+      plugin_write_entry_free(q);
+      return NULL;
+    }
+  }
+  memcpy(vl->values, vl_orig->values,
+         vl_orig->values_len * sizeof(*vl->values));
+
+  if (vl_orig->meta != NULL) {
+    vl->meta = meta_data_clone(vl_orig->meta);
+    if (vl->meta == NULL) {
+      plugin_write_entry_free(q);
+      return NULL;
+    }
+  }
+
+  if (vl->time == 0)
+    vl->time = cdtime();
+
+  /* Fill in the interval from the thread context, if it is zero. */
+  if (vl->interval == 0) {
+    plugin_ctx_t ctx = plugin_get_ctx();
+
+    if (ctx.interval != 0)
+      vl->interval = ctx.interval;
+    else {
+      char name[6 * DATA_MAX_NAME_LEN];
+      FORMAT_VL(name, sizeof(name), vl);
+      ERROR("plugin_write_entry_create: Unable to determine "
+            "interval from context for "
+            "value list \"%s\". "
+            "This indicates a broken plugin. "
+            "Please report this problem to the "
+            "collectd mailing list or at "
+            "<http://collectd.org/bugs/>.",
+            name);
+      vl->interval = cf_get_default_interval();
+    }
+  }
+
+  return q;
+} /* }}} write_queue_t *plugin_write_entry_create */
+
 static int plugin_write_enqueue(value_list_t const *vl) /* {{{ */
 {
+  static c_complain_t full_complaint = C_COMPLAIN_INIT_STATIC;
   write_queue_t *q;
 
-  q = malloc(sizeof(*q));
-  if (q == NULL)
-    return ENOMEM;
-  q->next = NULL;
+  if (write_queue == NULL) {
+    ERROR("plugin_write_enqueue: The write queue has not been "
+          "initialized yet.");
+    return EINVAL;
+  }
 
-  q->vl = plugin_value_list_clone(vl);
-  if (q->vl == NULL) {
-    sfree(q);
+  q = plugin_write_entry_create(vl);
+  if (q == NULL)
     return ENOMEM;
-  }
 
   /* Store context of caller (read plugin); otherwise, it would not be
    * available to the write plugins when actually dispatching the
    * value-list later on. */
   q->ctx = plugin_get_ctx();
 
-  pthread_mutex_lock(&write_lock);
-
-  if (write_queue_tail == NULL) {
-    write_queue_head = q;
-    write_queue_tail = q;
-    write_queue_length = 1;
-  } else {
-    write_queue_tail->next = q;
-    write_queue_tail = q;
-    write_queue_length += 1;
+  /* The ring is sized well above WriteQueueLimitHigh, so this only happens
+   * when the write threads are stuck. Wait for them rather than dropping the
+   * value list silently. */
+  while (mpmc_push(write_queue, q) != 0) {
+    if (!write_loop) {
+      plugin_write_entry_free(q);
+      return ECANCELED;
+    }
+    c_complain(LOG_WARNING, &full_complaint,
+               "plugin_write_enqueue: The write queue is full (%zu entries). "
+               "Waiting for the write threads to catch up.",
+               mpmc_capacity(write_queue));
+    nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 1000000}, NULL);
+  }
+  c_release(LOG_INFO, &full_complaint,
+            "plugin_write_enqueue: The write queue accepts values again.");
+
+  /* Pairs with the fence in plugin_write_dequeue(): either the sleeping
+   * thread sees our entry, or we see that it is waiting. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&write_threads_waiting, __ATOMIC_RELAXED) > 0) {
+    pthread_mutex_lock(&write_lock);
+    pthread_cond_signal(&write_cond);
+    pthread_mutex_unlock(&write_lock);
   }
 
-  pthread_cond_signal(&write_cond);
-  pthread_mutex_unlock(&write_lock);
-
   return 0;
 } /* }}} int plugin_write_enqueue */
 
-static value_list_t *plugin_write_dequeue(void) /* {{{ */
+static write_queue_t *plugin_write_dequeue(void) /* {{{ */
 {
-  write_queue_t *q;
-  value_list_t *vl;
+  write_queue_t *q = NULL;
 
-  pthread_mutex_lock(&write_lock);
+  while (mpmc_pop(write_queue, (void **)&q) != 0) {
+    pthread_mutex_lock(&write_lock);
+    __atomic_fetch_add(&write_threads_waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-  while (write_loop && (write_queue_head == NULL))
-    pthread_cond_wait(&write_cond, &write_lock);
+    /* Re-check after announcing ourselves, so a concurrent enqueue either
+     * becomes visible here or signals `write_cond'. */
+    int status = mpmc_pop(write_queue, (void **)&q);
+    if ((status != 0) && write_loop)
+      pthread_cond_wait(&write_cond, &write_lock);
 
-  if (write_queue_head == NULL) {
+    __atomic_fetch_sub(&write_threads_waiting, 1, __ATOMIC_SEQ_CST);
+    _Bool loop = write_loop;
     pthread_mutex_unlock(&write_lock);
-    return NULL;
-  }
 
-  q = write_queue_head;
-  write_queue_head = q->next;
-  write_queue_length -= 1;
-  if (write_queue_head == NULL) {
-    write_queue_tail = NULL;
-    assert(0 == write_queue_length);
+    if (status == 0)
+      break;
+    if (!loop)
+      return NULL;
   }
 
-  pthread_mutex_unlock(&write_lock);
-
   (void)plugin_set_ctx(q->ctx);
 
-  vl = q->vl;
-  sfree(q);
-  return vl;
-} /* }}} value_list_t *plugin_write_dequeue */
+  return q;
+} /* }}} write_queue_t *plugin_write_dequeue */
 
 static void *plugin_write_thread(void __attribute__((unused)) * args) /* {{{ */
 {
   while (write_loop) {
-    value_list_t *vl = plugin_write_dequeue();
-    if (vl == NULL)
+    write_queue_t *q = plugin_write_dequeue();
+    if (q == NULL)
       continue;
 
-    plugin_dispatch_values_internal(vl);
+    plugin_dispatch_values_internal(&q->vl);
 
-    plugin_value_list_free(vl);
+    plugin_write_entry_free(q);
   }
 
   pthread_exit(NULL);
@@ -885,25 +1193,28 @@ static void stop_write_threads(void) /* {{{ */
   sfree(write_threads);
   write_threads_num = 0;
 
-  pthread_mutex_lock(&write_lock);
   i = 0;
-  for (q = write_queue_head; q != NULL;) {
-    write_queue_t *q1 = q;
-    plugin_value_list_free(q->vl);
-    q = q->next;
-    sfree(q1);
+  while (mpmc_pop(write_queue, (void **)&q) == 0) {
+    plugin_write_entry_free(q);
     i++;
   }
-  write_queue_head = NULL;
-  write_queue_tail = NULL;
-  write_queue_length = 0;
-  pthread_mutex_unlock(&write_lock);
 
   if (i > 0) {
     WARNING("plugin: %zu value list%s left after shutting down "
             "the write threads.",
             i, (i == 1) ? " was" : "s were");
   }
+
+  mpmc_destroy(write_queue);
+  write_queue = NULL;
+
+  /* With `write_queue_pool' reset, plugin_write_entry_free() frees the
+   * entries instead of recycling them. */
+  mpmc_queue_t *pool = write_queue_pool;
+  write_queue_pool = NULL;
+  while (mpmc_pop(pool, (void **)&q) == 0)
+    sfree(q);
+  mpmc_destroy(pool);
 } /* }}} void stop_write_threads */
 
 /*
@@ -1077,30 +1388,43 @@ int plugin_register_init(const char *name, int (*callback)(void)) {
   return create_register_callback(&list_init, name, (void *)callback, NULL);
 } /* plugin_register_init */
 
-static int plugin_compare_read_func(const void *arg0, const void *arg1) {
-  const read_func_t *rf0;
-  const read_func_t *rf1;
-
-  rf0 = arg0;
-  rf1 = arg1;
-
-  if (rf0->rf_next_read < rf1->rf_next_read)
-    return -1;
-  else if (rf0->rf_next_read > rf1->rf_next_read)
-    return 1;
-  else
-    return 0;
-} /* int plugin_compare_read_func */
-
-/* Add a read function to both, the heap and a linked list. The linked list if
- * used to look-up read functions, especially for the remove function. The heap
- * is used to determine which plugin to read next. */
+/* Read functions with the same interval would all run at the same time,
+ * causing load spikes at every interval boundary. Schedule the first read at
+ * an offset derived from a hash of the name, relative to an absolute multiple
+ * of the interval (but at most the global interval). This spreads the reads
+ * over the interval and keeps their times the same across restarts. */
+static cdtime_t plugin_read_first(const read_func_t *rf, /* {{{ */
+                                  cdtime_t now) {
+  cdtime_t spread = rf->rf_interval;
+  uint64_t h = 14695981039346656037ULL;
+
+  if ((interval_g > 0) && (interval_g < spread))
+    spread = interval_g;
+  if (spread == 0)
+    return now;
+
+  for (const unsigned char *p = (const unsigned char *)rf->rf_name; *p != 0;
+       p++) {
+    h ^= (uint64_t)*p;
+    h *= 1099511628211ULL;
+  }
+
+  cdtime_t next = now - (now % spread) + (cdtime_t)(h % spread);
+  if (next < now)
+    next += spread;
+  return next;
+} /* }}} cdtime_t plugin_read_first */
+
+/* Add a read function to both, the wheel and a linked list. The linked list
+ * if used to look-up read functions, especially for the remove function. The
+ * wheel is used to determine which plugin to read next. */
 static int plugin_insert_read(read_func_t *rf) {
-  int status;
   llentry_t *le;
 
-  rf->rf_next_read = cdtime();
+  rf->rf_next_read = plugin_read_first(rf, cdtime());
   rf->rf_effective_interval = rf->rf_interval;
+  rf->rf_wheel.data = rf;
+  rf->rf_run_next = NULL;
 
   pthread_mutex_lock(&read_lock);
 
@@ -1113,11 +1437,11 @@ static int plugin_insert_read(read_func_t *rf) {
     }
   }
 
-  if (read_heap == NULL) {
-    read_heap = c_heap_create(plugin_compare_read_func);
-    if (read_heap == NULL) {
+  if (read_wheel == NULL) {
+    read_wheel = c_wheel_create(READ_WHEEL_RESOLUTION, cdtime());
+    if (read_wheel == NULL) {
       pthread_mutex_unlock(&read_lock);
-      ERROR("plugin_insert_read: c_heap_create failed.");
+      ERROR("plugin_insert_read: c_wheel_create failed.");
       return -1;
     }
   }
@@ -1138,18 +1462,12 @@ static int plugin_insert_read(read_func_t *rf) {
     return -1;
   }
 
-  status = c_heap_insert(read_heap, rf);
-  if (status != 0) {
-    pthread_mutex_unlock(&read_lock);
-    ERROR("plugin_insert_read: c_heap_insert failed.");
-    llentry_destroy(le);
-    return -1;
-  }
+  c_wheel_insert(read_wheel, &rf->rf_wheel, rf->rf_next_read);
 
   /* This does not fail. */
   llist_append(read_list, le);
 
-  /* Wake up all the read threads. */
+  /* Wake up the timekeeper. */
   pthread_cond_broadcast(&read_cond);
   pthread_mutex_unlock(&read_lock);
   return 0;
@@ -1227,7 +1545,11 @@ int plugin_register_complex_read(const char *group, const char *name,
 
 int plugin_register_write(const char *name, plugin_write_cb callback,
                           user_data_t const *ud) {
-  return create_register_callback(&list_write, name, (void *)callback, ud);
+  int status;
+
+  status = create_register_callback(&list_write, name, (void *)callback, ud);
+  __atomic_add_fetch(&write_generation, 1, __ATOMIC_RELEASE);
+  return status;
 } /* int plugin_register_write */
 
 static int plugin_flush_timeout_callback(user_data_t *ud) {
@@ -1385,6 +1707,11 @@ int plugin_register_notification(const char *name,
                                   ud);
 } /* int plugin_register_log */
 
+int plugin_register_query(const char *name, plugin_query_cb callback,
+                          user_data_t const *ud) {
+  return create_register_callback(&list_query, name, (void *)callback, ud);
+} /* int plugin_register_query */
+
 int plugin_unregister_config(const char *name) {
   cf_unregister(name);
   return 0;
@@ -1425,7 +1752,7 @@ int plugin_unregister_read(const char *name) /* {{{ */
 
   rf = le->value;
   assert(rf != NULL);
-  rf->rf_type = RF_REMOVE;
+  __atomic_store_n(&rf->rf_type, RF_REMOVE, __ATOMIC_RELEASE);
 
   pthread_mutex_unlock(&read_lock);
 
@@ -1477,7 +1804,7 @@ int plugin_unregister_read_group(const char *group) /* {{{ */
 
     rf = le->value;
     assert(rf != NULL);
-    rf->rf_type = RF_REMOVE;
+    __atomic_store_n(&rf->rf_type, RF_REMOVE, __ATOMIC_RELEASE);
 
     llentry_destroy(le);
 
@@ -1499,7 +1826,11 @@ int plugin_unregister_read_group(const char *group) /* {{{ */
 } /* }}} int plugin_unregister_read_group */
 
 int plugin_unregister_write(const char *name) {
-  return plugin_unregister(list_write, name);
+  int status;
+
+  status = plugin_unregister(list_write, name);
+  __atomic_add_fetch(&write_generation, 1, __ATOMIC_RELEASE);
+  return status;
 }
 
 int plugin_unregister_flush(const char *name) {
@@ -1549,6 +1880,10 @@ int plugin_unregister_notification(const char *name) {
   return plugin_unregister(list_notification, name);
 }
 
+int plugin_unregister_query(const char *name) {
+  return plugin_unregister(list_query, name);
+}
+
 int plugin_init_all(void) {
   char const *chain_name;
   llentry_t *le;
@@ -1595,7 +1930,26 @@ int plugin_init_all(void) {
     write_threads_num = 5;
   }
 
-  if ((list_init == NULL) && (read_heap == NULL))
+  if (write_queue == NULL) {
+    /* Leave plenty of room above the high limit; producers block when the
+     * ring is full. */
+    size_t size = WRITE_QUEUE_MIN_SIZE;
+    if ((size_t)write_limit_high * 2 > size)
+      size = (size_t)write_limit_high * 2;
+
+    write_queue = mpmc_create(size);
+    write_queue_pool = mpmc_create(WRITE_QUEUE_POOL_SIZE);
+    if ((write_queue == NULL) || (write_queue_pool == NULL)) {
+      ERROR("plugin_init_all: Creating the write queue failed.");
+      mpmc_destroy(write_queue);
+      mpmc_destroy(write_queue_pool);
+      write_queue = NULL;
+      write_queue_pool = NULL;
+      return -1;
+    }
+  }
+
+  if ((list_init == NULL) && (read_wheel == NULL))
     return ret;
 
   /* Calling all init callbacks before checking if read callbacks
@@ -1635,7 +1989,7 @@ int plugin_init_all(void) {
       global_option_get_time("MaxReadInterval", DEFAULT_MAX_READ_INTERVAL);
 
   /* Start read-threads */
-  if (read_heap != NULL) {
+  if (read_wheel != NULL) {
     const char *rt;
     int num;
 
@@ -1659,18 +2013,20 @@ int plugin_read_all_once(void) {
   int status;
   int return_status = 0;
 
-  if (read_heap == NULL) {
+  if (read_wheel == NULL) {
     NOTICE("No read-functions are registered.");
     return 0;
   }
 
   while (42) {
+    c_wheel_entry_t *e;
     read_func_t *rf;
     plugin_ctx_t old_ctx;
 
-    rf = c_heap_get_root(read_heap);
-    if (rf == NULL)
+    e = c_wheel_get_any(read_wheel);
+    if (e == NULL)
       break;
+    rf = e->data;
 
     old_ctx = plugin_set_ctx(rf->rf_ctx);
 
@@ -1775,6 +2131,56 @@ int plugin_write(const char *plugin, /* {{{ */
   return status;
 } /* }}} int plugin_write */
 
+int plugin_write_ref(plugin_write_ref_t *ref, /* {{{ */
+                     const data_set_t *ds, const value_list_t *vl) {
+  unsigned int generation;
+  callback_func_t *cf;
+  plugin_write_cb callback;
+
+  if ((ref == NULL) || (ref->plugin == NULL) || (vl == NULL))
+    return EINVAL;
+
+  if (ds == NULL) {
+    ds = plugin_get_ds(vl->type);
+    if (ds == NULL) {
+      ERROR("plugin_write_ref: Unable to lookup type `%s'.", vl->type);
+      return ENOENT;
+    }
+  }
+
+  generation = __atomic_load_n(&write_generation, __ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&ref->generation, __ATOMIC_ACQUIRE) != generation) {
+    pthread_mutex_lock(&write_ref_lock);
+    generation = __atomic_load_n(&write_generation, __ATOMIC_ACQUIRE);
+
+    cf = NULL;
+    for (llentry_t *le = llist_head(list_write); le != NULL; le = le->next) {
+      if (strcasecmp(ref->plugin, le->key) == 0) {
+        cf = le->value;
+        break;
+      }
+    }
+
+    /* A missing plugin is cached, too, so it isn't searched for again until
+     * the list of write callbacks changes. */
+    __atomic_store_n(&ref->cf, cf, __ATOMIC_RELAXED);
+    __atomic_store_n(&ref->generation, generation, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&write_ref_lock);
+  } else {
+    cf = __atomic_load_n(&ref->cf, __ATOMIC_RELAXED);
+  }
+
+  if (cf == NULL)
+    return ENOENT;
+
+  /* do not switch plugin context; rather keep the context (interval)
+   * information of the calling read plugin */
+
+  DEBUG("plugin: plugin_write_ref: Writing values via %s.", ref->plugin);
+  callback = cf->cf_callback;
+  return (*callback)(ds, vl, &cf->cf_udata);
+} /* }}} int plugin_write_ref */
+
 int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier) {
   llentry_t *le;
 
@@ -1805,6 +2211,32 @@ int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier) {
   return 0;
 } /* int plugin_flush */
 
+int plugin_query(const char *plugin, const char *identifier, /* {{{ */
+                 cdtime_t start, cdtime_t end, plugin_query_result_cb result,
+                 void *arg) {
+  if (list_query == NULL)
+    return ENOENT;
+
+  int status = ENOENT;
+  for (llentry_t *le = llist_head(list_query); le != NULL; le = le->next) {
+    if ((plugin != NULL) && (strcmp(plugin, le->key) != 0))
+      continue;
+
+    callback_func_t *cf = le->value;
+    plugin_ctx_t old_ctx = plugin_set_ctx(cf->cf_ctx);
+    plugin_query_cb callback = cf->cf_callback;
+
+    status = (*callback)(identifier, start, end, result, arg, &cf->cf_udata);
+
+    plugin_set_ctx(old_ctx);
+
+    if (status != ENOENT)
+      break;
+  }
+
+  return status;
+} /* }}} int plugin_query */
+
 int plugin_shutdown_all(void) {
   llentry_t *le;
   int ret = 0; // Assume success.
@@ -1818,7 +2250,7 @@ int plugin_shutdown_all(void) {
   read_list = NULL;
   pthread_mutex_unlock(&read_lock);
 
-  destroy_read_heap();
+  destroy_read_wheel();
 
   /* blocks until all write threads have shut down. */
   stop_write_threads();
@@ -1859,8 +2291,10 @@ int plugin_shutdown_all(void) {
    * the real free function when registering the write callback. This way
    * the data isn't freed twice. */
   destroy_all_callbacks(&list_flush);
+  destroy_all_callbacks(&list_query);
   destroy_all_callbacks(&list_missing);
   destroy_all_callbacks(&list_write);
+  __atomic_add_fetch(&write_generation, 1, __ATOMIC_RELEASE);
 
   destroy_all_callbacks(&list_notification);
   destroy_all_callbacks(&list_shutdown);
@@ -1983,6 +2417,10 @@ static int plugin_dispatch_values_internal(value_list_t *vl) {
   escape_slashes(vl->type, sizeof(vl->type));
   escape_slashes(vl->type_instance, sizeof(vl->type_instance));
 
+  /* Hash the identity once; targets that rename the value list reset it to
+   * zero and consumers recompute it lazily via VL_SERIES_ID(). */
+  vl->series_id = series_id_vl(vl);
+
   if (pre_cache_chain != NULL) {
     status = fc_process_chain(ds, vl, pre_cache_chain);
     if (status < 0) {
@@ -2022,9 +2460,7 @@ static double get_drop_probability(void) /* {{{ */
   long size;
   long wql;
 
-  pthread_mutex_lock(&write_lock);
-  wql = write_queue_length;
-  pthread_mutex_unlock(&write_lock);
+  wql = plugin_write_queue_length();
 
   if (wql < write_limit_low)
     return 0.0;
@@ -110,6 +110,11 @@ struct value_list_s {
   char type[DATA_MAX_NAME_LEN];
   char type_instance[DATA_MAX_NAME_LEN];
   meta_data_t *meta;
+  /* Identity of the series, see series_id_vl(). Set by the daemon when the
+   * values are dispatched, so the cache and write plugins do not need to
+   * format and compare names. Zero means "not computed"; code that changes
+   * the identity fields of a dispatched value list must reset it. */
+  uint64_t series_id;
 };
 typedef struct value_list_s value_list_t;
 
@@ -193,6 +198,16 @@ typedef int (*plugin_missing_cb)(const value_list_t *, user_data_t *);
 typedef void (*plugin_log_cb)(int severity, const char *message, user_data_t *);
 typedef int (*plugin_shutdown_cb)(void);
 typedef int (*plugin_notification_cb)(const notification_t *, user_data_t *);
+/* "query" callbacks read back values a plugin has stored. `result' is called
+ * once for each value of the series `identifier' with a time in
+ * [start, end], in ascending order of time. Returns zero if the series was
+ * found, ENOENT if the plugin doesn't know it and another error otherwise. A
+ * non-zero return value of `result' aborts the query and is returned. */
+typedef int (*plugin_query_result_cb)(const data_set_t *ds,
+                                      const value_list_t *vl, void *arg);
+typedef int (*plugin_query_cb)(const char *identifier, cdtime_t start,
+                               cdtime_t end, plugin_query_result_cb result,
+                               void *arg, user_data_t *);
 /*
  * NAME
  *  plugin_set_dir
@@ -267,8 +282,53 @@ int plugin_shutdown_all(void);
 int plugin_write(const char *plugin, const data_set_t *ds,
                  const value_list_t *vl);
 
+/*
+ * NAME
+ *  plugin_write_ref
+ *
+ * DESCRIPTION
+ *  Like `plugin_write' with a plugin name, but remembers the write callback
+ *  found in `ref' so that repeated calls don't search the list of write
+ *  plugins. The lookup is redone automatically after write callbacks have
+ *  been registered or unregistered.
+ *
+ * ARGUMENTS
+ *  ref        Initialize `plugin' with the plugin's name and all other
+ *             members with zero. The other members are private.
+ *  ds, vl     As for `plugin_write'.
+ *
+ * RETURN VALUE
+ *  Returns the status of the write callback, or ENOENT if no write plugin by
+ *  that name has been registered.
+ */
+struct plugin_write_ref_s {
+  char *plugin;
+  void *cf;
+  unsigned int generation;
+};
+typedef struct plugin_write_ref_s plugin_write_ref_t;
+
+int plugin_write_ref(plugin_write_ref_t *ref, const data_set_t *ds,
+                     const value_list_t *vl);
+
 int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier);
 
+/*
+ * NAME
+ *  plugin_query
+ *
+ * DESCRIPTION
+ *  Reads the stored values of the series `identifier' with a time in
+ *  [start, end] from the query callback of `plugin', or from the first query
+ *  callback knowing the series if `plugin' is NULL. See `plugin_query_cb'.
+ *
+ * RETURN VALUE
+ *  Zero upon success, ENOENT if no callback knows the series and the status
+ *  of the callback otherwise.
+ */
+int plugin_query(const char *plugin, const char *identifier, cdtime_t start,
+                 cdtime_t end, plugin_query_result_cb result, void *arg);
+
 /*
  * The `plugin_register_*' functions are used to make `config', `init',
  * `read', `write' and `shutdown' functions known to the plugin
@@ -299,6 +359,8 @@ int plugin_register_log(const char *name, plugin_log_cb callback,
 int plugin_register_notification(const char *name,
                                  plugin_notification_cb callback,
                                  user_data_t const *user_data);
+int plugin_register_query(const char *name, plugin_query_cb callback,
+                          user_data_t const *user_data);
 
 int plugin_unregister_config(const char *name);
 int plugin_unregister_complex_config(const char *name);
@@ -312,6 +374,7 @@ int plugin_unregister_shutdown(const char *name);
 int plugin_unregister_data_set(const char *name);
 int plugin_unregister_log(const char *name);
 int plugin_unregister_notification(const char *name);
+int plugin_unregister_query(const char *name);
 
 /*
  * NAME
@@ -67,6 +67,12 @@ int plugin_register_shutdown(const char *name, int (*callback)(void)) {
   return ENOTSUP;
 }
 
+int plugin_thread_create(pthread_t *thread, const pthread_attr_t *attr,
+                         void *(*start_routine)(void *), void *arg,
+                         char const *name) {
+  return pthread_create(thread, attr, start_routine, arg);
+}
+
 int plugin_register_data_set(const data_set_t *ds) { return ENOTSUP; }
 
 int plugin_dispatch_values(value_list_t const *vl) { return ENOTSUP; }
@@ -75,6 +81,11 @@ int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier) {
   return ENOTSUP;
 }
 
+int plugin_query(const char *plugin, const char *identifier, cdtime_t start,
+                 cdtime_t end, plugin_query_result_cb result, void *arg) {
+  return ENOENT;
+}
+
 static data_source_t magic_ds[] = {{"value", DS_TYPE_DERIVE, 0.0, NAN}};
 static data_set_t magic = {"MAGIC", 1, magic_ds};
 const data_set_t *plugin_get_ds(const char *name) {
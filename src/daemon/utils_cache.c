@@ -31,13 +31,22 @@
 #include "common.h"
 #include "meta_data.h"
 #include "plugin.h"
-#include "utils_avltree.h"
 #include "utils_cache.h"
 
 #include <assert.h>
 
+/* The cache is split into UC_SHARDS independent hash tables, each protected by
+ * its own lock, so that updates and queries for unrelated value lists do not
+ * serialize on one mutex. An entry is found by a 64 bit hash of its name: the
+ * upper bits select the shard, the lower bits the bucket. */
+#define UC_SHARDS 64
+#define UC_SHARD_INITIAL_SIZE 64
+
 typedef struct cache_entry_s {
   char name[6 * DATA_MAX_NAME_LEN];
+  uint64_t hash;
+  struct cache_entry_s *next;
+
   size_t values_num;
   gauge_t *values_gauge;
   value_t *values_raw;
@@ -69,22 +78,158 @@ typedef struct cache_entry_s {
   meta_data_t *meta;
 } cache_entry_t;
 
+typedef struct cache_shard_s {
+  pthread_mutex_t lock;
+  cache_entry_t **buckets;
+  size_t buckets_num; /* always a power of two */
+  size_t size;
+} cache_shard_t;
+
 struct uc_iter_s {
-  c_avl_iterator_t *iter;
+  /* The iterator holds the lock of `shard' while `locked' is true. */
+  size_t shard;
+  _Bool locked;
+  size_t bucket;
 
   char *name;
   cache_entry_t *entry;
 };
 
-static c_avl_tree_t *cache_tree = NULL;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_shard_t cache_shards[UC_SHARDS];
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void cache_shards_init(void) {
+  for (size_t i = 0; i < UC_SHARDS; i++) {
+    pthread_mutex_init(&cache_shards[i].lock, /* attr = */ NULL);
+    cache_shards[i].buckets = NULL;
+    cache_shards[i].buckets_num = 0;
+    cache_shards[i].size = 0;
+  }
+} /* void cache_shards_init */
+
+/* Entries are keyed by the series ID (see series_id_name()), so that value
+ * lists carrying a precomputed ID can be looked up without formatting their
+ * name. Both the upper (shard) and the lower (bucket) bits are used. */
+static uint64_t cache_hash(const char *name) { return series_id_name(name); }
+
+static cache_shard_t *cache_shard(uint64_t hash) {
+  return &cache_shards[(hash >> 32) % UC_SHARDS];
+} /* cache_shard_t *cache_shard */
+
+/* The shard's lock must be held. */
+static cache_entry_t *cache_lookup(cache_shard_t *shard, const char *name,
+                                   uint64_t hash) {
+  if (shard->buckets == NULL)
+    return NULL;
+
+  for (cache_entry_t *ce = shard->buckets[hash & (shard->buckets_num - 1)];
+       ce != NULL; ce = ce->next) {
+    if ((ce->hash == hash) && (strcmp(ce->name, name) == 0))
+      return ce;
+  }
+
+  return NULL;
+} /* cache_entry_t *cache_lookup */
+
+/* Locks the shard `name' belongs to and returns the entry, or NULL if there is
+ * none. The caller has to unlock `*ret_shard' in either case. */
+static cache_entry_t *cache_get(const char *name, cache_shard_t **ret_shard) {
+  uint64_t hash = cache_hash(name);
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  *ret_shard = shard;
 
-static int cache_compare(const cache_entry_t *a, const cache_entry_t *b) {
-#if COLLECT_DEBUG
-  assert((a != NULL) && (b != NULL));
-#endif
-  return strcmp(a->name, b->name);
-} /* int cache_compare */
+  return cache_lookup(shard, name, hash);
+} /* cache_entry_t *cache_get */
+
+/* The shard's lock must be held. */
+static cache_entry_t *cache_lookup_vl(cache_shard_t *shard,
+                                      const value_list_t *vl, uint64_t hash) {
+  if (shard->buckets == NULL)
+    return NULL;
+
+  for (cache_entry_t *ce = shard->buckets[hash & (shard->buckets_num - 1)];
+       ce != NULL; ce = ce->next) {
+    if ((ce->hash == hash) && series_name_matches(ce->name, vl))
+      return ce;
+  }
+
+  return NULL;
+} /* cache_entry_t *cache_lookup_vl */
+
+/* Like cache_get(), but takes the identity from `vl' without formatting it. */
+static cache_entry_t *cache_get_vl(const value_list_t *vl,
+                                   cache_shard_t **ret_shard) {
+  uint64_t hash = VL_SERIES_ID(vl);
+  cache_shard_t *shard = cache_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  *ret_shard = shard;
+
+  return cache_lookup_vl(shard, vl, hash);
+} /* cache_entry_t *cache_get_vl */
+
+/* The shard's lock must be held. */
+static int cache_resize(cache_shard_t *shard, size_t buckets_num) {
+  cache_entry_t **buckets = calloc(buckets_num, sizeof(*buckets));
+  if (buckets == NULL)
+    return ENOMEM;
+
+  for (size_t i = 0; i < shard->buckets_num; i++) {
+    cache_entry_t *ce = shard->buckets[i];
+    while (ce != NULL) {
+      cache_entry_t *next = ce->next;
+      size_t idx = ce->hash & (buckets_num - 1);
+
+      ce->next = buckets[idx];
+      buckets[idx] = ce;
+      ce = next;
+    }
+  }
+
+  sfree(shard->buckets);
+  shard->buckets = buckets;
+  shard->buckets_num = buckets_num;
+  return 0;
+} /* int cache_resize */
+
+/* The shard's lock must be held. */
+static int cache_link(cache_shard_t *shard, cache_entry_t *ce) {
+  if (shard->buckets == NULL) {
+    if (cache_resize(shard, UC_SHARD_INITIAL_SIZE) != 0)
+      return ENOMEM;
+  } else if (shard->size >= shard->buckets_num) {
+    /* A failed resize only makes the chains longer. */
+    (void)cache_resize(shard, 2 * shard->buckets_num);
+  }
+
+  size_t idx = ce->hash & (shard->buckets_num - 1);
+  ce->next = shard->buckets[idx];
+  shard->buckets[idx] = ce;
+  shard->size++;
+  return 0;
+} /* int cache_link */
+
+/* The shard's lock must be held. */
+static cache_entry_t *cache_unlink(cache_shard_t *shard, const char *name,
+                                   uint64_t hash) {
+  if (shard->buckets == NULL)
+    return NULL;
+
+  cache_entry_t **prev = &shard->buckets[hash & (shard->buckets_num - 1)];
+  for (cache_entry_t *ce = *prev; ce != NULL; prev = &ce->next, ce = ce->next) {
+    if ((ce->hash != hash) || (strcmp(ce->name, name) != 0))
+      continue;
+
+    *prev = ce->next;
+    ce->next = NULL;
+    shard->size--;
+    return ce;
+  }
+
+  return NULL;
+} /* cache_entry_t *cache_unlink */
 
 static cache_entry_t *cache_alloc(size_t values_num) {
   cache_entry_t *ce;
@@ -138,27 +283,20 @@ static void uc_check_range(const data_set_t *ds, cache_entry_t *ce) {
   }
 } /* void uc_check_range */
 
-static int uc_insert(const data_set_t *ds, const value_list_t *vl,
-                     const char *key) {
-  char *key_copy;
+static int uc_insert(cache_shard_t *shard, const data_set_t *ds,
+                     const value_list_t *vl, const char *key, uint64_t hash) {
   cache_entry_t *ce;
 
-  /* `cache_lock' has been locked by `uc_update' */
-
-  key_copy = strdup(key);
-  if (key_copy == NULL) {
-    ERROR("uc_insert: strdup failed.");
-    return -1;
-  }
+  /* The lock of `shard' has been locked by `uc_update' */
 
   ce = cache_alloc(ds->ds_num);
   if (ce == NULL) {
-    sfree(key_copy);
     ERROR("uc_insert: cache_alloc (%zu) failed.", ds->ds_num);
     return -1;
   }
 
   sstrncpy(ce->name, key, sizeof(ce->name));
+  ce->hash = hash;
 
   for (size_t i = 0; i < ds->ds_num; i++) {
     switch (ds->ds[i].type) {
@@ -189,7 +327,6 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
       /* This shouldn't happen. */
       ERROR("uc_insert: Don't know how to handle data source type %i.",
             ds->ds[i].type);
-      sfree(key_copy);
       cache_free(ce);
       return -1;
     } /* switch (ds->ds[i].type) */
@@ -203,9 +340,9 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
   ce->interval = vl->interval;
   ce->state = STATE_OKAY;
 
-  if (c_avl_insert(cache_tree, key_copy, ce) != 0) {
-    sfree(key_copy);
-    ERROR("uc_insert: c_avl_insert failed.");
+  if (cache_link(shard, ce) != 0) {
+    cache_free(ce);
+    ERROR("uc_insert: cache_link failed.");
     return -1;
   }
 
@@ -214,9 +351,7 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
 } /* int uc_insert */
 
 int uc_init(void) {
-  if (cache_tree == NULL)
-    cache_tree =
-        c_avl_create((int (*)(const void *, const void *))cache_compare);
+  pthread_once(&cache_once, cache_shards_init);
 
   return 0;
 } /* int uc_init */
@@ -224,44 +359,49 @@ int uc_init(void) {
 int uc_check_timeout(void) {
   struct {
     char *key;
+    uint64_t hash;
     cdtime_t time;
     cdtime_t interval;
   } *expired = NULL;
   size_t expired_num = 0;
 
-  pthread_mutex_lock(&cache_lock);
-  cdtime_t now = cdtime();
-
-  /* Build a list of entries to be flushed */
-  c_avl_iterator_t *iter = c_avl_get_iterator(cache_tree);
-  char *key = NULL;
-  cache_entry_t *ce = NULL;
-  while (c_avl_iterator_next(iter, (void *)&key, (void *)&ce) == 0) {
-    /* If the entry is fresh enough, continue. */
-    if ((now - ce->last_update) < (ce->interval * timeout_g))
-      continue;
-
-    void *tmp = realloc(expired, (expired_num + 1) * sizeof(*expired));
-    if (tmp == NULL) {
-      ERROR("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    expired = tmp;
-
-    expired[expired_num].key = strdup(key);
-    expired[expired_num].time = ce->last_time;
-    expired[expired_num].interval = ce->interval;
-
-    if (expired[expired_num].key == NULL) {
-      ERROR("uc_check_timeout: strdup failed.");
-      continue;
-    }
-
-    expired_num++;
-  } /* while (c_avl_iterator_next) */
-
-  c_avl_iterator_destroy(iter);
-  pthread_mutex_unlock(&cache_lock);
+  /* Build a list of entries to be flushed. Only one shard is locked at a
+   * time, so updates to the other shards can proceed meanwhile. */
+  for (size_t i = 0; i < UC_SHARDS; i++) {
+    cache_shard_t *shard = &cache_shards[i];
+
+    pthread_mutex_lock(&shard->lock);
+    cdtime_t now = cdtime();
+
+    for (size_t j = 0; j < shard->buckets_num; j++) {
+      for (cache_entry_t *ce = shard->buckets[j]; ce != NULL; ce = ce->next) {
+        /* If the entry is fresh enough, continue. */
+        if ((now - ce->last_update) < (ce->interval * timeout_g))
+          continue;
+
+        void *tmp = realloc(expired, (expired_num + 1) * sizeof(*expired));
+        if (tmp == NULL) {
+          ERROR("uc_check_timeout: realloc failed.");
+          continue;
+        }
+        expired = tmp;
+
+        expired[expired_num].key = strdup(ce->name);
+        expired[expired_num].hash = ce->hash;
+        expired[expired_num].time = ce->last_time;
+        expired[expired_num].interval = ce->interval;
+
+        if (expired[expired_num].key == NULL) {
+          ERROR("uc_check_timeout: strdup failed.");
+          continue;
+        }
+
+        expired_num++;
+      } /* for (ce) */
+    }   /* for (j) */
+
+    pthread_mutex_unlock(&shard->lock);
+  } /* for (i) */
 
   if (expired_num == 0) {
     sfree(expired);
@@ -290,23 +430,20 @@ int uc_check_timeout(void) {
   /* Now actually remove all the values from the cache. We don't re-evaluate
    * the timestamp again, so in theory it is possible we remove a value after
    * it is updated here. */
-  pthread_mutex_lock(&cache_lock);
   for (size_t i = 0; i < expired_num; i++) {
-    char *key = NULL;
-    cache_entry_t *value = NULL;
+    cache_shard_t *shard = cache_shard(expired[i].hash);
+    cache_entry_t *ce;
 
-    if (c_avl_remove(cache_tree, expired[i].key, (void *)&key,
-                     (void *)&value) != 0) {
-      ERROR("uc_check_timeout: c_avl_remove (\"%s\") failed.", expired[i].key);
-      sfree(expired[i].key);
-      continue;
-    }
-    sfree(key);
-    cache_free(value);
+    pthread_mutex_lock(&shard->lock);
+    ce = cache_unlink(shard, expired[i].key, expired[i].hash);
+    pthread_mutex_unlock(&shard->lock);
+
+    if (ce == NULL)
+      ERROR("uc_check_timeout: cache_unlink (\"%s\") failed.", expired[i].key);
+    cache_free(ce);
 
     sfree(expired[i].key);
   } /* for (i = 0; i < expired_num; i++) */
-  pthread_mutex_unlock(&cache_lock);
 
   sfree(expired);
   return 0;
@@ -317,18 +454,23 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
   cache_entry_t *ce = NULL;
   int status;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_update: FORMAT_VL failed.");
-    return -1;
-  }
+  uint64_t hash = VL_SERIES_ID(vl);
+  cache_shard_t *shard = cache_shard(hash);
 
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) /* entry does not yet exist */
+  ce = cache_lookup_vl(shard, vl, hash);
+  if (ce == NULL) /* entry does not yet exist */
   {
-    status = uc_insert(ds, vl, name);
-    pthread_mutex_unlock(&cache_lock);
+    /* Only new entries need the formatted name. */
+    if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+      pthread_mutex_unlock(&shard->lock);
+      ERROR("uc_update: FORMAT_VL failed.");
+      return -1;
+    }
+
+    status = uc_insert(shard, ds, vl, name, hash);
+    pthread_mutex_unlock(&shard->lock);
     return status;
   }
 
@@ -336,11 +478,12 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
   assert(ce->values_num == ds->ds_num);
 
   if (ce->last_time >= vl->time) {
-    pthread_mutex_unlock(&cache_lock);
+    sstrncpy(name, ce->name, sizeof(name));
+    cdtime_t last_time = ce->last_time;
+    pthread_mutex_unlock(&shard->lock);
     NOTICE("uc_update: Value too old: name = %s; value time = %.3f; "
            "last cache update = %.3f;",
-           name, CDTIME_T_TO_DOUBLE(vl->time),
-           CDTIME_T_TO_DOUBLE(ce->last_time));
+           name, CDTIME_T_TO_DOUBLE(vl->time), CDTIME_T_TO_DOUBLE(last_time));
     return -1;
   }
 
@@ -375,13 +518,13 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
 
     default:
       /* This shouldn't happen. */
-      pthread_mutex_unlock(&cache_lock);
+      pthread_mutex_unlock(&shard->lock);
       ERROR("uc_update: Don't know how to handle data source type %i.",
             ds->ds[i].type);
       return -1;
     } /* switch (ds->ds[i].type) */
 
-    DEBUG("uc_update: %s: ds[%zu] = %lf", name, i, ce->values_gauge[i]);
+    DEBUG("uc_update: %s: ds[%zu] = %lf", ce->name, i, ce->values_gauge[i]);
   } /* for (i) */
 
   /* Update the history if it exists. */
@@ -403,66 +546,63 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
   ce->last_update = cdtime();
   ce->interval = vl->interval;
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return 0;
 } /* int uc_update */
 
+/* The entry's shard must be locked. */
+static int cache_copy_rate(const cache_entry_t *ce, gauge_t **ret_values,
+                           size_t *ret_values_num) {
+  /* remove missing values from getval */
+  if (ce->state == STATE_MISSING) {
+    DEBUG("utils_cache: uc_get_rate: requested metric \"%s\" is in "
+          "state \"missing\".",
+          ce->name);
+    return -1;
+  }
+
+  gauge_t *ret = malloc(ce->values_num * sizeof(*ret));
+  if (ret == NULL) {
+    ERROR("utils_cache: uc_get_rate: malloc failed.");
+    return -1;
+  }
+  memcpy(ret, ce->values_gauge, ce->values_num * sizeof(gauge_t));
+
+  *ret_values = ret;
+  *ret_values_num = ce->values_num;
+  return 0;
+} /* int cache_copy_rate */
+
 int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
                         size_t *ret_values_num) {
-  gauge_t *ret = NULL;
-  size_t ret_num = 0;
+  cache_shard_t *shard;
   cache_entry_t *ce = NULL;
-  int status = 0;
+  int status = -1;
 
-  pthread_mutex_lock(&cache_lock);
-
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
-
-    /* remove missing values from getval */
-    if (ce->state == STATE_MISSING) {
-      DEBUG("utils_cache: uc_get_rate_by_name: requested metric \"%s\" is in "
-            "state \"missing\".",
-            name);
-      status = -1;
-    } else {
-      ret_num = ce->values_num;
-      ret = malloc(ret_num * sizeof(*ret));
-      if (ret == NULL) {
-        ERROR("utils_cache: uc_get_rate_by_name: malloc failed.");
-        status = -1;
-      } else {
-        memcpy(ret, ce->values_gauge, ret_num * sizeof(gauge_t));
-      }
-    }
-  } else {
+  ce = cache_get(name, &shard);
+  if (ce != NULL)
+    status = cache_copy_rate(ce, ret_values, ret_values_num);
+  else
     DEBUG("utils_cache: uc_get_rate_by_name: No such value: %s", name);
-    status = -1;
-  }
 
-  pthread_mutex_unlock(&cache_lock);
-
-  if (status == 0) {
-    *ret_values = ret;
-    *ret_values_num = ret_num;
-  }
+  pthread_mutex_unlock(&shard->lock);
 
   return status;
 } /* gauge_t *uc_get_rate_by_name */
 
 gauge_t *uc_get_rate(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
+  cache_entry_t *ce = NULL;
   gauge_t *ret = NULL;
   size_t ret_num = 0;
-  int status;
+  int status = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("utils_cache: uc_get_rate: FORMAT_VL failed.");
-    return NULL;
-  }
+  ce = cache_get_vl(vl, &shard);
+  if (ce != NULL)
+    status = cache_copy_rate(ce, &ret, &ret_num);
+  pthread_mutex_unlock(&shard->lock);
 
-  status = uc_get_rate_by_name(name, &ret, &ret_num);
   if (status != 0)
     return NULL;
 
@@ -470,7 +610,7 @@ gauge_t *uc_get_rate(const data_set_t *ds, const value_list_t *vl) {
    * values are returned. */
   if (ret_num != ds->ds_num) {
     ERROR("utils_cache: uc_get_rate: ds[%s] has %zu values, "
-          "but uc_get_rate_by_name returned %zu.",
+          "but the cache holds %zu.",
           ds->type, ds->ds_num, ret_num);
     sfree(ret);
     return NULL;
@@ -479,59 +619,54 @@ gauge_t *uc_get_rate(const data_set_t *ds, const value_list_t *vl) {
   return ret;
 } /* gauge_t *uc_get_rate */
 
+/* The entry's shard must be locked. */
+static int cache_copy_value(const cache_entry_t *ce, value_t **ret_values,
+                            size_t *ret_values_num) {
+  /* remove missing values from getval */
+  if (ce->state == STATE_MISSING)
+    return (-1);
+
+  value_t *ret = malloc(ce->values_num * sizeof(*ret));
+  if (ret == NULL) {
+    ERROR("utils_cache: uc_get_value: malloc failed.");
+    return (-1);
+  }
+  memcpy(ret, ce->values_raw, ce->values_num * sizeof(value_t));
+
+  *ret_values = ret;
+  *ret_values_num = ce->values_num;
+  return (0);
+} /* int cache_copy_value */
+
 int uc_get_value_by_name(const char *name, value_t **ret_values,
                          size_t *ret_values_num) {
-  value_t *ret = NULL;
-  size_t ret_num = 0;
+  cache_shard_t *shard;
   cache_entry_t *ce = NULL;
-  int status = 0;
+  int status = -1;
 
-  pthread_mutex_lock(&cache_lock);
-
-  if (c_avl_get(cache_tree, name, (void *) &ce) == 0) {
-    assert(ce != NULL);
-
-    /* remove missing values from getval */
-    if (ce->state == STATE_MISSING) {
-      status = -1;
-    } else {
-      ret_num = ce->values_num;
-      ret = malloc(ret_num * sizeof(*ret));
-      if (ret == NULL) {
-        ERROR("utils_cache: uc_get_value_by_name: malloc failed.");
-        status = -1;
-      } else {
-        memcpy(ret, ce->values_raw, ret_num * sizeof(value_t));
-      }
-    }
-  }
-  else {
+  ce = cache_get(name, &shard);
+  if (ce != NULL)
+    status = cache_copy_value(ce, ret_values, ret_values_num);
+  else
     DEBUG("utils_cache: uc_get_value_by_name: No such value: %s", name);
-    status = -1;
-  }
-
-  pthread_mutex_unlock(&cache_lock);
 
-  if (status == 0) {
-    *ret_values = ret;
-    *ret_values_num = ret_num;
-  }
+  pthread_mutex_unlock(&shard->lock);
 
   return (status);
 } /* int uc_get_value_by_name */
 
 value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
+  cache_entry_t *ce = NULL;
   value_t *ret = NULL;
   size_t ret_num = 0;
-  int status;
+  int status = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("utils_cache: uc_get_value: FORMAT_VL failed.");
-    return (NULL);
-  }
+  ce = cache_get_vl(vl, &shard);
+  if (ce != NULL)
+    status = cache_copy_value(ce, &ret, &ret_num);
+  pthread_mutex_unlock(&shard->lock);
 
-  status = uc_get_value_by_name(name, &ret, &ret_num);
   if (status != 0)
     return (NULL);
 
@@ -539,7 +674,7 @@ value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl) {
    * values are returned. */
   if (ret_num != (size_t) ds->ds_num) {
     ERROR("utils_cache: uc_get_value: ds[%s] has %zu values, "
-          "but uc_get_value_by_name returned %zu.", ds->type, ds->ds_num,
+          "but the cache holds %zu.", ds->type, ds->ds_num,
           ret_num);
     sfree(ret);
     return (NULL);
@@ -551,83 +686,113 @@ value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl) {
 size_t uc_get_size(void) {
   size_t size_arrays = 0;
 
-  pthread_mutex_lock(&cache_lock);
-  size_arrays = (size_t)c_avl_size(cache_tree);
-  pthread_mutex_unlock(&cache_lock);
+  for (size_t i = 0; i < UC_SHARDS; i++) {
+    pthread_mutex_lock(&cache_shards[i].lock);
+    size_arrays += cache_shards[i].size;
+    pthread_mutex_unlock(&cache_shards[i].lock);
+  }
 
   return size_arrays;
 }
 
+typedef struct {
+  char *name;
+  cdtime_t time;
+} uc_name_t;
+
+static int uc_name_compare(const void *a, const void *b) {
+  return strcmp(((const uc_name_t *)a)->name, ((const uc_name_t *)b)->name);
+} /* int uc_name_compare */
+
 int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
-  c_avl_iterator_t *iter;
-  char *key;
-  cache_entry_t *value;
+  uc_name_t *entries = NULL;
+  size_t entries_size = 0;
 
   char **names = NULL;
   cdtime_t *times = NULL;
   size_t number = 0;
-  size_t size_arrays = 0;
 
   int status = 0;
 
   if ((ret_names == NULL) || (ret_number == NULL))
     return -1;
 
-  pthread_mutex_lock(&cache_lock);
+  for (size_t i = 0; (i < UC_SHARDS) && (status == 0); i++) {
+    cache_shard_t *shard = &cache_shards[i];
 
-  size_arrays = (size_t)c_avl_size(cache_tree);
-  if (size_arrays < 1) {
-    /* Handle the "no values" case here, to avoid the error message when
-     * calloc() returns NULL. */
-    pthread_mutex_unlock(&cache_lock);
-    return 0;
-  }
+    pthread_mutex_lock(&shard->lock);
 
-  names = calloc(size_arrays, sizeof(*names));
-  times = calloc(size_arrays, sizeof(*times));
-  if ((names == NULL) || (times == NULL)) {
-    ERROR("uc_get_names: calloc failed.");
-    sfree(names);
-    sfree(times);
-    pthread_mutex_unlock(&cache_lock);
-    return ENOMEM;
-  }
+    if (number + shard->size > entries_size) {
+      uc_name_t *tmp =
+          realloc(entries, (number + shard->size) * sizeof(*entries));
+      if (tmp == NULL) {
+        ERROR("uc_get_names: realloc failed.");
+        pthread_mutex_unlock(&shard->lock);
+        status = ENOMEM;
+        break;
+      }
+      entries = tmp;
+      entries_size = number + shard->size;
+    }
 
-  iter = c_avl_get_iterator(cache_tree);
-  while (c_avl_iterator_next(iter, (void *)&key, (void *)&value) == 0) {
-    /* remove missing values when list values */
-    if (value->state == STATE_MISSING)
-      continue;
+    for (size_t j = 0; (j < shard->buckets_num) && (status == 0); j++) {
+      for (cache_entry_t *ce = shard->buckets[j]; ce != NULL; ce = ce->next) {
+        /* remove missing values when list values */
+        if (ce->state == STATE_MISSING)
+          continue;
 
-    /* c_avl_size does not return a number smaller than the number of elements
-     * returned by c_avl_iterator_next. */
-    assert(number < size_arrays);
+        assert(number < entries_size);
 
-    if (ret_times != NULL)
-      times[number] = value->last_time;
+        entries[number].time = ce->last_time;
+        entries[number].name = strdup(ce->name);
+        if (entries[number].name == NULL) {
+          status = -1;
+          break;
+        }
 
-    names[number] = strdup(key);
-    if (names[number] == NULL) {
-      status = -1;
-      break;
-    }
+        number++;
+      } /* for (ce) */
+    }   /* for (j) */
 
-    number++;
-  } /* while (c_avl_iterator_next) */
+    pthread_mutex_unlock(&shard->lock);
+  } /* for (i) */
 
-  c_avl_iterator_destroy(iter);
-  pthread_mutex_unlock(&cache_lock);
+  if ((status == 0) && (number > 0)) {
+    names = calloc(number, sizeof(*names));
+    times = calloc(number, sizeof(*times));
+    if ((names == NULL) || (times == NULL)) {
+      ERROR("uc_get_names: calloc failed.");
+      status = ENOMEM;
+    }
+  }
 
   if (status != 0) {
     for (size_t i = 0; i < number; i++) {
-      sfree(names[i]);
+      sfree(entries[i].name);
     }
+    sfree(entries);
     sfree(names);
     sfree(times);
 
-    return -1;
+    return status;
   }
 
+  if (number == 0) {
+    /* Handle the "no values" case here, to avoid the error message when
+     * calloc() returns NULL. */
+    sfree(entries);
+    return 0;
+  }
+
+  /* The shards are in hash order; keep the output sorted by name like it used
+   * to be. */
+  qsort(entries, number, sizeof(*entries), uc_name_compare);
+  for (size_t i = 0; i < number; i++) {
+    names[i] = entries[i].name;
+    times[i] = entries[i].time;
+  }
+  sfree(entries);
+
   *ret_names = names;
   if (ret_times != NULL)
     *ret_times = times;
@@ -639,67 +804,41 @@ int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
 } /* int uc_get_names */
 
 int uc_get_state(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_get_state: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
-
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  ce = cache_get_vl(vl, &shard);
+  if (ce != NULL) {
     ret = ce->state;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_get_state */
 
 int uc_set_state(const data_set_t *ds, const value_list_t *vl, int state) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_set_state: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
-
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  ce = cache_get_vl(vl, &shard);
+  if (ce != NULL) {
     ret = ce->state;
     ce->state = state;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_set_state */
 
-int uc_get_history_by_name(const char *name, gauge_t *ret_history,
-                           size_t num_steps, size_t num_ds) {
-  cache_entry_t *ce = NULL;
-  int status = 0;
-
-  pthread_mutex_lock(&cache_lock);
-
-  status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) {
-    pthread_mutex_unlock(&cache_lock);
-    return -ENOENT;
-  }
-
-  if (((size_t)ce->values_num) != num_ds) {
-    pthread_mutex_unlock(&cache_lock);
+/* The entry's shard must be locked. */
+static int cache_copy_history(cache_entry_t *ce, gauge_t *ret_history,
+                              size_t num_steps, size_t num_ds) {
+  if (((size_t)ce->values_num) != num_ds)
     return -EINVAL;
-  }
 
   /* Check if there are enough values available. If not, increase the buffer
    * size. */
@@ -708,10 +847,8 @@ int uc_get_history_by_name(const char *name, gauge_t *ret_history,
 
     tmp =
         realloc(ce->history, sizeof(*ce->history) * num_steps * ce->values_num);
-    if (tmp == NULL) {
-      pthread_mutex_unlock(&cache_lock);
+    if (tmp == NULL)
       return -ENOMEM;
-    }
 
     for (size_t i = ce->history_length * ce->values_num;
          i < (num_steps * ce->values_num); i++)
@@ -738,87 +875,82 @@ int uc_get_history_by_name(const char *name, gauge_t *ret_history,
            sizeof(*ret_history) * num_ds);
   }
 
-  pthread_mutex_unlock(&cache_lock);
-
   return 0;
+} /* int cache_copy_history */
+
+int uc_get_history_by_name(const char *name, gauge_t *ret_history,
+                           size_t num_steps, size_t num_ds) {
+  cache_shard_t *shard;
+  cache_entry_t *ce = NULL;
+  int status = -ENOENT;
+
+  ce = cache_get(name, &shard);
+  if (ce != NULL)
+    status = cache_copy_history(ce, ret_history, num_steps, num_ds);
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return status;
 } /* int uc_get_history_by_name */
 
 int uc_get_history(const data_set_t *ds, const value_list_t *vl,
                    gauge_t *ret_history, size_t num_steps, size_t num_ds) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
+  cache_entry_t *ce = NULL;
+  int status = -ENOENT;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("utils_cache: uc_get_history: FORMAT_VL failed.");
-    return -1;
-  }
+  ce = cache_get_vl(vl, &shard);
+  if (ce != NULL)
+    status = cache_copy_history(ce, ret_history, num_steps, num_ds);
+
+  pthread_mutex_unlock(&shard->lock);
 
-  return uc_get_history_by_name(name, ret_history, num_steps, num_ds);
+  return status;
 } /* int uc_get_history */
 
 int uc_get_hits(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_get_hits: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
-
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  ce = cache_get_vl(vl, &shard);
+  if (ce != NULL) {
     ret = ce->hits;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_get_hits */
 
 int uc_set_hits(const data_set_t *ds, const value_list_t *vl, int hits) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_set_hits: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
-
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  ce = cache_get_vl(vl, &shard);
+  if (ce != NULL) {
     ret = ce->hits;
     ce->hits = hits;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_set_hits */
 
 int uc_inc_hits(const data_set_t *ds, const value_list_t *vl, int step) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_inc_hits: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
-
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  ce = cache_get_vl(vl, &shard);
+  if (ce != NULL) {
     ret = ce->hits;
     ce->hits = ret + step;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_inc_hits */
@@ -833,36 +965,52 @@ uc_iter_t *uc_get_iterator(void) {
   if (iter == NULL)
     return NULL;
 
-  pthread_mutex_lock(&cache_lock);
-
-  iter->iter = c_avl_get_iterator(cache_tree);
-  if (iter->iter == NULL) {
-    free(iter);
-    return NULL;
-  }
-
+  /* Shards are locked lazily, one at a time, by uc_iterator_next(). */
   return iter;
 } /* uc_iter_t *uc_get_iterator */
 
 int uc_iterator_next(uc_iter_t *iter, char **ret_name) {
-  int status;
-
   if (iter == NULL)
     return -1;
 
-  while ((status = c_avl_iterator_next(iter->iter, (void *)&iter->name,
-                                       (void *)&iter->entry)) == 0) {
-    if (iter->entry->state == STATE_MISSING)
+  while (1) {
+    cache_shard_t *shard;
+    cache_entry_t *ce;
+
+    if (!iter->locked) {
+      if (iter->shard >= UC_SHARDS) {
+        iter->name = NULL;
+        iter->entry = NULL;
+        return -1;
+      }
+
+      pthread_mutex_lock(&cache_shards[iter->shard].lock);
+      iter->locked = 1;
+      iter->bucket = 0;
+      iter->entry = NULL;
+    }
+    shard = &cache_shards[iter->shard];
+
+    ce = (iter->entry != NULL) ? iter->entry->next : NULL;
+    while ((ce == NULL) && (iter->bucket < shard->buckets_num))
+      ce = shard->buckets[iter->bucket++];
+
+    if (ce == NULL) {
+      pthread_mutex_unlock(&shard->lock);
+      iter->locked = 0;
+      iter->shard++;
+      iter->entry = NULL;
+      continue;
+    }
+
+    iter->entry = ce;
+    if (ce->state == STATE_MISSING)
       continue;
 
     break;
   }
-  if (status != 0) {
-    iter->name = NULL;
-    iter->entry = NULL;
-    return -1;
-  }
 
+  iter->name = iter->entry->name;
   if (ret_name != NULL)
     *ret_name = iter->name;
 
@@ -873,8 +1021,8 @@ void uc_iterator_destroy(uc_iter_t *iter) {
   if (iter == NULL)
     return;
 
-  c_avl_iterator_destroy(iter->iter);
-  pthread_mutex_unlock(&cache_lock);
+  if (iter->locked)
+    pthread_mutex_unlock(&cache_shards[iter->shard].lock);
 
   free(iter);
 } /* void uc_iterator_destroy */
@@ -925,34 +1073,27 @@ int uc_iterator_get_meta(uc_iter_t *iter, meta_data_t **ret_meta) {
 /*
  * Meta data interface
  */
-/* XXX: This function will acquire `cache_lock' but will not free it! */
-static meta_data_t *uc_get_meta(const value_list_t *vl) /* {{{ */
+/* XXX: This function will acquire the lock of the entry's shard but will not
+ * free it! The shard is returned in `ret_shard'. */
+static meta_data_t *uc_get_meta(const value_list_t *vl,
+                                cache_shard_t **ret_shard) /* {{{ */
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  cache_shard_t *shard;
   cache_entry_t *ce = NULL;
-  int status;
-
-  status = FORMAT_VL(name, sizeof(name), vl);
-  if (status != 0) {
-    ERROR("utils_cache: uc_get_meta: FORMAT_VL failed.");
-    return NULL;
-  }
 
-  pthread_mutex_lock(&cache_lock);
-
-  status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) {
-    pthread_mutex_unlock(&cache_lock);
+  ce = cache_get_vl(vl, &shard);
+  if (ce == NULL) {
+    pthread_mutex_unlock(&shard->lock);
     return NULL;
   }
-  assert(ce != NULL);
 
   if (ce->meta == NULL)
     ce->meta = meta_data_create();
 
   if (ce->meta == NULL)
-    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&shard->lock);
 
+  *ret_shard = shard;
   return ce->meta;
 } /* }}} meta_data_t *uc_get_meta */
 
@@ -960,61 +1101,66 @@ static meta_data_t *uc_get_meta(const value_list_t *vl) /* {{{ */
  * shorter.. */
 #define UC_WRAP(wrap_function)                                                 \
   {                                                                            \
+    cache_shard_t *shard;                                                      \
     meta_data_t *meta;                                                         \
     int status;                                                                \
-    meta = uc_get_meta(vl);                                                    \
+    meta = uc_get_meta(vl, &shard);                                            \
     if (meta == NULL)                                                          \
       return -1;                                                               \
     status = wrap_function(meta, key);                                         \
-    pthread_mutex_unlock(&cache_lock);                                         \
+    pthread_mutex_unlock(&shard->lock);                                        \
     return status;                                                             \
   }
 int uc_meta_data_exists(const value_list_t *vl,
                         const char *key) UC_WRAP(meta_data_exists)
 
-    int uc_meta_data_delete(const value_list_t *vl,
-                            const char *key) UC_WRAP(meta_data_delete)
+int uc_meta_data_delete(const value_list_t *vl,
+                        const char *key) UC_WRAP(meta_data_delete)
 #undef UC_WRAP
 
 /* We need a new version of this macro because the following functions take
  * two argumetns. */
 #define UC_WRAP(wrap_function)                                                 \
   {                                                                            \
+    cache_shard_t *shard;                                                      \
     meta_data_t *meta;                                                         \
     int status;                                                                \
-    meta = uc_get_meta(vl);                                                    \
+    meta = uc_get_meta(vl, &shard);                                            \
     if (meta == NULL)                                                          \
       return -1;                                                               \
     status = wrap_function(meta, key, value);                                  \
-    pthread_mutex_unlock(&cache_lock);                                         \
+    pthread_mutex_unlock(&shard->lock);                                        \
     return status;                                                             \
   }
-        int uc_meta_data_add_string(const value_list_t *vl, const char *key,
-                                    const char *value)
-            UC_WRAP(meta_data_add_string) int uc_meta_data_add_signed_int(
-                const value_list_t *vl, const char *key, int64_t value)
-                UC_WRAP(meta_data_add_signed_int) int uc_meta_data_add_unsigned_int(
-                    const value_list_t *vl, const char *key, uint64_t value)
-                    UC_WRAP(meta_data_add_unsigned_int) int uc_meta_data_add_double(
-                        const value_list_t *vl, const char *key, double value)
-                        UC_WRAP(meta_data_add_double) int uc_meta_data_add_boolean(
-                            const value_list_t *vl, const char *key,
-                            _Bool value) UC_WRAP(meta_data_add_boolean)
-
-                            int uc_meta_data_get_string(const value_list_t *vl,
-                                                        const char *key,
-                                                        char **value)
-                                UC_WRAP(meta_data_get_string) int uc_meta_data_get_signed_int(
-                                    const value_list_t *vl, const char *key,
-                                    int64_t *value)
-                                    UC_WRAP(meta_data_get_signed_int) int uc_meta_data_get_unsigned_int(
-                                        const value_list_t *vl, const char *key,
-                                        uint64_t *value)
-                                        UC_WRAP(meta_data_get_unsigned_int) int uc_meta_data_get_double(
-                                            const value_list_t *vl,
-                                            const char *key, double *value)
-                                            UC_WRAP(meta_data_get_double) int uc_meta_data_get_boolean(
-                                                const value_list_t *vl,
-                                                const char *key, _Bool *value)
-                                                UC_WRAP(meta_data_get_boolean)
+int uc_meta_data_add_string(const value_list_t *vl, const char *key,
+                            const char *value) UC_WRAP(meta_data_add_string)
+
+int uc_meta_data_add_signed_int(const value_list_t *vl, const char *key,
+                                int64_t value) UC_WRAP(meta_data_add_signed_int)
+
+int uc_meta_data_add_unsigned_int(const value_list_t *vl, const char *key,
+                                  uint64_t value)
+    UC_WRAP(meta_data_add_unsigned_int)
+
+int uc_meta_data_add_double(const value_list_t *vl, const char *key,
+                            double value) UC_WRAP(meta_data_add_double)
+
+int uc_meta_data_add_boolean(const value_list_t *vl, const char *key,
+                             _Bool value) UC_WRAP(meta_data_add_boolean)
+
+int uc_meta_data_get_string(const value_list_t *vl, const char *key,
+                            char **value) UC_WRAP(meta_data_get_string)
+
+int uc_meta_data_get_signed_int(const value_list_t *vl, const char *key,
+                                int64_t *value) UC_WRAP(meta_data_get_signed_int)
+
+int uc_meta_data_get_unsigned_int(const value_list_t *vl, const char *key,
+                                  uint64_t *value)
+    UC_WRAP(meta_data_get_unsigned_int)
+
+int uc_meta_data_get_double(const value_list_t *vl, const char *key,
+                            double *value) UC_WRAP(meta_data_get_double)
+
+int uc_meta_data_get_boolean(const value_list_t *vl, const char *key,
+                             _Bool *value) UC_WRAP(meta_data_get_boolean)
 #undef UC_WRAP
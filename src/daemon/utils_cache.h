@@ -70,8 +70,10 @@ typedef struct uc_iter_s uc_iter_t;
  *   uc_get_iterator
  *
  * DESCRIPTION
- *   Create an iterator for the cache. It will hold the cache lock until it's
- *   destroyed.
+ *   Create an iterator for the cache. The cache is split into shards; the
+ *   iterator holds the lock of the shard it currently points into, so only
+ *   updates to that shard are blocked while iterating. Entries of shards that
+ *   have not been visited yet may change in the meantime.
  *
  * RETURN VALUE
  *   An iterator object on success or NULL else.
@@ -88,9 +90,9 @@ uc_iter_t *uc_get_iterator(void);
  *
  * PARAMETERS
  *   `iter'     The iterator object to advance.
- *   `ret_name' Optional pointer to a string where to store the name. If not
- *              NULL, the returned value is a copy of the value and has to be
- *              freed by the caller.
+ *   `ret_name' Optional pointer to a string where to store the name. The
+ *              returned string is only valid until the next call to
+ *              `uc_iterator_next' or `uc_iterator_destroy'.
  *
  * RETURN VALUE
  *   Zero upon success or non-zero if the iterator ie NULL or no further
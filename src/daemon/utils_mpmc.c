@@ -0,0 +1,175 @@
+/**
+ * collectd - src/daemon/utils_mpmc.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+
+#include "utils_mpmc.h"
+
+/* Bounded MPMC queue after Dmitry Vyukov: every slot carries a sequence
+ * number which tells producers and consumers whether the slot is free for
+ * the current lap. Claiming a slot is a single CAS on the respective
+ * position counter; publishing it is a release store of the sequence. */
+
+#define MPMC_CACHE_LINE 64
+
+struct mpmc_cell_s {
+  size_t sequence;
+  void *data;
+};
+typedef struct mpmc_cell_s mpmc_cell_t;
+
+struct mpmc_queue_s {
+  mpmc_cell_t *cells;
+  size_t mask;
+  char pad0[MPMC_CACHE_LINE - sizeof(mpmc_cell_t *) - sizeof(size_t)];
+
+  /* Producers and consumers each get their own cache line. */
+  size_t enqueue_pos;
+  char pad1[MPMC_CACHE_LINE - sizeof(size_t)];
+
+  size_t dequeue_pos;
+  char pad2[MPMC_CACHE_LINE - sizeof(size_t)];
+};
+
+mpmc_queue_t *mpmc_create(size_t capacity) /* {{{ */
+{
+  mpmc_queue_t *q;
+  size_t size = 2;
+
+  while (size < capacity) {
+    if (size > (((size_t)-1) >> 2))
+      return NULL;
+    size *= 2;
+  }
+
+  q = calloc(1, sizeof(*q));
+  if (q == NULL)
+    return NULL;
+
+  q->cells = calloc(size, sizeof(*q->cells));
+  if (q->cells == NULL) {
+    free(q);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < size; i++)
+    q->cells[i].sequence = i;
+
+  q->mask = size - 1;
+  q->enqueue_pos = 0;
+  q->dequeue_pos = 0;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return q;
+} /* }}} mpmc_queue_t *mpmc_create */
+
+void mpmc_destroy(mpmc_queue_t *q) /* {{{ */
+{
+  if (q == NULL)
+    return;
+
+  free(q->cells);
+  free(q);
+} /* }}} void mpmc_destroy */
+
+int mpmc_push(mpmc_queue_t *q, void *ptr) /* {{{ */
+{
+  mpmc_cell_t *cell;
+  size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+  while (1) {
+    cell = q->cells + (pos & q->mask);
+
+    size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      /* Slot is free in this lap: try to claim it. On failure "pos" is
+       * updated to the current value. */
+      if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1,
+                                      /* weak = */ 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      /* The consumer of the previous lap has not released this slot. */
+      return EAGAIN;
+    } else {
+      pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  cell->data = ptr;
+  __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+  return 0;
+} /* }}} int mpmc_push */
+
+int mpmc_pop(mpmc_queue_t *q, void **ret_ptr) /* {{{ */
+{
+  mpmc_cell_t *cell;
+  size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+
+  while (1) {
+    cell = q->cells + (pos & q->mask);
+
+    size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1,
+                                      /* weak = */ 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      /* Nothing has been published in this slot yet. */
+      return ENOENT;
+    } else {
+      pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  *ret_ptr = cell->data;
+  /* Hand the slot to the producer of the next lap. */
+  __atomic_store_n(&cell->sequence, pos + q->mask + 1, __ATOMIC_RELEASE);
+  return 0;
+} /* }}} int mpmc_pop */
+
+size_t mpmc_size(mpmc_queue_t *q) /* {{{ */
+{
+  size_t deq = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+  size_t enq = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+  /* Both counters move independently; clamp the transient inconsistencies. */
+  if (enq <= deq)
+    return 0;
+  if (enq - deq > q->mask + 1)
+    return q->mask + 1;
+  return enq - deq;
+} /* }}} size_t mpmc_size */
+
+size_t mpmc_capacity(mpmc_queue_t *q) /* {{{ */
+{
+  return q->mask + 1;
+} /* }}} size_t mpmc_capacity */
@@ -0,0 +1,106 @@
+/**
+ * collectd - src/daemon/utils_mpmc.h
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_MPMC_H
+#define UTILS_MPMC_H 1
+
+#include <stddef.h>
+
+struct mpmc_queue_s;
+typedef struct mpmc_queue_s mpmc_queue_t;
+
+/*
+ * NAME
+ *   mpmc_create
+ *
+ * DESCRIPTION
+ *   Allocates a bounded, lock-free multi-producer / multi-consumer FIFO of
+ *   pointers. Producers and consumers only synchronize on the slot they
+ *   claim, so no lock is shared between them.
+ *
+ * PARAMETERS
+ *   `capacity'   Maximum number of elements. Rounded up to the next power of
+ *                two.
+ *
+ * RETURN VALUE
+ *   A mpmc_queue_t-pointer upon success or NULL upon failure.
+ */
+mpmc_queue_t *mpmc_create(size_t capacity);
+
+/*
+ * NAME
+ *   mpmc_destroy
+ *
+ * DESCRIPTION
+ *   Frees the queue. Elements still in the queue are not freed; drain it with
+ *   `mpmc_pop' first if required. No other thread may use the queue anymore.
+ */
+void mpmc_destroy(mpmc_queue_t *q);
+
+/*
+ * NAME
+ *   mpmc_push
+ *
+ * DESCRIPTION
+ *   Appends `ptr' to the queue without blocking.
+ *
+ * RETURN VALUE
+ *   Zero upon success, EAGAIN if the queue is full.
+ */
+int mpmc_push(mpmc_queue_t *q, void *ptr);
+
+/*
+ * NAME
+ *   mpmc_pop
+ *
+ * DESCRIPTION
+ *   Removes the oldest element without blocking and stores it in `ret_ptr'.
+ *
+ * RETURN VALUE
+ *   Zero upon success, ENOENT if the queue is empty.
+ */
+int mpmc_pop(mpmc_queue_t *q, void **ret_ptr);
+
+/*
+ * NAME
+ *   mpmc_size
+ *
+ * DESCRIPTION
+ *   Returns the number of elements in the queue. Only a snapshot when other
+ *   threads are using the queue concurrently.
+ */
+size_t mpmc_size(mpmc_queue_t *q);
+
+/*
+ * NAME
+ *   mpmc_capacity
+ *
+ * DESCRIPTION
+ *   Returns the maximum number of elements the queue can hold.
+ */
+size_t mpmc_capacity(mpmc_queue_t *q);
+
+#endif /* UTILS_MPMC_H */
@@ -0,0 +1,142 @@
+/**
+ * collectd - src/daemon/utils_mpmc_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils_mpmc.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define ITEMS_PER_PRODUCER 200000
+
+DEF_TEST(basic) {
+  mpmc_queue_t *q;
+  int values[8];
+  void *ptr;
+
+  CHECK_NOT_NULL(q = mpmc_create(5));
+  EXPECT_EQ_INT(8, mpmc_capacity(q));
+  EXPECT_EQ_INT(0, mpmc_size(q));
+  EXPECT_EQ_INT(ENOENT, mpmc_pop(q, &ptr));
+
+  for (int i = 0; i < 8; i++)
+    CHECK_ZERO(mpmc_push(q, values + i));
+  EXPECT_EQ_INT(8, mpmc_size(q));
+  EXPECT_EQ_INT(EAGAIN, mpmc_push(q, values));
+
+  /* FIFO order, also across the wrap-around */
+  for (int lap = 0; lap < 3; lap++) {
+    for (int i = 0; i < 8; i++) {
+      CHECK_ZERO(mpmc_pop(q, &ptr));
+      OK(ptr == values + i);
+      CHECK_ZERO(mpmc_push(q, values + i));
+    }
+  }
+
+  for (int i = 0; i < 8; i++)
+    CHECK_ZERO(mpmc_pop(q, &ptr));
+  EXPECT_EQ_INT(ENOENT, mpmc_pop(q, &ptr));
+  EXPECT_EQ_INT(0, mpmc_size(q));
+
+  mpmc_destroy(q);
+  return 0;
+}
+
+static mpmc_queue_t *stress_queue;
+static uint64_t consumed_sum[CONSUMERS];
+static size_t consumed_num[CONSUMERS];
+static int producers_done;
+
+static void *producer(void *arg) {
+  uintptr_t base = (uintptr_t)arg * ITEMS_PER_PRODUCER;
+
+  for (uintptr_t i = 1; i <= ITEMS_PER_PRODUCER; i++) {
+    while (mpmc_push(stress_queue, (void *)(base + i)) != 0)
+      sched_yield();
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  size_t id = (size_t)(uintptr_t)arg;
+  void *ptr;
+
+  while (1) {
+    if (mpmc_pop(stress_queue, &ptr) == 0) {
+      consumed_sum[id] += (uint64_t)(uintptr_t)ptr;
+      consumed_num[id]++;
+    } else if (__atomic_load_n(&producers_done, __ATOMIC_ACQUIRE)) {
+      if (mpmc_size(stress_queue) == 0)
+        break;
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+DEF_TEST(concurrent) {
+  pthread_t producers[PRODUCERS];
+  pthread_t consumers[CONSUMERS];
+  uint64_t n = (uint64_t)PRODUCERS * ITEMS_PER_PRODUCER;
+  uint64_t sum = 0;
+  size_t num = 0;
+
+  /* Small enough to be full most of the time. */
+  CHECK_NOT_NULL(stress_queue = mpmc_create(64));
+
+  for (uintptr_t i = 0; i < CONSUMERS; i++)
+    CHECK_ZERO(pthread_create(consumers + i, NULL, consumer, (void *)i));
+  for (uintptr_t i = 0; i < PRODUCERS; i++)
+    CHECK_ZERO(pthread_create(producers + i, NULL, producer, (void *)i));
+
+  for (size_t i = 0; i < PRODUCERS; i++)
+    pthread_join(producers[i], NULL);
+  __atomic_store_n(&producers_done, 1, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < CONSUMERS; i++) {
+    pthread_join(consumers[i], NULL);
+    sum += consumed_sum[i];
+    num += consumed_num[i];
+  }
+
+  /* Every element was received exactly once: 1 + 2 + ... + n */
+  EXPECT_EQ_UINT64(n, num);
+  EXPECT_EQ_UINT64(n * (n + 1) / 2, sum);
+
+  mpmc_destroy(stress_queue);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(basic);
+  RUN_TEST(concurrent);
+
+  END_TEST;
+}
@@ -0,0 +1,305 @@
+/**
+ * collectd - src/daemon/utils_wheel.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_wheel.h"
+
+/* Five levels of 64 slots cover 2^30 ticks, i.e. about twelve days at a
+ * resolution of one millisecond. Entries further away wait in `overflow'.
+ *
+ * An entry lives on the lowest level at which its tick and the current tick
+ * only differ in that level's bits, so every occupied slot lies after the
+ * current position on its level and everything on a lower level is due
+ * before anything on a higher one. This lets `wheel_advance' jump straight
+ * to the next occupied slot instead of stepping through empty ticks. */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 5
+
+#define WHEEL_SLOT_READY (WHEEL_LEVELS * WHEEL_SLOTS)
+#define WHEEL_SLOT_OVERFLOW (WHEEL_SLOT_READY + 1)
+
+struct c_wheel_s {
+  cdtime_t resolution;
+  uint64_t now; /* in ticks */
+  size_t size;
+
+  uint64_t occupied[WHEEL_LEVELS];
+  c_wheel_entry_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+  c_wheel_entry_t ready;
+  c_wheel_entry_t overflow;
+};
+
+static void list_init(c_wheel_entry_t *head) /* {{{ */
+{
+  head->prev = head;
+  head->next = head;
+} /* }}} void list_init */
+
+static _Bool list_empty(const c_wheel_entry_t *head) /* {{{ */
+{
+  return head->next == head;
+} /* }}} _Bool list_empty */
+
+static void list_append(c_wheel_entry_t *head, c_wheel_entry_t *e) /* {{{ */
+{
+  e->prev = head->prev;
+  e->next = head;
+  head->prev->next = e;
+  head->prev = e;
+} /* }}} void list_append */
+
+static void list_unlink(c_wheel_entry_t *e) /* {{{ */
+{
+  e->prev->next = e->next;
+  e->next->prev = e->prev;
+  e->prev = e->next = NULL;
+} /* }}} void list_unlink */
+
+/* Moves all entries of `src' to the (empty) list `dst'. */
+static void list_move(c_wheel_entry_t *dst, c_wheel_entry_t *src) /* {{{ */
+{
+  list_init(dst);
+  if (list_empty(src))
+    return;
+
+  dst->next = src->next;
+  dst->prev = src->prev;
+  dst->next->prev = dst;
+  dst->prev->next = dst;
+  list_init(src);
+} /* }}} void list_move */
+
+/* Rounds up, so that entries never expire early. */
+static uint64_t wheel_tick(const c_wheel_t *w, cdtime_t t) /* {{{ */
+{
+  return (t / w->resolution) + (((t % w->resolution) != 0) ? 1 : 0);
+} /* }}} uint64_t wheel_tick */
+
+static void wheel_place(c_wheel_t *w, c_wheel_entry_t *e) /* {{{ */
+{
+  uint64_t tick = wheel_tick(w, e->due);
+
+  if (tick <= w->now) {
+    e->slot = WHEEL_SLOT_READY;
+    list_append(&w->ready, e);
+    return;
+  }
+
+  uint64_t diff = tick ^ w->now;
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    unsigned int shift = WHEEL_BITS * level;
+
+    if ((diff >> (shift + WHEEL_BITS)) != 0)
+      continue;
+
+    unsigned int slot = (unsigned int)(tick >> shift) & (WHEEL_SLOTS - 1);
+    e->slot = level * WHEEL_SLOTS + slot;
+    list_append(&w->slots[level][slot], e);
+    w->occupied[level] |= ((uint64_t)1) << slot;
+    return;
+  }
+
+  e->slot = WHEEL_SLOT_OVERFLOW;
+  list_append(&w->overflow, e);
+} /* }}} void wheel_place */
+
+/* Re-places all entries of `head', which is detached from the wheel. */
+static void wheel_cascade(c_wheel_t *w, c_wheel_entry_t *head) /* {{{ */
+{
+  c_wheel_entry_t tmp;
+
+  list_move(&tmp, head);
+  while (!list_empty(&tmp)) {
+    c_wheel_entry_t *e = tmp.next;
+    list_unlink(e);
+    wheel_place(w, e);
+  }
+} /* }}} void wheel_cascade */
+
+static void wheel_advance(c_wheel_t *w, uint64_t target) /* {{{ */
+{
+  while (w->now < target) {
+    int level;
+    uint64_t next;
+
+    for (level = 0; level < WHEEL_LEVELS; level++)
+      if (w->occupied[level] != 0)
+        break;
+
+    if (level == WHEEL_LEVELS) {
+      if (list_empty(&w->overflow)) {
+        w->now = target;
+        return;
+      }
+
+      unsigned int shift = WHEEL_BITS * WHEEL_LEVELS;
+      next = ((w->now >> shift) + 1) << shift;
+    } else {
+      unsigned int shift = WHEEL_BITS * level;
+      uint64_t slot = (uint64_t)__builtin_ctzll(w->occupied[level]);
+
+      next = ((w->now >> (shift + WHEEL_BITS)) << (shift + WHEEL_BITS)) |
+             (slot << shift);
+    }
+
+    if (next > target) {
+      w->now = target;
+      return;
+    }
+
+    w->now = next;
+    if (level == WHEEL_LEVELS) {
+      wheel_cascade(w, &w->overflow);
+    } else {
+      unsigned int slot =
+          (unsigned int)(next >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+      w->occupied[level] &= ~(((uint64_t)1) << slot);
+      wheel_cascade(w, &w->slots[level][slot]);
+    }
+  }
+} /* }}} void wheel_advance */
+
+c_wheel_t *c_wheel_create(cdtime_t resolution, cdtime_t now) /* {{{ */
+{
+  c_wheel_t *w;
+
+  if (resolution == 0)
+    return NULL;
+
+  w = calloc(1, sizeof(*w));
+  if (w == NULL)
+    return NULL;
+
+  w->resolution = resolution;
+  w->now = now / resolution;
+
+  for (int level = 0; level < WHEEL_LEVELS; level++)
+    for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init(&w->slots[level][slot]);
+  list_init(&w->ready);
+  list_init(&w->overflow);
+
+  return w;
+} /* }}} c_wheel_t *c_wheel_create */
+
+void c_wheel_destroy(c_wheel_t *w) /* {{{ */
+{
+  free(w);
+} /* }}} void c_wheel_destroy */
+
+void c_wheel_insert(c_wheel_t *w, c_wheel_entry_t *e, /* {{{ */
+                    cdtime_t due) {
+  e->due = due;
+  wheel_place(w, e);
+  w->size++;
+} /* }}} void c_wheel_insert */
+
+void c_wheel_remove(c_wheel_t *w, c_wheel_entry_t *e) /* {{{ */
+{
+  unsigned int slot = e->slot;
+
+  list_unlink(e);
+  w->size--;
+
+  if (slot < WHEEL_SLOT_READY) {
+    unsigned int level = slot / WHEEL_SLOTS;
+    slot %= WHEEL_SLOTS;
+    if (list_empty(&w->slots[level][slot]))
+      w->occupied[level] &= ~(((uint64_t)1) << slot);
+  }
+} /* }}} void c_wheel_remove */
+
+c_wheel_entry_t *c_wheel_expire(c_wheel_t *w, cdtime_t now) /* {{{ */
+{
+  wheel_advance(w, now / w->resolution);
+
+  if (list_empty(&w->ready))
+    return NULL;
+
+  c_wheel_entry_t *e = w->ready.next;
+  list_unlink(e);
+  w->size--;
+  return e;
+} /* }}} c_wheel_entry_t *c_wheel_expire */
+
+cdtime_t c_wheel_next(c_wheel_t *w) /* {{{ */
+{
+  uint64_t tick;
+
+  if (!list_empty(&w->ready)) {
+    tick = w->now;
+  } else {
+    int level;
+    for (level = 0; level < WHEEL_LEVELS; level++)
+      if (w->occupied[level] != 0)
+        break;
+
+    if (level < WHEEL_LEVELS) {
+      unsigned int shift = WHEEL_BITS * level;
+      uint64_t slot = (uint64_t)__builtin_ctzll(w->occupied[level]);
+
+      tick = ((w->now >> (shift + WHEEL_BITS)) << (shift + WHEEL_BITS)) |
+             (slot << shift);
+    } else if (!list_empty(&w->overflow)) {
+      unsigned int shift = WHEEL_BITS * WHEEL_LEVELS;
+      tick = ((w->now >> shift) + 1) << shift;
+    } else {
+      return 0;
+    }
+  }
+
+  /* Zero means "empty". */
+  return (tick != 0) ? (cdtime_t)(tick * w->resolution) : 1;
+} /* }}} cdtime_t c_wheel_next */
+
+c_wheel_entry_t *c_wheel_get_any(c_wheel_t *w) /* {{{ */
+{
+  c_wheel_entry_t *e = NULL;
+
+  if (!list_empty(&w->ready))
+    e = w->ready.next;
+  else if (!list_empty(&w->overflow))
+    e = w->overflow.next;
+  else {
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+      if (w->occupied[level] == 0)
+        continue;
+
+      unsigned int slot = (unsigned int)__builtin_ctzll(w->occupied[level]);
+      e = w->slots[level][slot].next;
+      break;
+    }
+  }
+
+  if (e != NULL)
+    c_wheel_remove(w, e);
+
+  return e;
+} /* }}} c_wheel_entry_t *c_wheel_get_any */
+
+size_t c_wheel_size(c_wheel_t *w) /* {{{ */
+{
+  return w->size;
+} /* }}} size_t c_wheel_size */
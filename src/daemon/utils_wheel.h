@@ -0,0 +1,141 @@
+/**
+ * collectd - src/daemon/utils_wheel.h
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_WHEEL_H
+#define UTILS_WHEEL_H 1
+
+#include "collectd.h"
+
+/* Entries are embedded in the caller's data structure, so inserting and
+ * removing them never allocates. Only `data' may be accessed by the caller;
+ * the other members belong to the wheel. */
+struct c_wheel_entry_s {
+  struct c_wheel_entry_s *prev;
+  struct c_wheel_entry_s *next;
+  cdtime_t due;
+  unsigned int slot;
+  void *data;
+};
+typedef struct c_wheel_entry_s c_wheel_entry_t;
+
+struct c_wheel_s;
+typedef struct c_wheel_s c_wheel_t;
+
+/*
+ * NAME
+ *   c_wheel_create
+ *
+ * DESCRIPTION
+ *   Allocates a hierarchical timer wheel. Inserting, removing and expiring an
+ *   entry are O(1); entries far in the future are moved to finer levels as
+ *   their time approaches. The wheel is not thread safe.
+ *
+ * PARAMETERS
+ *   `resolution'  Granularity of the wheel. Entries never expire early, but
+ *                 may expire up to one `resolution' late.
+ *   `now'         Current time.
+ *
+ * RETURN VALUE
+ *   A c_wheel_t-pointer upon success or NULL upon failure.
+ */
+c_wheel_t *c_wheel_create(cdtime_t resolution, cdtime_t now);
+
+/*
+ * NAME
+ *   c_wheel_destroy
+ *
+ * DESCRIPTION
+ *   Frees the wheel. Entries still in the wheel are not freed; drain it with
+ *   `c_wheel_get_any' first if required.
+ */
+void c_wheel_destroy(c_wheel_t *w);
+
+/*
+ * NAME
+ *   c_wheel_insert
+ *
+ * DESCRIPTION
+ *   Schedules `e' to expire at `due'. `e' must not be in the wheel already.
+ *   Times in the past expire with the next call to `c_wheel_expire'.
+ */
+void c_wheel_insert(c_wheel_t *w, c_wheel_entry_t *e, cdtime_t due);
+
+/*
+ * NAME
+ *   c_wheel_remove
+ *
+ * DESCRIPTION
+ *   Removes `e', which must be in the wheel, before it expires.
+ */
+void c_wheel_remove(c_wheel_t *w, c_wheel_entry_t *e);
+
+/*
+ * NAME
+ *   c_wheel_expire
+ *
+ * DESCRIPTION
+ *   Advances the wheel to `now' and removes one entry that is due, i.e. whose
+ *   time is less than or equal to `now'. Call repeatedly until it returns
+ *   NULL to collect all due entries.
+ *
+ * RETURN VALUE
+ *   An expired entry or NULL if none is due.
+ */
+c_wheel_entry_t *c_wheel_expire(c_wheel_t *w, cdtime_t now);
+
+/*
+ * NAME
+ *   c_wheel_next
+ *
+ * DESCRIPTION
+ *   Returns the time at which `c_wheel_expire' should be called next. This
+ *   is exact for entries that are due soon and a lower bound otherwise, so
+ *   the caller may wake up without anything to do.
+ *
+ * RETURN VALUE
+ *   The time, or zero if the wheel is empty.
+ */
+cdtime_t c_wheel_next(c_wheel_t *w);
+
+/*
+ * NAME
+ *   c_wheel_get_any
+ *
+ * DESCRIPTION
+ *   Removes and returns an arbitrary entry, regardless of its time.
+ *
+ * RETURN VALUE
+ *   An entry or NULL if the wheel is empty.
+ */
+c_wheel_entry_t *c_wheel_get_any(c_wheel_t *w);
+
+/*
+ * NAME
+ *   c_wheel_size
+ *
+ * RETURN VALUE
+ *   The number of entries in the wheel.
+ */
+size_t c_wheel_size(c_wheel_t *w);
+
+#endif /* UTILS_WHEEL_H */
@@ -0,0 +1,141 @@
+/**
+ * collectd - src/daemon/utils_wheel_test.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils_wheel.h"
+
+#define RES 1000
+
+DEF_TEST(basic) {
+  c_wheel_t *w;
+  c_wheel_entry_t e[4];
+
+  CHECK_NOT_NULL(w = c_wheel_create(RES, 10 * RES));
+  EXPECT_EQ_UINT64(0, c_wheel_next(w));
+  OK(c_wheel_expire(w, 1000 * RES) == NULL);
+
+  c_wheel_insert(w, &e[0], 1500 * RES);
+  c_wheel_insert(w, &e[1], 1200 * RES);
+  c_wheel_insert(w, &e[2], 1200 * RES + 1); /* rounds up to 1201 */
+  c_wheel_insert(w, &e[3], 500 * RES);      /* in the past */
+  EXPECT_EQ_INT(4, (int)c_wheel_size(w));
+
+  /* Entries in the past are due right away. */
+  OK(c_wheel_next(w) <= 1000 * RES);
+  OK(c_wheel_expire(w, 1000 * RES) == &e[3]);
+  OK(c_wheel_expire(w, 1000 * RES) == NULL);
+
+  /* The next time is a lower bound. */
+  OK(c_wheel_next(w) <= 1200 * RES);
+  OK(c_wheel_expire(w, 1200 * RES - 1) == NULL);
+  OK(c_wheel_expire(w, 1200 * RES) == &e[1]);
+  OK(c_wheel_expire(w, 1200 * RES) == NULL);
+  OK(c_wheel_expire(w, 1201 * RES) == &e[2]);
+
+  c_wheel_remove(w, &e[0]);
+  EXPECT_EQ_INT(0, (int)c_wheel_size(w));
+  EXPECT_EQ_UINT64(0, c_wheel_next(w));
+  OK(c_wheel_expire(w, 2000 * RES) == NULL);
+
+  c_wheel_destroy(w);
+  return 0;
+}
+
+#define NUM 4096
+
+DEF_TEST(random) {
+  c_wheel_t *w;
+  static c_wheel_entry_t e[NUM];
+  static _Bool expired[NUM];
+  cdtime_t now = 0;
+  size_t expired_num = 0;
+  size_t errors = 0;
+
+  CHECK_NOT_NULL(w = c_wheel_create(RES, now));
+
+  srand(42);
+  for (size_t i = 0; i < NUM; i++) {
+    /* Spread over all levels, including far beyond the top one. */
+    cdtime_t due = (cdtime_t)rand() << (rand() % 16);
+    e[i].data = (void *)i;
+    c_wheel_insert(w, &e[i], due * RES + (cdtime_t)(rand() % RES));
+  }
+
+  while (expired_num < NUM) {
+    cdtime_t next = c_wheel_next(w);
+    if (next == 0)
+      errors++;
+
+    /* Step to the reported time, or a random bit further. */
+    if (next > now)
+      now = next;
+    now += (cdtime_t)(rand() % 4) * (cdtime_t)rand();
+
+    c_wheel_entry_t *x;
+    while ((x = c_wheel_expire(w, now)) != NULL) {
+      size_t i = (size_t)x->data;
+      if (expired[i] || (e[i].due > now))
+        errors++;
+      expired[i] = 1;
+      expired_num++;
+    }
+
+    /* Nothing that is due, rounded up to the resolution, is left. */
+    for (size_t i = 0; i < NUM; i++)
+      if (!expired[i] && ((e[i].due + RES - 1) / RES) * RES <= now)
+        errors++;
+  }
+
+  EXPECT_EQ_INT(0, (int)errors);
+  EXPECT_EQ_INT(0, (int)c_wheel_size(w));
+  c_wheel_destroy(w);
+  return 0;
+}
+
+DEF_TEST(get_any) {
+  c_wheel_t *w;
+  c_wheel_entry_t e[3];
+
+  CHECK_NOT_NULL(w = c_wheel_create(RES, 0));
+  c_wheel_insert(w, &e[0], 0);
+  c_wheel_insert(w, &e[1], 100 * RES);
+  c_wheel_insert(w, &e[2], ((cdtime_t)1 << 40) * RES);
+
+  for (int i = 0; i < 3; i++)
+    CHECK_NOT_NULL(c_wheel_get_any(w));
+  OK(c_wheel_get_any(w) == NULL);
+  EXPECT_EQ_INT(0, (int)c_wheel_size(w));
+
+  c_wheel_destroy(w);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(basic);
+  RUN_TEST(random);
+  RUN_TEST(get_any);
+
+  END_TEST;
+}
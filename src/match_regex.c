@@ -37,6 +37,7 @@
 #include "filter_chain.h"
 #include "meta_data.h"
 #include "utils_llist.h"
+#include "utils_multimatch.h"
 
 #include <regex.h>
 #include <sys/types.h>
@@ -53,6 +54,8 @@ typedef struct mr_regex_s mr_regex_t;
 struct mr_regex_s {
   regex_t re;
   char *re_str;
+  /* Text every matching string contains, checked before calling regexec. */
+  char *literal;
 
   mr_regex_t *next;
 };
@@ -80,6 +83,7 @@ static void mr_free_regex(mr_regex_t *r) /* {{{ */
   regfree(&r->re);
   memset(&r->re, 0, sizeof(r->re));
   sfree(r->re_str);
+  sfree(r->literal);
 
   if (r->next != NULL)
     mr_free_regex(r->next);
@@ -112,6 +116,12 @@ static int mr_match_regexen(mr_regex_t *re_head, /* {{{ */
   for (mr_regex_t *re = re_head; re != NULL; re = re->next) {
     int status;
 
+    if ((re->literal != NULL) && (strstr(string, re->literal) == NULL)) {
+      DEBUG("regex match: Regular expression `%s' does not match `%s'.",
+            re->re_str, string);
+      return FC_MATCH_NO_MATCH;
+    }
+
     status = regexec(&re->re, string,
                      /* nmatch = */ 0, /* pmatch = */ NULL,
                      /* eflags = */ 0);
@@ -159,6 +169,12 @@ static int mr_add_regex(mr_regex_t **re_head, const char *re_str, /* {{{ */
     return -1;
   }
 
+  {
+    char literal[DATA_MAX_NAME_LEN];
+    if (multimatch_literal(re->re_str, literal, sizeof(literal)) > 0)
+      re->literal = strdup(literal);
+  }
+
   if (*re_head == NULL) {
     *re_head = re;
   } else {
@@ -356,11 +372,52 @@ static int mr_match(const data_set_t __attribute__((unused)) * ds, /* {{{ */
   return match_value;
 } /* }}} int mr_match */
 
+/* Returns true if one of the regular expressions only matches the literal
+ * string `^literal$', and stores the literal in `buffer'. */
+static _Bool mr_regexen_literal(mr_regex_t *re_head, /* {{{ */
+                                char *buffer, size_t buffer_size) {
+  for (mr_regex_t *re = re_head; re != NULL; re = re->next) {
+    size_t len = strlen(re->re_str);
+
+    if ((len < 2) || (re->re_str[0] != '^') || (re->re_str[len - 1] != '$'))
+      continue;
+    if ((len - 2) >= buffer_size)
+      continue;
+    if (strcspn(re->re_str + 1, ".[]()*+?{}|^$\\") != (len - 2))
+      continue;
+
+    memcpy(buffer, re->re_str + 1, len - 2);
+    buffer[len - 2] = 0;
+    return 1;
+  }
+
+  return 0;
+} /* }}} _Bool mr_regexen_literal */
+
+static int mr_hint(void **user_data, fc_match_hint_t *hint) /* {{{ */
+{
+  mr_match_t *m;
+
+  if ((user_data == NULL) || (*user_data == NULL))
+    return -1;
+
+  m = *user_data;
+
+  /* An inverted match accepts everything but the literal. */
+  if (m->invert)
+    return 0;
+
+  mr_regexen_literal(m->plugin, hint->plugin, sizeof(hint->plugin));
+  mr_regexen_literal(m->type, hint->type, sizeof(hint->type));
+  return 0;
+} /* }}} int mr_hint */
+
 void module_register(void) {
   match_proc_t mproc = {0};
 
   mproc.create = mr_create;
   mproc.destroy = mr_destroy;
   mproc.match = mr_match;
+  mproc.hint = mr_hint;
   fc_register_match("regex", mproc);
 } /* module_register */
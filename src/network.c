@@ -24,6 +24,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE /* For struct ip_mreq */
+#define _GNU_SOURCE /* For recvmmsg and struct mmsghdr */
 
 #include "collectd.h"
 
@@ -122,7 +123,9 @@ struct sockent_server {
   int security_level;
   char *auth_file;
   fbhash_t *userdb;
+  /* Shared by the dispatch threads. */
   gcry_cipher_hd_t cypher;
+  pthread_mutex_t cypher_lock;
 #endif
 };
 
@@ -250,14 +253,51 @@ struct part_encryption_aes256_s {
 };
 typedef struct part_encryption_aes256_s part_encryption_aes256_t;
 
+/* Entries are allocated together with a buffer of `network_config_packet_size'
+ * bytes and are recycled through `receive_pool' once they are dispatched. */
 struct receive_list_entry_s {
   char *data;
   int data_len;
-  int fd;
+  sockent_t *se;
   struct receive_list_entry_s *next;
 };
 typedef struct receive_list_entry_s receive_list_entry_t;
 
+struct receive_list_s {
+  receive_list_entry_t *head;
+  receive_list_entry_t *tail;
+  uint64_t length;
+};
+typedef struct receive_list_s receive_list_t;
+
+/* Each dispatch thread has a queue of its own. Packets are assigned to a queue
+ * by their source address, so the packets of one host are parsed in the order
+ * they were received. */
+struct receive_queue_s {
+  receive_list_t list;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread_id;
+  _Bool thread_running;
+};
+typedef struct receive_queue_s receive_queue_t;
+
+/* The listening sockets polled by one receive thread and the sockent each of
+ * them belongs to. */
+struct receive_thread_s {
+  struct pollfd *pollfd;
+  sockent_t **sockent;
+  size_t num;
+  pthread_t thread_id;
+  _Bool thread_running;
+};
+typedef struct receive_thread_s receive_thread_t;
+
+/* Number of packets read from a socket with one system call. */
+#define RECEIVE_BATCH_SIZE 32
+/* Number of unused entries kept in `receive_pool'. Any more are freed. */
+#define RECEIVE_POOL_SIZE 4096
+
 /*
  * Private variables
  */
@@ -266,26 +306,25 @@ static int network_config_ttl = 0;
 static size_t network_config_packet_size = 1452;
 static _Bool network_config_forward = 0;
 static _Bool network_config_stats = 0;
+static size_t network_config_receive_threads = 1;
+static size_t network_config_dispatch_threads = 1;
 
 static sockent_t *sending_sockets = NULL;
 
-static receive_list_entry_t *receive_list_head = NULL;
-static receive_list_entry_t *receive_list_tail = NULL;
-static pthread_mutex_t receive_list_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t receive_list_cond = PTHREAD_COND_INITIALIZER;
-static uint64_t receive_list_length = 0;
+static receive_list_entry_t *receive_pool = NULL;
+static size_t receive_pool_length = 0;
+static pthread_mutex_t receive_pool_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static sockent_t *listen_sockets = NULL;
-static struct pollfd *listen_sockets_pollfd = NULL;
 static size_t listen_sockets_num = 0;
 
 /* The receive and dispatch threads will run as long as `listen_loop' is set to
  * zero. */
 static int listen_loop = 0;
-static int receive_thread_running = 0;
-static pthread_t receive_thread_id;
-static int dispatch_thread_running = 0;
-static pthread_t dispatch_thread_id;
+static receive_thread_t *receive_threads = NULL;
+static size_t receive_threads_num = 0;
+static receive_queue_t *receive_queues = NULL;
+static size_t receive_queues_num = 0;
 
 /* Buffer in which to-be-sent network packets are constructed. */
 static char *send_buffer;
@@ -296,11 +335,11 @@ static value_list_t send_buffer_vl = VALUE_LIST_INIT;
 static pthread_mutex_t send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* XXX: These counters are incremented from one place only. The spot in which
- * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
- * example). Only if neither is true, the stats_lock is acquired. The counters
- * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
+ * the values are incremented is either locked by some lock (send_buffer_lock
+ * for example) or, for the counters updated by the receive and dispatch
+ * threads, incremented atomically. Only if neither is true, the stats_lock is
+ * acquired. The counters are always read without holding a lock in the hope
+ * that writing 8 bytes to memory is an atomic operation. */
 static derive_t stats_octets_rx = 0;
 static derive_t stats_octets_tx = 0;
 static derive_t stats_packets_rx = 0;
@@ -407,7 +446,7 @@ static int network_dispatch_values(value_list_t *vl, /* {{{ */
           "NOT dispatching %s.",
           name);
 #endif
-    stats_values_not_dispatched++;
+    __atomic_fetch_add(&stats_values_not_dispatched, 1, __ATOMIC_RELAXED);
     return 0;
   }
 
@@ -438,7 +477,7 @@ static int network_dispatch_values(value_list_t *vl, /* {{{ */
   }
 
   plugin_dispatch_values(vl);
-  stats_values_dispatched++;
+  __atomic_fetch_add(&stats_values_dispatched, 1, __ATOMIC_RELAXED);
 
   meta_data_destroy(vl->meta);
   vl->meta = NULL;
@@ -1215,8 +1254,11 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
   assert(buffer_offset ==
          (username_len + PART_ENCRYPTION_AES256_SIZE - sizeof(pea.hash)));
 
+  /* The cypher handle is shared by all dispatch threads. */
+  pthread_mutex_lock(&se->data.server.cypher_lock);
   cypher = network_get_aes256_cypher(se, pea.iv, sizeof(pea.iv), pea.username);
   if (cypher == NULL) {
+    pthread_mutex_unlock(&se->data.server.cypher_lock);
     ERROR("network plugin: Failed to get cypher. Username: %s", pea.username);
     sfree(pea.username);
     return -1;
@@ -1229,6 +1271,7 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
   err = gcry_cipher_decrypt(cypher, buffer + buffer_offset,
                             part_size - buffer_offset,
                             /* in = */ NULL, /* in len = */ 0);
+  pthread_mutex_unlock(&se->data.server.cypher_lock);
   if (err != 0) {
     ERROR("network plugin: gcry_cipher_decrypt returned: %s. Username: %s",
           gcry_strerror(err), pea.username);
@@ -1524,6 +1567,7 @@ static void free_sockent_server(struct sockent_server *ses) /* {{{ */
   fbh_destroy(ses->userdb);
   if (ses->cypher != NULL)
     gcry_cipher_close(ses->cypher);
+  pthread_mutex_destroy(&ses->cypher_lock);
 #endif
 } /* }}} void free_sockent_server */
 
@@ -1693,6 +1737,19 @@ static int network_set_interface(const sockent_t *se,
   return 0;
 } /* }}} network_set_interface */
 
+static _Bool network_addr_is_multicast(const struct addrinfo *ai) /* {{{ */
+{
+  if (ai->ai_family == AF_INET) {
+    struct sockaddr_in *addr = (struct sockaddr_in *)ai->ai_addr;
+    return IN_MULTICAST(ntohl(addr->sin_addr.s_addr)) ? 1 : 0;
+  } else if (ai->ai_family == AF_INET6) {
+    struct sockaddr_in6 *addr = (struct sockaddr_in6 *)ai->ai_addr;
+    return IN6_IS_ADDR_MULTICAST(&addr->sin6_addr) ? 1 : 0;
+  }
+
+  return 0;
+} /* }}} _Bool network_addr_is_multicast */
+
 static int network_bind_socket(int fd, const struct addrinfo *ai,
                                const int interface_idx) {
 #if KERNEL_SOLARIS
@@ -1853,6 +1910,7 @@ static sockent_t *sockent_create(int type) /* {{{ */
     se->data.server.auth_file = NULL;
     se->data.server.userdb = NULL;
     se->data.server.cypher = NULL;
+    pthread_mutex_init(&se->data.server.cypher_lock, /* attr = */ NULL);
 #endif
   } else {
     se->data.client.fd = -1;
@@ -2068,34 +2126,58 @@ static int sockent_server_listen(sockent_t *se) /* {{{ */
 
   for (struct addrinfo *ai_ptr = ai_list; ai_ptr != NULL;
        ai_ptr = ai_ptr->ai_next) {
-    int *tmp;
+    /* Open one socket per receive thread and let the kernel distribute the
+     * packets among them. Multicast packets would be delivered to each of the
+     * sockets, so a single one is used for those. */
+    size_t sockets_num = network_config_receive_threads;
+    if (network_addr_is_multicast(ai_ptr))
+      sockets_num = 1;
+
+    for (size_t i = 0; i < sockets_num; i++) {
+      int *tmp;
+
+      tmp = realloc(se->data.server.fd,
+                    sizeof(*tmp) * (se->data.server.fd_num + 1));
+      if (tmp == NULL) {
+        ERROR("network plugin: realloc failed.");
+        continue;
+      }
+      se->data.server.fd = tmp;
+      tmp = se->data.server.fd + se->data.server.fd_num;
 
-    tmp = realloc(se->data.server.fd,
-                  sizeof(*tmp) * (se->data.server.fd_num + 1));
-    if (tmp == NULL) {
-      ERROR("network plugin: realloc failed.");
-      continue;
-    }
-    se->data.server.fd = tmp;
-    tmp = se->data.server.fd + se->data.server.fd_num;
+      *tmp =
+          socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+      if (*tmp < 0) {
+        char errbuf[1024];
+        ERROR("network plugin: socket(2) failed: %s",
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+        continue;
+      }
 
-    *tmp = socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
-    if (*tmp < 0) {
-      char errbuf[1024];
-      ERROR("network plugin: socket(2) failed: %s",
-            sstrerror(errno, errbuf, sizeof(errbuf)));
-      continue;
-    }
+#ifdef SO_REUSEPORT
+      if (sockets_num > 1) {
+        int yes = 1;
+        if (setsockopt(*tmp, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) ==
+            -1) {
+          char errbuf[1024];
+          ERROR("network plugin: setsockopt (reuseport): %s",
+                sstrerror(errno, errbuf, sizeof(errbuf)));
+          close(*tmp);
+          *tmp = -1;
+          continue;
+        }
+      }
+#endif
 
-    status = network_bind_socket(*tmp, ai_ptr, se->interface);
-    if (status != 0) {
-      close(*tmp);
-      *tmp = -1;
-      continue;
-    }
+      status = network_bind_socket(*tmp, ai_ptr, se->interface);
+      if (status != 0) {
+        close(*tmp);
+        *tmp = -1;
+        continue;
+      }
 
-    se->data.server.fd_num++;
-    continue;
+      se->data.server.fd_num++;
+    }
   } /* for (ai_list) */
 
   freeaddrinfo(ai_list);
@@ -2114,24 +2196,8 @@ static int sockent_add(sockent_t *se) /* {{{ */
     return -1;
 
   if (se->type == SOCKENT_TYPE_SERVER) {
-    struct pollfd *tmp;
-
-    tmp = realloc(listen_sockets_pollfd,
-                  sizeof(*tmp) * (listen_sockets_num + se->data.server.fd_num));
-    if (tmp == NULL) {
-      ERROR("network plugin: realloc failed.");
-      return -1;
-    }
-    listen_sockets_pollfd = tmp;
-    tmp = listen_sockets_pollfd + listen_sockets_num;
-
-    for (size_t i = 0; i < se->data.server.fd_num; i++) {
-      memset(tmp + i, 0, sizeof(*tmp));
-      tmp[i].fd = se->data.server.fd[i];
-      tmp[i].events = POLLIN | POLLPRI;
-      tmp[i].revents = 0;
-    }
-
+    /* The sockets are distributed among the receive threads in
+     * `network_init'. */
     listen_sockets_num += se->data.server.fd_num;
 
     if (listen_sockets == NULL) {
@@ -2155,189 +2221,315 @@ static int sockent_add(sockent_t *se) /* {{{ */
   return 0;
 } /* }}} int sockent_add */
 
-static void *dispatch_thread(void __attribute__((unused)) * arg) /* {{{ */
+/* Fills the empty slots of `ents' with entries from the pool. New entries are
+ * allocated if the pool runs dry. */
+static int receive_pool_get(receive_list_entry_t **ents, size_t num) /* {{{ */
 {
-  while (42) {
+  pthread_mutex_lock(&receive_pool_lock);
+  for (size_t i = 0; i < num; i++) {
     receive_list_entry_t *ent;
-    sockent_t *se;
 
-    /* Lock and wait for more data to come in */
-    pthread_mutex_lock(&receive_list_lock);
-    while ((listen_loop == 0) && (receive_list_head == NULL))
-      pthread_cond_wait(&receive_list_cond, &receive_list_lock);
+    if (ents[i] != NULL)
+      continue;
 
-    /* Remove the head entry and unlock */
-    ent = receive_list_head;
-    if (ent != NULL)
-      receive_list_head = ent->next;
-    receive_list_length--;
-    pthread_mutex_unlock(&receive_list_lock);
+    if (receive_pool != NULL) {
+      ent = receive_pool;
+      receive_pool = ent->next;
+      receive_pool_length--;
+    } else {
+      ent = malloc(sizeof(*ent) + network_config_packet_size);
+      if (ent == NULL) {
+        pthread_mutex_unlock(&receive_pool_lock);
+        ERROR("network plugin: malloc failed.");
+        return ENOMEM;
+      }
+      ent->data = (char *)(ent + 1);
+    }
 
-    /* Check whether we are supposed to exit. We do NOT check `listen_loop'
-     * because we dispatch all missing packets before shutting down. */
-    if (ent == NULL)
-      break;
+    ent->data_len = 0;
+    ent->se = NULL;
+    ent->next = NULL;
+    ents[i] = ent;
+  }
+  pthread_mutex_unlock(&receive_pool_lock);
 
-    /* Look for the correct `sockent_t' */
-    se = listen_sockets;
-    while (se != NULL) {
-      size_t i;
+  return 0;
+} /* }}} int receive_pool_get */
 
-      for (i = 0; i < se->data.server.fd_num; i++)
-        if (se->data.server.fd[i] == ent->fd)
-          break;
+/* Returns a list of entries to the pool. */
+static void receive_pool_put(receive_list_entry_t *head) /* {{{ */
+{
+  pthread_mutex_lock(&receive_pool_lock);
+  while ((head != NULL) && (receive_pool_length < RECEIVE_POOL_SIZE)) {
+    receive_list_entry_t *next = head->next;
 
-      if (i < se->data.server.fd_num)
-        break;
+    head->next = receive_pool;
+    receive_pool = head;
+    receive_pool_length++;
 
-      se = se->next;
-    }
+    head = next;
+  }
+  pthread_mutex_unlock(&receive_pool_lock);
 
-    if (se == NULL) {
-      ERROR("network plugin: Got packet from FD %i, but can't "
-            "find an appropriate socket entry.",
-            ent->fd);
-      sfree(ent->data);
-      sfree(ent);
-      continue;
-    }
+  while (head != NULL) {
+    receive_list_entry_t *next = head->next;
+    sfree(head);
+    head = next;
+  }
+} /* }}} void receive_pool_put */
+
+static void receive_pool_free(void) /* {{{ */
+{
+  pthread_mutex_lock(&receive_pool_lock);
+  while (receive_pool != NULL) {
+    receive_list_entry_t *next = receive_pool->next;
+    sfree(receive_pool);
+    receive_pool = next;
+  }
+  receive_pool_length = 0;
+  pthread_mutex_unlock(&receive_pool_lock);
+} /* }}} void receive_pool_free */
+
+static void receive_list_append(receive_list_t *l, /* {{{ */
+                                receive_list_entry_t *ent) {
+  ent->next = NULL;
+  if (l->head == NULL)
+    l->head = ent;
+  else
+    l->tail->next = ent;
+  l->tail = ent;
+  l->length++;
+} /* }}} void receive_list_append */
+
+/* Moves the entries of `l' to the queue `q' and wakes up its dispatch thread.
+ * Unless `block' is true, nothing happens if the queue is locked: blocking
+ * here has led to insufficient performance in the past. */
+static void receive_queue_push(receive_queue_t *q, receive_list_t *l, /* {{{ */
+                               _Bool block) {
+  if (l->head == NULL)
+    return;
+
+  if (block)
+    pthread_mutex_lock(&q->lock);
+  else if (pthread_mutex_trylock(&q->lock) != 0)
+    return;
+
+  assert(((q->list.head == NULL) && (q->list.length == 0)) ||
+         ((q->list.head != NULL) && (q->list.length != 0)));
+
+  if (q->list.head == NULL)
+    q->list.head = l->head;
+  else
+    q->list.tail->next = l->head;
+  q->list.tail = l->tail;
+  q->list.length += l->length;
+
+  pthread_cond_signal(&q->cond);
+  pthread_mutex_unlock(&q->lock);
+
+  l->head = NULL;
+  l->tail = NULL;
+  l->length = 0;
+} /* }}} void receive_queue_push */
+
+/* Selects the dispatch queue for a packet by hashing its source address. */
+static size_t receive_queue_index(const struct sockaddr_storage *addr) /* {{{ */
+{
+  const unsigned char *key;
+  size_t key_len;
+  uint32_t hash = 2166136261u; /* FNV-1a */
+
+  if (receive_queues_num < 2)
+    return 0;
+
+  if (addr->ss_family == AF_INET) {
+    const struct sockaddr_in *sa = (const struct sockaddr_in *)addr;
+    key = (const unsigned char *)&sa->sin_addr;
+    key_len = sizeof(sa->sin_addr);
+  } else if (addr->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *sa = (const struct sockaddr_in6 *)addr;
+    key = (const unsigned char *)&sa->sin6_addr;
+    key_len = sizeof(sa->sin6_addr);
+  } else {
+    return 0;
+  }
+
+  for (size_t i = 0; i < key_len; i++) {
+    hash ^= key[i];
+    hash *= 16777619u;
+  }
+
+  return (size_t)(hash % receive_queues_num);
+} /* }}} size_t receive_queue_index */
+
+static void *dispatch_thread(void *arg) /* {{{ */
+{
+  receive_queue_t *q = arg;
 
-    parse_packet(se, ent->data, ent->data_len, /* flags = */ 0,
-                 /* username = */ NULL);
-    sfree(ent->data);
-    sfree(ent);
+  while (42) {
+    receive_list_entry_t *head;
+
+    /* Lock and wait for more data to come in */
+    pthread_mutex_lock(&q->lock);
+    while ((listen_loop == 0) && (q->list.head == NULL))
+      pthread_cond_wait(&q->cond, &q->lock);
+
+    /* Take all queued entries, so the receive threads are not held up while
+     * they are parsed. */
+    head = q->list.head;
+    q->list.head = NULL;
+    q->list.tail = NULL;
+    q->list.length = 0;
+    pthread_mutex_unlock(&q->lock);
+
+    /* Check whether we are supposed to exit. We do NOT check `listen_loop'
+     * because we dispatch all missing packets before shutting down. */
+    if (head == NULL)
+      break;
+
+    for (receive_list_entry_t *ent = head; ent != NULL; ent = ent->next)
+      parse_packet(ent->se, ent->data, ent->data_len, /* flags = */ 0,
+                   /* username = */ NULL);
+
+    receive_pool_put(head);
   } /* while (42) */
 
   return NULL;
 } /* }}} void *dispatch_thread */
 
-static int network_receive(void) /* {{{ */
+/* Reads up to `num' packets from `fd' into `ents' and their source addresses
+ * into `addrs'. Returns the number of packets read or -1 on error. */
+static int network_recv_batch(int fd, receive_list_entry_t **ents, /* {{{ */
+                              struct sockaddr_storage *addrs, size_t num) {
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[num];
+  struct iovec iovs[num];
+  int status;
+
+  memset(msgs, 0, sizeof(msgs));
+  for (size_t i = 0; i < num; i++) {
+    iovs[i].iov_base = ents[i]->data;
+    iovs[i].iov_len = network_config_packet_size;
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = addrs + i;
+    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+  }
+
+  /* poll(2) reported the socket as readable, so this returns at least one
+   * packet unless an error occurred. */
+  status = recvmmsg(fd, msgs, (unsigned int)num, MSG_DONTWAIT,
+                    /* timeout = */ NULL);
+  if (status < 0)
+    return -1;
+
+  for (int i = 0; i < status; i++)
+    ents[i]->data_len = (int)msgs[i].msg_len;
+
+  return status;
+#else
+  socklen_t addrlen = sizeof(addrs[0]);
+  ssize_t status;
+
+  (void)num;
+
+  status = recvfrom(fd, ents[0]->data, network_config_packet_size,
+                    /* flags = */ 0, (struct sockaddr *)addrs, &addrlen);
+  if (status < 0)
+    return -1;
+
+  ents[0]->data_len = (int)status;
+  return 1;
+#endif
+} /* }}} int network_recv_batch */
+
+static int network_receive(receive_thread_t *rt) /* {{{ */
 {
-  char buffer[network_config_packet_size];
-  int buffer_len;
+  receive_list_entry_t *batch[RECEIVE_BATCH_SIZE] = {NULL};
+  struct sockaddr_storage addrs[RECEIVE_BATCH_SIZE];
 
-  int status = 0;
+  /* Packets not yet handed to the dispatch threads, one list per queue. */
+  receive_list_t private_lists[receive_queues_num];
 
-  receive_list_entry_t *private_list_head;
-  receive_list_entry_t *private_list_tail;
-  uint64_t private_list_length;
+  int status = 0;
 
-  assert(listen_sockets_num > 0);
+  assert(rt->num > 0);
 
-  private_list_head = NULL;
-  private_list_tail = NULL;
-  private_list_length = 0;
+  memset(private_lists, 0, sizeof(private_lists));
 
   while (listen_loop == 0) {
-    status = poll(listen_sockets_pollfd, listen_sockets_num, -1);
-    if (status <= 0) {
+    int ready = poll(rt->pollfd, rt->num, -1);
+    if (ready <= 0) {
       char errbuf[1024];
       if (errno == EINTR)
         continue;
       ERROR("network plugin: poll(2) failed: %s",
             sstrerror(errno, errbuf, sizeof(errbuf)));
+      status = -1;
       break;
     }
 
-    for (size_t i = 0; (i < listen_sockets_num) && (status > 0); i++) {
-      receive_list_entry_t *ent;
+    for (size_t i = 0; (i < rt->num) && (ready > 0); i++) {
+      uint64_t octets = 0;
+      int received;
 
-      if ((listen_sockets_pollfd[i].revents & (POLLIN | POLLPRI)) == 0)
+      if ((rt->pollfd[i].revents & (POLLIN | POLLPRI)) == 0)
         continue;
-      status--;
+      ready--;
 
-      buffer_len = recv(listen_sockets_pollfd[i].fd, buffer, sizeof(buffer),
-                        0 /* no flags */);
-      if (buffer_len < 0) {
+      status = receive_pool_get(batch, STATIC_ARRAY_SIZE(batch));
+      if (status != 0)
+        break;
+
+      received = network_recv_batch(rt->pollfd[i].fd, batch, addrs,
+                                    STATIC_ARRAY_SIZE(batch));
+      if (received < 0) {
         char errbuf[1024];
+        if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK))
+          continue;
         status = (errno != 0) ? errno : -1;
         ERROR("network plugin: recv(2) failed: %s",
               sstrerror(errno, errbuf, sizeof(errbuf)));
         break;
       }
 
-      stats_octets_rx += ((uint64_t)buffer_len);
-      stats_packets_rx++;
+      for (int j = 0; j < received; j++) {
+        receive_list_entry_t *ent = batch[j];
 
-      /* TODO: Possible performance enhancement: Do not free
-       * these entries in the dispatch thread but put them in
-       * another list, so we don't have to allocate more and
-       * more of these structures. */
-      ent = calloc(1, sizeof(*ent));
-      if (ent == NULL) {
-        ERROR("network plugin: calloc failed.");
-        status = ENOMEM;
-        break;
-      }
+        batch[j] = NULL;
+        ent->se = rt->sockent[i];
+        octets += (uint64_t)ent->data_len;
 
-      ent->data = malloc(network_config_packet_size);
-      if (ent->data == NULL) {
-        sfree(ent);
-        ERROR("network plugin: malloc failed.");
-        status = ENOMEM;
-        break;
-      }
-      ent->fd = listen_sockets_pollfd[i].fd;
-      ent->next = NULL;
-
-      memcpy(ent->data, buffer, buffer_len);
-      ent->data_len = buffer_len;
-
-      if (private_list_head == NULL)
-        private_list_head = ent;
-      else
-        private_list_tail->next = ent;
-      private_list_tail = ent;
-      private_list_length++;
-
-      /* Do not block here. Blocking here has led to
-       * insufficient performance in the past. */
-      if (pthread_mutex_trylock(&receive_list_lock) == 0) {
-        assert(((receive_list_head == NULL) && (receive_list_length == 0)) ||
-               ((receive_list_head != NULL) && (receive_list_length != 0)));
-
-        if (receive_list_head == NULL)
-          receive_list_head = private_list_head;
-        else
-          receive_list_tail->next = private_list_head;
-        receive_list_tail = private_list_tail;
-        receive_list_length += private_list_length;
-
-        pthread_cond_signal(&receive_list_cond);
-        pthread_mutex_unlock(&receive_list_lock);
-
-        private_list_head = NULL;
-        private_list_tail = NULL;
-        private_list_length = 0;
+        receive_list_append(private_lists + receive_queue_index(addrs + j),
+                            ent);
       }
 
-      status = 0;
-    } /* for (listen_sockets_pollfd) */
+      __atomic_fetch_add(&stats_octets_rx, (derive_t)octets, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&stats_packets_rx, (derive_t)received,
+                         __ATOMIC_RELAXED);
+
+      for (size_t j = 0; j < receive_queues_num; j++)
+        receive_queue_push(receive_queues + j, private_lists + j,
+                           /* block = */ 0);
+    } /* for (rt->pollfd) */
 
     if (status != 0)
       break;
   } /* while (listen_loop == 0) */
 
   /* Make sure everything is dispatched before exiting. */
-  if (private_list_head != NULL) {
-    pthread_mutex_lock(&receive_list_lock);
-
-    if (receive_list_head == NULL)
-      receive_list_head = private_list_head;
-    else
-      receive_list_tail->next = private_list_head;
-    receive_list_tail = private_list_tail;
-    receive_list_length += private_list_length;
+  for (size_t i = 0; i < receive_queues_num; i++)
+    receive_queue_push(receive_queues + i, private_lists + i, /* block = */ 1);
 
-    pthread_cond_signal(&receive_list_cond);
-    pthread_mutex_unlock(&receive_list_lock);
-  }
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(batch); i++)
+    if (batch[i] != NULL)
+      receive_pool_put(batch[i]);
 
   return status;
 } /* }}} int network_receive */
 
-static void *receive_thread(void __attribute__((unused)) * arg) {
-  return network_receive() ? (void *)1 : (void *)0;
+static void *receive_thread(void *arg) {
+  return network_receive(arg) ? (void *)1 : (void *)0;
 } /* void *receive_thread */
 
 static void network_init_buffer(void) {
@@ -2705,6 +2897,22 @@ static int network_config_set_ttl(const oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int network_config_set_ttl */
 
+static int network_config_set_threads(const oconfig_item_t *ci, /* {{{ */
+                                      size_t *ret) {
+  int tmp = 0;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  else if ((tmp > 0) && (tmp <= 256))
+    *ret = (size_t)tmp;
+  else {
+    WARNING("network plugin: The `%s' must be between 1 and 256.", ci->key);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int network_config_set_threads */
+
 static int network_config_set_interface(const oconfig_item_t *ci, /* {{{ */
                                         int *interface) {
   char if_name[256];
@@ -2922,8 +3130,18 @@ static int network_config(oconfig_item_t *ci) /* {{{ */
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp("TimeToLive", child->key) == 0)
       network_config_set_ttl(child);
+    else if (strcasecmp("ReceiveThreads", child->key) == 0)
+      network_config_set_threads(child, &network_config_receive_threads);
   }
 
+#ifndef SO_REUSEPORT
+  if (network_config_receive_threads > 1) {
+    WARNING("network plugin: `ReceiveThreads' requires SO_REUSEPORT, which is "
+            "not available on this system. Using one receive thread.");
+    network_config_receive_threads = 1;
+  }
+#endif
+
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
 
@@ -2931,9 +3149,12 @@ static int network_config(oconfig_item_t *ci) /* {{{ */
       network_config_add_listen(child);
     else if (strcasecmp("Server", child->key) == 0)
       network_config_add_server(child);
-    else if (strcasecmp("TimeToLive", child->key) == 0) {
+    else if ((strcasecmp("TimeToLive", child->key) == 0) ||
+             (strcasecmp("ReceiveThreads", child->key) == 0)) {
       /* Handled earlier */
-    } else if (strcasecmp("MaxPacketSize", child->key) == 0)
+    } else if (strcasecmp("DispatchThreads", child->key) == 0)
+      network_config_set_threads(child, &network_config_dispatch_threads);
+    else if (strcasecmp("MaxPacketSize", child->key) == 0)
       network_config_set_buffer_size(child);
     else if (strcasecmp("Forward", child->key) == 0)
       cf_util_get_boolean(child, &network_config_forward);
@@ -3018,24 +3239,47 @@ static int network_notification(const notification_t *n,
 static int network_shutdown(void) {
   listen_loop++;
 
-  /* Kill the listening thread */
-  if (receive_thread_running != 0) {
-    INFO("network plugin: Stopping receive thread.");
-    pthread_kill(receive_thread_id, SIGTERM);
-    pthread_join(receive_thread_id, NULL /* no return value */);
-    memset(&receive_thread_id, 0, sizeof(receive_thread_id));
-    receive_thread_running = 0;
-  }
+  /* Kill the listening threads */
+  if (receive_threads_num > 0)
+    INFO("network plugin: Stopping receive threads.");
+  for (size_t i = 0; i < receive_threads_num; i++) {
+    receive_thread_t *rt = receive_threads + i;
+
+    if (rt->thread_running) {
+      pthread_kill(rt->thread_id, SIGTERM);
+      pthread_join(rt->thread_id, NULL /* no return value */);
+      memset(&rt->thread_id, 0, sizeof(rt->thread_id));
+      rt->thread_running = 0;
+    }
 
-  /* Shutdown the dispatching thread */
-  if (dispatch_thread_running != 0) {
-    INFO("network plugin: Stopping dispatch thread.");
-    pthread_mutex_lock(&receive_list_lock);
-    pthread_cond_broadcast(&receive_list_cond);
-    pthread_mutex_unlock(&receive_list_lock);
-    pthread_join(dispatch_thread_id, /* ret = */ NULL);
-    dispatch_thread_running = 0;
+    sfree(rt->pollfd);
+    sfree(rt->sockent);
+  }
+  sfree(receive_threads);
+  receive_threads_num = 0;
+
+  /* Shutdown the dispatching threads. They dispatch the packets still queued
+   * before exiting. */
+  if (receive_queues_num > 0)
+    INFO("network plugin: Stopping dispatch threads.");
+  for (size_t i = 0; i < receive_queues_num; i++) {
+    receive_queue_t *q = receive_queues + i;
+
+    if (q->thread_running) {
+      pthread_mutex_lock(&q->lock);
+      pthread_cond_broadcast(&q->cond);
+      pthread_mutex_unlock(&q->lock);
+      pthread_join(q->thread_id, /* ret = */ NULL);
+      q->thread_running = 0;
+    }
+
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->cond);
   }
+  sfree(receive_queues);
+  receive_queues_num = 0;
+
+  receive_pool_free();
 
   sockent_destroy(listen_sockets);
 
@@ -3078,7 +3322,9 @@ static int network_stats_read(void) /* {{{ */
   copy_values_not_dispatched = stats_values_not_dispatched;
   copy_values_sent = stats_values_sent;
   copy_values_not_sent = stats_values_not_sent;
-  copy_receive_list_length = receive_list_length;
+  copy_receive_list_length = 0;
+  for (size_t i = 0; i < receive_queues_num; i++)
+    copy_receive_list_length += receive_queues[i].list.length;
 
   /* Initialize `vl' */
   vl.values = values;
@@ -3157,35 +3403,109 @@ static int network_init(void) {
   }
 
   /* If no threads need to be started, return here. */
-  if ((listen_sockets_num == 0) ||
-      ((dispatch_thread_running != 0) && (receive_thread_running != 0)))
+  if (listen_sockets_num == 0)
     return 0;
 
-  if (dispatch_thread_running == 0) {
+  receive_queues = calloc(network_config_dispatch_threads,
+                          sizeof(*receive_queues));
+  receive_threads = calloc(network_config_receive_threads,
+                           sizeof(*receive_threads));
+  if ((receive_queues == NULL) || (receive_threads == NULL)) {
+    ERROR("network plugin: calloc failed.");
+    sfree(receive_queues);
+    sfree(receive_threads);
+    return -1;
+  }
+  receive_queues_num = network_config_dispatch_threads;
+  receive_threads_num = network_config_receive_threads;
+
+  for (size_t i = 0; i < receive_queues_num; i++) {
+    pthread_mutex_init(&receive_queues[i].lock, /* attr = */ NULL);
+    pthread_cond_init(&receive_queues[i].cond, /* attr = */ NULL);
+  }
+
+  /* Distribute the listening sockets among the receive threads. Each Listen
+   * address has one socket per receive thread, so handing them out in turn
+   * gives every thread one socket of each address. */
+  for (size_t i = 0; i < receive_threads_num; i++) {
+    receive_thread_t *rt = receive_threads + i;
+
+    rt->pollfd = calloc(listen_sockets_num, sizeof(*rt->pollfd));
+    rt->sockent = calloc(listen_sockets_num, sizeof(*rt->sockent));
+    if ((rt->pollfd == NULL) || (rt->sockent == NULL)) {
+      ERROR("network plugin: calloc failed.");
+      return -1;
+    }
+  }
+
+  size_t next_thread = 0;
+  for (sockent_t *se = listen_sockets; se != NULL; se = se->next) {
+    for (size_t i = 0; i < se->data.server.fd_num; i++) {
+      receive_thread_t *rt = receive_threads + next_thread;
+
+      rt->pollfd[rt->num] = (struct pollfd){
+          .fd = se->data.server.fd[i], .events = POLLIN | POLLPRI,
+      };
+      rt->sockent[rt->num] = se;
+      rt->num++;
+
+      next_thread = (next_thread + 1) % receive_threads_num;
+    }
+  }
+
+  for (size_t i = 0; i < receive_queues_num; i++) {
+    receive_queue_t *q = receive_queues + i;
+    char name[DATA_MAX_NAME_LEN];
     int status;
-    status = plugin_thread_create(&dispatch_thread_id, NULL /* no attributes */,
-                                  dispatch_thread, NULL /* no argument */,
-                                  "network disp");
+
+    snprintf(name, sizeof(name), "network disp%zu", i);
+    status = plugin_thread_create(&q->thread_id, NULL /* no attributes */,
+                                  dispatch_thread, q, name);
     if (status != 0) {
       char errbuf[1024];
       ERROR("network: pthread_create failed: %s",
-            sstrerror(errno, errbuf, sizeof(errbuf)));
-    } else {
-      dispatch_thread_running = 1;
+            sstrerror(status, errbuf, sizeof(errbuf)));
+
+      /* Nobody would ever take packets from this queue. The receive threads
+       * aren't running yet, so simply stop routing to it and the ones after
+       * it. */
+      for (size_t j = i; j < receive_queues_num; j++) {
+        pthread_mutex_destroy(&receive_queues[j].lock);
+        pthread_cond_destroy(&receive_queues[j].cond);
+      }
+      receive_queues_num = i;
+      break;
     }
+    q->thread_running = 1;
+  }
+
+  if (receive_queues_num == 0) {
+    ERROR("network plugin: Unable to start any dispatch thread.");
+    return -1;
+  } else if (receive_queues_num < network_config_dispatch_threads) {
+    WARNING("network plugin: Only %zu of %zu dispatch threads could be "
+            "started.",
+            receive_queues_num, network_config_dispatch_threads);
   }
 
-  if (receive_thread_running == 0) {
+  for (size_t i = 0; i < receive_threads_num; i++) {
+    receive_thread_t *rt = receive_threads + i;
+    char name[DATA_MAX_NAME_LEN];
     int status;
-    status = plugin_thread_create(&receive_thread_id, NULL /* no attributes */,
-                                  receive_thread, NULL /* no argument */,
-                                  "network recv");
+
+    /* Fewer sockets than threads, e.g. a single multicast group. */
+    if (rt->num == 0)
+      continue;
+
+    snprintf(name, sizeof(name), "network recv%zu", i);
+    status = plugin_thread_create(&rt->thread_id, NULL /* no attributes */,
+                                  receive_thread, rt, name);
     if (status != 0) {
       char errbuf[1024];
       ERROR("network: pthread_create failed: %s",
-            sstrerror(errno, errbuf, sizeof(errbuf)));
+            sstrerror(status, errbuf, sizeof(errbuf)));
     } else {
-      receive_thread_running = 1;
+      rt->thread_running = 1;
     }
   }
 
@@ -28,12 +28,20 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_complain.h"
 #include "utils_rrdcreate.h"
 
+#include <netdb.h>
+#include <sys/un.h>
+
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
 
+#ifndef RRDCACHED_DEFAULT_PORT
+#define RRDCACHED_DEFAULT_PORT "42217"
+#endif
+
 /*
  * Private variables
  */
@@ -55,6 +63,35 @@ static rrdcreate_config_t rrdcreate_config = {
 
     /* async = */ 0};
 
+/* With "BatchSize" set, rc_write() only queues the updates. A separate
+ * thread sends them to the daemon with the BATCH command, either when
+ * `batch_size' updates are queued or `batch_interval' after the first one.
+ * The queue holds at most `batch_queue_size' updates. */
+static int batch_size = 0;
+static int batch_queue_size = 65536;
+static cdtime_t batch_interval = TIME_T_TO_CDTIME_T_STATIC(1);
+
+static char *batch_data = NULL;
+static size_t batch_data_size = 0;
+static size_t batch_data_len = 0;
+static int batch_updates = 0;
+static cdtime_t batch_first = 0;
+static _Bool batch_flush = 0;
+static _Bool batch_shutdown = 0;
+/* Number of batches taken from the queue and sent, respectively. */
+static uint64_t batch_taken = 0;
+static uint64_t batch_sent = 0;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batch_sent_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t batch_thread;
+static _Bool batch_thread_running = 0;
+static c_complain_t batch_complaint = C_COMPLAIN_INIT_STATIC;
+
+/* Only used by the sender thread. */
+static int batch_fd = -1;
+static FILE *batch_fh = NULL;
+
 /*
  * Prototypes.
  */
@@ -245,7 +282,15 @@ static int rc_config(oconfig_item_t *ci) {
         status = rc_config_add_timespan(tmp);
     } else if (strcasecmp("XFF", key) == 0)
       status = rc_config_get_xff(child, &rrdcreate_config.xff);
-    else {
+    else if (strcasecmp("BatchSize", key) == 0)
+      status = rc_config_get_int_positive(child, &batch_size);
+    else if (strcasecmp("BatchInterval", key) == 0)
+      status = cf_util_get_cdtime(child, &batch_interval);
+    else if (strcasecmp("QueueSize", key) == 0) {
+      status = rc_config_get_int_positive(child, &batch_queue_size);
+      if ((status == 0) && (batch_queue_size == 0))
+        status = EINVAL;
+    } else {
       WARNING("rrdcached plugin: Ignoring invalid option %s.", key);
       continue;
     }
@@ -379,10 +424,362 @@ static int rc_read(void) {
   return 0;
 } /* int rc_read */
 
+/* Opens a connection of our own to the daemon for the BATCH command, so the
+ * sender thread does not share librrd's global connection with the read and
+ * flush callbacks. */
+static int rc_batch_connect(void) /* {{{ */
+{
+  char const *path = NULL;
+
+  if (strncmp("unix:", daemon_address, strlen("unix:")) == 0)
+    path = daemon_address + strlen("unix:");
+  else if (daemon_address[0] == '/')
+    path = daemon_address;
+
+  if (path != NULL) {
+    struct sockaddr_un sa = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+      ERROR("rrdcached plugin: Socket path too long: %s", path);
+      return -1;
+    }
+    sstrncpy(sa.sun_path, path, sizeof(sa.sun_path));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  /* Accepted forms are "host", "host:port" and "[address]:port". */
+  char host[NI_MAXHOST];
+  char const *port = RRDCACHED_DEFAULT_PORT;
+
+  sstrncpy(host, daemon_address, sizeof(host));
+  if (host[0] == '[') {
+    char *end = strchr(host, ']');
+    if (end == NULL)
+      return -1;
+    *end = 0;
+    if (end[1] == ':')
+      port = daemon_address + (end - host) + 2;
+    memmove(host, host + 1, strlen(host + 1) + 1);
+  } else {
+    char *colon = strchr(host, ':');
+    if ((colon != NULL) && (strchr(colon + 1, ':') == NULL)) {
+      *colon = 0;
+      port = daemon_address + (colon - host) + 1;
+    }
+  }
+
+  struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
+                              .ai_flags = AI_ADDRCONFIG,
+                              .ai_socktype = SOCK_STREAM};
+  struct addrinfo *ai_list;
+
+  int status = getaddrinfo(host, port, &ai_hints, &ai_list);
+  if (status != 0) {
+    ERROR("rrdcached plugin: getaddrinfo (%s, %s) failed: %s", host, port,
+          gai_strerror(status));
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo *ai = ai_list; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(ai_list);
+
+  return fd;
+} /* }}} int rc_batch_connect */
+
+static void rc_batch_disconnect(void) /* {{{ */
+{
+  if (batch_fh != NULL) {
+    fclose(batch_fh); /* closes batch_fd */
+    batch_fh = NULL;
+  } else if (batch_fd >= 0) {
+    close(batch_fd);
+  }
+  batch_fd = -1;
+} /* }}} void rc_batch_disconnect */
+
+/* Reads one response line and returns the status code at its beginning. */
+static int rc_batch_response(char *buffer, size_t buffer_size) /* {{{ */
+{
+  if (fgets(buffer, (int)buffer_size, batch_fh) == NULL)
+    return -1;
+
+  size_t len = strlen(buffer);
+  while ((len > 0) && ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
+    buffer[--len] = 0;
+
+  char *endptr = NULL;
+  long status = strtol(buffer, &endptr, 10);
+  if (endptr == buffer)
+    return -1;
+  return (int)status;
+} /* }}} int rc_batch_response */
+
+/* Sends `updates' lines of "UPDATE <file> <values>" with a single BATCH
+ * command. The daemon does not answer the individual lines, so the whole
+ * batch costs one round trip. */
+static int rc_batch_send_once(char const *data, size_t data_len, /* {{{ */
+                              int updates) {
+  char buffer[1024];
+  int status;
+
+  if (batch_fd < 0) {
+    batch_fd = rc_batch_connect();
+    if (batch_fd < 0)
+      return -1;
+    batch_fh = fdopen(batch_fd, "r");
+    if (batch_fh == NULL) {
+      rc_batch_disconnect();
+      return -1;
+    }
+  }
+
+  if (swrite(batch_fd, "BATCH\n", strlen("BATCH\n")) != 0)
+    return -1;
+  status = rc_batch_response(buffer, sizeof(buffer));
+  if (status != 0) {
+    ERROR("rrdcached plugin: BATCH command failed: %s", buffer);
+    return -1;
+  }
+
+  if ((swrite(batch_fd, data, data_len) != 0) ||
+      (swrite(batch_fd, ".\n", strlen(".\n")) != 0))
+    return -1;
+
+  /* The response is the number of failed commands, each of which is
+   * followed by a line with its number and the error message. */
+  status = rc_batch_response(buffer, sizeof(buffer));
+  if (status < 0)
+    return -1;
+
+  int errors = status;
+  for (int i = 0; i < errors; i++) {
+    char line[1024];
+    if (fgets(line, sizeof(line), batch_fh) == NULL)
+      return -1;
+    if (i < 5)
+      WARNING("rrdcached plugin: BATCH: update failed: %s", line);
+  }
+
+  DEBUG("rrdcached plugin: BATCH: Sent %d updates, %d errors.", updates,
+        errors);
+  return 0;
+} /* }}} int rc_batch_send_once */
+
+static void rc_batch_send(char const *data, size_t data_len, /* {{{ */
+                          int updates) {
+  if (rc_batch_send_once(data, data_len, updates) == 0)
+    return;
+
+  /* The connection may have been closed by the daemon in the meantime, so
+   * try once more with a new one. */
+  rc_batch_disconnect();
+  if (rc_batch_send_once(data, data_len, updates) == 0)
+    return;
+
+  char errbuf[1024];
+  ERROR("rrdcached plugin: Sending %d updates to RRDCacheD at %s failed: %s",
+        updates, daemon_address, sstrerror(errno, errbuf, sizeof(errbuf)));
+  rc_batch_disconnect();
+} /* }}} void rc_batch_send */
+
+static void *rc_batch_thread(void __attribute__((unused)) * arg) /* {{{ */
+{
+  char *data = NULL;
+  size_t data_size = 0;
+
+  pthread_mutex_lock(&batch_lock);
+  while (42) {
+    cdtime_t deadline = batch_first + batch_interval;
+
+    while ((batch_updates < batch_size) && !batch_flush && !batch_shutdown) {
+      if (batch_updates == 0) {
+        pthread_cond_wait(&batch_cond, &batch_lock);
+        continue;
+      }
+
+      deadline = batch_first + batch_interval;
+      if (cdtime() >= deadline)
+        break;
+
+      struct timespec ts = CDTIME_T_TO_TIMESPEC(deadline);
+      pthread_cond_timedwait(&batch_cond, &batch_lock, &ts);
+    }
+
+    if (batch_updates == 0) {
+      batch_flush = 0;
+      batch_sent = batch_taken;
+      pthread_cond_broadcast(&batch_sent_cond);
+      if (batch_shutdown)
+        break;
+      continue;
+    }
+
+    /* Swap the buffers, so writers can go on while the batch is sent. */
+    char *tmp = batch_data;
+    size_t tmp_size = batch_data_size;
+    size_t data_len = batch_data_len;
+    int updates = batch_updates;
+
+    batch_data = data;
+    batch_data_size = data_size;
+    batch_data_len = 0;
+    batch_updates = 0;
+    batch_flush = 0;
+    data = tmp;
+    data_size = tmp_size;
+    uint64_t generation = ++batch_taken;
+
+    pthread_mutex_unlock(&batch_lock);
+    rc_batch_send(data, data_len, updates);
+    pthread_mutex_lock(&batch_lock);
+
+    batch_sent = generation;
+    pthread_cond_broadcast(&batch_sent_cond);
+  }
+  pthread_mutex_unlock(&batch_lock);
+
+  sfree(data);
+  rc_batch_disconnect();
+  return NULL;
+} /* }}} void *rc_batch_thread */
+
+/* Appends `s' escaped as required by the rrdcached protocol. Must hold
+ * batch_lock when calling. */
+static int rc_batch_append(char const *s, _Bool escape) /* {{{ */
+{
+  size_t len = strlen(s);
+  size_t need = batch_data_len + (escape ? 2 * len : len) + 1;
+
+  if (need > batch_data_size) {
+    size_t new_size = (batch_data_size > 0) ? 2 * batch_data_size : 4096;
+    while (new_size < need)
+      new_size *= 2;
+
+    char *tmp = realloc(batch_data, new_size);
+    if (tmp == NULL)
+      return ENOMEM;
+    batch_data = tmp;
+    batch_data_size = new_size;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    if (escape && ((s[i] == ' ') || (s[i] == '\\')))
+      batch_data[batch_data_len++] = '\\';
+    batch_data[batch_data_len++] = s[i];
+  }
+  batch_data[batch_data_len] = 0;
+  return 0;
+} /* }}} int rc_batch_append */
+
+static int rc_batch_add(char const *filename, char const *values) /* {{{ */
+{
+  char path[PATH_MAX];
+
+  /* Like librrd, hand absolute paths to a local daemon, because its working
+   * directory is not ours. */
+  if (((strncmp("unix:", daemon_address, strlen("unix:")) == 0) ||
+       (daemon_address[0] == '/')) &&
+      (filename[0] != '/') && (realpath(filename, path) != NULL))
+    filename = path;
+
+  pthread_mutex_lock(&batch_lock);
+
+  if (batch_updates >= batch_queue_size) {
+    pthread_mutex_unlock(&batch_lock);
+    c_complain(LOG_WARNING, &batch_complaint,
+               "rrdcached plugin: The update queue is full, dropping "
+               "values. Is RRDCacheD at %s slow or unavailable?",
+               daemon_address);
+    return -1;
+  }
+
+  size_t old_len = batch_data_len;
+  int status = rc_batch_append("UPDATE ", /* escape = */ 0);
+  if (status == 0)
+    status = rc_batch_append(filename, /* escape = */ 1);
+  if (status == 0)
+    status = rc_batch_append(" ", /* escape = */ 0);
+  if (status == 0)
+    status = rc_batch_append(values, /* escape = */ 0);
+  if (status == 0)
+    status = rc_batch_append("\n", /* escape = */ 0);
+  if (status != 0) {
+    batch_data_len = old_len;
+    pthread_mutex_unlock(&batch_lock);
+    ERROR("rrdcached plugin: realloc failed.");
+    return -1;
+  }
+
+  if (batch_updates == 0)
+    batch_first = cdtime();
+  batch_updates++;
+  /* Wake the sender to start the interval timer or send a full batch. */
+  if ((batch_updates == 1) || (batch_updates >= batch_size))
+    pthread_cond_signal(&batch_cond);
+
+  pthread_mutex_unlock(&batch_lock);
+
+  c_release(LOG_INFO, &batch_complaint,
+            "rrdcached plugin: The update queue has room again.");
+  return 0;
+} /* }}} int rc_batch_add */
+
+/* Sends all queued updates and waits until the daemon received them. */
+static void rc_batch_flush(void) /* {{{ */
+{
+  pthread_mutex_lock(&batch_lock);
+  if (!batch_thread_running) {
+    pthread_mutex_unlock(&batch_lock);
+    return;
+  }
+
+  uint64_t want = batch_taken + ((batch_updates > 0) ? 1 : 0);
+  batch_flush = 1;
+  pthread_cond_signal(&batch_cond);
+  while ((batch_sent < want) && !batch_shutdown)
+    pthread_cond_wait(&batch_sent_cond, &batch_lock);
+  pthread_mutex_unlock(&batch_lock);
+} /* }}} void rc_batch_flush */
+
 static int rc_init(void) {
   if (config_collect_stats)
     plugin_register_read("rrdcached", rc_read);
 
+  if ((batch_size > 0) && (daemon_address != NULL)) {
+    if (batch_queue_size < batch_size) {
+      INFO("rrdcached plugin: Adjusting \"QueueSize\" to %d, the value of "
+           "\"BatchSize\".",
+           batch_size);
+      batch_queue_size = batch_size;
+    }
+
+    int status = plugin_thread_create(&batch_thread, /* attr = */ NULL,
+                                      rc_batch_thread, /* arg = */ NULL,
+                                      "rrdcached batch");
+    if (status != 0) {
+      ERROR("rrdcached plugin: Starting the batch thread failed.");
+      return -1;
+    }
+    batch_thread_running = 1;
+  }
+
   return 0;
 } /* int rc_init */
 
@@ -439,6 +836,9 @@ static int rc_write(const data_set_t *ds, const value_list_t *vl,
     }
   }
 
+  if (batch_thread_running)
+    return rc_batch_add(filename, values);
+
   rrd_clear_error();
   status = rrdc_connect(daemon_address);
   if (status != 0) {
@@ -478,8 +878,12 @@ static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
   int status;
   _Bool retried = 0;
 
+  /* Updates still queued have to reach the daemon before it can write them
+   * to disk. */
+  rc_batch_flush();
+
   if (identifier == NULL)
-    return EINVAL;
+    return batch_thread_running ? 0 : EINVAL;
 
   if (datadir != NULL)
     snprintf(filename, sizeof(filename), "%s/%s.rrd", datadir, identifier);
@@ -520,6 +924,19 @@ static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
 } /* }}} int rc_flush */
 
 static int rc_shutdown(void) {
+  if (batch_thread_running) {
+    pthread_mutex_lock(&batch_lock);
+    batch_shutdown = 1;
+    pthread_cond_broadcast(&batch_cond);
+    pthread_cond_broadcast(&batch_sent_cond);
+    pthread_mutex_unlock(&batch_lock);
+
+    /* The thread sends the remaining updates before exiting. */
+    pthread_join(batch_thread, /* retval = */ NULL);
+    batch_thread_running = 0;
+  }
+  sfree(batch_data);
+
   rrdc_disconnect();
   return 0;
 } /* int rc_shutdown */
@@ -38,13 +38,28 @@
  */
 typedef struct rrd_cache_s {
   int values_num;
-  char **values;
+  /* The update strings, each terminated by a null byte, in one buffer. */
+  char *values;
+  size_t values_len;
+  size_t values_size;
   cdtime_t first_value;
   cdtime_t last_value;
   int64_t random_variation;
+  /* Location of the file, used to order updates. */
+  dev_t dev;
+  ino_t ino;
   enum { FLAG_NONE = 0x00, FLAG_QUEUED = 0x01, FLAG_FLUSHQ = 0x02 } flags;
 } rrd_cache_t;
 
+/* The cache is split into shards by the hash of the file name, so writes to
+ * different files rarely wait for each other or for a flush. */
+struct rrd_cache_shard_s {
+  c_avl_tree_t *tree;
+  pthread_mutex_t lock;
+  cdtime_t flush_last;
+};
+typedef struct rrd_cache_shard_s rrd_cache_shard_t;
+
 enum rrd_queue_dir_e { QUEUE_INSERT_FRONT, QUEUE_INSERT_BACK };
 typedef enum rrd_queue_dir_e rrd_queue_dir_t;
 
@@ -54,13 +69,40 @@ struct rrd_queue_s {
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+/* Each update thread has its own queues and serves a fixed subset of the
+ * shards. All updates of a file are therefore done by the same thread, in
+ * order. */
+struct rrd_worker_s {
+  rrd_queue_t *queue_head;
+  rrd_queue_t *queue_tail;
+  rrd_queue_t *flushq_head;
+  rrd_queue_t *flushq_tail;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  _Bool thread_running;
+  _Bool shutdown;
+};
+typedef struct rrd_worker_s rrd_worker_t;
+
+/* A file taken from the queue, with the values to write to it. */
+struct rrd_update_s {
+  rrd_queue_t *entry;
+  char *values;
+  int values_num;
+  dev_t dev;
+  ino_t ino;
+};
+typedef struct rrd_update_s rrd_update_t;
+
 /*
  * Private variables
  */
 static const char *config_keys[] = {
-    "CacheTimeout", "CacheFlush",      "CreateFilesAsync", "DataDir",
-    "StepSize",     "HeartBeat",       "RRARows",          "RRATimespan",
-    "XFF",          "WritesPerSecond", "RandomTimeout"};
+    "CacheTimeout",  "CacheFlush",      "CreateFilesAsync", "DataDir",
+    "StepSize",      "HeartBeat",       "RRARows",          "RRATimespan",
+    "XFF",           "WritesPerSecond", "RandomTimeout",    "UpdateThreads",
+    "UpdateBatchSize"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 /* If datadir is zero, the daemon's basedir is used. If stepsize or heartbeat
@@ -82,23 +124,20 @@ static rrdcreate_config_t rrdcreate_config = {
 
     /* async = */ 0};
 
-/* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
- * ALWAYS lock `cache_lock' first! */
+#ifndef RRD_CACHE_SHARDS
+#define RRD_CACHE_SHARDS 64
+#endif
+
+/* XXX: If you need to lock both, a shard's lock and a worker's lock, at the
+ * same time, ALWAYS lock the shard first! */
 static cdtime_t cache_timeout = 0;
 static cdtime_t cache_flush_timeout = 0;
 static cdtime_t random_timeout = 0;
-static cdtime_t cache_flush_last;
-static c_avl_tree_t *cache = NULL;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
-
-static rrd_queue_t *queue_head = NULL;
-static rrd_queue_t *queue_tail = NULL;
-static rrd_queue_t *flushq_head = NULL;
-static rrd_queue_t *flushq_tail = NULL;
-static pthread_t queue_thread;
-static int queue_thread_running = 1;
-static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static rrd_cache_shard_t *cache_shards = NULL;
+
+static rrd_worker_t *workers = NULL;
+static size_t workers_num = 1;
+static size_t update_batch_size = 64;
 
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -109,7 +148,9 @@ static int do_shutdown = 0;
 #if HAVE_THREADSAFE_LIBRRD
 static int srrd_update(char *filename, char *template, int argc,
                        const char **argv) {
-  optind = 0; /* bug in librrd? */
+  /* rrd_update_r() does not parse options, so unlike rrd_update() it does
+   * not need `optind' to be reset. Not touching it allows several update
+   * threads. */
   rrd_clear_error();
 
   int status = rrd_update_r(filename, template, argc, (void *)argv);
@@ -279,44 +320,110 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
   return 0;
 } /* int value_list_to_filename */
 
-static void *rrd_queue_thread(void __attribute__((unused)) * data) {
+static uint32_t rrd_filename_hash(const char *filename) /* {{{ */
+{
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+
+  for (const unsigned char *p = (const unsigned char *)filename; *p != 0; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+
+  return hash;
+} /* }}} uint32_t rrd_filename_hash */
+
+static rrd_cache_shard_t *rrd_cache_shard(const char *filename) /* {{{ */
+{
+  return cache_shards + (rrd_filename_hash(filename) % RRD_CACHE_SHARDS);
+} /* }}} rrd_cache_shard_t *rrd_cache_shard */
+
+static rrd_worker_t *rrd_worker(rrd_cache_shard_t const *shard) /* {{{ */
+{
+  return workers + ((size_t)(shard - cache_shards) % workers_num);
+} /* }}} rrd_worker_t *rrd_worker */
+
+/* Orders updates by their location on disk, so that the files are visited
+ * in roughly sequential order rather than the order they were queued in. */
+static int rrd_update_compare(const void *a_ptr, const void *b_ptr) /* {{{ */
+{
+  rrd_update_t const *a = a_ptr;
+  rrd_update_t const *b = b_ptr;
+
+  if (a->dev != b->dev)
+    return (a->dev < b->dev) ? -1 : 1;
+  if (a->ino != b->ino)
+    return (a->ino < b->ino) ? -1 : 1;
+  return strcmp(a->entry->filename, b->entry->filename);
+} /* }}} int rrd_update_compare */
+
+static void rrd_update_write(rrd_update_t *u) /* {{{ */
+{
+  const char **argv = malloc(u->values_num * sizeof(*argv));
+  if (argv == NULL) {
+    ERROR("rrdtool plugin: malloc failed.");
+    return;
+  }
+
+  char *value = u->values;
+  for (int i = 0; i < u->values_num; i++) {
+    argv[i] = value;
+    value += strlen(value) + 1;
+  }
+
+  /* Write the values to the RRD-file */
+  srrd_update(u->entry->filename, NULL, u->values_num, argv);
+  DEBUG("rrdtool plugin: queue thread: Wrote %i value%s to %s", u->values_num,
+        (u->values_num == 1) ? "" : "s", u->entry->filename);
+
+  sfree(argv);
+} /* }}} void rrd_update_write */
+
+static void *rrd_queue_thread(void *data) {
+  rrd_worker_t *w = data;
   struct timeval tv_next_update;
   struct timeval tv_now;
 
+  /* Each thread updates its share of the files, so the configured rate is
+   * split evenly between the threads. */
+  double thread_write_rate = write_rate * (double)workers_num;
+
+  /* Honor the write rate by taking one file at a time. */
+  size_t batch_size = (write_rate > 0.0) ? 1 : update_batch_size;
+  rrd_update_t *batch = calloc(batch_size, sizeof(*batch));
+  if (batch == NULL) {
+    ERROR("rrdtool plugin: calloc failed.");
+    return (void *)-1;
+  }
+
   gettimeofday(&tv_next_update, /* timezone = */ NULL);
 
   while (42) {
-    rrd_queue_t *queue_entry;
-    rrd_cache_t *cache_entry;
-    char **values;
-    int values_num;
+    size_t batch_num = 0;
     int status;
 
-    values = NULL;
-    values_num = 0;
-
-    pthread_mutex_lock(&queue_lock);
+    pthread_mutex_lock(&w->lock);
     /* Wait for values to arrive */
     while (42) {
       struct timespec ts_wait;
 
-      while ((flushq_head == NULL) && (queue_head == NULL) &&
-             (do_shutdown == 0))
-        pthread_cond_wait(&queue_cond, &queue_lock);
+      while ((w->flushq_head == NULL) && (w->queue_head == NULL) &&
+             !w->shutdown)
+        pthread_cond_wait(&w->cond, &w->lock);
 
-      if ((flushq_head == NULL) && (queue_head == NULL))
+      if ((w->flushq_head == NULL) && (w->queue_head == NULL))
         break;
 
       /* Don't delay if there's something to flush */
-      if (flushq_head != NULL)
+      if (w->flushq_head != NULL)
         break;
 
       /* Don't delay if we're shutting down */
-      if (do_shutdown != 0)
+      if (w->shutdown)
         break;
 
       /* Don't delay if no delay was configured. */
-      if (write_rate <= 0.0)
+      if (thread_write_rate <= 0.0)
         break;
 
       gettimeofday(&tv_now, /* timezone = */ NULL);
@@ -331,94 +438,112 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
       ts_wait.tv_sec = tv_next_update.tv_sec;
       ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
 
-      status = pthread_cond_timedwait(&queue_cond, &queue_lock, &ts_wait);
+      status = pthread_cond_timedwait(&w->cond, &w->lock, &ts_wait);
       if (status == ETIMEDOUT)
         break;
     } /* while (42) */
 
-    /* XXX: If you need to lock both, cache_lock and queue_lock, at
-     * the same time, ALWAYS lock `cache_lock' first! */
-
     /* We're in the shutdown phase */
-    if ((flushq_head == NULL) && (queue_head == NULL)) {
-      pthread_mutex_unlock(&queue_lock);
+    if ((w->flushq_head == NULL) && (w->queue_head == NULL)) {
+      pthread_mutex_unlock(&w->lock);
       break;
     }
 
-    if (flushq_head != NULL) {
-      /* Dequeue the first flush entry */
-      queue_entry = flushq_head;
-      if (flushq_head == flushq_tail)
-        flushq_head = flushq_tail = NULL;
-      else
-        flushq_head = flushq_head->next;
-    } else /* if (queue_head != NULL) */
-    {
-      /* Dequeue the first regular entry */
-      queue_entry = queue_head;
-      if (queue_head == queue_tail)
-        queue_head = queue_tail = NULL;
-      else
-        queue_head = queue_head->next;
+    /* Dequeue up to `batch_size' entries, flush entries first */
+    while ((batch_num < batch_size) &&
+           ((w->flushq_head != NULL) || (w->queue_head != NULL))) {
+      rrd_queue_t *queue_entry;
+
+      if (w->flushq_head != NULL) {
+        queue_entry = w->flushq_head;
+        if (w->flushq_head == w->flushq_tail)
+          w->flushq_head = w->flushq_tail = NULL;
+        else
+          w->flushq_head = w->flushq_head->next;
+      } else /* if (w->queue_head != NULL) */
+      {
+        queue_entry = w->queue_head;
+        if (w->queue_head == w->queue_tail)
+          w->queue_head = w->queue_tail = NULL;
+        else
+          w->queue_head = w->queue_head->next;
+      }
+
+      batch[batch_num].entry = queue_entry;
+      batch_num++;
     }
 
     /* Unlock the queue again */
-    pthread_mutex_unlock(&queue_lock);
-
-    /* We now need the cache lock so the entry isn't updated while
-     * we make a copy of its values */
-    pthread_mutex_lock(&cache_lock);
-
-    status = c_avl_get(cache, queue_entry->filename, (void *)&cache_entry);
+    pthread_mutex_unlock(&w->lock);
+
+    /* We now need the shard locks so the entries aren't updated while we
+     * take their values. */
+    size_t valid_num = 0;
+    for (size_t i = 0; i < batch_num; i++) {
+      rrd_update_t *u = batch + i;
+      rrd_cache_shard_t *shard = rrd_cache_shard(u->entry->filename);
+      rrd_cache_t *cache_entry;
+
+      pthread_mutex_lock(&shard->lock);
+      status = c_avl_get(shard->tree, u->entry->filename, (void *)&cache_entry);
+      if (status == 0) {
+        u->values = cache_entry->values;
+        u->values_num = cache_entry->values_num;
+        u->dev = cache_entry->dev;
+        u->ino = cache_entry->ino;
+
+        cache_entry->values = NULL;
+        cache_entry->values_len = 0;
+        cache_entry->values_size = 0;
+        cache_entry->values_num = 0;
+        cache_entry->flags = FLAG_NONE;
+      }
+      pthread_mutex_unlock(&shard->lock);
 
-    if (status == 0) {
-      values = cache_entry->values;
-      values_num = cache_entry->values_num;
+      if ((status != 0) || (u->values_num == 0)) {
+        sfree(u->values);
+        sfree(u->entry->filename);
+        sfree(u->entry);
+        continue;
+      }
 
-      cache_entry->values = NULL;
-      cache_entry->values_num = 0;
-      cache_entry->flags = FLAG_NONE;
+      batch[valid_num] = *u;
+      valid_num++;
     }
 
-    pthread_mutex_unlock(&cache_lock);
-
-    if (status != 0) {
-      sfree(queue_entry->filename);
-      sfree(queue_entry);
-      continue;
-    }
+    if (valid_num > 1)
+      qsort(batch, valid_num, sizeof(*batch), rrd_update_compare);
 
     /* Update `tv_next_update' */
-    if (write_rate > 0.0) {
+    if (thread_write_rate > 0.0) {
       gettimeofday(&tv_now, /* timezone = */ NULL);
       tv_next_update.tv_sec = tv_now.tv_sec;
       tv_next_update.tv_usec =
-          tv_now.tv_usec + ((suseconds_t)(1000000 * write_rate));
+          tv_now.tv_usec + ((suseconds_t)(1000000 * thread_write_rate));
       while (tv_next_update.tv_usec > 1000000) {
         tv_next_update.tv_sec++;
         tv_next_update.tv_usec -= 1000000;
       }
     }
 
-    /* Write the values to the RRD-file */
-    srrd_update(queue_entry->filename, NULL, values_num, (const char **)values);
-    DEBUG("rrdtool plugin: queue thread: Wrote %i value%s to %s", values_num,
-          (values_num == 1) ? "" : "s", queue_entry->filename);
+    for (size_t i = 0; i < valid_num; i++) {
+      rrd_update_write(batch + i);
 
-    for (int i = 0; i < values_num; i++) {
-      sfree(values[i]);
+      sfree(batch[i].values);
+      sfree(batch[i].entry->filename);
+      sfree(batch[i].entry);
     }
-    sfree(values);
-    sfree(queue_entry->filename);
-    sfree(queue_entry);
+    memset(batch, 0, batch_num * sizeof(*batch));
   } /* while (42) */
 
+  sfree(batch);
+
   pthread_exit((void *)0);
   return (void *)0;
 } /* void *rrd_queue_thread */
 
-static int rrd_queue_enqueue(const char *filename, rrd_queue_t **head,
-                             rrd_queue_t **tail) {
+static int rrd_queue_enqueue(rrd_worker_t *w, const char *filename,
+                             rrd_queue_t **head, rrd_queue_t **tail) {
   rrd_queue_t *queue_entry;
 
   queue_entry = malloc(sizeof(*queue_entry));
@@ -433,7 +558,7 @@ static int rrd_queue_enqueue(const char *filename, rrd_queue_t **head,
 
   queue_entry->next = NULL;
 
-  pthread_mutex_lock(&queue_lock);
+  pthread_mutex_lock(&w->lock);
 
   if (*tail == NULL)
     *head = queue_entry;
@@ -441,18 +566,18 @@ static int rrd_queue_enqueue(const char *filename, rrd_queue_t **head,
     (*tail)->next = queue_entry;
   *tail = queue_entry;
 
-  pthread_cond_signal(&queue_cond);
-  pthread_mutex_unlock(&queue_lock);
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
 
   return 0;
 } /* int rrd_queue_enqueue */
 
-static int rrd_queue_dequeue(const char *filename, rrd_queue_t **head,
-                             rrd_queue_t **tail) {
+static int rrd_queue_dequeue(rrd_worker_t *w, const char *filename,
+                             rrd_queue_t **head, rrd_queue_t **tail) {
   rrd_queue_t *this;
   rrd_queue_t *prev;
 
-  pthread_mutex_lock(&queue_lock);
+  pthread_mutex_lock(&w->lock);
 
   prev = NULL;
   this = *head;
@@ -466,7 +591,7 @@ static int rrd_queue_dequeue(const char *filename, rrd_queue_t **head,
   }
 
   if (this == NULL) {
-    pthread_mutex_unlock(&queue_lock);
+    pthread_mutex_unlock(&w->lock);
     return -1;
   }
 
@@ -478,7 +603,7 @@ static int rrd_queue_dequeue(const char *filename, rrd_queue_t **head,
   if (this->next == NULL)
     *tail = prev;
 
-  pthread_mutex_unlock(&queue_lock);
+  pthread_mutex_unlock(&w->lock);
 
   sfree(this->filename);
   sfree(this);
@@ -486,8 +611,9 @@ static int rrd_queue_dequeue(const char *filename, rrd_queue_t **head,
   return 0;
 } /* int rrd_queue_dequeue */
 
-/* XXX: You must hold "cache_lock" when calling this function! */
-static void rrd_cache_flush(cdtime_t timeout) {
+/* XXX: You must hold the shard's lock when calling this function! */
+static void rrd_cache_flush(rrd_cache_shard_t *shard, cdtime_t timeout) {
+  rrd_worker_t *w = rrd_worker(shard);
   rrd_cache_t *rc;
   cdtime_t now;
 
@@ -503,7 +629,7 @@ static void rrd_cache_flush(cdtime_t timeout) {
   now = cdtime();
 
   /* Build a list of entries to be flushed */
-  iter = c_avl_get_iterator(cache);
+  iter = c_avl_get_iterator(shard->tree);
   while (c_avl_iterator_next(iter, (void *)&key, (void *)&rc) == 0) {
     if (rc->flags != FLAG_NONE)
       continue;
@@ -513,7 +639,7 @@ static void rrd_cache_flush(cdtime_t timeout) {
     else if (rc->values_num > 0) {
       int status;
 
-      status = rrd_queue_enqueue(key, &queue_head, &queue_tail);
+      status = rrd_queue_enqueue(w, key, &w->queue_head, &w->queue_tail);
       if (status == 0)
         rc->flags = FLAG_QUEUED;
     } else /* ancient and no values -> waste of memory */
@@ -536,7 +662,7 @@ static void rrd_cache_flush(cdtime_t timeout) {
   c_avl_iterator_destroy(iter);
 
   for (int i = 0; i < keys_num; i++) {
-    if (c_avl_remove(cache, keys[i], (void *)&key, (void *)&rc) != 0) {
+    if (c_avl_remove(shard->tree, keys[i], (void *)&key, (void *)&rc) != 0) {
       DEBUG("rrdtool plugin: c_avl_remove (%s) failed.", keys[i]);
       continue;
     }
@@ -551,18 +677,32 @@ static void rrd_cache_flush(cdtime_t timeout) {
 
   sfree(keys);
 
-  cache_flush_last = now;
+  shard->flush_last = now;
 } /* void rrd_cache_flush */
 
+static void rrd_cache_flush_all(cdtime_t timeout) /* {{{ */
+{
+  for (size_t i = 0; i < RRD_CACHE_SHARDS; i++) {
+    rrd_cache_shard_t *shard = cache_shards + i;
+
+    pthread_mutex_lock(&shard->lock);
+    if (shard->tree != NULL)
+      rrd_cache_flush(shard, timeout);
+    pthread_mutex_unlock(&shard->lock);
+  }
+} /* }}} void rrd_cache_flush_all */
+
 static int rrd_cache_flush_identifier(cdtime_t timeout,
                                       const char *identifier) {
+  rrd_cache_shard_t *shard;
+  rrd_worker_t *w;
   rrd_cache_t *rc;
   cdtime_t now;
   int status;
   char key[2048];
 
   if (identifier == NULL) {
-    rrd_cache_flush(timeout);
+    rrd_cache_flush_all(timeout);
     return 0;
   }
 
@@ -574,8 +714,13 @@ static int rrd_cache_flush_identifier(cdtime_t timeout,
     snprintf(key, sizeof(key), "%s/%s.rrd", datadir, identifier);
   key[sizeof(key) - 1] = 0;
 
-  status = c_avl_get(cache, key, (void *)&rc);
+  shard = rrd_cache_shard(key);
+  w = rrd_worker(shard);
+  pthread_mutex_lock(&shard->lock);
+
+  status = c_avl_get(shard->tree, key, (void *)&rc);
   if (status != 0) {
+    pthread_mutex_unlock(&shard->lock);
     INFO("rrdtool plugin: rrd_cache_flush_identifier: "
          "c_avl_get (%s) failed. Does that file really exist?",
          key);
@@ -585,18 +730,19 @@ static int rrd_cache_flush_identifier(cdtime_t timeout,
   if (rc->flags == FLAG_FLUSHQ) {
     status = 0;
   } else if (rc->flags == FLAG_QUEUED) {
-    rrd_queue_dequeue(key, &queue_head, &queue_tail);
-    status = rrd_queue_enqueue(key, &flushq_head, &flushq_tail);
+    rrd_queue_dequeue(w, key, &w->queue_head, &w->queue_tail);
+    status = rrd_queue_enqueue(w, key, &w->flushq_head, &w->flushq_tail);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   } else if ((now - rc->first_value) < timeout) {
     status = 0;
   } else if (rc->values_num > 0) {
-    status = rrd_queue_enqueue(key, &flushq_head, &flushq_tail);
+    status = rrd_queue_enqueue(w, key, &w->flushq_head, &w->flushq_tail);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
 
+  pthread_mutex_unlock(&shard->lock);
   return status;
 } /* int rrd_cache_flush_identifier */
 
@@ -607,57 +753,82 @@ static int64_t rrd_get_random_variation(void) {
   return (int64_t)cdrand_range(-random_timeout, random_timeout);
 } /* int64_t rrd_get_random_variation */
 
+/* Appends `value' to the entry's buffer, growing it geometrically. */
+static int rrd_cache_append(rrd_cache_t *rc, const char *value) /* {{{ */
+{
+  size_t value_size = strlen(value) + 1;
+
+  if (rc->values_len + value_size > rc->values_size) {
+    size_t new_size = (rc->values_size > 0) ? 2 * rc->values_size : 256;
+    while (new_size < rc->values_len + value_size)
+      new_size *= 2;
+
+    char *tmp = realloc(rc->values, new_size);
+    if (tmp == NULL)
+      return ENOMEM;
+    rc->values = tmp;
+    rc->values_size = new_size;
+  }
+
+  memcpy(rc->values + rc->values_len, value, value_size);
+  rc->values_len += value_size;
+  rc->values_num++;
+  return 0;
+} /* }}} int rrd_cache_append */
+
 static int rrd_cache_insert(const char *filename, const char *value,
-                            cdtime_t value_time) {
+                            cdtime_t value_time, struct stat const *statbuf) {
+  rrd_cache_shard_t *shard;
   rrd_cache_t *rc = NULL;
   int new_rc = 0;
-  char **values_new;
-
-  pthread_mutex_lock(&cache_lock);
 
   /* This shouldn't happen, but it did happen at least once, so we'll be
    * careful. */
-  if (cache == NULL) {
-    pthread_mutex_unlock(&cache_lock);
+  if (cache_shards == NULL) {
     WARNING("rrdtool plugin: cache == NULL.");
     return -1;
   }
 
-  int status = c_avl_get(cache, filename, (void *)&rc);
+  shard = rrd_cache_shard(filename);
+  pthread_mutex_lock(&shard->lock);
+
+  int status = c_avl_get(shard->tree, filename, (void *)&rc);
   if ((status != 0) || (rc == NULL)) {
     rc = malloc(sizeof(*rc));
     if (rc == NULL) {
-      pthread_mutex_unlock(&cache_lock);
+      pthread_mutex_unlock(&shard->lock);
       return -1;
     }
     rc->values_num = 0;
     rc->values = NULL;
+    rc->values_len = 0;
+    rc->values_size = 0;
     rc->first_value = 0;
     rc->last_value = 0;
     rc->random_variation = rrd_get_random_variation();
     rc->flags = FLAG_NONE;
     new_rc = 1;
   }
+  rc->dev = statbuf->st_dev;
+  rc->ino = statbuf->st_ino;
 
   assert(value_time > 0); /* plugin_dispatch() ensures this. */
   if (rc->last_value >= value_time) {
-    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&shard->lock);
     DEBUG("rrdtool plugin: (rc->last_value = %" PRIu64 ") "
           ">= (value_time = %" PRIu64 ")",
           rc->last_value, value_time);
     return -1;
   }
 
-  values_new =
-      realloc((void *)rc->values, (rc->values_num + 1) * sizeof(char *));
-  if (values_new == NULL) {
+  if (rrd_cache_append(rc, value) != 0) {
     char errbuf[1024];
     void *cache_key = NULL;
 
     sstrerror(errno, errbuf, sizeof(errbuf));
 
-    c_avl_remove(cache, filename, &cache_key, NULL);
-    pthread_mutex_unlock(&cache_lock);
+    c_avl_remove(shard->tree, filename, &cache_key, NULL);
+    pthread_mutex_unlock(&shard->lock);
 
     ERROR("rrdtool plugin: realloc failed: %s", errbuf);
 
@@ -666,11 +837,6 @@ static int rrd_cache_insert(const char *filename, const char *value,
     sfree(rc);
     return -1;
   }
-  rc->values = values_new;
-
-  rc->values[rc->values_num] = strdup(value);
-  if (rc->values[rc->values_num] != NULL)
-    rc->values_num++;
 
   if (rc->values_num == 1)
     rc->first_value = value_time;
@@ -684,17 +850,16 @@ static int rrd_cache_insert(const char *filename, const char *value,
       char errbuf[1024];
       sstrerror(errno, errbuf, sizeof(errbuf));
 
-      pthread_mutex_unlock(&cache_lock);
+      pthread_mutex_unlock(&shard->lock);
 
       ERROR("rrdtool plugin: strdup failed: %s", errbuf);
 
-      sfree(rc->values[0]);
       sfree(rc->values);
       sfree(rc);
       return -1;
     }
 
-    c_avl_insert(cache, cache_key, rc);
+    c_avl_insert(shard->tree, cache_key, rc);
   }
 
   DEBUG("rrdtool plugin: rrd_cache_insert: file = %s; "
@@ -704,12 +869,13 @@ static int rrd_cache_insert(const char *filename, const char *value,
 
   if ((rc->last_value - rc->first_value) >=
       (cache_timeout + rc->random_variation)) {
-    /* XXX: If you need to lock both, cache_lock and queue_lock, at
-     * the same time, ALWAYS lock `cache_lock' first! */
+    /* XXX: If you need to lock both, a shard's lock and a worker's lock, at
+     * the same time, ALWAYS lock the shard first! */
     if (rc->flags == FLAG_NONE) {
+      rrd_worker_t *w = rrd_worker(shard);
       int status;
 
-      status = rrd_queue_enqueue(filename, &queue_head, &queue_tail);
+      status = rrd_queue_enqueue(w, filename, &w->queue_head, &w->queue_tail);
       if (status == 0)
         rc->flags = FLAG_QUEUED;
 
@@ -720,10 +886,10 @@ static int rrd_cache_insert(const char *filename, const char *value,
   }
 
   if ((cache_timeout > 0) &&
-      ((cdtime() - cache_flush_last) > cache_flush_timeout))
-    rrd_cache_flush(cache_timeout + random_timeout);
+      ((cdtime() - shard->flush_last) > cache_flush_timeout))
+    rrd_cache_flush(shard, cache_timeout + random_timeout);
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return 0;
 } /* int rrd_cache_insert */
@@ -735,33 +901,42 @@ static int rrd_cache_destroy(void) /* {{{ */
 
   int non_empty = 0;
 
-  pthread_mutex_lock(&cache_lock);
-
-  if (cache == NULL) {
-    pthread_mutex_unlock(&cache_lock);
+  if (cache_shards == NULL)
     return 0;
-  }
 
-  while (c_avl_pick(cache, &key, &value) == 0) {
-    rrd_cache_t *rc;
+  for (size_t i = 0; i < RRD_CACHE_SHARDS; i++) {
+    rrd_cache_shard_t *shard = cache_shards + i;
 
-    sfree(key);
-    key = NULL;
+    /* Only set if rrd_init() got as far as this shard. */
+    if (shard->tree == NULL)
+      continue;
 
-    rc = value;
-    value = NULL;
+    pthread_mutex_lock(&shard->lock);
 
-    if (rc->values_num > 0)
-      non_empty++;
+    while (c_avl_pick(shard->tree, &key, &value) == 0) {
+      rrd_cache_t *rc;
 
-    for (int i = 0; i < rc->values_num; i++)
-      sfree(rc->values[i]);
-    sfree(rc->values);
-    sfree(rc);
+      sfree(key);
+      key = NULL;
+
+      rc = value;
+      value = NULL;
+
+      if (rc->values_num > 0)
+        non_empty++;
+
+      sfree(rc->values);
+      sfree(rc);
+    }
+
+    c_avl_destroy(shard->tree);
+    shard->tree = NULL;
+
+    pthread_mutex_unlock(&shard->lock);
+    pthread_mutex_destroy(&shard->lock);
   }
 
-  c_avl_destroy(cache);
-  cache = NULL;
+  sfree(cache_shards);
 
   if (non_empty > 0) {
     INFO("rrdtool plugin: %i cache %s had values when destroying the cache.",
@@ -771,7 +946,6 @@ static int rrd_cache_destroy(void) /* {{{ */
           "when destroying the cache.");
   }
 
-  pthread_mutex_unlock(&cache_lock);
   return 0;
 } /* }}} int rrd_cache_destroy */
 
@@ -825,21 +999,15 @@ static int rrd_write(const data_set_t *ds, const value_list_t *vl,
     return -1;
   }
 
-  return rrd_cache_insert(filename, values, vl->time);
+  return rrd_cache_insert(filename, values, vl->time, &statbuf);
 } /* int rrd_write */
 
 static int rrd_flush(cdtime_t timeout, const char *identifier,
                      __attribute__((unused)) user_data_t *user_data) {
-  pthread_mutex_lock(&cache_lock);
-
-  if (cache == NULL) {
-    pthread_mutex_unlock(&cache_lock);
+  if (cache_shards == NULL)
     return 0;
-  }
 
   rrd_cache_flush_identifier(timeout, identifier);
-
-  pthread_mutex_unlock(&cache_lock);
   return 0;
 } /* int rrd_flush */
 
@@ -983,6 +1151,26 @@ static int rrd_config(const char *key, const char *value) {
     } else {
       random_timeout = DOUBLE_TO_CDTIME_T(tmp);
     }
+  } else if (strcasecmp("UpdateThreads", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      fprintf(stderr, "rrdtool: `UpdateThreads' must "
+                      "be greater than 0.\n");
+      ERROR("rrdtool: `UpdateThreads' must "
+            "be greater than 0.");
+      return 1;
+    }
+    workers_num = (size_t)tmp;
+  } else if (strcasecmp("UpdateBatchSize", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      fprintf(stderr, "rrdtool: `UpdateBatchSize' must "
+                      "be greater than 0.\n");
+      ERROR("rrdtool: `UpdateBatchSize' must "
+            "be greater than 0.");
+      return 1;
+    }
+    update_batch_size = (size_t)tmp;
   } else {
     return -1;
   }
@@ -990,30 +1178,43 @@ static int rrd_config(const char *key, const char *value) {
 } /* int rrd_config */
 
 static int rrd_shutdown(void) {
-  pthread_mutex_lock(&cache_lock);
-  rrd_cache_flush(0);
-  pthread_mutex_unlock(&cache_lock);
+  _Bool queued = 0;
+
+  if (cache_shards != NULL)
+    rrd_cache_flush_all(0);
 
-  pthread_mutex_lock(&queue_lock);
   do_shutdown = 1;
-  pthread_cond_signal(&queue_cond);
-  pthread_mutex_unlock(&queue_lock);
+  for (size_t i = 0; (workers != NULL) && (i < workers_num); i++) {
+    rrd_worker_t *w = workers + i;
+
+    pthread_mutex_lock(&w->lock);
+    w->shutdown = 1;
+    if ((w->queue_head != NULL) || (w->flushq_head != NULL))
+      queued = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+  }
 
-  if ((queue_thread_running != 0) &&
-      ((queue_head != NULL) || (flushq_head != NULL))) {
-    INFO("rrdtool plugin: Shutting down the queue thread. "
+  if (queued) {
+    INFO("rrdtool plugin: Shutting down the queue threads. "
          "This may take a while.");
-  } else if (queue_thread_running != 0) {
-    INFO("rrdtool plugin: Shutting down the queue thread.");
+  } else if (workers != NULL) {
+    INFO("rrdtool plugin: Shutting down the queue threads.");
   }
 
   /* Wait for all the values to be written to disk before returning. */
-  if (queue_thread_running != 0) {
-    pthread_join(queue_thread, NULL);
-    memset(&queue_thread, 0, sizeof(queue_thread));
-    queue_thread_running = 0;
-    DEBUG("rrdtool plugin: queue_thread exited.");
+  for (size_t i = 0; (workers != NULL) && (i < workers_num); i++) {
+    rrd_worker_t *w = workers + i;
+
+    if (w->thread_running) {
+      pthread_join(w->thread, NULL);
+      w->thread_running = 0;
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
   }
+  sfree(workers);
+  DEBUG("rrdtool plugin: queue threads exited.");
 
   rrd_cache_destroy();
 
@@ -1031,16 +1232,26 @@ static int rrd_init(void) {
     rrdcreate_config.heartbeat = 2 * rrdcreate_config.stepsize;
 
   /* Set the cache up */
-  pthread_mutex_lock(&cache_lock);
-
-  cache = c_avl_create((int (*)(const void *, const void *))strcmp);
-  if (cache == NULL) {
-    pthread_mutex_unlock(&cache_lock);
-    ERROR("rrdtool plugin: c_avl_create failed.");
+  cache_shards = calloc(RRD_CACHE_SHARDS, sizeof(*cache_shards));
+  if (cache_shards == NULL) {
+    ERROR("rrdtool plugin: calloc failed.");
     return -1;
   }
 
-  cache_flush_last = cdtime();
+  cdtime_t now = cdtime();
+  for (size_t i = 0; i < RRD_CACHE_SHARDS; i++) {
+    rrd_cache_shard_t *shard = cache_shards + i;
+
+    shard->tree = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (shard->tree == NULL) {
+      ERROR("rrdtool plugin: c_avl_create failed.");
+      rrd_cache_destroy();
+      return -1;
+    }
+    pthread_mutex_init(&shard->lock, /* attr = */ NULL);
+    shard->flush_last = now;
+  }
+
   if (cache_timeout == 0) {
     random_timeout = 0;
     cache_flush_timeout = 0;
@@ -1060,22 +1271,42 @@ static int rrd_init(void) {
     random_timeout = cache_timeout;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  /* More threads than shards would never get any work. */
+  if (workers_num > RRD_CACHE_SHARDS)
+    workers_num = RRD_CACHE_SHARDS;
 
-  int status =
-      plugin_thread_create(&queue_thread, /* attr = */ NULL, rrd_queue_thread,
-                           /* args = */ NULL, "rrdtool queue");
-  if (status != 0) {
-    ERROR("rrdtool plugin: Cannot create queue-thread.");
+  workers = calloc(workers_num, sizeof(*workers));
+  if (workers == NULL) {
+    ERROR("rrdtool plugin: calloc failed.");
+    rrd_cache_destroy();
     return -1;
   }
-  queue_thread_running = 1;
+
+  for (size_t i = 0; i < workers_num; i++) {
+    rrd_worker_t *w = workers + i;
+    char name[DATA_MAX_NAME_LEN];
+
+    pthread_mutex_init(&w->lock, /* attr = */ NULL);
+    pthread_cond_init(&w->cond, /* attr = */ NULL);
+
+    snprintf(name, sizeof(name), "rrdtool queue%zu", i);
+    int status = plugin_thread_create(&w->thread, /* attr = */ NULL,
+                                      rrd_queue_thread, w, name);
+    if (status != 0) {
+      ERROR("rrdtool plugin: Cannot create queue-thread.");
+      /* Stop the workers started so far and tear the cache down again. */
+      workers_num = i + 1;
+      rrd_shutdown();
+      return -1;
+    }
+    w->thread_running = 1;
+  }
 
   DEBUG("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
-        " heartbeat = %i; rrarows = %i; xff = %lf;",
+        " heartbeat = %i; rrarows = %i; xff = %lf; update threads = %zu;",
         (datadir == NULL) ? "(null)" : datadir, rrdcreate_config.stepsize,
         rrdcreate_config.heartbeat, rrdcreate_config.rrarows,
-        rrdcreate_config.xff);
+        rrdcreate_config.xff, workers_num);
 
   return 0;
 } /* int rrd_init */
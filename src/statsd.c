@@ -24,6 +24,9 @@
  *   Florian octo Forster <octo at collectd.org>
  */
 
+/* _GNU_SOURCE is needed for recvmmsg and struct mmsghdr */
+#define _GNU_SOURCE
+
 #include "collectd.h"
 
 #include "common.h"
@@ -48,6 +51,24 @@
 #define STATSD_DEFAULT_SERVICE "8125"
 #endif
 
+/* Metrics are spread over this many independently locked trees by the hash of
+ * their name, so that several listener threads can update them in
+ * parallel. */
+#ifndef STATSD_SHARDS
+#define STATSD_SHARDS 32
+#endif
+
+/* Maximum number of datagrams read with one recvmmsg(2) call. */
+#ifndef STATSD_RECV_BATCH
+#define STATSD_RECV_BATCH 32
+#endif
+
+#define STATSD_BUFFER_SIZE 4096
+
+/* The listener threads check `network_thread_shutdown' at least this often
+ * (in milliseconds), see statsd_init(). */
+#define STATSD_POLL_TIMEOUT 1000
+
 enum metric_type_e { STATSD_COUNTER, STATSD_TIMER, STATSD_GAUGE, STATSD_SET };
 typedef enum metric_type_e metric_type_t;
 
@@ -61,15 +82,35 @@ struct statsd_metric_s {
 };
 typedef struct statsd_metric_s statsd_metric_t;
 
-static c_avl_tree_t *metrics_tree = NULL;
+struct statsd_shard_s {
+  pthread_mutex_t lock;
+  c_avl_tree_t *tree;
+};
+typedef struct statsd_shard_s statsd_shard_t;
+
+/* Receive buffers of one listener thread. */
+struct statsd_listener_s {
+  char buffers[STATSD_RECV_BATCH][STATSD_BUFFER_SIZE];
+#if HAVE_RECVMMSG
+  struct iovec iovecs[STATSD_RECV_BATCH];
+  struct mmsghdr msgs[STATSD_RECV_BATCH];
+#endif
+};
+typedef struct statsd_listener_s statsd_listener_t;
+
+static statsd_shard_t metrics_shards[STATSD_SHARDS];
+static _Bool metrics_initialized = 0;
+/* Protects metrics_initialized and the creation / destruction of the
+ * shards. The metrics themselves are protected by their shard's lock. */
 static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static pthread_t network_thread;
-static _Bool network_thread_running = 0;
+static pthread_t *network_threads = NULL;
+static size_t network_threads_num = 0;
 static _Bool network_thread_shutdown = 0;
 
 static char *conf_node = NULL;
 static char *conf_service = NULL;
+static int conf_listeners = 1;
 
 static _Bool conf_delete_counters = 0;
 static _Bool conf_delete_timers = 0;
@@ -85,35 +126,28 @@ static _Bool conf_timer_upper = 0;
 static _Bool conf_timer_sum = 0;
 static _Bool conf_timer_count = 0;
 
-/* Must hold metrics_lock when calling this function. */
-static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
-                                                    metric_type_t type) {
-  char key[DATA_MAX_NAME_LEN + 2];
-  char *key_copy;
-  statsd_metric_t *metric;
-  int status;
+/* FNV-1a */
+static uint32_t statsd_hash(char const *key) /* {{{ */
+{
+  uint32_t hash = 2166136261u;
 
-  switch (type) {
-  case STATSD_COUNTER:
-    key[0] = 'c';
-    break;
-  case STATSD_TIMER:
-    key[0] = 't';
-    break;
-  case STATSD_GAUGE:
-    key[0] = 'g';
-    break;
-  case STATSD_SET:
-    key[0] = 's';
-    break;
-  default:
-    return NULL;
+  for (unsigned char const *ptr = (void *)key; *ptr != 0; ptr++) {
+    hash ^= *ptr;
+    hash *= 16777619u;
   }
 
-  key[1] = ':';
-  sstrncpy(&key[2], name, sizeof(key) - 2);
+  return hash;
+} /* }}} uint32_t statsd_hash */
+
+/* Must hold the shard's lock when calling this function. */
+static statsd_metric_t *
+statsd_metric_lookup_unsafe(statsd_shard_t *shard, /* {{{ */
+                            char const *key, metric_type_t type) {
+  char *key_copy;
+  statsd_metric_t *metric;
+  int status;
 
-  status = c_avl_get(metrics_tree, key, (void *)&metric);
+  status = c_avl_get(shard->tree, key, (void *)&metric);
   if (status == 0)
     return metric;
 
@@ -134,7 +168,7 @@ static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
   metric->latency = NULL;
   metric->set = NULL;
 
-  status = c_avl_insert(metrics_tree, key_copy, metric);
+  status = c_avl_insert(shard->tree, key_copy, metric);
   if (status != 0) {
     ERROR("statsd plugin: c_avl_insert failed.");
     sfree(key_copy);
@@ -145,42 +179,78 @@ static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
   return metric;
 } /* }}} statsd_metric_lookup_unsafe */
 
-static int statsd_metric_set(char const *name, double value, /* {{{ */
-                             metric_type_t type) {
+/* Looks up or creates the metric and returns it with its shard locked. The
+ * caller must unlock `*ret_shard'. Returns NULL, with no lock held, on
+ * failure. */
+static statsd_metric_t *statsd_metric_lock(char const *name, /* {{{ */
+                                           metric_type_t type,
+                                           statsd_shard_t **ret_shard) {
+  char key[DATA_MAX_NAME_LEN + 2];
   statsd_metric_t *metric;
 
-  pthread_mutex_lock(&metrics_lock);
+  switch (type) {
+  case STATSD_COUNTER:
+    key[0] = 'c';
+    break;
+  case STATSD_TIMER:
+    key[0] = 't';
+    break;
+  case STATSD_GAUGE:
+    key[0] = 'g';
+    break;
+  case STATSD_SET:
+    key[0] = 's';
+    break;
+  default:
+    return NULL;
+  }
+
+  key[1] = ':';
+  sstrncpy(&key[2], name, sizeof(key) - 2);
 
-  metric = statsd_metric_lookup_unsafe(name, type);
+  statsd_shard_t *shard = metrics_shards + (statsd_hash(key) % STATSD_SHARDS);
+
+  pthread_mutex_lock(&shard->lock);
+  metric = statsd_metric_lookup_unsafe(shard, key, type);
   if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
-    return -1;
+    pthread_mutex_unlock(&shard->lock);
+    return NULL;
   }
 
+  *ret_shard = shard;
+  return metric;
+} /* }}} statsd_metric_t *statsd_metric_lock */
+
+static int statsd_metric_set(char const *name, double value, /* {{{ */
+                             metric_type_t type) {
+  statsd_shard_t *shard;
+  statsd_metric_t *metric;
+
+  metric = statsd_metric_lock(name, type, &shard);
+  if (metric == NULL)
+    return -1;
+
   metric->value = value;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return 0;
 } /* }}} int statsd_metric_set */
 
 static int statsd_metric_add(char const *name, double delta, /* {{{ */
                              metric_type_t type) {
+  statsd_shard_t *shard;
   statsd_metric_t *metric;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_lock(name, type, &shard);
+  if (metric == NULL)
     return -1;
-  }
 
   metric->value += delta;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return 0;
 } /* }}} int statsd_metric_add */
@@ -270,6 +340,7 @@ static int statsd_handle_gauge(char const *name, /* {{{ */
 
 static int statsd_handle_timer(char const *name, /* {{{ */
                                char const *value_str, char const *extra) {
+  statsd_shard_t *shard;
   statsd_metric_t *metric;
   value_t value_ms;
   value_t scale;
@@ -296,62 +367,55 @@ static int statsd_handle_timer(char const *name, /* {{{ */
 
   value = MS_TO_CDTIME_T(value_ms.gauge / scale.gauge);
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, STATSD_TIMER);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_lock(name, STATSD_TIMER, &shard);
+  if (metric == NULL)
     return -1;
-  }
 
   if (metric->latency == NULL)
     metric->latency = latency_counter_create();
   if (metric->latency == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    pthread_mutex_unlock(&shard->lock);
     return -1;
   }
 
   latency_counter_add(metric->latency, value);
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&shard->lock);
   return 0;
 } /* }}} int statsd_handle_timer */
 
 static int statsd_handle_set(char const *name, /* {{{ */
                              char const *set_key_orig) {
+  statsd_shard_t *shard;
   statsd_metric_t *metric = NULL;
   char *set_key;
   int status;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, STATSD_SET);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_lock(name, STATSD_SET, &shard);
+  if (metric == NULL)
     return -1;
-  }
 
   /* Make sure metric->set exists. */
   if (metric->set == NULL)
     metric->set = c_avl_create((int (*)(const void *, const void *))strcmp);
 
   if (metric->set == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    pthread_mutex_unlock(&shard->lock);
     ERROR("statsd plugin: c_avl_create failed.");
     return -1;
   }
 
   set_key = strdup(set_key_orig);
   if (set_key == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    pthread_mutex_unlock(&shard->lock);
     ERROR("statsd plugin: strdup failed.");
     return -1;
   }
 
   status = c_avl_insert(metric->set, set_key, /* value = */ NULL);
   if (status < 0) {
-    pthread_mutex_unlock(&metrics_lock);
+    pthread_mutex_unlock(&shard->lock);
     if (status < 0)
       ERROR("statsd plugin: c_avl_insert (\"%s\") failed with status %i.",
             set_key, status);
@@ -364,7 +428,7 @@ static int statsd_handle_set(char const *name, /* {{{ */
 
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&shard->lock);
   return 0;
 } /* }}} int statsd_handle_set */
 
@@ -438,13 +502,41 @@ static void statsd_parse_buffer(char *buffer) /* {{{ */
   }
 } /* }}} void statsd_parse_buffer */
 
-static void statsd_network_read(int fd) /* {{{ */
+#if HAVE_RECVMMSG
+static void statsd_network_read(statsd_listener_t *l, int fd) /* {{{ */
+{
+  int status;
+
+  /* Keep reading as long as full batches come in. */
+  do {
+    status = recvmmsg(fd, l->msgs, STATSD_RECV_BATCH,
+                      /* flags = */ MSG_DONTWAIT, /* timeout = */ NULL);
+    if (status < 0) {
+      char errbuf[1024];
+
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        return;
+
+      ERROR("statsd plugin: recvmmsg(2) failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      return;
+    }
+
+    for (int i = 0; i < status; i++) {
+      /* iov_len leaves room for the terminating null byte. */
+      l->buffers[i][l->msgs[i].msg_len] = 0;
+      statsd_parse_buffer(l->buffers[i]);
+    }
+  } while (status == STATSD_RECV_BATCH);
+} /* }}} void statsd_network_read */
+#else /* !HAVE_RECVMMSG */
+static void statsd_network_read(statsd_listener_t *l, int fd) /* {{{ */
 {
-  char buffer[4096];
+  char *buffer = l->buffers[0];
   size_t buffer_size;
   ssize_t status;
 
-  status = recv(fd, buffer, sizeof(buffer), /* flags = */ MSG_DONTWAIT);
+  status = recv(fd, buffer, STATSD_BUFFER_SIZE, /* flags = */ MSG_DONTWAIT);
   if (status < 0) {
     char errbuf[1024];
 
@@ -457,12 +549,13 @@ static void statsd_network_read(int fd) /* {{{ */
   }
 
   buffer_size = (size_t)status;
-  if (buffer_size >= sizeof(buffer))
-    buffer_size = sizeof(buffer) - 1;
+  if (buffer_size >= STATSD_BUFFER_SIZE)
+    buffer_size = STATSD_BUFFER_SIZE - 1;
   buffer[buffer_size] = 0;
 
   statsd_parse_buffer(buffer);
 } /* }}} void statsd_network_read */
+#endif /* HAVE_RECVMMSG */
 
 static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
                                size_t *ret_fds_num) {
@@ -509,6 +602,22 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
     DEBUG("statsd plugin: Trying to bind to [%s]:%s ...", dbg_node,
           dbg_service);
 
+#ifdef SO_REUSEPORT
+    /* Every listener thread binds its own sockets; the kernel spreads the
+     * datagrams over them. */
+    if (conf_listeners > 1) {
+      int one = 1;
+      status = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+      if (status != 0) {
+        char errbuf[1024];
+        ERROR("statsd plugin: setsockopt(SO_REUSEPORT) failed: %s",
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+        close(fd);
+        continue;
+      }
+    }
+#endif
+
     status = bind(fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     if (status != 0) {
       char errbuf[1024];
@@ -552,14 +661,31 @@ static void *statsd_network_thread(void *args) /* {{{ */
   size_t fds_num = 0;
   int status;
 
+  statsd_listener_t *l = malloc(sizeof(*l));
+  if (l == NULL) {
+    ERROR("statsd plugin: malloc failed.");
+    pthread_exit((void *)0);
+  }
+
+#if HAVE_RECVMMSG
+  memset(l->msgs, 0, sizeof(l->msgs));
+  for (size_t i = 0; i < STATSD_RECV_BATCH; i++) {
+    l->iovecs[i].iov_base = l->buffers[i];
+    l->iovecs[i].iov_len = STATSD_BUFFER_SIZE - 1;
+    l->msgs[i].msg_hdr.msg_iov = &l->iovecs[i];
+    l->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+#endif
+
   status = statsd_network_init(&fds, &fds_num);
   if (status != 0) {
     ERROR("statsd plugin: Unable to open listening sockets.");
+    sfree(l);
     pthread_exit((void *)0);
   }
 
   while (!network_thread_shutdown) {
-    status = poll(fds, (nfds_t)fds_num, /* timeout = */ -1);
+    status = poll(fds, (nfds_t)fds_num, STATSD_POLL_TIMEOUT);
     if (status < 0) {
       char errbuf[1024];
 
@@ -575,7 +701,7 @@ static void *statsd_network_thread(void *args) /* {{{ */
       if ((fds[i].revents & (POLLIN | POLLPRI)) == 0)
         continue;
 
-      statsd_network_read(fds[i].fd);
+      statsd_network_read(l, fds[i].fd);
       fds[i].revents = 0;
     }
   } /* while (!network_thread_shutdown) */
@@ -584,6 +710,7 @@ static void *statsd_network_thread(void *args) /* {{{ */
   for (size_t i = 0; i < fds_num; i++)
     close(fds[i].fd);
   sfree(fds);
+  sfree(l);
 
   return (void *)0;
 } /* }}} void *statsd_network_thread */
@@ -628,6 +755,8 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_string(child, &conf_node);
     else if (strcasecmp("Port", child->key) == 0)
       cf_util_get_service(child, &conf_service);
+    else if (strcasecmp("Listeners", child->key) == 0)
+      cf_util_get_int(child, &conf_listeners);
     else if (strcasecmp("DeleteCounters", child->key) == 0)
       cf_util_get_boolean(child, &conf_delete_counters);
     else if (strcasecmp("DeleteTimers", child->key) == 0)
@@ -653,37 +782,114 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
             child->key);
   }
 
+  if (conf_listeners < 1) {
+    WARNING("statsd plugin: \"Listeners\" must be at least 1.");
+    conf_listeners = 1;
+  }
+#ifndef SO_REUSEPORT
+  if (conf_listeners > 1) {
+    WARNING("statsd plugin: \"Listeners\" requires SO_REUSEPORT, which is "
+            "not available on this system. Using a single listener.");
+    conf_listeners = 1;
+  }
+#endif
+
   return 0;
 } /* }}} int statsd_config */
 
+/* Must hold metrics_lock when calling this function. */
+static void statsd_metrics_destroy_unsafe(void) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (!metrics_initialized)
+    return;
+
+  for (size_t i = 0; i < STATSD_SHARDS; i++) {
+    statsd_shard_t *shard = metrics_shards + i;
+
+    pthread_mutex_lock(&shard->lock);
+    while (c_avl_pick(shard->tree, &key, &value) == 0) {
+      sfree(key);
+      statsd_metric_free(value);
+    }
+    c_avl_destroy(shard->tree);
+    shard->tree = NULL;
+    pthread_mutex_unlock(&shard->lock);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  metrics_initialized = 0;
+} /* }}} void statsd_metrics_destroy_unsafe */
+
 static int statsd_init(void) /* {{{ */
 {
   pthread_mutex_lock(&metrics_lock);
-  if (metrics_tree == NULL)
-    metrics_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
-
-  if (!network_thread_running) {
-    int status;
+  if (!metrics_initialized) {
+    for (size_t i = 0; i < STATSD_SHARDS; i++) {
+      statsd_shard_t *shard = metrics_shards + i;
+
+      pthread_mutex_init(&shard->lock, /* attr = */ NULL);
+      shard->tree =
+          c_avl_create((int (*)(const void *, const void *))strcmp);
+      if (shard->tree == NULL) {
+        ERROR("statsd plugin: c_avl_create failed.");
+        /* Undo the shards set up so far. Their trees are still empty. */
+        for (size_t j = 0; j < i; j++) {
+          c_avl_destroy(metrics_shards[j].tree);
+          metrics_shards[j].tree = NULL;
+          pthread_mutex_destroy(&metrics_shards[j].lock);
+        }
+        pthread_mutex_destroy(&shard->lock);
+        pthread_mutex_unlock(&metrics_lock);
+        return -1;
+      }
+    }
+    metrics_initialized = 1;
+  }
 
-    status = pthread_create(&network_thread,
-                            /* attr = */ NULL, statsd_network_thread,
-                            /* args = */ NULL);
-    if (status != 0) {
-      char errbuf[1024];
+  if (network_threads == NULL) {
+    network_threads = calloc((size_t)conf_listeners, sizeof(*network_threads));
+    if (network_threads == NULL) {
+      statsd_metrics_destroy_unsafe();
       pthread_mutex_unlock(&metrics_lock);
-      ERROR("statsd plugin: pthread_create failed: %s",
-            sstrerror(errno, errbuf, sizeof(errbuf)));
-      return status;
+      ERROR("statsd plugin: calloc failed.");
+      return -1;
+    }
+
+    while (network_threads_num < (size_t)conf_listeners) {
+      int status = pthread_create(network_threads + network_threads_num,
+                                  /* attr = */ NULL, statsd_network_thread,
+                                  /* args = */ NULL);
+      if (status != 0) {
+        char errbuf[1024];
+        ERROR("statsd plugin: pthread_create failed: %s",
+              sstrerror(status, errbuf, sizeof(errbuf)));
+
+        /* Stop the threads started so far. Unlike statsd_shutdown(), don't
+         * signal them: the signal would reach the daemon's SIGTERM handler.
+         * They notice the flag within STATSD_POLL_TIMEOUT instead. */
+        network_thread_shutdown = 1;
+        for (size_t i = 0; i < network_threads_num; i++)
+          pthread_join(network_threads[i], /* retval = */ NULL);
+        sfree(network_threads);
+        network_threads_num = 0;
+        network_thread_shutdown = 0;
+
+        statsd_metrics_destroy_unsafe();
+        pthread_mutex_unlock(&metrics_lock);
+        return status;
+      }
+      network_threads_num++;
     }
   }
-  network_thread_running = 1;
 
   pthread_mutex_unlock(&metrics_lock);
 
   return 0;
 } /* }}} int statsd_init */
 
-/* Must hold metrics_lock when calling this function. */
+/* Must hold the shard's lock when calling this function. */
 static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
 {
   void *key;
@@ -703,7 +909,7 @@ static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
   return 0;
 } /* }}} int statsd_metric_clear_set_unsafe */
 
-/* Must hold metrics_lock when calling this function. */
+/* Must hold the shard's lock when calling this function. */
 static int statsd_metric_submit_unsafe(char const *name,
                                        statsd_metric_t *metric) /* {{{ */
 {
@@ -819,7 +1025,8 @@ static int statsd_metric_submit_unsafe(char const *name,
   return plugin_dispatch_values(&vl);
 } /* }}} int statsd_metric_submit_unsafe */
 
-static int statsd_read(void) /* {{{ */
+/* Dispatches and resets all metrics of one shard. */
+static void statsd_read_shard(statsd_shard_t *shard) /* {{{ */
 {
   c_avl_iterator_t *iter;
   char *name;
@@ -828,14 +1035,9 @@ static int statsd_read(void) /* {{{ */
   char **to_be_deleted = NULL;
   size_t to_be_deleted_num = 0;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  if (metrics_tree == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
-    return 0;
-  }
+  pthread_mutex_lock(&shard->lock);
 
-  iter = c_avl_get_iterator(metrics_tree);
+  iter = c_avl_get_iterator(shard->tree);
   while (c_avl_iterator_next(iter, (void *)&name, (void *)&metric) == 0) {
     if ((metric->updates_num == 0) &&
         ((conf_delete_counters && (metric->type == STATSD_COUNTER)) ||
@@ -861,7 +1063,7 @@ static int statsd_read(void) /* {{{ */
   for (size_t i = 0; i < to_be_deleted_num; i++) {
     int status;
 
-    status = c_avl_remove(metrics_tree, to_be_deleted[i], (void *)&name,
+    status = c_avl_remove(shard->tree, to_be_deleted[i], (void *)&name,
                           (void *)&metric);
     if (status != 0) {
       ERROR("stats plugin: c_avl_remove (\"%s\") failed with status %i.",
@@ -873,33 +1075,43 @@ static int statsd_read(void) /* {{{ */
     statsd_metric_free(metric);
   }
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   strarray_free(to_be_deleted, to_be_deleted_num);
+} /* }}} void statsd_read_shard */
+
+static int statsd_read(void) /* {{{ */
+{
+  pthread_mutex_lock(&metrics_lock);
+
+  if (!metrics_initialized) {
+    pthread_mutex_unlock(&metrics_lock);
+    return 0;
+  }
+
+  /* The listener threads keep updating the other shards while one is being
+   * read. */
+  for (size_t i = 0; i < STATSD_SHARDS; i++)
+    statsd_read_shard(metrics_shards + i);
+
+  pthread_mutex_unlock(&metrics_lock);
 
   return 0;
 } /* }}} int statsd_read */
 
 static int statsd_shutdown(void) /* {{{ */
 {
-  void *key;
-  void *value;
-
-  if (network_thread_running) {
-    network_thread_shutdown = 1;
-    pthread_kill(network_thread, SIGTERM);
-    pthread_join(network_thread, /* retval = */ NULL);
-  }
-  network_thread_running = 0;
+  network_thread_shutdown = 1;
+  for (size_t i = 0; i < network_threads_num; i++)
+    pthread_kill(network_threads[i], SIGTERM);
+  for (size_t i = 0; i < network_threads_num; i++)
+    pthread_join(network_threads[i], /* retval = */ NULL);
+  sfree(network_threads);
+  network_threads_num = 0;
 
   pthread_mutex_lock(&metrics_lock);
 
-  while (c_avl_pick(metrics_tree, &key, &value) == 0) {
-    sfree(key);
-    statsd_metric_free(value);
-  }
-  c_avl_destroy(metrics_tree);
-  metrics_tree = NULL;
+  statsd_metrics_destroy_unsafe();
 
   sfree(conf_node);
   sfree(conf_service);
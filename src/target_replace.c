@@ -550,6 +550,9 @@ static int tr_invoke(const data_set_t *ds, value_list_t *vl, /* {{{ */
   /* HANDLE_FIELD (type, 0); */
   HANDLE_FIELD(type_instance, 1);
 
+  /* The identity may have changed; let consumers rehash it. */
+  vl->series_id = 0;
+
   return FC_TARGET_CONTINUE;
 } /* }}} int tr_invoke */
 
@@ -403,6 +403,9 @@ static int ts_invoke(const data_set_t *ds, value_list_t *vl, /* {{{ */
   /* SUBST_FIELD (type); */
   SUBST_FIELD(type_instance);
 
+  /* The identity may have changed; let consumers rehash it. */
+  vl->series_id = 0;
+
   /* Need to merge the metadata in now, because of the shallow copy. */
   if (new_meta != NULL) {
     meta_data_clone_merge(&(vl->meta), new_meta);
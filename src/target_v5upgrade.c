@@ -40,6 +40,7 @@ static void v5_swap_instances(value_list_t *vl) /* {{{ */
   memcpy(tmp, vl->plugin_instance, sizeof(tmp));
   memcpy(vl->plugin_instance, vl->type_instance, sizeof(tmp));
   memcpy(vl->type_instance, tmp, sizeof(tmp));
+  vl->series_id = 0;
 } /* }}} void v5_swap_instances */
 
 /*
@@ -24,10 +24,14 @@
  *   Florian octo Forster <octo at collectd.org>
  **/
 
+/* _GNU_SOURCE is needed for fopencookie and accept4 */
+#define _GNU_SOURCE
+
 #include "collectd.h"
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_complain.h"
 
 #include "utils_cmd_flush.h"
 #include "utils_cmd_getthreshold.h"
@@ -36,6 +40,7 @@
 #include "utils_cmd_putnotif.h"
 #include "utils_cmd_putval.h"
 #include "utils_cmd_putinsight.h"
+#include "utils_cmd_query.h"
 #include "unixsock.h"
 
 #include <sys/stat.h>
@@ -43,12 +48,65 @@
 
 #include <grp.h>
 
+/* Connections are served by a pool of workers waiting on an epoll instance
+ * where available. Elsewhere, every connection gets its own thread. */
+#if HAVE_SYS_EPOLL_H && HAVE_FOPENCOOKIE && HAVE_ACCEPT4
+#define US_USE_EPOLL 1
+#include <sys/epoll.h>
+#else
+#define US_USE_EPOLL 0
+#endif
+
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)0)->sun_path)
 #endif
 
 #define US_DEFAULT_PATH LOCALSTATEDIR "/run/" PACKAGE_NAME "-unixsock"
 
+#define US_DEFAULT_THREADS 2
+/* Initial size of a connection's input buffer. */
+#define US_BUFFER_SIZE 4096
+/* Buffers larger than this are released when a connection becomes idle, so
+ * that one large LISTVAL does not pin memory for the connection's lifetime. */
+#define US_BUFFER_KEEP 65536
+/* Longest command accepted, same as the old fgets() buffer. */
+#define US_MAX_LINE (1 << 20)
+/* Bytes handled per wakeup before a busy connection yields its worker. */
+#define US_READ_BUDGET 65536
+
+/*
+ * Private data types
+ */
+#if US_USE_EPOLL
+struct us_conn_s;
+typedef struct us_conn_s us_conn_t;
+struct us_conn_s {
+  int fd;
+
+  /* Received bytes that do not form a complete line yet. One extra byte is
+   * always allocated, so the last line can be terminated in place. */
+  char *in;
+  size_t in_fill;
+  size_t in_size;
+
+  /* Replies not yet written to the socket. The command handlers print to
+   * `fh', which appends to this buffer. */
+  FILE *fh;
+  char *out;
+  size_t out_fill;
+  size_t out_sent;
+  size_t out_size;
+
+  _Bool closing;
+
+  /* Collects the payload lines of a PUTINSIGHTS command. */
+  cmd_putinsights_t putinsights;
+
+  us_conn_t *prev;
+  us_conn_t *next;
+};
+#endif /* US_USE_EPOLL */
+
 /*
  * Private variables
  */
@@ -61,8 +119,25 @@ static char *sock_file = NULL;
 static char *sock_group = NULL;
 static int sock_perms = S_IRWXU | S_IRWXG;
 static _Bool delete_socket = 1;
-
+static int sock_threads = US_DEFAULT_THREADS;
+
+static _Bool server_running = 0;
+
+#if US_USE_EPOLL
+/* All workers wait on `epoll_fd'. Every descriptor is registered with
+ * EPOLLONESHOT, so a connection is only ever handled by one worker at a time
+ * and needs no locking of its own. */
+static int epoll_fd = -1;
+static int wakeup_fd[2] = {-1, -1};
+static pthread_t *worker_threads = NULL;
+static size_t worker_threads_num = 0;
+
+/* Open connections, only needed to free them on shutdown. */
+static us_conn_t *conn_list = NULL;
+static pthread_mutex_t conn_list_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
 static pthread_t listen_thread = (pthread_t)0;
+#endif
 
 /*
  * Functions
@@ -71,7 +146,11 @@ static int us_open_socket(void) {
   struct sockaddr_un sa = {0};
   int status;
 
+#if US_USE_EPOLL
+  sock_fd = socket(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+#else
   sock_fd = socket(PF_UNIX, SOCK_STREAM, 0);
+#endif
   if (sock_fd < 0) {
     char errbuf[1024];
     ERROR("unixsock plugin: socket failed: %s",
@@ -118,7 +197,8 @@ static int us_open_socket(void) {
     return -1;
   }
 
-  status = listen(sock_fd, 8);
+  /* Clients open many short-lived connections; give the backlog some room. */
+  status = listen(sock_fd, 128);
   if (status != 0) {
     char errbuf[1024];
     ERROR("unixsock plugin: listen failed: %s",
@@ -131,6 +211,495 @@ static int us_open_socket(void) {
   return 0;
 } /* int us_open_socket */
 
+/* Handles one line received on a connection. `putinsights' holds the state of
+ * the connection's PUTINSIGHTS command, if any. */
+static void us_handle_command(FILE *fh, cmd_putinsights_t *putinsights,
+                              char *line, size_t len) {
+  while ((len > 0) && (line[len - 1] == '\r'))
+    line[--len] = 0;
+
+  /* Payload lines of a PUTINSIGHTS command are not commands themselves. */
+  if (putinsights->expected > 0) {
+    if (len > 0)
+      cmd_putinsights_append(fh, putinsights, line, len);
+    return;
+  }
+
+  /* Find the command name in place; the handlers parse the line themselves. */
+  char *cmd = line;
+  while ((*cmd == ' ') || (*cmd == '\t'))
+    cmd++;
+  size_t cmd_len = strcspn(cmd, " \t");
+  if (cmd_len == 0)
+    return;
+
+#define US_IS_CMD(name)                                                        \
+  ((cmd_len == sizeof(name) - 1) && (strncasecmp(cmd, name, cmd_len) == 0))
+
+  if (US_IS_CMD("getval")) {
+    cmd_handle_getval(fh, line);
+  } else if (US_IS_CMD("getthreshold")) {
+    handle_getthreshold(fh, line);
+  } else if (US_IS_CMD("putval")) {
+    cmd_handle_putval(fh, line);
+  } else if (US_IS_CMD("listval")) {
+    cmd_handle_listval(fh, line);
+  } else if (US_IS_CMD("putnotif")) {
+    handle_putnotif(fh, line);
+  } else if (US_IS_CMD("flush")) {
+    cmd_handle_flush(fh, line);
+  } else if (US_IS_CMD("query")) {
+    cmd_handle_query(fh, line);
+  } else if (US_IS_CMD("putinsight")) {
+    cmd_handle_putinsight(fh, line + 10); // skip over the putinsight part
+  } else if (US_IS_CMD("putinsights")) {
+    cmd_handle_putinsights(fh, line, putinsights);
+  } else if (US_IS_CMD("reloadinsights")) {
+    cmd_handle_reloadinsights(fh);
+  } else {
+    fprintf(fh, "-1 Unknown command: %.*s\n", (int)cmd_len, cmd);
+  }
+
+#undef US_IS_CMD
+} /* void us_handle_command */
+
+#if US_USE_EPOLL
+
+/* Write callback of a connection's `fh'. */
+static ssize_t us_conn_write(void *cookie, const char *buf, size_t size) {
+  us_conn_t *conn = cookie;
+
+  if (conn->out_fill + size > conn->out_size) {
+    size_t new_size = (conn->out_size > 0) ? conn->out_size : US_BUFFER_SIZE;
+    while (new_size < conn->out_fill + size)
+      new_size *= 2;
+
+    char *tmp = realloc(conn->out, new_size);
+    if (tmp == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    conn->out = tmp;
+    conn->out_size = new_size;
+  }
+
+  memcpy(conn->out + conn->out_fill, buf, size);
+  conn->out_fill += size;
+  return (ssize_t)size;
+} /* ssize_t us_conn_write */
+
+static us_conn_t *us_conn_create(int fd) {
+  us_conn_t *conn = calloc(1, sizeof(*conn));
+  if (conn == NULL)
+    return NULL;
+  conn->fd = fd;
+
+  conn->fh = fopencookie(conn, "w", (cookie_io_functions_t){
+                                        .write = us_conn_write,
+                                    });
+  if (conn->fh == NULL) {
+    sfree(conn);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&conn_list_lock);
+  conn->next = conn_list;
+  if (conn_list != NULL)
+    conn_list->prev = conn;
+  conn_list = conn;
+  pthread_mutex_unlock(&conn_list_lock);
+
+  return conn;
+} /* us_conn_t *us_conn_create */
+
+static void us_conn_destroy(us_conn_t *conn) {
+  if (conn == NULL)
+    return;
+
+  pthread_mutex_lock(&conn_list_lock);
+  if (conn->prev != NULL)
+    conn->prev->next = conn->next;
+  else
+    conn_list = conn->next;
+  if (conn->next != NULL)
+    conn->next->prev = conn->prev;
+  pthread_mutex_unlock(&conn_list_lock);
+
+  DEBUG("unixsock plugin: Closing connection on fd #%i", conn->fd);
+
+  /* Closing the descriptor also removes it from the epoll set. */
+  if (conn->putinsights.expected > 0)
+    WARNING("unixsock plugin: Connection on fd #%i closed with %zu "
+            "PUTINSIGHTS lines outstanding; dropping the batch.",
+            conn->fd, conn->putinsights.expected);
+  cmd_destroy_putinsights(&conn->putinsights);
+
+  close(conn->fd);
+  fclose(conn->fh);
+  sfree(conn->in);
+  sfree(conn->out);
+  sfree(conn);
+} /* void us_conn_destroy */
+
+/* Sends buffered replies. Returns zero when everything has been sent, EAGAIN
+ * if the socket is full and an error number otherwise. */
+static int us_conn_send(us_conn_t *conn) {
+  fflush(conn->fh);
+
+  while (conn->out_sent < conn->out_fill) {
+    ssize_t status = send(conn->fd, conn->out + conn->out_sent,
+                          conn->out_fill - conn->out_sent, MSG_NOSIGNAL);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return EAGAIN;
+      return errno;
+    }
+    conn->out_sent += (size_t)status;
+  }
+
+  conn->out_fill = 0;
+  conn->out_sent = 0;
+  if (conn->out_size > US_BUFFER_KEEP) {
+    sfree(conn->out);
+    conn->out_size = 0;
+  }
+
+  return 0;
+} /* int us_conn_send */
+
+
+/* Handles all complete lines in the input buffer. With `eof' set, a trailing
+ * line without newline is handled, too. */
+static int us_conn_process(us_conn_t *conn, _Bool eof) {
+  char *start = conn->in;
+  char *end = conn->in + conn->in_fill;
+  char *newline;
+
+  if (conn->in == NULL)
+    return 0;
+
+  while ((newline = memchr(start, '\n', (size_t)(end - start))) != NULL) {
+    *newline = 0;
+    us_handle_command(conn->fh, &conn->putinsights, start,
+                      (size_t)(newline - start));
+    start = newline + 1;
+  }
+
+  if (eof && (start < end)) {
+    *end = 0;
+    us_handle_command(conn->fh, &conn->putinsights, start,
+                      (size_t)(end - start));
+    start = end;
+  }
+
+  conn->in_fill = (size_t)(end - start);
+  if (conn->in_fill > 0)
+    memmove(conn->in, start, conn->in_fill);
+
+  if (conn->in_fill >= US_MAX_LINE) {
+    WARNING("unixsock plugin: Command on fd #%i exceeds %i bytes; closing "
+            "the connection.",
+            conn->fd, US_MAX_LINE);
+    fprintf(conn->fh, "-1 Command too long\n");
+    return EMSGSIZE;
+  }
+
+  if ((conn->in_fill == 0) && (conn->in_size > US_BUFFER_KEEP)) {
+    sfree(conn->in);
+    conn->in_size = 0;
+  }
+
+  return 0;
+} /* int us_conn_process */
+
+/* Reads and handles input until the socket is drained or the budget is used
+ * up. Returns zero if the connection stays open. */
+static int us_conn_receive(us_conn_t *conn) {
+  size_t budget = US_READ_BUDGET;
+
+  while (budget > 0) {
+    if (conn->in_fill == conn->in_size) {
+      size_t new_size = (conn->in_size > 0) ? 2 * conn->in_size
+                                            : US_BUFFER_SIZE;
+      if (new_size > US_MAX_LINE)
+        new_size = US_MAX_LINE;
+
+      char *tmp = realloc(conn->in, new_size + 1);
+      if (tmp == NULL) {
+        ERROR("unixsock plugin: realloc failed.");
+        return ENOMEM;
+      }
+      conn->in = tmp;
+      conn->in_size = new_size;
+    }
+
+    ssize_t status =
+        read(conn->fd, conn->in + conn->in_fill, conn->in_size - conn->in_fill);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return 0;
+
+      char errbuf[1024];
+      WARNING("unixsock plugin: failed to read from socket #%i: %s", conn->fd,
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+      return errno;
+    } else if (status == 0) {
+      /* The peer may still read our replies after shutting down its end. */
+      conn->closing = 1;
+      return us_conn_process(conn, /* eof = */ 1);
+    }
+
+    conn->in_fill += (size_t)status;
+    budget -= ((size_t)status < budget) ? (size_t)status : budget;
+
+    int ret = us_conn_process(conn, /* eof = */ 0);
+    if (ret != 0)
+      return ret;
+  }
+
+  return 0;
+} /* int us_conn_receive */
+
+static void us_conn_handle(us_conn_t *conn, uint32_t events) {
+  int status = 0;
+
+  if (!conn->closing && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+    status = us_conn_receive(conn);
+
+  if (status == EMSGSIZE) {
+    /* Tell the client why we give up, but do not wait for it to read. */
+    (void)us_conn_send(conn);
+    us_conn_destroy(conn);
+    return;
+  } else if (status != 0) {
+    us_conn_destroy(conn);
+    return;
+  }
+
+  status = us_conn_send(conn);
+  if ((status != 0) && (status != EAGAIN)) {
+    us_conn_destroy(conn);
+    return;
+  }
+
+  if (conn->closing && (status == 0)) {
+    us_conn_destroy(conn);
+    return;
+  }
+
+  /* Stop reading while replies are pending, so that a client which does not
+   * read its replies cannot make us buffer without bounds. */
+  struct epoll_event ev = {
+      .events = EPOLLONESHOT | ((status == EAGAIN) ? EPOLLOUT : EPOLLIN),
+      .data.ptr = conn,
+  };
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) != 0) {
+    char errbuf[1024];
+    ERROR("unixsock plugin: epoll_ctl failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    us_conn_destroy(conn);
+  }
+} /* void us_conn_handle */
+
+static void us_accept(void) {
+  static c_complain_t accept_complaint = C_COMPLAIN_INIT_STATIC;
+
+  while (loop != 0) {
+    int fd = accept4(sock_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+      if (errno == ECONNABORTED)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+
+      if ((errno == EMFILE) || (errno == ENFILE) || (errno == ENOBUFS) ||
+          (errno == ENOMEM)) {
+        /* Keep serving the existing connections and retry later, without
+         * spinning on the still readable listening socket. */
+        c_complain(LOG_ERR, &accept_complaint,
+                   "unixsock plugin: accept failed: %s",
+                   sstrerror(errno, errbuf, sizeof(errbuf)));
+        nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000000},
+                  NULL);
+        break;
+      }
+
+      ERROR("unixsock plugin: accept failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      return;
+    }
+    c_release(LOG_INFO, &accept_complaint,
+              "unixsock plugin: accept succeeded again.");
+
+    us_conn_t *conn = us_conn_create(fd);
+    if (conn == NULL) {
+      ERROR("unixsock plugin: us_conn_create failed.");
+      close(fd);
+      continue;
+    }
+
+    DEBUG("unixsock plugin: Accepted connection on fd #%i", fd);
+
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLONESHOT, .data.ptr = conn,
+    };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      char errbuf[1024];
+      ERROR("unixsock plugin: epoll_ctl failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      us_conn_destroy(conn);
+    }
+  } /* while (loop) */
+
+  struct epoll_event ev = {
+      .events = EPOLLIN | EPOLLONESHOT, .data.ptr = &sock_fd,
+  };
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock_fd, &ev) != 0) {
+    char errbuf[1024];
+    ERROR("unixsock plugin: epoll_ctl failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+  }
+} /* void us_accept */
+
+static void *us_worker_thread(void __attribute__((unused)) * arg) {
+  while (loop != 0) {
+    struct epoll_event ev;
+
+    int status = epoll_wait(epoll_fd, &ev, 1, -1);
+    if (status < 0) {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+
+      ERROR("unixsock plugin: epoll_wait failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      break;
+    } else if (status == 0) {
+      continue;
+    }
+
+    if (ev.data.ptr == wakeup_fd) /* shutdown */
+      continue;
+    else if (ev.data.ptr == &sock_fd)
+      us_accept();
+    else
+      us_conn_handle(ev.data.ptr, ev.events);
+  } /* while (loop) */
+
+  return (void *)0;
+} /* void *us_worker_thread */
+
+static void us_close_server(void) {
+  if (epoll_fd >= 0) {
+    close(epoll_fd);
+    epoll_fd = -1;
+  }
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(wakeup_fd); i++) {
+    if (wakeup_fd[i] >= 0) {
+      close(wakeup_fd[i]);
+      wakeup_fd[i] = -1;
+    }
+  }
+  if (sock_fd >= 0) {
+    close(sock_fd);
+    sock_fd = -1;
+  }
+} /* void us_close_server */
+
+static int us_start_server(void) {
+  if (us_open_socket() != 0)
+    return -1;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    char errbuf[1024];
+    ERROR("unixsock plugin: epoll_create1 failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    us_close_server();
+    return -1;
+  }
+
+  if (pipe(wakeup_fd) != 0) {
+    char errbuf[1024];
+    ERROR("unixsock plugin: pipe failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    wakeup_fd[0] = wakeup_fd[1] = -1;
+    us_close_server();
+    return -1;
+  }
+
+  /* The wakeup pipe is level-triggered and never drained, so once written to
+   * it wakes every worker. */
+  struct epoll_event ev_wakeup = {.events = EPOLLIN, .data.ptr = wakeup_fd};
+  struct epoll_event ev_listen = {
+      .events = EPOLLIN | EPOLLONESHOT, .data.ptr = &sock_fd,
+  };
+  if ((epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd[0], &ev_wakeup) != 0) ||
+      (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev_listen) != 0)) {
+    char errbuf[1024];
+    ERROR("unixsock plugin: epoll_ctl failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    us_close_server();
+    return -1;
+  }
+
+  worker_threads = calloc((size_t)sock_threads, sizeof(*worker_threads));
+  if (worker_threads == NULL) {
+    ERROR("unixsock plugin: calloc failed.");
+    us_close_server();
+    return -1;
+  }
+
+  for (int i = 0; i < sock_threads; i++) {
+    int status = plugin_thread_create(worker_threads + worker_threads_num,
+                                      NULL, us_worker_thread, NULL,
+                                      "unixsock");
+    if (status != 0) {
+      char errbuf[1024];
+      ERROR("unixsock plugin: pthread_create failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      break;
+    }
+    worker_threads_num++;
+  }
+
+  if (worker_threads_num == 0) {
+    sfree(worker_threads);
+    us_close_server();
+    return -1;
+  }
+
+  return 0;
+} /* int us_start_server */
+
+static void us_stop_server(void) {
+  /* Wake up all workers blocked in epoll_wait(). */
+  if (write(wakeup_fd[1], "", 1) != 1) {
+    char errbuf[1024];
+    ERROR("unixsock plugin: write to wakeup pipe failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+  }
+
+  for (size_t i = 0; i < worker_threads_num; i++)
+    pthread_join(worker_threads[i], NULL);
+  sfree(worker_threads);
+  worker_threads_num = 0;
+
+  while (conn_list != NULL)
+    us_conn_destroy(conn_list);
+
+  us_close_server();
+} /* void us_stop_server */
+#else /* !US_USE_EPOLL */
 static void *us_handle_client(void *arg) {
   int fdin;
   int fdout;
@@ -148,7 +717,7 @@ static void *us_handle_client(void *arg) {
     ERROR("unixsock plugin: dup failed: %s",
           sstrerror(errno, errbuf, sizeof(errbuf)));
     close(fdin);
-    pthread_exit((void *)1);
+    return (void *)1;
   }
 
   fhin = fdopen(fdin, "r");
@@ -158,7 +727,6 @@ static void *us_handle_client(void *arg) {
           sstrerror(errno, errbuf, sizeof(errbuf)));
     close(fdin);
     close(fdout);
-    pthread_exit((void *)1);
     return (void *)1;
   }
 
@@ -169,40 +737,24 @@ static void *us_handle_client(void *arg) {
           sstrerror(errno, errbuf, sizeof(errbuf)));
     fclose(fhin); /* this closes fdin as well */
     close(fdout);
-    pthread_exit((void *)1);
     return (void *)1;
   }
 
-  /* change output buffer to line buffered mode */
-  if (setvbuf(fhout, NULL, _IOLBF, 0) != 0) {
-    char errbuf[1024];
-    ERROR("unixsock plugin: setvbuf failed: %s",
-          sstrerror(errno, errbuf, sizeof(errbuf)));
+  /* The output buffer is line buffered, so every reply is sent right away. */
+  char *buffer = malloc(US_MAX_LINE);
+  if ((setvbuf(fhout, NULL, _IOLBF, 0) != 0) || (buffer == NULL)) {
+    ERROR("unixsock plugin: Setting up the connection failed.");
     fclose(fhin);
     fclose(fhout);
-    pthread_exit((void *)1);
-    return (void *)0;
+    sfree(buffer);
+    return (void *)1;
   }
 
-  int limit = 1 << 20; //1MB Limit
-  char *buffer = malloc(limit);
-  char *buffer_copy = malloc(limit);
-
-  if (!buffer || !buffer_copy) {
-     ERROR("unixsock plugin: buffer allocation failed");
-     fclose(fhin);
-     fclose(fhout);
-     pthread_exit((void *)1);
-     return (void *)0;
-  }
+  cmd_putinsights_t putinsights = {0};
 
   while (42) {
-    char *fields[128];
-    int fields_num;
-    int len;
-
     errno = 0;
-    if (fgets(buffer, limit, fhin) == NULL) {
+    if (fgets(buffer, US_MAX_LINE, fhin) == NULL) {
       if ((errno == EINTR) || (errno == EAGAIN))
         continue;
 
@@ -214,76 +766,30 @@ static void *us_handle_client(void *arg) {
       break;
     }
 
-    len = strlen(buffer);
-    while ((len > 0) &&
-           ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-      buffer[--len] = '\0';
-
-    if (len == 0)
-      continue;
-
-    sstrncpy(buffer_copy, buffer, limit);
-
-    fields_num =
-        strsplit(buffer_copy, fields, sizeof(fields) / sizeof(fields[0]));
-    if (fields_num < 1) {
-      fprintf(fhout, "-1 Internal error\n");
-      fclose(fhin);
-      fclose(fhout);
-      pthread_exit((void *)1);
-      return (void *)1;
-    }
+    size_t len = strlen(buffer);
+    while ((len > 0) && (buffer[len - 1] == '\n'))
+      buffer[--len] = 0;
 
-    if (strcasecmp(fields[0], "getval") == 0) {
-      cmd_handle_getval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "getthreshold") == 0) {
-      handle_getthreshold(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putval") == 0) {
-      cmd_handle_putval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "listval") == 0) {
-      cmd_handle_listval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putnotif") == 0) {
-      handle_putnotif(fhout, buffer);
-    } else if (strcasecmp(fields[0], "flush") == 0) {
-      cmd_handle_flush(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putinsight") == 0) {
-      cmd_handle_putinsight(fhout, buffer + 10); //skip over the putinsight part
-    } else if (strcasecmp(fields[0], "reloadinsights") == 0) {
-      cmd_handle_reloadinsights(fhout);
-    } else {
-      if (fprintf(fhout, "-1 Unknown command: %s\n", fields[0]) < 0) {
-        char errbuf[1024];
-        WARNING("unixsock plugin: failed to write to socket #%i: %s",
-                fileno(fhout), sstrerror(errno, errbuf, sizeof(errbuf)));
-        break;
-      }
-    }
+    us_handle_command(fhout, &putinsights, buffer, len);
   } /* while (fgets) */
 
   DEBUG("unixsock plugin: us_handle_client: Exiting..");
+  cmd_destroy_putinsights(&putinsights);
   fclose(fhin);
   fclose(fhout);
   sfree(buffer);
-  sfree(buffer_copy);
-  pthread_exit((void *)0);
   return (void *)0;
 } /* void *us_handle_client */
 
 static void *us_server_thread(void __attribute__((unused)) * arg) {
-  int status;
-  int *remote_fd;
-  pthread_t th;
   pthread_attr_t th_attr;
 
   pthread_attr_init(&th_attr);
   pthread_attr_setdetachstate(&th_attr, PTHREAD_CREATE_DETACHED);
 
-  if (us_open_socket() != 0)
-    pthread_exit((void *)1);
-
   while (loop != 0) {
     DEBUG("unixsock plugin: Calling accept..");
-    status = accept(sock_fd, NULL, NULL);
+    int status = accept(sock_fd, NULL, NULL);
     if (status < 0) {
       char errbuf[1024];
 
@@ -292,13 +798,10 @@ static void *us_server_thread(void __attribute__((unused)) * arg) {
 
       ERROR("unixsock plugin: accept failed: %s",
             sstrerror(errno, errbuf, sizeof(errbuf)));
-      close(sock_fd);
-      sock_fd = -1;
-      pthread_attr_destroy(&th_attr);
-      pthread_exit((void *)1);
+      break;
     }
 
-    remote_fd = malloc(sizeof(*remote_fd));
+    int *remote_fd = malloc(sizeof(*remote_fd));
     if (remote_fd == NULL) {
       char errbuf[1024];
       WARNING("unixsock plugin: malloc failed: %s",
@@ -310,6 +813,7 @@ static void *us_server_thread(void __attribute__((unused)) * arg) {
 
     DEBUG("Spawning child to handle connection on fd #%i", *remote_fd);
 
+    pthread_t th;
     status = plugin_thread_create(&th, &th_attr, us_handle_client,
                                   (void *)remote_fd, "unixsock conn");
     if (status != 0) {
@@ -322,20 +826,39 @@ static void *us_server_thread(void __attribute__((unused)) * arg) {
     }
   } /* while (loop) */
 
-  close(sock_fd);
-  sock_fd = -1;
   pthread_attr_destroy(&th_attr);
+  return (void *)0;
+} /* void *us_server_thread */
 
-  status = unlink((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
+static int us_start_server(void) {
+  if (us_open_socket() != 0)
+    return -1;
+
+  int status = plugin_thread_create(&listen_thread, NULL, us_server_thread,
+                                    NULL, "unixsock listen");
   if (status != 0) {
     char errbuf[1024];
-    NOTICE("unixsock plugin: unlink (%s) failed: %s",
-           (sock_file != NULL) ? sock_file : US_DEFAULT_PATH,
-           sstrerror(errno, errbuf, sizeof(errbuf)));
+    ERROR("unixsock plugin: pthread_create failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    close(sock_fd);
+    sock_fd = -1;
+    return -1;
   }
 
-  return (void *)0;
-} /* void *us_server_thread */
+  return 0;
+} /* int us_start_server */
+
+static void us_stop_server(void) {
+  /* Interrupts accept(). Connection threads are detached and end when their
+   * client disconnects. */
+  pthread_kill(listen_thread, SIGTERM);
+  pthread_join(listen_thread, NULL);
+  listen_thread = (pthread_t)0;
+
+  close(sock_fd);
+  sock_fd = -1;
+} /* void us_stop_server */
+#endif /* US_USE_EPOLL */
 
 int us_config(const char *key, char *val) {
   if (strcasecmp(key, "SocketFile") == 0) {
@@ -359,6 +882,14 @@ int us_config(const char *key, char *val) {
       delete_socket = 1;
     else
       delete_socket = 0;
+  } else if (strcasecmp(key, "SocketThreads") == 0) {
+    int tmp = atoi(val);
+    if (tmp < 1) {
+      ERROR("unixsock plugin: SocketThreads must be positive.");
+      return 1;
+    }
+    sock_threads = tmp;
+    sfree(val);
   } else {
     return -1;
   }
@@ -378,14 +909,12 @@ int us_init(void) {
 
   loop = 1;
 
-  status = plugin_thread_create(&listen_thread, NULL, us_server_thread, NULL,
-                                "unixsock listen");
+  status = us_start_server();
   if (status != 0) {
-    char errbuf[1024];
-    ERROR("unixsock plugin: pthread_create failed: %s",
-          sstrerror(errno, errbuf, sizeof(errbuf)));
+    loop = 0;
     return -1;
   }
+  server_running = 1;
 
   return 0;
 } /* int us_init */
@@ -401,7 +930,8 @@ int us_config_complex(oconfig_item_t *ci)
         if (strcasecmp(child->key, "SocketFile") == 0 ||
             strcasecmp(child->key, "SocketGroup") == 0 ||
             strcasecmp(child->key, "SocketPerms") == 0 ||
-            strcasecmp(child->key, "DeleteSocket") == 0) {
+            strcasecmp(child->key, "DeleteSocket") == 0 ||
+            strcasecmp(child->key, "SocketThreads") == 0) {
 
             status = cf_util_get_string (child, &tmp);
             if (status != 0)
@@ -417,14 +947,21 @@ int us_config_complex(oconfig_item_t *ci)
 }
 
 int us_shutdown_listener(void) {
-  void *ret;
+  int status;
+
+  if (!server_running)
+    return 0;
+  server_running = 0;
 
   loop = 0;
+  us_stop_server();
 
-  if (listen_thread != (pthread_t)0) {
-    pthread_kill(listen_thread, SIGTERM);
-    pthread_join(listen_thread, &ret);
-    listen_thread = (pthread_t)0;
+  status = unlink((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
+  if (status != 0) {
+    char errbuf[1024];
+    NOTICE("unixsock plugin: unlink (%s) failed: %s",
+           (sock_file != NULL) ? sock_file : US_DEFAULT_PATH,
+           sstrerror(errno, errbuf, sizeof(errbuf)));
   }
 
   return 0;
@@ -1,6 +1,7 @@
 #include "utils_cmd_putinsight.h"
 #include "scribe_capi.h"
 #include "common.h"
+#include "utils_parse_option.h"
 
 #define print_to_socket(fh, ...)                                               \
   do {                                                                         \
@@ -33,3 +34,132 @@ void cmd_handle_reloadinsights(FILE *fh)
         print_to_socket(fh, "-1 No Scribe\n");
     }
 }
+
+static void putinsights_reset(cmd_putinsights_t *batch)
+{
+    batch->expected = 0;
+    batch->received = 0;
+    batch->fill = 0;
+    batch->failed = 0;
+    if (batch->buffer != NULL)
+        batch->buffer[0] = 0;
+}
+
+/* Terminates the array collected so far and hands it to Scribe. */
+static void putinsights_send(cmd_putinsights_t *batch)
+{
+    if (batch->fill == 0)
+        return;
+
+    /* putinsights_append() always leaves room for the trailer. */
+    batch->buffer[0] = '[';
+    memcpy(batch->buffer + batch->fill, "]\n", 3);
+
+    if (is_scribe_initialized())
+        scribe_log(batch->buffer, "insights");
+
+    batch->fill = 0;
+    batch->buffer[0] = 0;
+}
+
+static int putinsights_append(cmd_putinsights_t *batch, const char *line,
+        size_t len)
+{
+    /* ',' or '[' in front, "]\n" and the terminating null byte after. */
+    size_t need = len + 4;
+
+    if ((batch->fill > 0) && (batch->fill + need > CMD_PUTINSIGHTS_MAX_SIZE))
+        putinsights_send(batch);
+
+    if (batch->fill + need > batch->size) {
+        size_t new_size = (batch->size > 0) ? batch->size : 4096;
+        while (new_size < batch->fill + need)
+            new_size *= 2;
+
+        char *tmp = realloc(batch->buffer, new_size);
+        if (tmp == NULL)
+            return ENOMEM;
+        batch->buffer = tmp;
+        batch->size = new_size;
+    }
+
+    batch->buffer[batch->fill++] = ',';
+    memcpy(batch->buffer + batch->fill, line, len);
+    batch->fill += len;
+    batch->buffer[batch->fill] = 0;
+    return 0;
+}
+
+void cmd_handle_putinsights(FILE *fh, char *buffer, cmd_putinsights_t *batch)
+{
+    char *command = NULL;
+    char *endptr = NULL;
+    unsigned long num;
+
+    putinsights_reset(batch);
+
+    /* Skip over the command name. */
+    if (parse_string(&buffer, &command) != 0) {
+        print_to_socket(fh, "-1 Cannot parse command.\n");
+        return;
+    }
+
+    while ((*buffer == ' ') || (*buffer == '\t'))
+        buffer++;
+
+    errno = 0;
+    num = strtoul(buffer, &endptr, 10);
+    if ((errno != 0) || (endptr == buffer) || (*endptr != 0) || (num == 0) ||
+            (num > CMD_PUTINSIGHTS_MAX_NUM)) {
+        print_to_socket(fh, "-1 Usage: PUTINSIGHTS <1-%i>\n",
+                CMD_PUTINSIGHTS_MAX_NUM);
+        return;
+    }
+
+    batch->expected = (size_t)num;
+}
+
+void cmd_putinsights_append(FILE *fh, cmd_putinsights_t *batch,
+        const char *line, size_t len)
+{
+    if (batch->expected == 0)
+        return;
+
+    if (!batch->failed && (putinsights_append(batch, line, len) != 0)) {
+        ERROR("cmd_putinsights_append: Out of memory; dropping the batch.");
+        batch->failed = 1;
+        batch->fill = 0;
+    }
+
+    batch->received++;
+    batch->expected--;
+    if (batch->expected > 0)
+        return;
+
+    size_t received = batch->received;
+    _Bool failed = batch->failed;
+    _Bool have_scribe = is_scribe_initialized();
+
+    if (!failed)
+        putinsights_send(batch);
+    putinsights_reset(batch);
+
+    if (failed) {
+        print_to_socket(fh, "-1 Out of memory\n");
+    } else if (have_scribe) {
+        print_to_socket(fh, "1 %zu Insight%s added\n", received,
+                (received == 1) ? "" : "s");
+    } else {
+        print_to_socket(fh, "-1 No Scribe\n");
+    }
+}
+
+void cmd_destroy_putinsights(cmd_putinsights_t *batch)
+{
+    if (batch == NULL)
+        return;
+
+    sfree(batch->buffer);
+    batch->size = 0;
+    putinsights_reset(batch);
+}
@@ -3,7 +3,35 @@
 
 #include <stdio.h>
 
+/* Upper limits for one PUTINSIGHTS command. Larger batches are handed to
+ * Scribe in several arrays of at most CMD_PUTINSIGHTS_MAX_SIZE bytes. */
+#define CMD_PUTINSIGHTS_MAX_NUM 100000
+#define CMD_PUTINSIGHTS_MAX_SIZE (1 << 20)
+
+/*
+ * State of a "PUTINSIGHTS <n>" command while its n payload lines arrive.
+ * The payloads are collected into one JSON array, sent to Scribe in a single
+ * call and acknowledged with a single reply.
+ */
+typedef struct {
+    size_t expected; /* payload lines still to come; 0 when idle */
+    size_t received;
+    char *buffer;
+    size_t fill;
+    size_t size;
+    _Bool failed;
+} cmd_putinsights_t;
+
 void cmd_handle_putinsight(FILE *fh, char *buffer);
 void cmd_handle_reloadinsights(FILE *fh);
 
+/* Parses "PUTINSIGHTS <n>" and prepares "batch" for the payload lines. Replies
+ * with an error if the command is invalid. */
+void cmd_handle_putinsights(FILE *fh, char *buffer, cmd_putinsights_t *batch);
+/* Adds one payload line. Once the last line has been added, the batch is
+ * sent, acknowledged on "fh" and "batch" is ready for the next command. */
+void cmd_putinsights_append(FILE *fh, cmd_putinsights_t *batch,
+                            const char *line, size_t len);
+void cmd_destroy_putinsights(cmd_putinsights_t *batch);
+
 #endif /* UTILS_CMD_PUTINSIGHT_H */
@@ -0,0 +1,239 @@
+/**
+ * collectd - src/utils_cmd_query.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_cmd_query.h"
+
+struct query_result_s {
+  char *buffer;
+  size_t len;
+  size_t size;
+  size_t values_num;
+};
+typedef struct query_result_s query_result_t;
+
+/* Parses an epoch time in seconds. Negative values are relative to now. */
+static int parse_query_time(char const *str, cdtime_t *ret) /* {{{ */
+{
+  char *endptr = NULL;
+
+  errno = 0;
+  double t = strtod(str, &endptr);
+  if ((endptr == str) || (*endptr != 0) || (errno != 0) || !isfinite(t))
+    return EINVAL;
+
+  if (t < 0.0) {
+    cdtime_t ago = DOUBLE_TO_CDTIME_T(-t);
+    cdtime_t now = cdtime();
+    *ret = (ago < now) ? (now - ago) : 0;
+  } else {
+    *ret = DOUBLE_TO_CDTIME_T(t);
+  }
+  return 0;
+} /* }}} int parse_query_time */
+
+cmd_status_t cmd_parse_query(size_t argc, char **argv, /* {{{ */
+                             cmd_query_t *ret_query, const cmd_options_t *opts,
+                             cmd_error_handler_t *err) {
+  if ((ret_query == NULL) || (opts == NULL)) {
+    errno = EINVAL;
+    cmd_error(CMD_ERROR, err, "Invalid arguments to cmd_parse_query.");
+    return CMD_ERROR;
+  }
+
+  if (argc < 1) {
+    cmd_error(CMD_PARSE_ERROR, err, "Missing identifier.");
+    return CMD_PARSE_ERROR;
+  }
+
+  ret_query->start = 0;
+  ret_query->end = (cdtime_t)-1;
+
+  for (size_t i = 1; i < argc; i++) {
+    char *key = NULL;
+    char *value = NULL;
+
+    int status = cmd_parse_option(argv[i], &key, &value, err);
+    if (status != CMD_OK) {
+      if (status == CMD_NO_OPTION)
+        cmd_error(CMD_PARSE_ERROR, err, "Invalid option string `%s'.", argv[i]);
+      cmd_destroy_query(ret_query);
+      return CMD_PARSE_ERROR;
+    }
+
+    if ((strcasecmp("start", key) == 0) || (strcasecmp("end", key) == 0)) {
+      cdtime_t *t =
+          (strcasecmp("start", key) == 0) ? &ret_query->start : &ret_query->end;
+      if (parse_query_time(value, t) != 0) {
+        cmd_error(CMD_PARSE_ERROR, err, "Invalid value for option `%s': %s",
+                  key, value);
+        cmd_destroy_query(ret_query);
+        return CMD_PARSE_ERROR;
+      }
+    } else if (strcasecmp("plugin", key) == 0) {
+      sfree(ret_query->plugin);
+      ret_query->plugin = sstrdup(value);
+    } else {
+      cmd_error(CMD_PARSE_ERROR, err, "Cannot parse option `%s'.", key);
+      cmd_destroy_query(ret_query);
+      return CMD_PARSE_ERROR;
+    }
+  }
+
+  if (ret_query->start > ret_query->end) {
+    cmd_error(CMD_PARSE_ERROR, err, "Start of the range is after its end.");
+    cmd_destroy_query(ret_query);
+    return CMD_PARSE_ERROR;
+  }
+
+  /* parse_identifier() modifies its first argument, returning pointers into
+   * it */
+  char *identifier_copy = sstrdup(argv[0]);
+  identifier_t *id = &ret_query->identifier;
+  if (parse_identifier(argv[0], &id->host, &id->plugin, &id->plugin_instance,
+                       &id->type, &id->type_instance,
+                       opts->identifier_default_host) != 0) {
+    cmd_error(CMD_PARSE_ERROR, err, "Cannot parse identifier `%s'.",
+              identifier_copy);
+    sfree(identifier_copy);
+    cmd_destroy_query(ret_query);
+    return CMD_PARSE_ERROR;
+  }
+
+  /* Normalize, e.g. if the host name was left out. */
+  char name[6 * DATA_MAX_NAME_LEN];
+  if (format_name(name, sizeof(name), id->host, id->plugin,
+                  id->plugin_instance, id->type, id->type_instance) != 0) {
+    cmd_error(CMD_PARSE_ERROR, err, "Cannot parse identifier `%s'.",
+              identifier_copy);
+    sfree(identifier_copy);
+    cmd_destroy_query(ret_query);
+    return CMD_PARSE_ERROR;
+  }
+  sfree(identifier_copy);
+
+  ret_query->raw_identifier = sstrdup(name);
+  return CMD_OK;
+} /* }}} cmd_status_t cmd_parse_query */
+
+static int query_result(const data_set_t *ds, /* {{{ */
+                        const value_list_t *vl, void *arg) {
+  query_result_t *res = arg;
+  char line[1024];
+
+  if (format_values(line, sizeof(line), ds, vl, /* store rates = */ 0) != 0)
+    return EINVAL;
+
+  size_t len = strlen(line);
+  if ((res->len + len + 2) > res->size) {
+    size_t size = (res->size == 0) ? 4096 : res->size;
+    while ((res->len + len + 2) > size)
+      size *= 2;
+
+    char *tmp = realloc(res->buffer, size);
+    if (tmp == NULL)
+      return ENOMEM;
+    res->buffer = tmp;
+    res->size = size;
+  }
+
+  memcpy(res->buffer + res->len, line, len);
+  res->len += len;
+  res->buffer[res->len++] = '\n';
+  res->buffer[res->len] = 0;
+  res->values_num++;
+  return 0;
+} /* }}} int query_result */
+
+cmd_status_t cmd_handle_query(FILE *fh, char *buffer) /* {{{ */
+{
+  cmd_error_handler_t err = {cmd_error_fh, fh};
+  cmd_status_t status;
+  cmd_t cmd;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return -1;
+
+  DEBUG("utils_cmd_query: cmd_handle_query (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  if ((status = cmd_parse(buffer, &cmd, NULL, &err)) != CMD_OK)
+    return status;
+  if (cmd.type != CMD_QUERY) {
+    cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
+              CMD_TO_STRING(cmd.type));
+    cmd_destroy(&cmd);
+    return CMD_UNKNOWN_COMMAND;
+  }
+
+  cmd_query_t *q = &cmd.cmd.query;
+  query_result_t res = {0};
+
+  int qstatus = plugin_query(q->plugin, q->raw_identifier, q->start, q->end,
+                             query_result, &res);
+  if (qstatus == ENOENT) {
+    cmd_error(CMD_ERROR, &err, "No such value.");
+    sfree(res.buffer);
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
+  } else if (qstatus != 0) {
+    char errbuf[1024];
+    cmd_error(CMD_ERROR, &err, "Query failed: %s",
+              sstrerror(qstatus, errbuf, sizeof(errbuf)));
+    sfree(res.buffer);
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
+  }
+
+  if ((fprintf(fh, "%zu Value%s found\n", res.values_num,
+               (res.values_num == 1) ? "" : "s") < 0) ||
+      ((res.len > 0) && (fwrite(res.buffer, 1, res.len, fh) != res.len))) {
+    char errbuf[1024];
+    WARNING("cmd_handle_query: failed to write to socket #%i: %s", fileno(fh),
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+    sfree(res.buffer);
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
+  }
+  fflush(fh);
+
+  sfree(res.buffer);
+  cmd_destroy(&cmd);
+  return CMD_OK;
+} /* }}} cmd_status_t cmd_handle_query */
+
+void cmd_destroy_query(cmd_query_t *query) /* {{{ */
+{
+  if (query == NULL)
+    return;
+
+  sfree(query->raw_identifier);
+  sfree(query->plugin);
+} /* }}} void cmd_destroy_query */
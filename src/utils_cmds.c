@@ -32,6 +32,7 @@
 #include "utils_cmd_getval.h"
 #include "utils_cmd_listval.h"
 #include "utils_cmd_putval.h"
+#include "utils_cmd_query.h"
 #include "utils_parse_option.h"
 
 #include <stdbool.h>
@@ -212,6 +213,10 @@ cmd_status_t cmd_parsev(size_t argc, char **argv, cmd_t *ret_cmd,
     ret_cmd->type = CMD_PUTVAL;
     status =
         cmd_parse_putval(argc - 1, argv + 1, &ret_cmd->cmd.putval, opts, err);
+  } else if (strcasecmp("QUERY", command) == 0) {
+    ret_cmd->type = CMD_QUERY;
+    status =
+        cmd_parse_query(argc - 1, argv + 1, &ret_cmd->cmd.query, opts, err);
   } else {
     ret_cmd->type = CMD_UNKNOWN;
     cmd_error(CMD_UNKNOWN_COMMAND, err, "Unknown command `%s'.", command);
@@ -257,6 +262,9 @@ void cmd_destroy(cmd_t *cmd) {
   case CMD_PUTVAL:
     cmd_destroy_putval(&cmd->cmd.putval);
     break;
+  case CMD_QUERY:
+    cmd_destroy_query(&cmd->cmd.query);
+    break;
   }
 } /* void cmd_destroy */
 
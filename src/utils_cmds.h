@@ -37,15 +37,18 @@ typedef enum {
   CMD_GETVAL = 2,
   CMD_LISTVAL = 3,
   CMD_PUTVAL = 4,
+  CMD_QUERY = 5,
 } cmd_type_t;
 #define CMD_TO_STRING(type)                                                    \
-  ((type) == CMD_FLUSH) ? "FLUSH" : ((type) == CMD_GETVAL)                     \
-                                        ? "GETVAL"                             \
-                                        : ((type) == CMD_LISTVAL)              \
-                                              ? "LISTVAL"                      \
-                                              : ((type) == CMD_PUTVAL)         \
-                                                    ? "PUTVAL"                 \
-                                                    : "UNKNOWN"
+  ((type) == CMD_FLUSH)                                                        \
+      ? "FLUSH"                                                                \
+      : ((type) == CMD_GETVAL)                                                 \
+            ? "GETVAL"                                                         \
+            : ((type) == CMD_LISTVAL)                                          \
+                  ? "LISTVAL"                                                  \
+                  : ((type) == CMD_PUTVAL)                                     \
+                        ? "PUTVAL"                                             \
+                        : ((type) == CMD_QUERY) ? "QUERY" : "UNKNOWN"
 
 typedef struct {
   double timeout;
@@ -74,6 +77,17 @@ typedef struct {
   size_t vl_num;
 } cmd_putval_t;
 
+typedef struct {
+  /* The identifier as passed to the query callbacks. */
+  char *raw_identifier;
+  identifier_t identifier;
+
+  cdtime_t start;
+  cdtime_t end;
+  /* Query only this plugin, or NULL. */
+  char *plugin;
+} cmd_query_t;
+
 /*
  * NAME
  *   cmd_t
@@ -88,6 +102,7 @@ typedef struct {
     cmd_getval_t getval;
     cmd_listval_t listval;
     cmd_putval_t putval;
+    cmd_query_t query;
   } cmd;
 } cmd_t;
 
@@ -175,6 +175,38 @@ static struct {
     },
     */
 
+    /* Valid QUERY commands. */
+    {
+        "QUERY myhost/magic/MAGIC", NULL, CMD_OK, CMD_QUERY,
+    },
+    {
+        "QUERY magic/MAGIC start=1500000000 end=1500003600.5",
+        &default_host_opts, CMD_OK, CMD_QUERY,
+    },
+    {
+        "QUERY myhost/magic/MAGIC start=-3600 plugin=write_archive", NULL,
+        CMD_OK, CMD_QUERY,
+    },
+
+    /* Invalid QUERY commands. */
+    {
+        "QUERY", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
+    },
+    {
+        "QUERY magic/MAGIC", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
+    },
+    {
+        "QUERY myhost/magic/MAGIC start=A", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
+    },
+    {
+        "QUERY myhost/magic/MAGIC start=20 end=10", NULL, CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        "QUERY myhost/magic/MAGIC invalid=option", NULL, CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+
     /* Invalid commands. */
     {
         "INVALID", NULL, CMD_UNKNOWN_COMMAND, CMD_UNKNOWN,
@@ -234,8 +234,6 @@ static int value_list_to_insights(char *buffer, size_t buffer_size, /* {{{ */
   char **keys;
   int status;
 
-  memset(buffer, 0, buffer_size);
-
 #define BUFFER_ADD(...)                                                        \
   do {                                                                         \
     status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
@@ -341,25 +339,26 @@ static int value_list_to_insights(char *buffer, size_t buffer_size, /* {{{ */
       BUFFER_ADD(" \"%s\"", http_attrs[j + 1]);
     }
 
-    //Add specific metadata
+    //Add specific metadata, formatted in place
     if (vl->meta != NULL) {
-        char meta_buffer[buffer_size];
-        memset(meta_buffer, 0, sizeof(meta_buffer));
-
         status = meta_data_toc(vl->meta, &keys);
-        if (status <= 0)
+        if (status < 0)
             return status;
-        keys_num = (size_t)status;
+        keys_num = status;
 
-        status = meta_to_tags(meta_buffer, buffer_size, vl->meta, keys, keys_num);
+        if (keys_num > 0) {
+            status = meta_to_tags(buffer + offset, buffer_size - offset,
+                                  vl->meta, keys, (size_t)keys_num);
 
-        if (status != 0)
-            return status;
+            for (int k = 0; k < keys_num; ++k)
+                sfree(keys[k]);
+            sfree(keys);
 
-        BUFFER_ADD("%s", meta_buffer);
-        for (size_t i = 0; i < keys_num; ++i)
-            sfree(keys[i]);
-        sfree(keys);
+            if (status == 0)
+                offset += strlen(buffer + offset);
+            else if (status != ENOENT)
+                return status;
+        }
     }
 
     if (strlen(vl->plugin_instance))
@@ -400,19 +399,22 @@ static int format_insights_value_list_nocheck(
     char const *const *http_attrs, size_t http_attrs_num, int data_ttl,
     char const *metrics_prefix, int offset, int limit, 
     int history_length, gauge_t *history_values) {
-  char temp[temp_size];
+  char *temp = buffer + (*ret_buffer_fill);
   int status;
 
-  status = value_list_to_insights(temp, sizeof(temp), ds, vl, store_rates,
+  /* Format in place; a failed attempt is discarded by re-terminating the
+   * buffer where it was before. */
+  status = value_list_to_insights(temp, temp_size, ds, vl, store_rates,
                                   http_attrs, http_attrs_num, data_ttl,
                                   metrics_prefix, offset, limit, 
                                   history_length, history_values);
 
-  if (status != 0)
+  if (status != 0) {
+    temp[0] = 0;
     return status;
+  }
   temp_size = strlen(temp);
 
-  memcpy(buffer + (*ret_buffer_fill), temp, temp_size + 1);
   (*ret_buffer_fill) += temp_size;
   (*ret_buffer_free) -= temp_size;
 
@@ -492,7 +494,9 @@ int format_insights_initialize(char *buffer, /* {{{ */
   if (buffer_free < 3)
     return -ENOMEM;
 
-  memset(buffer, 0, buffer_free);
+  /* Every formatter below terminates its output, so there is no need to clear
+   * the whole (potentially huge) buffer here. */
+  buffer[0] = 0;
   *ret_buffer_fill = buffer_fill;
   *ret_buffer_free = buffer_free;
 
@@ -526,6 +530,34 @@ int format_insights_finalize(char *buffer, /* {{{ */
   return 0;
 } /* }}} int format_insights_finalize */
 
+int format_insights_finalize_batch(char *buffer, /* {{{ */
+                                   size_t *ret_buffer_fill,
+                                   size_t *ret_buffer_free) {
+  size_t pos;
+
+  if ((buffer == NULL) || (ret_buffer_fill == NULL) ||
+      (ret_buffer_free == NULL))
+    return -EINVAL;
+
+  if (*ret_buffer_free < 3)
+    return -ENOMEM;
+
+  /* Turn the comma separated list of objects into a JSON array. */
+  if (buffer[0] != ',')
+    return -EINVAL;
+  buffer[0] = '[';
+
+  pos = *ret_buffer_fill;
+  buffer[pos] = ']';
+  buffer[pos + 1] = '\n';
+  buffer[pos + 2] = 0;
+
+  (*ret_buffer_fill) += 2;
+  (*ret_buffer_free) -= 2;
+
+  return 0;
+} /* }}} int format_insights_finalize_batch */
+
 int format_insights_value_list(char *buffer, /* {{{ */
                                size_t *ret_buffer_fill, size_t *ret_buffer_free,
                                const data_set_t *ds, const value_list_t *vl,
@@ -563,4 +595,486 @@ int format_insights_log(char *buffer, size_t *ret_buffer_fill, size_t *ret_buffe
 }
 
 
+/*
+ * Streaming encoder
+ */
+#define ENC_DEFAULT_SIZE 4096
+
+int insights_encoder_init(insights_encoder_t *enc, /* {{{ */
+                          size_t initial_size, size_t max_size) {
+  if (enc == NULL)
+    return -EINVAL;
+
+  if (initial_size == 0)
+    initial_size = ENC_DEFAULT_SIZE;
+  if (max_size < initial_size)
+    max_size = initial_size;
+
+  memset(enc, 0, sizeof(*enc));
+  enc->buffer = malloc(initial_size);
+  if (enc->buffer == NULL)
+    return -ENOMEM;
+
+  enc->size = initial_size;
+  enc->max_size = max_size;
+  enc->buffer[0] = 0;
+
+  return 0;
+} /* }}} int insights_encoder_init */
+
+void insights_encoder_destroy(insights_encoder_t *enc) /* {{{ */
+{
+  if (enc == NULL)
+    return;
+
+  sfree(enc->buffer);
+  enc->fill = enc->size = enc->count = 0;
+} /* }}} void insights_encoder_destroy */
+
+void insights_encoder_reset(insights_encoder_t *enc) /* {{{ */
+{
+  enc->fill = 0;
+  enc->count = 0;
+  enc->buffer[0] = 0;
+} /* }}} void insights_encoder_reset */
+
+/* Room kept free for the "]\n" added by insights_encoder_finalize(). */
+#define ENC_TRAILER_LEN 2
+
+static int enc_grow(insights_encoder_t *enc, size_t need) /* {{{ */
+{
+  size_t size;
+  char *tmp;
+
+  if (need <= enc->size)
+    return 0;
+  if (need > enc->max_size)
+    return -ENOMEM;
+
+  size = enc->size;
+  while (size < need)
+    size *= 2;
+  if (size > enc->max_size)
+    size = enc->max_size;
+
+  tmp = realloc(enc->buffer, size);
+  if (tmp == NULL)
+    return -ENOMEM;
+
+  enc->buffer = tmp;
+  enc->size = size;
+  return 0;
+} /* }}} int enc_grow */
+
+/* Makes room for "len" more bytes plus the terminating null byte, leaving
+ * enough space to finalize the document. */
+static int enc_reserve(insights_encoder_t *enc, size_t len) /* {{{ */
+{
+  return enc_grow(enc, enc->fill + len + 1 + ENC_TRAILER_LEN);
+} /* }}} int enc_reserve */
+
+static int enc_add_mem(insights_encoder_t *enc, const char *s, /* {{{ */
+                       size_t len) {
+  if (enc_reserve(enc, len) != 0)
+    return -ENOMEM;
+
+  memcpy(enc->buffer + enc->fill, s, len);
+  enc->fill += len;
+  return 0;
+} /* }}} int enc_add_mem */
+
+#define enc_add_lit(enc, lit) enc_add_mem((enc), (lit), sizeof(lit) - 1)
+
+static int enc_add_str(insights_encoder_t *enc, const char *s) /* {{{ */
+{
+  return enc_add_mem(enc, s, strlen(s));
+} /* }}} int enc_add_str */
+
+/* Like insights_escape_string(), quotes included: control characters are
+ * replaced by a question mark, everything else is copied verbatim. Unlike
+ * insights_escape_string(), bytes >= 0x80 are copied, too; where char is
+ * signed, the old function turned each of them into a question mark and so
+ * mangled UTF-8 tags. */
+static int enc_add_escaped(insights_encoder_t *enc, const char *s, /* {{{ */
+                           size_t len) {
+  char *dst;
+
+  /* Worst case every character needs escaping. */
+  if (enc_reserve(enc, 2 * len + 2) != 0)
+    return -ENOMEM;
+
+  dst = enc->buffer + enc->fill;
+  *dst++ = '"';
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)s[i];
+
+    if ((c == '"') || (c == '\\')) {
+      *dst++ = '\\';
+      *dst++ = (char)c;
+    } else if (c <= 0x1F)
+      *dst++ = '?';
+    else
+      *dst++ = (char)c;
+  }
+  *dst++ = '"';
+
+  enc->fill = (size_t)(dst - enc->buffer);
+  return 0;
+} /* }}} int enc_add_escaped */
+
+static int enc_add_uint64(insights_encoder_t *enc, uint64_t v) /* {{{ */
+{
+  char tmp[20];
+  size_t pos = sizeof(tmp);
+
+  do {
+    tmp[--pos] = (char)('0' + (v % 10));
+    v /= 10;
+  } while (v != 0);
+
+  return enc_add_mem(enc, tmp + pos, sizeof(tmp) - pos);
+} /* }}} int enc_add_uint64 */
+
+static int enc_add_int64(insights_encoder_t *enc, int64_t v) /* {{{ */
+{
+  if (v >= 0)
+    return enc_add_uint64(enc, (uint64_t)v);
+
+  if (enc_add_lit(enc, "-") != 0)
+    return -ENOMEM;
+  /* Negate in unsigned arithmetic so INT64_MIN does not overflow. */
+  return enc_add_uint64(enc, (uint64_t)0 - (uint64_t)v);
+} /* }}} int enc_add_int64 */
+
+/* Appends "v" with a decimal point "scale" digits from the right. */
+static int enc_add_decimal(insights_encoder_t *enc, int64_t v, /* {{{ */
+                           int scale) {
+  char tmp[24];
+  size_t pos = sizeof(tmp);
+  uint64_t u = (v < 0) ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+
+  for (int i = 0; (u != 0) || (i <= scale); i++) {
+    if ((i == scale) && (i > 0))
+      tmp[--pos] = '.';
+    tmp[--pos] = (char)('0' + (u % 10));
+    u /= 10;
+  }
+  if (v < 0)
+    tmp[--pos] = '-';
+
+  return enc_add_mem(enc, tmp + pos, sizeof(tmp) - pos);
+} /* }}} int enc_add_decimal */
+
+/* Formats "v" like printf("%.15g") would. Values which are exactly
+ * representable with at most six decimal places and fewer than 15 digits,
+ * which covers most counters and gauges, are printed by hand; if n / 10^k
+ * rounds to "v", %.15g prints exactly those digits. Everything else is
+ * formatted straight into the output buffer. */
+static int enc_add_double(insights_encoder_t *enc, const char *fmt, /* {{{ */
+                          double v) {
+  static const double pow10[] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6};
+  int status;
+
+  if ((fmt == NULL) && (v > -1e14) && (v < 1e14) &&
+      !((v == 0.0) && signbit(v))) {
+    if (v == (double)(int64_t)v)
+      return enc_add_int64(enc, (int64_t)v);
+
+    /* %g switches to exponential notation below 1e-4 */
+    if (fabs(v) >= 1e-4) {
+      for (int k = 1; k < (int)STATIC_ARRAY_SIZE(pow10); k++) {
+        double scaled = v * pow10[k];
+        int64_t n;
+
+        if ((scaled <= -1e14) || (scaled >= 1e14))
+          break;
+
+        n = llround(scaled);
+        if ((double)n / pow10[k] == v)
+          return enc_add_decimal(enc, n, k);
+      }
+    }
+  }
+
+  /* %.15g needs at most 23 characters, %f can be longer. */
+  for (size_t reserve = 32;; reserve *= 16) {
+    if (enc_reserve(enc, reserve) != 0)
+      return -ENOMEM;
+
+    status = snprintf(enc->buffer + enc->fill, enc->size - enc->fill,
+                      (fmt != NULL) ? fmt : JSON_GAUGE_FORMAT, v);
+    if (status < 1)
+      return -1;
+    if ((size_t)status < enc->size - enc->fill)
+      break;
+  }
+
+  enc->fill += (size_t)status;
+  return 0;
+} /* }}} int enc_add_double */
+
+#define ENC_ADD(call)                                                          \
+  do {                                                                         \
+    int status__ = (call);                                                     \
+    if (status__ != 0)                                                         \
+      return status__;                                                         \
+  } while (0)
+
+static int enc_meta_tag(const char *key, int type, /* {{{ */
+                        const void *value, void *user_data) {
+  insights_encoder_t *enc = user_data;
+
+  if ((type < MD_TYPE_STRING) || (type > MD_TYPE_BOOLEAN))
+    return 0;
+
+  ENC_ADD(enc_add_lit(enc, ",\""));
+  ENC_ADD(enc_add_str(enc, key));
+  ENC_ADD(enc_add_lit(enc, "\":"));
+
+  switch (type) {
+  case MD_TYPE_STRING:
+    return enc_add_escaped(enc, value, strlen(value));
+  case MD_TYPE_SIGNED_INT:
+    return enc_add_int64(enc, *(const int64_t *)value);
+  case MD_TYPE_UNSIGNED_INT:
+    return enc_add_uint64(enc, *(const uint64_t *)value);
+  case MD_TYPE_DOUBLE:
+    return enc_add_double(enc, "%f", *(const double *)value);
+  default: /* MD_TYPE_BOOLEAN */
+    if (*(const _Bool *)value)
+      return enc_add_lit(enc, "true");
+    return enc_add_lit(enc, "false");
+  }
+} /* }}} int enc_meta_tag */
+
+static int enc_add_gauge_or_nan(insights_encoder_t *enc, /* {{{ */
+                                gauge_t v) {
+  if (isfinite(v))
+    return enc_add_double(enc, NULL, v);
+  return enc_add_lit(enc, "\"NaN\"");
+} /* }}} int enc_add_gauge_or_nan */
+
+static int enc_value_list(insights_encoder_t *enc, /* {{{ */
+                          const data_set_t *ds, const value_list_t *vl,
+                          int store_rates, size_t i, int history_length,
+                          const gauge_t *history_values) {
+  const data_source_t *dsrc = ds->ds + i;
+  _Bool is_mcac = (strcasecmp(vl->plugin, "mcac") == 0);
+
+  /* All value lists have a leading comma. The first one will be replaced in
+   * `insights_encoder_finalize'. */
+  ENC_ADD(enc_add_lit(enc, ",{\"metadata\":{\"name\":\""));
+
+  // Avoid use the plugin-instance for the name in the case of C*.
+  if (is_mcac) {
+    ENC_ADD(enc_add_str(enc, vl->plugin_instance));
+  } else {
+    ENC_ADD(enc_add_lit(enc, "collectd"));
+    if (strcmp(vl->plugin, vl->type) != 0) {
+      ENC_ADD(enc_add_lit(enc, "_"));
+      ENC_ADD(enc_add_str(enc, vl->plugin));
+    }
+    ENC_ADD(enc_add_lit(enc, "_"));
+    ENC_ADD(enc_add_str(enc, vl->type));
+    if (strcmp("value", dsrc->name) != 0) {
+      ENC_ADD(enc_add_lit(enc, "_"));
+      ENC_ADD(enc_add_str(enc, dsrc->name));
+    }
+    if (history_length > 0)
+      ENC_ADD(enc_add_lit(enc, "_series"));
+  }
+
+  ENC_ADD(enc_add_lit(enc, "\", \"timestamp\":"));
+  ENC_ADD(enc_add_uint64(enc, CDTIME_T_TO_MS(vl->time)));
+  ENC_ADD(enc_add_lit(enc, ", \"insightMappingId\": \"collectd-v1\""
+                           ", \"insightType\":\""));
+
+  if (history_length > 0) {
+    ENC_ADD(enc_add_lit(enc, "SERIES"));
+  } else {
+    switch (dsrc->type) {
+    case DS_TYPE_ABSOLUTE:
+    case DS_TYPE_COUNTER:
+    case DS_TYPE_DERIVE:
+      ENC_ADD(enc_add_lit(enc, "COUNTER"));
+      break;
+    case DS_TYPE_GAUGE:
+      ENC_ADD(enc_add_lit(enc, "GAUGE"));
+      break;
+    default:
+      ERROR("format_insights: Unknown data source type: %i", dsrc->type);
+      return -1;
+    }
+  }
+
+  /* Now adds meta data to metric as tags */
+  ENC_ADD(enc_add_lit(enc, "\", \"tags\":{"));
+
+  if (history_length > 0) {
+    ENC_ADD(enc_add_lit(enc, "\"seriesLength\": "));
+    ENC_ADD(enc_add_int64(enc, history_length));
+    ENC_ADD(enc_add_lit(enc, ",\"seriesInterval\": "));
+    ENC_ADD(enc_add_uint64(enc, CDTIME_T_TO_MS(vl->interval)));
+    ENC_ADD(enc_add_lit(enc, ","));
+  }
+
+  ENC_ADD(enc_add_lit(enc, "\"collectdType\": "));
+  ENC_ADD(enc_add_int64(enc, dsrc->type));
+  ENC_ADD(enc_add_lit(enc, ",\"host\": \""));
+  ENC_ADD(enc_add_str(enc, vl->host));
+  ENC_ADD(enc_add_lit(enc, "\""));
+
+  if (vl->meta != NULL)
+    ENC_ADD(meta_data_iterate(vl->meta, enc_meta_tag, enc));
+
+  if (vl->plugin_instance[0] != 0) {
+    ENC_ADD(enc_add_lit(enc, ",\"plugin_instance\": "));
+    ENC_ADD(enc_add_escaped(enc, vl->plugin_instance,
+                            strlen(vl->plugin_instance)));
+  }
+  if (vl->type_instance[0] != 0) {
+    ENC_ADD(enc_add_lit(enc, ",\"type_instance\": "));
+    ENC_ADD(
+        enc_add_escaped(enc, vl->type_instance, strlen(vl->type_instance)));
+  }
+  if (ds->ds_num != 1) {
+    ENC_ADD(enc_add_lit(enc, ",\"ds\": "));
+    ENC_ADD(enc_add_escaped(enc, dsrc->name, strlen(dsrc->name)));
+  }
+
+  ENC_ADD(enc_add_lit(enc, ",\"plugin\": "));
+  ENC_ADD(enc_add_escaped(enc, vl->plugin, strlen(vl->plugin)));
+  ENC_ADD(enc_add_lit(enc, ",\"type\": "));
+  ENC_ADD(enc_add_escaped(enc, vl->type, strlen(vl->type)));
+  ENC_ADD(enc_add_lit(enc, "}}, \"data\": {\"value\":"));
+
+  if (history_length > 0) {
+    ENC_ADD(enc_add_lit(enc, "["));
+    for (size_t p = i; p < (size_t)history_length * ds->ds_num;
+         p += ds->ds_num) {
+      if (p > i)
+        ENC_ADD(enc_add_lit(enc, ","));
+      ENC_ADD(enc_add_gauge_or_nan(enc, history_values[p]));
+    }
+    ENC_ADD(enc_add_lit(enc, "]"));
+  } else if (dsrc->type == DS_TYPE_GAUGE) {
+    if (!isfinite(vl->values[i].gauge)) {
+      DEBUG("utils_format_insights: invalid vl->values[ds_idx].gauge for "
+            "%s|%s|%s|%s|%s",
+            vl->plugin, vl->plugin_instance, vl->type, vl->type_instance,
+            dsrc->name);
+      return -1;
+    }
+    ENC_ADD(enc_add_double(enc, NULL, vl->values[i].gauge));
+  } else if (store_rates) {
+    gauge_t *rates = uc_get_rate(ds, vl);
+    if (rates == NULL) {
+      WARNING("utils_format_insights: uc_get_rate failed for %s|%s|%s|%s|%s",
+              vl->plugin, vl->plugin_instance, vl->type, vl->type_instance,
+              dsrc->name);
+      return -1;
+    }
+    int status = enc_add_gauge_or_nan(enc, rates[i]);
+    sfree(rates);
+    if (status != 0)
+      return status;
+  } else if (dsrc->type == DS_TYPE_COUNTER) {
+    ENC_ADD(enc_add_uint64(enc, vl->values[i].counter));
+  } else if (dsrc->type == DS_TYPE_DERIVE) {
+    ENC_ADD(enc_add_int64(enc, vl->values[i].derive));
+  } else {
+    ENC_ADD(enc_add_uint64(enc, vl->values[i].absolute));
+  }
+
+  return enc_add_lit(enc, "}}");
+} /* }}} int enc_value_list */
+
+int insights_encoder_add_value_list(insights_encoder_t *enc, /* {{{ */
+                                    const data_set_t *ds,
+                                    const value_list_t *vl, int store_rates,
+                                    size_t ds_idx, int history_length,
+                                    const gauge_t *history_values) {
+  size_t start;
+  int status;
+
+  if ((enc == NULL) || (ds == NULL) || (vl == NULL) ||
+      (ds_idx >= ds->ds_num) ||
+      ((history_length > 0) && (history_values == NULL)))
+    return -EINVAL;
+
+  start = enc->fill;
+  status = enc_value_list(enc, ds, vl, store_rates, ds_idx, history_length,
+                          history_values);
+  if (status != 0) {
+    enc->fill = start;
+    enc->buffer[start] = 0;
+    return status;
+  }
+
+  enc->buffer[enc->fill] = 0;
+  enc->count++;
+  return 0;
+} /* }}} int insights_encoder_add_value_list */
+
+static int enc_log(insights_encoder_t *enc, const char *logmsg, /* {{{ */
+                   size_t logmsg_len, const char *file) {
+  ENC_ADD(enc_add_lit(enc, ",{\"metadata\":{\"name\":\""));
+  ENC_ADD(enc_add_str(enc, file));
+  ENC_ADD(enc_add_lit(enc, "\", \"timestamp\":"));
+  ENC_ADD(enc_add_uint64(enc, CDTIME_T_TO_MS(cdtime())));
+  ENC_ADD(enc_add_lit(enc, ", \"insightType\":\"LOG\", \"tags\":{\"host\": \""));
+  ENC_ADD(enc_add_str(enc, hostname_g));
+  ENC_ADD(enc_add_lit(enc, "\"}}, \"data\": "));
+  ENC_ADD(enc_add_escaped(enc, logmsg, logmsg_len));
+  return enc_add_lit(enc, "}");
+} /* }}} int enc_log */
+
+int insights_encoder_add_log(insights_encoder_t *enc, /* {{{ */
+                             const char *logmsg, size_t logmsg_len,
+                             const char *file) {
+  size_t start;
+  int status;
+
+  if ((enc == NULL) || (logmsg == NULL) || (file == NULL))
+    return -EINVAL;
+
+  start = enc->fill;
+  status = enc_log(enc, logmsg, logmsg_len, file);
+  if (status != 0) {
+    enc->fill = start;
+    enc->buffer[start] = 0;
+    return status;
+  }
+
+  enc->buffer[enc->fill] = 0;
+  enc->count++;
+  return 0;
+} /* }}} int insights_encoder_add_log */
+
+int insights_encoder_finalize(insights_encoder_t *enc, /* {{{ */
+                              _Bool as_array) {
+  if (enc == NULL)
+    return -EINVAL;
+
+  if ((enc->count == 0) || (enc->buffer[0] != ','))
+    return -EINVAL;
+
+  /* enc_reserve() always left room for the trailer. */
+  ENC_ADD(enc_grow(enc, enc->fill + ENC_TRAILER_LEN + 1));
+
+  if (as_array) {
+    memcpy(enc->buffer + enc->fill, "]\n", 2);
+    enc->fill += 2;
+    enc->buffer[0] = '[';
+  } else {
+    enc->buffer[enc->fill++] = '\n';
+    enc->buffer[0] = ' ';
+  }
+
+  enc->buffer[enc->fill] = 0;
+  return 0;
+} /* }}} int insights_encoder_finalize */
+
+#undef ENC_ADD
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
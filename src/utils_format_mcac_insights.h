@@ -29,4 +29,45 @@ int format_insights_log(char *buffer, size_t *ret_buffer_fill, size_t *ret_buffe
 int format_insights_finalize(char *buffer, size_t *ret_buffer_fill,
                              size_t *ret_buffer_free);
 
+/* Like format_insights_finalize() but wraps all objects added since
+ * format_insights_initialize() into a single JSON array. */
+int format_insights_finalize_batch(char *buffer, size_t *ret_buffer_fill,
+                                   size_t *ret_buffer_free);
+
+/*
+ * Streaming encoder
+ *
+ * Appends insights directly to a growable buffer: no intermediate copies, no
+ * snprintf for names, tags and integers, and meta data is read in a single
+ * pass. The buffer grows on demand up to "max_size". The output is identical
+ * to the format_insights_* functions above.
+ */
+typedef struct {
+  char *buffer;
+  size_t fill;
+  size_t size;
+  size_t max_size;
+  size_t count; /* number of objects since the last reset */
+} insights_encoder_t;
+
+int insights_encoder_init(insights_encoder_t *enc, size_t initial_size,
+                          size_t max_size);
+void insights_encoder_destroy(insights_encoder_t *enc);
+void insights_encoder_reset(insights_encoder_t *enc);
+
+/* Appends one data source of "vl". On error the buffer is left as it was
+ * before the call. */
+int insights_encoder_add_value_list(insights_encoder_t *enc,
+                                    const data_set_t *ds,
+                                    const value_list_t *vl, int store_rates,
+                                    size_t ds_idx, int history_length,
+                                    const gauge_t *history_values);
+int insights_encoder_add_log(insights_encoder_t *enc, const char *logmsg,
+                             size_t logmsg_len, const char *file);
+
+/* Terminates the document, either as a single object (like
+ * format_insights_finalize) or as a JSON array of all objects (like
+ * format_insights_finalize_batch). */
+int insights_encoder_finalize(insights_encoder_t *enc, _Bool as_array);
+
 #endif /* UTILS_FORMAT_INSIGHTS_H */
@@ -0,0 +1,120 @@
+/**
+ * Microbenchmark: snprintf based insights formatter vs. streaming encoder
+ *
+ * Usage: bench_format_insights [iterations]
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "utils_format_mcac_insights.h"
+
+#include <time.h>
+
+#define BENCH_BUFFER_SIZE (1 << 20)
+
+static data_set_t ds_bench = {
+    .type = "gauge",
+    .ds_num = 1,
+    .ds = &(data_source_t){"value", DS_TYPE_GAUGE, NAN, NAN},
+};
+
+static double bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double bench_legacy(const value_list_t *vl, long iterations,
+                           char *buffer) {
+  double start = bench_now();
+
+  for (long i = 0; i < iterations; i++) {
+    size_t bfill = 0;
+    size_t bfree = BENCH_BUFFER_SIZE;
+
+    if ((format_insights_initialize(buffer, &bfill, &bfree) != 0) ||
+        (format_insights_value_list(buffer, &bfill, &bfree, &ds_bench, vl, 0,
+                                    NULL, 0, 0, NULL, 0, 1, 0, NULL) != 0) ||
+        (format_insights_finalize(buffer, &bfill, &bfree) != 0)) {
+      fprintf(stderr, "legacy formatter failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  return bench_now() - start;
+}
+
+static double bench_encoder(const value_list_t *vl, long iterations,
+                            insights_encoder_t *enc) {
+  double start = bench_now();
+
+  for (long i = 0; i < iterations; i++) {
+    insights_encoder_reset(enc);
+    if ((insights_encoder_add_value_list(enc, &ds_bench, vl, 0, 0, 0, NULL) !=
+         0) ||
+        (insights_encoder_finalize(enc, 0) != 0)) {
+      fprintf(stderr, "encoder failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  return bench_now() - start;
+}
+
+int main(int argc, char **argv) {
+  long iterations = 200000;
+  char *buffer;
+  insights_encoder_t enc;
+  double t_legacy, t_encoder;
+
+  if (argc > 1)
+    iterations = atol(argv[1]);
+  if (iterations <= 0)
+    iterations = 1;
+
+  value_list_t vl = {
+      .values = &(value_t){.gauge = 12345.678},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T_STATIC(1524257264),
+      .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+      .host = "cassandra-node-17.example.com",
+      .plugin = "mcac",
+      .plugin_instance = "org.apache.cassandra.metrics.table.read_latency",
+      .type = "gauge",
+      .type_instance = "p99",
+  };
+
+  vl.meta = meta_data_create();
+  meta_data_add_string(vl.meta, "keyspace", "system_schema");
+  meta_data_add_string(vl.meta, "table", "columns");
+  meta_data_add_string(vl.meta, "insight_dc", "dc1");
+  meta_data_add_unsigned_int(vl.meta, "shard", 3);
+
+  buffer = malloc(BENCH_BUFFER_SIZE);
+  if ((buffer == NULL) ||
+      (insights_encoder_init(&enc, 4096, BENCH_BUFFER_SIZE) != 0)) {
+    fprintf(stderr, "out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  /* warm up */
+  bench_legacy(&vl, iterations / 10 + 1, buffer);
+  bench_encoder(&vl, iterations / 10 + 1, &enc);
+
+  t_legacy = bench_legacy(&vl, iterations, buffer);
+  t_encoder = bench_encoder(&vl, iterations, &enc);
+
+  printf("iterations: %ld, document size: %zu bytes\n", iterations, enc.fill);
+  printf("format_insights_value_list:      %8.1f ns/op\n",
+         t_legacy * 1e9 / iterations);
+  printf("insights_encoder_add_value_list: %8.1f ns/op\n",
+         t_encoder * 1e9 / iterations);
+  printf("speedup: %.2fx\n", t_legacy / t_encoder);
+
+  insights_encoder_destroy(&enc);
+  meta_data_destroy(vl.meta);
+  free(buffer);
+  return EXIT_SUCCESS;
+}
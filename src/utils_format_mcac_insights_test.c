@@ -0,0 +1,244 @@
+/**
+ * Tests for the insights formatter and streaming encoder
+ **/
+
+#include "collectd.h"
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "testing.h"
+#include "utils_format_mcac_insights.h"
+
+static data_set_t ds_single = {
+    .type = "single",
+    .ds_num = 1,
+    .ds = &(data_source_t){"value", DS_TYPE_GAUGE, NAN, NAN},
+};
+
+static data_set_t ds_double = {
+    .type = "double",
+    .ds_num = 2,
+    .ds =
+        (data_source_t[]){
+            {"rx", DS_TYPE_DERIVE, 0, NAN}, {"tx", DS_TYPE_COUNTER, 0, NAN},
+        },
+};
+
+/* Formats with the snprintf based functions. */
+static int format_legacy(char *buffer, size_t buffer_size, const data_set_t *ds,
+                         const value_list_t *vl, size_t ds_idx,
+                         int history_length, gauge_t *history_values) {
+  size_t bfill = 0;
+  size_t bfree = buffer_size;
+  int status;
+
+  status = format_insights_initialize(buffer, &bfill, &bfree);
+  if (status == 0)
+    status = format_insights_value_list(
+        buffer, &bfill, &bfree, ds, vl, 0, NULL, 0, 0, NULL, (int)ds_idx,
+        (int)ds_idx + 1, history_length, history_values);
+  if (status == 0)
+    status = format_insights_finalize(buffer, &bfill, &bfree);
+  return status;
+}
+
+DEF_TEST(encoder_output) {
+  value_list_t vl = {
+      .values = &(value_t){.gauge = 42},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+      .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+      .host = "example.com",
+      .plugin = "test",
+      .plugin_instance = "foo \"bar\"",
+      .type = "single",
+  };
+  char const *want =
+      " {\"metadata\":{\"name\":\"collectd_test_single\", "
+      "\"timestamp\":1480063672000, \"insightMappingId\": \"collectd-v1\", "
+      "\"insightType\":\"GAUGE\", \"tags\":{\"collectdType\": 1,\"host\": "
+      "\"example.com\",\"plugin_instance\": \"foo \\\"bar\\\"\",\"plugin\": "
+      "\"test\",\"type\": \"single\"}}, \"data\": {\"value\":42}}\n";
+  insights_encoder_t enc;
+
+  CHECK_ZERO(insights_encoder_init(&enc, 16, 4096));
+  CHECK_ZERO(insights_encoder_add_value_list(&enc, &ds_single, &vl, 0, 0, 0,
+                                             NULL));
+  CHECK_ZERO(insights_encoder_finalize(&enc, 0));
+  EXPECT_EQ_STR(want, enc.buffer);
+  EXPECT_EQ_INT(strlen(want), enc.fill);
+
+  insights_encoder_destroy(&enc);
+  return 0;
+}
+
+DEF_TEST(encoder_matches_legacy) {
+  struct {
+    const data_set_t *ds;
+    size_t ds_idx;
+    gauge_t gauge;
+    const char *plugin;
+    const char *plugin_instance;
+    const char *type_instance;
+    const char *meta_string;
+    int history_length;
+  } cases[] = {
+      {.ds = &ds_single, .gauge = 42, .plugin = "test"},
+      {.ds = &ds_single, .gauge = -0.125, .plugin = "single"},
+      {.ds = &ds_single, .gauge = 1e300, .plugin = "test"},
+      {.ds = &ds_single, .gauge = 1.0 / 3.0, .plugin = "test",
+       .type_instance = "tab\there"},
+      {.ds = &ds_single, .gauge = 3, .plugin = "mcac",
+       .plugin_instance = "org.apache.cassandra.metrics.Table",
+       .meta_string = "keyspace \"ks\""},
+      {.ds = &ds_double, .ds_idx = 0, .plugin = "interface",
+       .plugin_instance = "eth0"},
+      {.ds = &ds_double, .ds_idx = 1, .plugin = "interface",
+       .plugin_instance = "eth0", .meta_string = "x"},
+      {.ds = &ds_double, .ds_idx = 1, .plugin = "interface",
+       .history_length = 3},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    value_t values[2] = {{.gauge = cases[i].gauge}, {.counter = 7}};
+    gauge_t history[6] = {1, 2, 3.5, NAN, 5, 6};
+    value_list_t vl = {
+        .values = values,
+        .values_len = cases[i].ds->ds_num,
+        .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+        .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+        .host = "example.com",
+    };
+    char want[8192];
+    insights_encoder_t enc;
+
+    if (cases[i].ds == &ds_double)
+      values[0].derive = -1337;
+
+    sstrncpy(vl.plugin, cases[i].plugin, sizeof(vl.plugin));
+    sstrncpy(vl.type, cases[i].ds->type, sizeof(vl.type));
+    if (cases[i].plugin_instance != NULL)
+      sstrncpy(vl.plugin_instance, cases[i].plugin_instance,
+               sizeof(vl.plugin_instance));
+    if (cases[i].type_instance != NULL)
+      sstrncpy(vl.type_instance, cases[i].type_instance,
+               sizeof(vl.type_instance));
+    if (cases[i].meta_string != NULL) {
+      CHECK_NOT_NULL(vl.meta = meta_data_create());
+      CHECK_ZERO(meta_data_add_string(vl.meta, "insight_tag",
+                                      cases[i].meta_string));
+      CHECK_ZERO(meta_data_add_signed_int(vl.meta, "signed", -3));
+      CHECK_ZERO(meta_data_add_unsigned_int(vl.meta, "unsigned", 3));
+      CHECK_ZERO(meta_data_add_double(vl.meta, "double", 0.5));
+      CHECK_ZERO(meta_data_add_boolean(vl.meta, "bool", 1));
+    }
+
+    CHECK_ZERO(format_legacy(want, sizeof(want), cases[i].ds, &vl,
+                             cases[i].ds_idx, cases[i].history_length,
+                             history));
+
+    CHECK_ZERO(insights_encoder_init(&enc, 64, 8192));
+    CHECK_ZERO(insights_encoder_add_value_list(&enc, cases[i].ds, &vl, 0,
+                                               cases[i].ds_idx,
+                                               cases[i].history_length,
+                                               history));
+    CHECK_ZERO(insights_encoder_finalize(&enc, 0));
+    EXPECT_EQ_STR(want, enc.buffer);
+
+    insights_encoder_destroy(&enc);
+    meta_data_destroy(vl.meta);
+  }
+
+  return 0;
+}
+
+DEF_TEST(encoder_batch) {
+  value_list_t vl = {
+      .values = &(value_t){.gauge = NAN},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "single",
+  };
+  insights_encoder_t enc;
+  size_t fill;
+
+  CHECK_ZERO(insights_encoder_init(&enc, 16, 512));
+
+  /* nothing to finalize yet */
+  OK(insights_encoder_finalize(&enc, 1) != 0);
+
+  /* invalid values leave the buffer untouched */
+  OK(insights_encoder_add_value_list(&enc, &ds_single, &vl, 0, 0, 0, NULL) !=
+     0);
+  EXPECT_EQ_INT(0, enc.fill);
+  EXPECT_EQ_STR("", enc.buffer);
+
+  vl.values[0].gauge = 1;
+  CHECK_ZERO(insights_encoder_add_value_list(&enc, &ds_single, &vl, 0, 0, 0,
+                                             NULL));
+  fill = enc.fill;
+  CHECK_ZERO(insights_encoder_add_value_list(&enc, &ds_single, &vl, 0, 0, 0,
+                                             NULL));
+  EXPECT_EQ_INT(2 * fill, enc.fill);
+  EXPECT_EQ_INT(2, enc.count);
+
+  /* exceeding the maximum size fails without corrupting the buffer */
+  OK(insights_encoder_add_value_list(&enc, &ds_single, &vl, 0, 0, 0, NULL) ==
+     -ENOMEM);
+  EXPECT_EQ_INT(2 * fill, enc.fill);
+
+  CHECK_ZERO(insights_encoder_finalize(&enc, 1));
+  EXPECT_EQ_INT('[', enc.buffer[0]);
+  EXPECT_EQ_STR("}}]\n", enc.buffer + enc.fill - 4);
+  OK(strstr(enc.buffer, "}},{\"metadata\"") != NULL);
+
+  insights_encoder_reset(&enc);
+  EXPECT_EQ_INT(0, enc.count);
+  CHECK_ZERO(insights_encoder_add_log(&enc, "line \"1\"", 8, "system.log"));
+  CHECK_ZERO(insights_encoder_finalize(&enc, 0));
+  OK(strstr(enc.buffer, "\"data\": \"line \\\"1\\\"\"}\n") != NULL);
+
+  insights_encoder_destroy(&enc);
+  return 0;
+}
+
+DEF_TEST(encoder_non_ascii) {
+  value_list_t vl = {
+      .values = &(value_t){.gauge = 1},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+      .host = "example.com",
+      .plugin = "test",
+      .plugin_instance = "gr\xc3\xbc\xc3\x9f" "e",
+      .type = "single",
+  };
+  insights_encoder_t enc;
+
+  CHECK_NOT_NULL(vl.meta = meta_data_create());
+  CHECK_ZERO(meta_data_add_string(vl.meta, "insight_tag",
+                                  "k\xc3\xa4"
+                                  "se\x01"));
+
+  /* UTF-8 is copied verbatim, control characters still become '?'. */
+  CHECK_ZERO(insights_encoder_init(&enc, 16, 4096));
+  CHECK_ZERO(insights_encoder_add_value_list(&enc, &ds_single, &vl, 0, 0, 0,
+                                             NULL));
+  CHECK_ZERO(insights_encoder_finalize(&enc, 0));
+  OK(strstr(enc.buffer, "\"plugin_instance\": \"gr\xc3\xbc\xc3\x9f" "e\"") !=
+     NULL);
+  OK(strstr(enc.buffer, "\"insight_tag\":\"k\xc3\xa4" "se?\"") != NULL);
+
+  insights_encoder_destroy(&enc);
+  meta_data_destroy(vl.meta);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(encoder_output);
+  RUN_TEST(encoder_matches_legacy);
+  RUN_TEST(encoder_batch);
+  RUN_TEST(encoder_non_ascii);
+
+  END_TEST;
+}
@@ -0,0 +1,341 @@
+/**
+ * collectd - src/utils_gorilla.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+
+#include "utils_gorilla.h"
+
+/* Width of the fields that describe a new XOR window. Unlike the original
+ * format, six bits are used for the leading zeros: counters are stored as
+ * integers, whose XORs typically have far more than 31 leading zeros. */
+#define GORILLA_LEADING_BITS 6
+#define GORILLA_LENGTH_BITS 6
+
+static void gorilla_put(uint8_t *buffer, uint64_t *pos, /* {{{ */
+                        uint64_t value, unsigned int n) {
+  while (n > 0) {
+    uint8_t *byte = buffer + (*pos / 8);
+    unsigned int avail = 8 - (unsigned int)(*pos % 8);
+    unsigned int take = (n < avail) ? n : avail;
+    unsigned int shift = avail - take;
+    uint8_t mask = (uint8_t)(((1u << take) - 1) << shift);
+    uint8_t bits = (uint8_t)((value >> (n - take)) & ((1u << take) - 1));
+
+    /* Clear first: bits past the recorded end may be left over from a write
+     * that was interrupted before the state was updated. */
+    *byte = (uint8_t)((*byte & ~mask) | (bits << shift));
+    *pos += take;
+    n -= take;
+  }
+} /* }}} void gorilla_put */
+
+static int gorilla_get(gorilla_reader_t *r, uint64_t *ret, /* {{{ */
+                       unsigned int n) {
+  if ((r->pos + n) > r->bits)
+    return EINVAL;
+
+  uint64_t value = 0;
+  while (n > 0) {
+    uint8_t byte = r->buffer[r->pos / 8];
+    unsigned int avail = 8 - (unsigned int)(r->pos % 8);
+    unsigned int take = (n < avail) ? n : avail;
+    unsigned int shift = avail - take;
+
+    value = (value << take) |
+            (uint64_t)((byte >> shift) & ((1u << take) - 1));
+    r->pos += take;
+    n -= take;
+  }
+
+  *ret = value;
+  return 0;
+} /* }}} int gorilla_get */
+
+static _Bool gorilla_fits(uint64_t bits, size_t size, uint64_t n) /* {{{ */
+{
+  return (bits + n) <= ((uint64_t)size * 8);
+} /* }}} _Bool gorilla_fits */
+
+int gorilla_time_append(gorilla_time_t *st, uint8_t *buffer, /* {{{ */
+                        size_t size, int64_t t) {
+  uint64_t pos = st->bits;
+
+  if (st->count == 0) {
+    if (!gorilla_fits(pos, size, 64))
+      return ENOSPC;
+    gorilla_put(buffer, &pos, (uint64_t)t, 64);
+    st->bits = pos;
+    st->count = 1;
+    st->prev = t;
+    st->prev_delta = 0;
+    return 0;
+  }
+
+  /* Unsigned arithmetic: wrapping is well defined and the decoder undoes it
+   * the same way. */
+  int64_t delta = (int64_t)((uint64_t)t - (uint64_t)st->prev);
+  int64_t dod = (int64_t)((uint64_t)delta - (uint64_t)st->prev_delta);
+
+  uint64_t control;
+  unsigned int control_bits;
+  uint64_t payload;
+  unsigned int payload_bits;
+
+  if (dod == 0) {
+    control = 0x0; /* 0 */
+    control_bits = 1;
+    payload = 0;
+    payload_bits = 0;
+  } else if ((dod >= -63) && (dod <= 64)) {
+    control = 0x2; /* 10 */
+    control_bits = 2;
+    payload = (uint64_t)(dod + 63);
+    payload_bits = 7;
+  } else if ((dod >= -255) && (dod <= 256)) {
+    control = 0x6; /* 110 */
+    control_bits = 3;
+    payload = (uint64_t)(dod + 255);
+    payload_bits = 9;
+  } else if ((dod >= -2047) && (dod <= 2048)) {
+    control = 0xe; /* 1110 */
+    control_bits = 4;
+    payload = (uint64_t)(dod + 2047);
+    payload_bits = 12;
+  } else {
+    control = 0xf; /* 1111 */
+    control_bits = 4;
+    payload = (uint64_t)dod;
+    payload_bits = 64;
+  }
+
+  if (!gorilla_fits(pos, size, control_bits + payload_bits))
+    return ENOSPC;
+
+  gorilla_put(buffer, &pos, control, control_bits);
+  if (payload_bits > 0)
+    gorilla_put(buffer, &pos, payload, payload_bits);
+
+  st->bits = pos;
+  st->count++;
+  st->prev = t;
+  st->prev_delta = delta;
+  return 0;
+} /* }}} int gorilla_time_append */
+
+int gorilla_value_append(gorilla_value_t *st, uint8_t *buffer, /* {{{ */
+                         size_t size, uint64_t v) {
+  uint64_t pos = st->bits;
+
+  if (st->count == 0) {
+    if (!gorilla_fits(pos, size, 64))
+      return ENOSPC;
+    gorilla_put(buffer, &pos, v, 64);
+    st->bits = pos;
+    st->count = 1;
+    st->prev = v;
+    /* An empty window, so the first XOR always describes a new one. */
+    st->leading = 64;
+    st->trailing = 64;
+    return 0;
+  }
+
+  uint64_t xor = v ^ st->prev;
+  if (xor == 0) {
+    if (!gorilla_fits(pos, size, 1))
+      return ENOSPC;
+    gorilla_put(buffer, &pos, 0, 1);
+    st->bits = pos;
+    st->count++;
+    return 0;
+  }
+
+  unsigned int leading = (unsigned int)__builtin_clzll(xor);
+  unsigned int trailing = (unsigned int)__builtin_ctzll(xor);
+
+  /* Reuse the previous window if the XOR fits and that is not more expensive
+   * than describing a tighter one. */
+  _Bool reuse = 0;
+  unsigned int window = 64 - leading - trailing;
+  if ((leading >= st->leading) && (trailing >= st->trailing)) {
+    unsigned int prev_window = 64u - st->leading - st->trailing;
+    reuse = (prev_window <=
+             (window + GORILLA_LEADING_BITS + GORILLA_LENGTH_BITS));
+  }
+
+  if (reuse) {
+    unsigned int prev_window = 64u - st->leading - st->trailing;
+    if (!gorilla_fits(pos, size, 2 + prev_window))
+      return ENOSPC;
+    gorilla_put(buffer, &pos, 0x2, 2); /* 10 */
+    gorilla_put(buffer, &pos, xor >> st->trailing, prev_window);
+  } else {
+    if (!gorilla_fits(pos, size, 2 + GORILLA_LEADING_BITS +
+                                     GORILLA_LENGTH_BITS + window))
+      return ENOSPC;
+    gorilla_put(buffer, &pos, 0x3, 2); /* 11 */
+    gorilla_put(buffer, &pos, leading, GORILLA_LEADING_BITS);
+    gorilla_put(buffer, &pos, window - 1, GORILLA_LENGTH_BITS);
+    gorilla_put(buffer, &pos, xor >> trailing, window);
+    st->leading = (uint8_t)leading;
+    st->trailing = (uint8_t)trailing;
+  }
+
+  st->bits = pos;
+  st->count++;
+  st->prev = v;
+  return 0;
+} /* }}} int gorilla_value_append */
+
+void gorilla_time_reader_init(gorilla_reader_t *r, /* {{{ */
+                              uint8_t const *buffer,
+                              gorilla_time_t const *st) {
+  memset(r, 0, sizeof(*r));
+  r->buffer = buffer;
+  r->bits = st->bits;
+  r->count = st->count;
+} /* }}} void gorilla_time_reader_init */
+
+void gorilla_value_reader_init(gorilla_reader_t *r, /* {{{ */
+                               uint8_t const *buffer,
+                               gorilla_value_t const *st) {
+  memset(r, 0, sizeof(*r));
+  r->buffer = buffer;
+  r->bits = st->bits;
+  r->count = st->count;
+} /* }}} void gorilla_value_reader_init */
+
+int gorilla_time_next(gorilla_reader_t *r, int64_t *ret) /* {{{ */
+{
+  if (r->index >= r->count)
+    return ENOENT;
+
+  uint64_t tmp;
+  if (r->index == 0) {
+    if (gorilla_get(r, &tmp, 64) != 0)
+      return EINVAL;
+    r->prev = (int64_t)tmp;
+    r->prev_delta = 0;
+    r->index++;
+    *ret = r->prev;
+    return 0;
+  }
+
+  /* Count the leading one bits of the control code, at most four. */
+  unsigned int ones = 0;
+  while (ones < 4) {
+    if (gorilla_get(r, &tmp, 1) != 0)
+      return EINVAL;
+    if (tmp == 0)
+      break;
+    ones++;
+  }
+
+  int64_t dod;
+  int status = 0;
+  switch (ones) {
+  case 0:
+    dod = 0;
+    break;
+  case 1:
+    status = gorilla_get(r, &tmp, 7);
+    dod = (int64_t)tmp - 63;
+    break;
+  case 2:
+    status = gorilla_get(r, &tmp, 9);
+    dod = (int64_t)tmp - 255;
+    break;
+  case 3:
+    status = gorilla_get(r, &tmp, 12);
+    dod = (int64_t)tmp - 2047;
+    break;
+  default:
+    status = gorilla_get(r, &tmp, 64);
+    dod = (int64_t)tmp;
+    break;
+  }
+  if (status != 0)
+    return EINVAL;
+
+  int64_t delta = (int64_t)((uint64_t)r->prev_delta + (uint64_t)dod);
+  r->prev = (int64_t)((uint64_t)r->prev + (uint64_t)delta);
+  r->prev_delta = delta;
+  r->index++;
+  *ret = r->prev;
+  return 0;
+} /* }}} int gorilla_time_next */
+
+int gorilla_value_next(gorilla_reader_t *r, uint64_t *ret) /* {{{ */
+{
+  if (r->index >= r->count)
+    return ENOENT;
+
+  uint64_t tmp;
+  if (r->index == 0) {
+    if (gorilla_get(r, &tmp, 64) != 0)
+      return EINVAL;
+    r->prev_value = tmp;
+    r->leading = 64;
+    r->trailing = 64;
+    r->index++;
+    *ret = tmp;
+    return 0;
+  }
+
+  if (gorilla_get(r, &tmp, 1) != 0)
+    return EINVAL;
+  if (tmp == 0) {
+    r->index++;
+    *ret = r->prev_value;
+    return 0;
+  }
+
+  if (gorilla_get(r, &tmp, 1) != 0)
+    return EINVAL;
+  if (tmp == 1) {
+    uint64_t leading;
+    uint64_t length;
+    if ((gorilla_get(r, &leading, GORILLA_LEADING_BITS) != 0) ||
+        (gorilla_get(r, &length, GORILLA_LENGTH_BITS) != 0))
+      return EINVAL;
+    length++;
+    if ((leading + length) > 64)
+      return EINVAL;
+    r->leading = (uint8_t)leading;
+    r->trailing = (uint8_t)(64 - leading - length);
+  } else if ((r->leading + r->trailing) >= 64) {
+    /* Reusing a window that was never described. */
+    return EINVAL;
+  }
+
+  unsigned int window = 64u - r->leading - r->trailing;
+  if (gorilla_get(r, &tmp, window) != 0)
+    return EINVAL;
+
+  r->prev_value ^= tmp << r->trailing;
+  r->index++;
+  *ret = r->prev_value;
+  return 0;
+} /* }}} int gorilla_value_next */
@@ -0,0 +1,135 @@
+/**
+ * collectd - src/utils_gorilla.h
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_GORILLA_H
+#define UTILS_GORILLA_H 1
+
+#include "collectd.h"
+
+/*
+ * Gorilla-style compression of a time series: timestamps are stored as the
+ * delta of their deltas, values as the XOR with their predecessor. Each
+ * column is a bit stream in a caller provided buffer, so it can live in a
+ * memory mapped file. The encoder state is a plain struct without pointers
+ * which may be stored next to the buffer to continue appending later.
+ *
+ * The buffers must be zeroed before the first append. Bits are written most
+ * significant first; the format is independent of the host's byte order.
+ */
+
+/*
+ * Data types
+ */
+struct gorilla_time_s {
+  uint64_t bits; /* number of bits used in the buffer */
+  uint32_t count;
+  uint32_t pad;
+  int64_t prev;
+  int64_t prev_delta;
+};
+typedef struct gorilla_time_s gorilla_time_t;
+
+struct gorilla_value_s {
+  uint64_t bits;
+  uint32_t count;
+  uint8_t leading;  /* leading zeros of the last stored XOR */
+  uint8_t trailing; /* trailing zeros of the last stored XOR */
+  uint16_t pad;
+  uint64_t prev;
+};
+typedef struct gorilla_value_s gorilla_value_t;
+
+struct gorilla_reader_s {
+  uint8_t const *buffer;
+  uint64_t bits;
+  uint64_t pos;
+  uint32_t count;
+  uint32_t index;
+
+  int64_t prev;
+  int64_t prev_delta;
+  uint64_t prev_value;
+  uint8_t leading;
+  uint8_t trailing;
+};
+typedef struct gorilla_reader_s gorilla_reader_t;
+
+/*
+ * Prototypes
+ */
+/*
+ * NAME
+ *  gorilla_time_append
+ *
+ * DESCRIPTION
+ *  Appends the timestamp `t' to the column in `buffer', which is `size' bytes
+ *  long. Regular intervals take a single bit per timestamp, small jitter
+ *  around ten bits.
+ *
+ * RETURN VALUE
+ *  Zero upon success or ENOSPC if the buffer is full. In the latter case
+ *  neither the buffer nor `st' are modified.
+ */
+int gorilla_time_append(gorilla_time_t *st, uint8_t *buffer, size_t size,
+                        int64_t t);
+
+/*
+ * NAME
+ *  gorilla_value_append
+ *
+ * DESCRIPTION
+ *  Appends the 64 bit pattern `v' to the column in `buffer'. Pass the bits of
+ *  a double for gauges and the integer for counters; repeated values take a
+ *  single bit, slowly changing ones only their meaningful bits.
+ *
+ * RETURN VALUE
+ *  Zero upon success or ENOSPC if the buffer is full, in which case nothing
+ *  is modified.
+ */
+int gorilla_value_append(gorilla_value_t *st, uint8_t *buffer, size_t size,
+                         uint64_t v);
+
+/* Prepares `r' to decode the column described by `st'. */
+void gorilla_time_reader_init(gorilla_reader_t *r, uint8_t const *buffer,
+                              gorilla_time_t const *st);
+void gorilla_value_reader_init(gorilla_reader_t *r, uint8_t const *buffer,
+                               gorilla_value_t const *st);
+
+/*
+ * NAME
+ *  gorilla_time_next, gorilla_value_next
+ *
+ * DESCRIPTION
+ *  Decodes the next entry of the column.
+ *
+ * RETURN VALUE
+ *  Zero upon success, ENOENT after the last entry and EINVAL if the column is
+ *  corrupt.
+ */
+int gorilla_time_next(gorilla_reader_t *r, int64_t *ret);
+int gorilla_value_next(gorilla_reader_t *r, uint64_t *ret);
+
+#endif /* UTILS_GORILLA_H */
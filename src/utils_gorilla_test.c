@@ -0,0 +1,178 @@
+/**
+ * collectd - src/utils_gorilla_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "testing.h"
+#include "utils_gorilla.h"
+
+#include <math.h>
+
+static uint64_t double_bits(double d) {
+  uint64_t ret;
+  memcpy(&ret, &d, sizeof(ret));
+  return ret;
+}
+
+DEF_TEST(time) {
+  int64_t times[] = {
+      1500000000000, 1500000010000, 1500000020000, 1500000030003,
+      1500000039990, 1500000050000, 1500000050001, 1500000150000,
+      1500003600000, 1400000000000, 1500003600000, 1500003610000,
+  };
+  uint8_t buffer[256] = {0};
+  gorilla_time_t st = {0};
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(times); i++)
+    CHECK_ZERO(gorilla_time_append(&st, buffer, sizeof(buffer), times[i]));
+  EXPECT_EQ_INT((int)STATIC_ARRAY_SIZE(times), (int)st.count);
+
+  gorilla_reader_t r;
+  gorilla_time_reader_init(&r, buffer, &st);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(times); i++) {
+    int64_t got = 0;
+    CHECK_ZERO(gorilla_time_next(&r, &got));
+    EXPECT_EQ_UINT64((uint64_t)times[i], (uint64_t)got);
+  }
+  int64_t got;
+  EXPECT_EQ_INT(ENOENT, gorilla_time_next(&r, &got));
+
+  return 0;
+}
+
+DEF_TEST(time_regular) {
+  uint8_t buffer[64] = {0};
+  gorilla_time_t st = {0};
+
+  /* 64 bits for the first timestamp, 9 for the first delta and a single bit
+   * for each following one. */
+  int64_t t = 1500000000000;
+  int status = 0;
+  for (int i = 0; i < 300; i++)
+    status |= gorilla_time_append(&st, buffer, sizeof(buffer), t + 10 * i);
+  EXPECT_EQ_INT(0, status);
+  EXPECT_EQ_UINT64(64 + 9 + 298, st.bits);
+
+  /* Appending to a full buffer fails without changing anything. */
+  while (gorilla_time_append(&st, buffer, sizeof(buffer), t) == 0)
+    t += 100000;
+  gorilla_time_t copy = st;
+  EXPECT_EQ_INT(ENOSPC, gorilla_time_append(&st, buffer, sizeof(buffer), t));
+  OK(memcmp(&copy, &st, sizeof(st)) == 0);
+
+  return 0;
+}
+
+DEF_TEST(value) {
+  double values[] = {
+      0.0, 0.0,  1.0,   1.0,     1.5,      2.5,  -2.5, 1e300,
+      NAN, 42.0, 42.25, 42.125, 1e-300, 0.0, 0.0,
+  };
+  uint8_t buffer[512] = {0};
+  gorilla_value_t st = {0};
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(values); i++)
+    CHECK_ZERO(gorilla_value_append(&st, buffer, sizeof(buffer),
+                                    double_bits(values[i])));
+
+  gorilla_reader_t r;
+  gorilla_value_reader_init(&r, buffer, &st);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(values); i++) {
+    uint64_t got = 0;
+    CHECK_ZERO(gorilla_value_next(&r, &got));
+    EXPECT_EQ_UINT64(double_bits(values[i]), got);
+  }
+  uint64_t got;
+  EXPECT_EQ_INT(ENOENT, gorilla_value_next(&r, &got));
+
+  return 0;
+}
+
+DEF_TEST(value_counter) {
+  uint8_t buffer[4096] = {0};
+  gorilla_value_t st = {0};
+
+  /* A slowly increasing counter, including a wrap around. */
+  uint64_t v = UINT64_MAX - 5000;
+  int status = 0;
+  for (int i = 0; i < 1000; i++) {
+    status |= gorilla_value_append(&st, buffer, sizeof(buffer), v);
+    v += (uint64_t)(i % 17);
+  }
+  EXPECT_EQ_INT(0, status);
+  /* Raw storage would take 64000 bits. */
+  OK(st.bits < 16000);
+
+  gorilla_reader_t r;
+  gorilla_value_reader_init(&r, buffer, &st);
+  v = UINT64_MAX - 5000;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t got = 0;
+    CHECK_ZERO(gorilla_value_next(&r, &got));
+    EXPECT_EQ_UINT64(v, got);
+    v += (uint64_t)(i % 17);
+  }
+
+  return 0;
+}
+
+DEF_TEST(resume) {
+  uint8_t buffer[1024];
+  gorilla_value_t st = {0};
+
+  /* Garbage past the recorded end, e.g. from an interrupted write, must not
+   * leak into the values appended later. */
+  memset(buffer, 0, sizeof(buffer));
+  CHECK_ZERO(gorilla_value_append(&st, buffer, sizeof(buffer),
+                                  double_bits(3.0)));
+  memset(buffer + 9, 0xff, sizeof(buffer) - 9);
+  for (int i = 0; i < 100; i++)
+    CHECK_ZERO(gorilla_value_append(&st, buffer, sizeof(buffer),
+                                    double_bits(3.0 + (double)(i % 3))));
+
+  gorilla_reader_t r;
+  gorilla_value_reader_init(&r, buffer, &st);
+  uint64_t got;
+  CHECK_ZERO(gorilla_value_next(&r, &got));
+  EXPECT_EQ_UINT64(double_bits(3.0), got);
+  for (int i = 0; i < 100; i++) {
+    CHECK_ZERO(gorilla_value_next(&r, &got));
+    EXPECT_EQ_UINT64(double_bits(3.0 + (double)(i % 3)), got);
+  }
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(time);
+  RUN_TEST(time_regular);
+  RUN_TEST(value);
+  RUN_TEST(value_counter);
+  RUN_TEST(resume);
+
+  END_TEST;
+}
@@ -37,10 +37,32 @@
 #define LLONG_MAX 9223372036854775807LL
 #endif
 
-#ifndef HISTOGRAM_DEFAULT_BIN_WIDTH
-/* 1048576 = 2^20 ^= 1/1024 s */
-#define HISTOGRAM_DEFAULT_BIN_WIDTH 1048576
-#endif
+/*
+ * The histogram uses a log-linear ("HDR") bucket layout. Latencies are
+ * counted in units of 2^LATENCY_UNIT_BITS cdtime_t (about one microsecond).
+ * The first 2^LATENCY_SUB_BITS units each get their own bucket. Above that,
+ * every power of two is split into 2^(LATENCY_SUB_BITS - 1) buckets of equal
+ * width, so a bucket is never wider than 1/64 of the values it holds. A
+ * percentile is therefore off by at most that much, no matter how large the
+ * other values are, and adding a value never touches more than one bucket.
+ *
+ * Buckets are grouped in rows of 2^(LATENCY_SUB_BITS - 1). Each row keeps
+ * the sum of its buckets, so that percentiles, rates, merges and resets only
+ * need to look at the rows that actually hold values.
+ *
+ * Like the previous linear histogram, bucket boundaries are exclusive at the
+ * bottom and inclusive at the top: (lower, upper].
+ */
+#define LATENCY_UNIT_BITS 10
+#define LATENCY_SUB_BITS 7
+/* Highest power of two (in units) with full resolution; about 24 days.
+ * Larger latencies are counted in the last bucket. */
+#define LATENCY_MAX_BIT 40
+
+#define LATENCY_ROW_BITS (LATENCY_SUB_BITS - 1)
+#define LATENCY_ROW_SIZE (1 << LATENCY_ROW_BITS)
+#define LATENCY_ROWS (LATENCY_MAX_BIT - LATENCY_SUB_BITS + 3)
+#define LATENCY_BUCKETS (LATENCY_ROWS * LATENCY_ROW_SIZE)
 
 struct latency_counter_s {
   cdtime_t start_time;
@@ -51,67 +73,72 @@ struct latency_counter_s {
   cdtime_t min;
   cdtime_t max;
 
-  cdtime_t bin_width;
-  int histogram[HISTOGRAM_NUM_BINS];
+  uint64_t rows[LATENCY_ROWS];
+  uint32_t buckets[LATENCY_BUCKETS];
 };
 
-/*
-* Histogram represents the distribution of data, it has a list of "bins".
-* Each bin represents an interval and has a count (frequency) of
-* number of values fall within its interval.
-*
-* Histogram's range is determined by the number of bins and the bin width,
-* There are 1000 bins and all bins have the same width of default 1 millisecond.
-* When a value above this range is added, Histogram's range is increased by
-* increasing the bin width (note that number of bins remains always at 1000).
-* This operation of increasing bin width is little expensive as each bin need
-* to be visited to update it's count. To reduce frequent change of bin width,
-* new bin width will be the next nearest power of 2. Example: 2, 4, 8, 16, 32,
-* 64, 128, 256, 512, 1024, 2048, 5086, ...
-*
-* So, if the required bin width is 300, then new bin width will be 512 as it is
-* the next nearest power of 2.
-*/
-static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
+/* Returns the bucket holding latencies in (units << LATENCY_UNIT_BITS,
+ * (units + 1) << LATENCY_UNIT_BITS]. */
+static size_t latency_bucket(uint64_t units) /* {{{ */
+{
+  if (units < (1 << LATENCY_SUB_BITS))
+    return (size_t)units;
+  if (units >> (LATENCY_MAX_BIT + 1))
+    return LATENCY_BUCKETS - 1;
+
+  int msb = 63 - __builtin_clzll(units);
+  int shift = msb - LATENCY_SUB_BITS + 1;
+
+  /* (units >> shift) is in [2^(SUB_BITS-1), 2^SUB_BITS), i.e. it already
+   * includes the offset of one row. */
+  return (((size_t)shift) << LATENCY_ROW_BITS) + (size_t)(units >> shift);
+} /* }}} size_t latency_bucket */
+
+static size_t latency_bucket_of(cdtime_t latency) /* {{{ */
 {
-  /* This function is called because the new value is above histogram's range.
-   * First find the required bin width:
-   *           requiredBinWidth = (value + 1) / numBins
-   * then get the next nearest power of 2
-   *           newBinWidth = 2^(ceil(log2(requiredBinWidth)))
-   */
-  double required_bin_width =
-      ((double)(latency + 1)) / ((double)HISTOGRAM_NUM_BINS);
-  double required_bin_width_logbase2 = log(required_bin_width) / log(2.0);
-  cdtime_t new_bin_width =
-      (cdtime_t)(pow(2.0, ceil(required_bin_width_logbase2)) + .5);
-  cdtime_t old_bin_width = lc->bin_width;
-
-  lc->bin_width = new_bin_width;
-
-  /* bin_width has been increased, now iterate through all bins and move the
-   * old bin's count to new bin. */
-  if (lc->num > 0) // if the histogram has data then iterate else skip
-  {
-    double width_change_ratio =
-        ((double)old_bin_width) / ((double)new_bin_width);
-
-    for (size_t i = 0; i < HISTOGRAM_NUM_BINS; i++) {
-      size_t new_bin = (size_t)(((double)i) * width_change_ratio);
-      if (i == new_bin)
-        continue;
-      assert(new_bin < i);
-
-      lc->histogram[new_bin] += lc->histogram[i];
-      lc->histogram[i] = 0;
+  return latency_bucket((latency - 1) >> LATENCY_UNIT_BITS);
+} /* }}} size_t latency_bucket_of */
+
+/* Returns the exclusive lower and the inclusive upper boundary of a bucket. */
+static void latency_bucket_bounds(size_t bucket, cdtime_t *ret_lower, /* {{{ */
+                                  cdtime_t *ret_upper) {
+  uint64_t lower = bucket;
+  uint64_t width = 1;
+
+  if (bucket >= (1 << LATENCY_SUB_BITS)) {
+    int shift = (int)(bucket >> LATENCY_ROW_BITS) - 1;
+    lower = ((uint64_t)(bucket & (LATENCY_ROW_SIZE - 1)) + LATENCY_ROW_SIZE)
+            << shift;
+    width = ((uint64_t)1) << shift;
+  }
+
+  *ret_lower = (cdtime_t)(lower << LATENCY_UNIT_BITS);
+  *ret_upper = (cdtime_t)((lower + width) << LATENCY_UNIT_BITS);
+} /* }}} void latency_bucket_bounds */
+
+/* Sums up the buckets [first, last]. */
+static uint64_t latency_counter_count(latency_counter_t const *lc, /* {{{ */
+                                      size_t first, size_t last) {
+  uint64_t sum = 0;
+
+  while (first <= last) {
+    size_t row = first >> LATENCY_ROW_BITS;
+    if (((first & (LATENCY_ROW_SIZE - 1)) == 0) &&
+        ((first + LATENCY_ROW_SIZE - 1) <= last)) {
+      sum += lc->rows[row];
+      first += LATENCY_ROW_SIZE;
+      continue;
+    }
+    if (lc->rows[row] == 0) {
+      first = (row + 1) << LATENCY_ROW_BITS;
+      continue;
     }
+    sum += lc->buckets[first];
+    first++;
   }
 
-  DEBUG("utils_latency: change_bin_width: latency = %.3f; "
-        "old_bin_width = %.3f; new_bin_width = %.3f;",
-        CDTIME_T_TO_DOUBLE(latency), CDTIME_T_TO_DOUBLE(old_bin_width),
-        CDTIME_T_TO_DOUBLE(new_bin_width));
-} /* }}} void change_bin_width */
+  return sum;
+} /* }}} uint64_t latency_counter_count */
 
 latency_counter_t *latency_counter_create(void) /* {{{ */
 {
@@ -121,7 +148,6 @@ latency_counter_t *latency_counter_create(void) /* {{{ */
   if (lc == NULL)
     return NULL;
 
-  lc->bin_width = HISTOGRAM_DEFAULT_BIN_WIDTH;
   latency_counter_reset(lc);
   return lc;
 } /* }}} latency_counter_t *latency_counter_create */
@@ -133,8 +159,6 @@ void latency_counter_destroy(latency_counter_t *lc) /* {{{ */
 
 void latency_counter_add(latency_counter_t *lc, cdtime_t latency) /* {{{ */
 {
-  cdtime_t bin;
-
   if ((lc == NULL) || (latency == 0) || (latency > ((cdtime_t)LLONG_MAX)))
     return;
 
@@ -148,50 +172,60 @@ void latency_counter_add(latency_counter_t *lc, cdtime_t latency) /* {{{ */
   if (lc->max < latency)
     lc->max = latency;
 
-  /* A latency of _exactly_ 1.0 ms is stored in the buffer 0, so
-   * subtract one from the cdtime_t value so that exactly 1.0 ms get sorted
-   * accordingly. */
-  bin = (latency - 1) / lc->bin_width;
-  if (bin >= HISTOGRAM_NUM_BINS) {
-    change_bin_width(lc, latency);
-    bin = (latency - 1) / lc->bin_width;
-    if (bin >= HISTOGRAM_NUM_BINS) {
-      ERROR("utils_latency: latency_counter_add: Invalid bin: %" PRIu64, bin);
-      return;
-    }
-  }
-  lc->histogram[bin]++;
+  size_t bucket = latency_bucket_of(latency);
+  lc->buckets[bucket]++;
+  lc->rows[bucket >> LATENCY_ROW_BITS]++;
 } /* }}} void latency_counter_add */
 
+void latency_counter_merge(latency_counter_t *dst, /* {{{ */
+                           latency_counter_t const *src) {
+  if ((dst == NULL) || (src == NULL) || (src->num == 0))
+    return;
+
+  dst->sum += src->sum;
+  dst->num += src->num;
+
+  if ((dst->min == 0) && (dst->max == 0)) {
+    dst->min = src->min;
+    dst->max = src->max;
+  }
+  if (dst->min > src->min)
+    dst->min = src->min;
+  if (dst->max < src->max)
+    dst->max = src->max;
+
+  for (size_t row = 0; row < LATENCY_ROWS; row++) {
+    if (src->rows[row] == 0)
+      continue;
+
+    dst->rows[row] += src->rows[row];
+    for (size_t i = row << LATENCY_ROW_BITS;
+         i < ((row + 1) << LATENCY_ROW_BITS); i++)
+      dst->buckets[i] += src->buckets[i];
+  }
+
+  if ((dst->start_time == 0) || (dst->start_time > src->start_time))
+    dst->start_time = src->start_time;
+} /* }}} void latency_counter_merge */
+
 void latency_counter_reset(latency_counter_t *lc) /* {{{ */
 {
   if (lc == NULL)
     return;
 
-  cdtime_t bin_width = lc->bin_width;
-  cdtime_t max_bin = (lc->max - 1) / lc->bin_width;
+  for (size_t row = 0; row < LATENCY_ROWS; row++) {
+    if (lc->rows[row] == 0)
+      continue;
 
-/*
-  If max latency is REDUCE_THRESHOLD times less than histogram's range,
-  then cut it in half. REDUCE_THRESHOLD must be >= 2.
-  Value of 4 is selected to reduce frequent changes of bin width.
-*/
-#define REDUCE_THRESHOLD 4
-  if ((lc->num > 0) && (lc->bin_width >= HISTOGRAM_DEFAULT_BIN_WIDTH * 2) &&
-      (max_bin < HISTOGRAM_NUM_BINS / REDUCE_THRESHOLD)) {
-    /* new bin width will be the previous power of 2 */
-    bin_width = bin_width / 2;
-
-    DEBUG("utils_latency: latency_counter_reset: max_latency = %.3f; "
-          "max_bin = %" PRIu64 "; old_bin_width = %.3f; new_bin_width = %.3f;",
-          CDTIME_T_TO_DOUBLE(lc->max), max_bin,
-          CDTIME_T_TO_DOUBLE(lc->bin_width), CDTIME_T_TO_DOUBLE(bin_width));
+    memset(lc->buckets + (row << LATENCY_ROW_BITS), 0,
+           LATENCY_ROW_SIZE * sizeof(lc->buckets[0]));
+    lc->rows[row] = 0;
   }
 
-  memset(lc, 0, sizeof(*lc));
-
-  /* preserve bin width */
-  lc->bin_width = bin_width;
+  lc->sum = 0;
+  lc->num = 0;
+  lc->min = 0;
+  lc->max = 0;
   lc->start_time = cdtime();
 } /* }}} void latency_counter_reset */
 
@@ -236,47 +270,34 @@ cdtime_t latency_counter_get_average(latency_counter_t *lc) /* {{{ */
 
 cdtime_t latency_counter_get_percentile(latency_counter_t *lc, /* {{{ */
                                         double percent) {
-  double percent_upper;
-  double percent_lower;
-  double p;
-  cdtime_t latency_lower;
-  cdtime_t latency_interpolated;
-  int sum;
-  size_t i;
-
   if ((lc == NULL) || (lc->num == 0) || !((percent > 0.0) && (percent < 100.0)))
     return 0;
 
-  /* Find index i so that at least "percent" events are within i+1 ms. */
-  percent_upper = 0.0;
-  percent_lower = 0.0;
-  sum = 0;
-  for (i = 0; i < HISTOGRAM_NUM_BINS; i++) {
-    percent_lower = percent_upper;
-    sum += lc->histogram[i];
-    if (sum == 0)
-      percent_upper = 0.0;
-    else
-      percent_upper = 100.0 * ((double)sum) / ((double)lc->num);
-
-    if (percent_upper >= percent)
-      break;
-  }
+  /* Find the bucket in which the number of values seen so far reaches
+   * "percent" percent of all values: first the row, then within the row. */
+  double target = percent * ((double)lc->num) / 100.0;
+  uint64_t sum = 0;
+  size_t row = 0;
 
-  if (i >= HISTOGRAM_NUM_BINS)
-    return 0;
+  while ((row < LATENCY_ROWS - 1) && ((double)(sum + lc->rows[row]) < target))
+    sum += lc->rows[row++];
 
-  assert(percent_upper >= percent);
-  assert(percent_lower < percent);
+  size_t bucket = row << LATENCY_ROW_BITS;
+  size_t last = ((row + 1) << LATENCY_ROW_BITS) - 1;
+  while ((bucket < last) && ((double)(sum + lc->buckets[bucket]) < target))
+    sum += lc->buckets[bucket++];
 
-  if (i == 0)
-    return lc->bin_width;
+  if (lc->buckets[bucket] == 0)
+    return 0;
 
-  latency_lower = ((cdtime_t)i) * lc->bin_width;
-  p = (percent - percent_lower) / (percent_upper - percent_lower);
+  /* Interpolate linearly within the bucket. */
+  cdtime_t lower;
+  cdtime_t upper;
+  latency_bucket_bounds(bucket, &lower, &upper);
 
-  latency_interpolated =
-      latency_lower + DOUBLE_TO_CDTIME_T(p * CDTIME_T_TO_DOUBLE(lc->bin_width));
+  double p = (target - (double)sum) / ((double)lc->buckets[bucket]);
+  cdtime_t latency_interpolated =
+      lower + DOUBLE_TO_CDTIME_T(p * CDTIME_T_TO_DOUBLE(upper - lower));
 
   DEBUG("latency_counter_get_percentile: latency_interpolated = %.3f",
         CDTIME_T_TO_DOUBLE(latency_interpolated));
@@ -294,50 +315,40 @@ double latency_counter_get_rate(const latency_counter_t *lc, /* {{{ */
   if (lower == upper)
     return 0;
 
-  /* Buckets have an exclusive lower bound and an inclusive upper bound. That
-   * means that the first bucket, index 0, represents (0-bin_width]. That means
-   * that latency==bin_width needs to result in bin=0, that's why we need to
-   * subtract one before dividing by bin_width. */
-  cdtime_t lower_bin = 0;
+  /* lower is *exclusive* => determine bucket for lower+1 */
+  size_t lower_bucket = 0;
   if (lower)
-    /* lower is *exclusive* => determine bucket for lower+1 */
-    lower_bin = ((lower + 1) - 1) / lc->bin_width;
+    lower_bucket = latency_bucket_of(lower + 1);
 
-  /* lower is greater than the longest latency observed => rate is zero. */
-  if (lower_bin >= HISTOGRAM_NUM_BINS)
-    return 0;
-
-  cdtime_t upper_bin = HISTOGRAM_NUM_BINS - 1;
+  size_t upper_bucket = LATENCY_BUCKETS - 1;
   if (upper)
-    upper_bin = (upper - 1) / lc->bin_width;
-
-  if (upper_bin >= HISTOGRAM_NUM_BINS) {
-    upper_bin = HISTOGRAM_NUM_BINS - 1;
-    upper = 0;
-  }
+    upper_bucket = latency_bucket_of(upper);
 
-  double sum = 0;
-  for (size_t i = lower_bin; i <= upper_bin; i++)
-    sum += lc->histogram[i];
+  double sum = (double)latency_counter_count(lc, lower_bucket, upper_bucket);
 
   if (lower) {
-    /* Approximate ratio of requests in lower_bin, that fall between
-     * lower_bin_boundary and lower. This ratio is then subtracted from sum to
-     * increase accuracy. */
-    cdtime_t lower_bin_boundary = lower_bin * lc->bin_width;
-    assert(lower >= lower_bin_boundary);
-    double lower_ratio =
-        (double)(lower - lower_bin_boundary) / ((double)lc->bin_width);
-    sum -= lower_ratio * lc->histogram[lower_bin];
+    /* Approximate ratio of requests in lower_bucket, that fall between the
+     * bucket's lower boundary and lower. This ratio is then subtracted from
+     * sum to increase accuracy. */
+    cdtime_t bucket_lower;
+    cdtime_t bucket_upper;
+    latency_bucket_bounds(lower_bucket, &bucket_lower, &bucket_upper);
+    if ((lower > bucket_lower) && (lower < bucket_upper))
+      sum -= ((double)(lower - bucket_lower)) /
+             ((double)(bucket_upper - bucket_lower)) *
+             lc->buckets[lower_bucket];
   }
 
   if (upper) {
-    /* As above: approximate ratio of requests in upper_bin, that fall between
-     * upper and upper_bin_boundary. */
-    cdtime_t upper_bin_boundary = (upper_bin + 1) * lc->bin_width;
-    assert(upper <= upper_bin_boundary);
-    double ratio = (double)(upper_bin_boundary - upper) / (double)lc->bin_width;
-    sum -= ratio * lc->histogram[upper_bin];
+    /* As above: approximate ratio of requests in upper_bucket, that fall
+     * between upper and the bucket's upper boundary. */
+    cdtime_t bucket_lower;
+    cdtime_t bucket_upper;
+    latency_bucket_bounds(upper_bucket, &bucket_lower, &bucket_upper);
+    if ((upper > bucket_lower) && (upper < bucket_upper))
+      sum -= ((double)(bucket_upper - upper)) /
+             ((double)(bucket_upper - bucket_lower)) *
+             lc->buckets[upper_bucket];
   }
 
   return sum / (CDTIME_T_TO_DOUBLE(now - lc->start_time));
@@ -28,10 +28,6 @@
 
 #include "utils_time.h"
 
-#ifndef HISTOGRAM_NUM_BINS
-#define HISTOGRAM_NUM_BINS 1000
-#endif
-
 struct latency_counter_s;
 typedef struct latency_counter_s latency_counter_t;
 
@@ -41,6 +37,18 @@ void latency_counter_destroy(latency_counter_t *lc);
 void latency_counter_add(latency_counter_t *lc, cdtime_t latency);
 void latency_counter_reset(latency_counter_t *lc);
 
+/*
+ * NAME
+ *  latency_counter_merge(dst,src)
+ *
+ * DESCRIPTION
+ *   Adds all latencies counted by `src' to `dst', e.g. to combine counters
+ *   that are each updated by a single thread without locking. Only the
+ *   non-empty parts of `src' are visited. `src' is not modified.
+ */
+void latency_counter_merge(latency_counter_t *dst,
+                           latency_counter_t const *src);
+
 cdtime_t latency_counter_get_min(latency_counter_t *lc);
 cdtime_t latency_counter_get_max(latency_counter_t *lc);
 cdtime_t latency_counter_get_sum(latency_counter_t *lc);
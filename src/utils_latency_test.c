@@ -101,16 +101,88 @@ DEF_TEST(percentile) {
   return 0;
 }
 
+DEF_TEST(outlier) {
+  latency_counter_t *l;
+
+  CHECK_NOT_NULL(l = latency_counter_create());
+
+  /* A single slow request must not cost the low latencies their
+   * resolution. */
+  for (size_t i = 0; i < 1000; i++)
+    latency_counter_add(l, MS_TO_CDTIME_T(((uint64_t)i % 10) + 1));
+  latency_counter_add(l, TIME_T_TO_CDTIME_T(3600));
+
+  EXPECT_EQ_DOUBLE(3600.0, CDTIME_T_TO_DOUBLE(latency_counter_get_max(l)));
+
+  struct {
+    double percent;
+    double want;
+  } cases[] = {
+      {5.0, 0.001}, {45.0, 0.005}, {85.0, 0.009}, {95.0, 0.010},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    double got =
+        CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(l, cases[i].percent));
+    printf("## case %zu: percentile(%g) = %g, want %g\n", i, cases[i].percent,
+           got, cases[i].want);
+    OK(fabs(got - cases[i].want) <= cases[i].want / 64.0);
+  }
+
+  double got = CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(l, 99.99));
+  OK(fabs(got - 3600.0) <= 3600.0 / 64.0);
+
+  latency_counter_destroy(l);
+  return 0;
+}
+
+DEF_TEST(merge) {
+  latency_counter_t *all;
+  latency_counter_t *parts[3];
+
+  CHECK_NOT_NULL(all = latency_counter_create());
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(parts); i++)
+    CHECK_NOT_NULL(parts[i] = latency_counter_create());
+
+  for (uint64_t i = 1; i <= 3000; i++) {
+    cdtime_t latency = US_TO_CDTIME_T(i * i);
+    latency_counter_add(all, latency);
+    latency_counter_add(parts[i % 3], latency);
+  }
+
+  latency_counter_t *merged;
+  CHECK_NOT_NULL(merged = latency_counter_create());
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(parts); i++)
+    latency_counter_merge(merged, parts[i]);
+
+  EXPECT_EQ_UINT64(latency_counter_get_num(all),
+                   latency_counter_get_num(merged));
+  EXPECT_EQ_UINT64(latency_counter_get_sum(all),
+                   latency_counter_get_sum(merged));
+  EXPECT_EQ_UINT64(latency_counter_get_min(all),
+                   latency_counter_get_min(merged));
+  EXPECT_EQ_UINT64(latency_counter_get_max(all),
+                   latency_counter_get_max(merged));
+  for (double p = 5.0; p < 100.0; p += 5.0)
+    EXPECT_EQ_UINT64(latency_counter_get_percentile(all, p),
+                     latency_counter_get_percentile(merged, p));
+
+  latency_counter_reset(merged);
+  EXPECT_EQ_UINT64(0, latency_counter_get_num(merged));
+  CHECK_ZERO(latency_counter_get_percentile(merged, 50.0));
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(parts); i++)
+    latency_counter_destroy(parts[i]);
+  latency_counter_destroy(merged);
+  latency_counter_destroy(all);
+  return 0;
+}
+
 DEF_TEST(get_rate) {
-  /* We re-declare the struct here so we can inspect its content. */
+  /* We re-declare the beginning of the struct here so we can inspect the
+   * start time. */
   struct {
     cdtime_t start_time;
-    cdtime_t sum;
-    size_t num;
-    cdtime_t min;
-    cdtime_t max;
-    cdtime_t bin_width;
-    int histogram[HISTOGRAM_NUM_BINS];
   } * peek;
   latency_counter_t *l;
 
@@ -121,71 +193,37 @@ DEF_TEST(get_rate) {
     latency_counter_add(l, TIME_T_TO_CDTIME_T(i));
   }
 
-  /* We expect a bucket width of 125ms. */
-  EXPECT_EQ_UINT64(DOUBLE_TO_CDTIME_T(0.125), peek->bin_width);
-
-  struct {
-    size_t index;
-    int want;
-  } bucket_cases[] = {
-      {0, 0},  /* (0.000-0.125] */
-      {1, 0},  /* (0.125-0.250] */
-      {2, 0},  /* (0.250-0.375] */
-      {3, 0},  /* (0.375-0.500] */
-      {4, 0},  /* (0.500-0.625] */
-      {5, 0},  /* (0.625-0.750] */
-      {6, 0},  /* (0.750-0.875] */
-      {7, 1},  /* (0.875-1.000] */
-      {8, 0},  /* (1.000-1.125] */
-      {9, 0},  /* (1.125-1.250] */
-      {10, 0}, /* (1.250-1.375] */
-      {11, 0}, /* (1.375-1.500] */
-      {12, 0}, /* (1.500-1.625] */
-      {13, 0}, /* (1.625-1.750] */
-      {14, 0}, /* (1.750-1.875] */
-      {15, 1}, /* (1.875-2.000] */
-      {16, 0}, /* (2.000-2.125] */
-  };
-
-  for (size_t i = 0; i < STATIC_ARRAY_SIZE(bucket_cases); i++) {
-    size_t index = bucket_cases[i].index;
-    EXPECT_EQ_INT(bucket_cases[i].want, peek->histogram[index]);
-  }
-
+  /* Just below 2s buckets are 1/64s wide, so the bucket holding the t=2 update
+   * is (1.984375-2.000]. */
   struct {
     cdtime_t lower_bound;
     cdtime_t upper_bound;
     double want;
   } cases[] = {
       {
-          // bucket 6 is zero
+          // no updates in range
           DOUBLE_TO_CDTIME_T_STATIC(0.750), DOUBLE_TO_CDTIME_T_STATIC(0.875),
           0.00,
       },
       {
-          // bucket 7 contains the t=1 update
+          // contains the t=1 update
           DOUBLE_TO_CDTIME_T_STATIC(0.875), DOUBLE_TO_CDTIME_T_STATIC(1.000),
           1.00,
       },
       {
-          // range: bucket 7 - bucket 15; contains the t=1 and t=2 updates
+          // contains the t=1 and t=2 updates
           DOUBLE_TO_CDTIME_T_STATIC(0.875), DOUBLE_TO_CDTIME_T_STATIC(2.000),
           2.00,
       },
       {
           // lower bucket is only partially applied
-          DOUBLE_TO_CDTIME_T_STATIC(0.875 + (0.125 / 4)),
-          DOUBLE_TO_CDTIME_T_STATIC(2.000), 1.75,
+          DOUBLE_TO_CDTIME_T_STATIC(2.000 - (1.0 / 256.0)),
+          DOUBLE_TO_CDTIME_T_STATIC(3.000), 1.25,
       },
       {
           // upper bucket is only partially applied
-          DOUBLE_TO_CDTIME_T_STATIC(0.875),
-          DOUBLE_TO_CDTIME_T_STATIC(2.000 - (0.125 / 4)), 1.75,
-      },
-      {
-          // both buckets are only partially applied
-          DOUBLE_TO_CDTIME_T_STATIC(0.875 + (0.125 / 4)),
-          DOUBLE_TO_CDTIME_T_STATIC(2.000 - (0.125 / 4)), 1.50,
+          DOUBLE_TO_CDTIME_T_STATIC(0.500),
+          DOUBLE_TO_CDTIME_T_STATIC(2.000 - (1.0 / 256.0)), 1.75,
       },
       {
           // lower bound is unspecified
@@ -193,7 +231,7 @@ DEF_TEST(get_rate) {
       },
       {
           // upper bound is unspecified
-          DOUBLE_TO_CDTIME_T_STATIC(125.000 - 0.125), 0, 1.00,
+          DOUBLE_TO_CDTIME_T_STATIC(125.000 - 1.000), 0, 1.00,
       },
       {
           // overflow test: upper >> longest latency
@@ -228,6 +266,8 @@ DEF_TEST(get_rate) {
 int main(void) {
   RUN_TEST(simple);
   RUN_TEST(percentile);
+  RUN_TEST(outlier);
+  RUN_TEST(merge);
   RUN_TEST(get_rate);
 
   END_TEST;
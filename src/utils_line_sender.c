@@ -0,0 +1,772 @@
+/**
+ * collectd - src/utils_line_sender.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_complain.h"
+#include "utils_line_sender.h"
+#include "utils_random.h"
+
+#include <netdb.h>
+#include <poll.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Bytes taken from the queue and sent at once. */
+#define LS_OUT_SIZE 65536
+#define LS_CONNECT_TIMEOUT TIME_T_TO_CDTIME_T_STATIC(5)
+#define LS_SHUTDOWN_TIMEOUT TIME_T_TO_CDTIME_T_STATIC(5)
+
+/*
+ * Private types
+ */
+struct line_sender_s {
+  /* Read only after line_sender_create(). */
+  char *log_prefix;
+  char *thread_name;
+  char *node;
+  char *service;
+  int socktype;
+  size_t send_threshold;
+  cdtime_t reconnect_min;
+  cdtime_t reconnect_max;
+  cdtime_t reconnect_interval;
+  cdtime_t resolve_interval;
+  cdtime_t resolve_jitter;
+  _Bool log_send_errors;
+
+  /* Shared with the write threads, protected by `lock'. Data is queued in the
+   * memory ring and, once that is full, the spill file. To keep the order,
+   * new data goes to the spill file as long as it is not empty. */
+  pthread_mutex_t lock;
+  char *queue;
+  size_t queue_size;
+  size_t queue_head;
+  size_t queue_len;
+  cdtime_t queue_time; /* when the oldest pending data was queued */
+
+  char *spill_file;
+  int spill_fd;
+  size_t spill_size;
+  size_t spill_read;
+  size_t spill_write;
+
+  _Bool flush_requested;
+  _Bool shutdown;
+  cdtime_t shutdown_deadline;
+  _Bool thread_running;
+  pthread_t thread;
+  int wakeup_fd[2];
+  _Bool wakeup_pending;
+
+  uint64_t dropped;
+  c_complain_t drop_complaint;
+
+  /* Only used by the I/O thread. */
+  cdtime_t stop_time; /* copy of shutdown_deadline */
+  int fd;
+  cdtime_t connect_time;
+  cdtime_t next_connect;
+  unsigned int failures;
+  struct addrinfo *ai;
+  cdtime_t ai_expires;
+  c_complain_t connect_complaint;
+
+  char out[LS_OUT_SIZE];
+  size_t out_pos;
+  size_t out_len;
+  _Bool drop_line; /* rest of an over-long line is still queued */
+};
+
+static size_t ls_pending_nolock(line_sender_t const *s) /* {{{ */
+{
+  return s->queue_len + (s->spill_write - s->spill_read);
+} /* }}} size_t ls_pending_nolock */
+
+static void ls_wakeup_nolock(line_sender_t *s) /* {{{ */
+{
+  if (!s->thread_running || s->wakeup_pending)
+    return;
+
+  s->wakeup_pending = 1;
+  if (write(s->wakeup_fd[1], "", 1) < 0)
+    s->wakeup_pending = 0;
+} /* }}} void ls_wakeup_nolock */
+
+static void ls_ring_put(line_sender_t *s, char const *data, /* {{{ */
+                        size_t len) {
+  size_t tail = (s->queue_head + s->queue_len) % s->queue_size;
+  size_t first = s->queue_size - tail;
+  if (first > len)
+    first = len;
+
+  memcpy(s->queue + tail, data, first);
+  memcpy(s->queue, data + first, len - first);
+  s->queue_len += len;
+} /* }}} void ls_ring_put */
+
+/* Copies up to `len' bytes from the head of the ring without removing them. */
+static size_t ls_ring_peek(line_sender_t const *s, char *buffer, /* {{{ */
+                           size_t len) {
+  if (len > s->queue_len)
+    len = s->queue_len;
+
+  size_t first = s->queue_size - s->queue_head;
+  if (first > len)
+    first = len;
+
+  memcpy(buffer, s->queue + s->queue_head, first);
+  memcpy(buffer + first, s->queue, len - first);
+  return len;
+} /* }}} size_t ls_ring_peek */
+
+static void ls_ring_consume(line_sender_t *s, size_t len) /* {{{ */
+{
+  s->queue_head = (s->queue_head + len) % s->queue_size;
+  s->queue_len -= len;
+  if (s->queue_len == 0)
+    s->queue_head = 0;
+} /* }}} void ls_ring_consume */
+
+static int ls_spill_put_nolock(line_sender_t *s, char const *data, /* {{{ */
+                               size_t len) {
+  if ((s->spill_fd < 0) || ((s->spill_write + len) > s->spill_size))
+    return ENOBUFS;
+
+  size_t done = 0;
+  while (done < len) {
+    ssize_t status = pwrite(s->spill_fd, data + done, len - done,
+                            (off_t)(s->spill_write + done));
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if (status <= 0) {
+      char errbuf[1024];
+      ERROR("%s: Writing to the spill file \"%s\" failed: %s", s->log_prefix,
+            s->spill_file, sstrerror(errno, errbuf, sizeof(errbuf)));
+      /* The partially written data is overwritten by the next write. */
+      return ENOBUFS;
+    }
+    done += (size_t)status;
+  }
+
+  s->spill_write += len;
+  return 0;
+} /* }}} int ls_spill_put_nolock */
+
+/* Moves data from the spill file into the memory ring as space permits. */
+static void ls_spill_refill_nolock(line_sender_t *s) /* {{{ */
+{
+  while ((s->spill_read < s->spill_write) && (s->queue_len < s->queue_size)) {
+    size_t tail = (s->queue_head + s->queue_len) % s->queue_size;
+    size_t len = s->queue_size - s->queue_len;
+    if (len > (s->queue_size - tail))
+      len = s->queue_size - tail;
+    if (len > (s->spill_write - s->spill_read))
+      len = s->spill_write - s->spill_read;
+
+    ssize_t status =
+        pread(s->spill_fd, s->queue + tail, len, (off_t)s->spill_read);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if (status <= 0) {
+      char errbuf[1024];
+      ERROR("%s: Reading from the spill file \"%s\" failed, dropping its "
+            "content: %s",
+            s->log_prefix, s->spill_file,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      s->spill_read = s->spill_write;
+      break;
+    }
+
+    s->queue_len += (size_t)status;
+    s->spill_read += (size_t)status;
+  }
+
+  if ((s->spill_fd >= 0) && (s->spill_read == s->spill_write) &&
+      (s->spill_write > 0)) {
+    if (ftruncate(s->spill_fd, 0) != 0) {
+      char errbuf[1024];
+      WARNING("%s: Truncating the spill file \"%s\" failed: %s",
+              s->log_prefix, s->spill_file,
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+    }
+    s->spill_read = 0;
+    s->spill_write = 0;
+  }
+} /* }}} void ls_spill_refill_nolock */
+
+/* Removes the line at the head of the queue, which is too long for a
+ * datagram. If its end is not queued yet, the rest is dropped by the next
+ * call. */
+static void ls_drop_line_nolock(line_sender_t *s) /* {{{ */
+{
+  size_t len = 0;
+  _Bool found = 0;
+
+  while ((len < s->queue_len) && !found) {
+    found = (s->queue[(s->queue_head + len) % s->queue_size] == '\n');
+    len++;
+  }
+
+  if (!s->drop_line && s->log_send_errors)
+    WARNING("%s: Dropping a line which does not fit into a datagram of %zu "
+            "bytes.",
+            s->log_prefix, s->send_threshold);
+
+  ls_ring_consume(s, len);
+  s->drop_line = !found;
+} /* }}} void ls_drop_line_nolock */
+
+/* Moves the next batch from the queue to the output buffer. Datagrams only
+ * contain complete lines; longer lines are dropped. */
+static void ls_take_nolock(line_sender_t *s) /* {{{ */
+{
+  s->out_pos = 0;
+  s->out_len = 0;
+
+  if (s->socktype != SOCK_DGRAM) {
+    s->out_len = ls_ring_peek(s, s->out, sizeof(s->out));
+    ls_ring_consume(s, s->out_len);
+    return;
+  }
+
+  if (s->drop_line) {
+    ls_drop_line_nolock(s);
+    return;
+  }
+
+  size_t len = sizeof(s->out);
+  if (s->send_threshold < len)
+    len = s->send_threshold;
+
+  len = ls_ring_peek(s, s->out, len);
+  while ((len > 0) && (s->out[len - 1] != '\n'))
+    len--;
+
+  if (len == 0) {
+    ls_drop_line_nolock(s);
+    return;
+  }
+
+  ls_ring_consume(s, len);
+  s->out_len = len;
+} /* }}} void ls_take_nolock */
+
+static cdtime_t ls_backoff(line_sender_t const *s) /* {{{ */
+{
+  cdtime_t delay = s->reconnect_min;
+  for (unsigned int i = 1; (i < s->failures) && (delay < s->reconnect_max);
+       i++)
+    delay *= 2;
+  return (delay < s->reconnect_max) ? delay : s->reconnect_max;
+} /* }}} cdtime_t ls_backoff */
+
+static void ls_disconnect(line_sender_t *s) /* {{{ */
+{
+  if (s->fd < 0)
+    return;
+
+  close(s->fd);
+  s->fd = -1;
+
+  /* The receiver discards an incomplete line, so resume with the next one. */
+  if ((s->out_pos > 0) && (s->out_pos < s->out_len) &&
+      (s->out[s->out_pos - 1] != '\n')) {
+    char *eol = memchr(s->out + s->out_pos, '\n', s->out_len - s->out_pos);
+    s->out_pos = (eol != NULL) ? (size_t)(eol - s->out) + 1 : s->out_len;
+  }
+  if ((s->socktype == SOCK_DGRAM) || (s->out_pos >= s->out_len)) {
+    s->out_pos = 0;
+    s->out_len = 0;
+  }
+} /* }}} void ls_disconnect */
+
+static int ls_connect_addr(line_sender_t *s, /* {{{ */
+                           struct addrinfo const *ai, char *errbuf,
+                           size_t errbuf_size) {
+  int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if (fd < 0) {
+    char tmp[1024];
+    snprintf(errbuf, errbuf_size, "failed to open socket: %s",
+             sstrerror(errno, tmp, sizeof(tmp)));
+    return -1;
+  }
+
+  set_sock_opts(fd);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  int status = connect(fd, ai->ai_addr, ai->ai_addrlen);
+  if ((status != 0) && (errno == EINPROGRESS)) {
+    cdtime_t timeout = LS_CONNECT_TIMEOUT;
+    if (s->stop_time != 0) {
+      cdtime_t now = cdtime();
+      timeout = (s->stop_time > now) ? (s->stop_time - now) : 0;
+    }
+
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    status = poll(&pfd, 1, (int)CDTIME_T_TO_MS(timeout));
+    if (status == 0) {
+      errno = ETIMEDOUT;
+      status = -1;
+    } else if (status > 0) {
+      int err = 0;
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &(socklen_t){sizeof(err)});
+      errno = err;
+      status = (err == 0) ? 0 : -1;
+    }
+  }
+
+  if (status != 0) {
+    char tmp[1024];
+    snprintf(errbuf, errbuf_size, "failed to connect to remote host: %s",
+             sstrerror(errno, tmp, sizeof(tmp)));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+} /* }}} int ls_connect_addr */
+
+static void ls_connect(line_sender_t *s) /* {{{ */
+{
+  cdtime_t now = cdtime();
+  char connerr[1024] = "";
+
+  if ((s->ai != NULL) && (now >= s->ai_expires)) {
+    freeaddrinfo(s->ai);
+    s->ai = NULL;
+  }
+
+  if (s->ai == NULL) {
+    struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
+                                .ai_flags = AI_ADDRCONFIG,
+                                .ai_socktype = s->socktype};
+
+    int status = getaddrinfo(s->node, s->service, &ai_hints, &s->ai);
+    if (status != 0) {
+      s->ai = NULL;
+      snprintf(connerr, sizeof(connerr), "getaddrinfo failed: %s",
+               gai_strerror(status));
+    } else {
+      s->ai_expires = now + s->resolve_interval;
+      if (s->resolve_jitter > 0)
+        s->ai_expires += (cdtime_t)cdrand_range(0, (long)s->resolve_jitter);
+    }
+  }
+
+  for (struct addrinfo *ai = s->ai; ai != NULL; ai = ai->ai_next) {
+    s->fd = ls_connect_addr(s, ai, connerr, sizeof(connerr));
+    if (s->fd >= 0)
+      break;
+  }
+
+  now = cdtime();
+  if (s->fd < 0) {
+    /* Resolve again next time, the address may have changed. */
+    if (s->ai != NULL) {
+      freeaddrinfo(s->ai);
+      s->ai = NULL;
+    }
+    s->failures++;
+    s->next_connect = now + ls_backoff(s);
+    c_complain(LOG_ERR, &s->connect_complaint,
+               "%s: Connecting to %s:%s failed, retrying in %.1f seconds. "
+               "The last error was: %s",
+               s->log_prefix, s->node, s->service,
+               CDTIME_T_TO_DOUBLE(s->next_connect - now), connerr);
+    return;
+  }
+
+  if (s->resolve_interval == 0) {
+    freeaddrinfo(s->ai);
+    s->ai = NULL;
+  }
+  s->failures = 0;
+  s->connect_time = now;
+  c_release(LOG_INFO, &s->connect_complaint,
+            "%s: Successfully connected to %s:%s.", s->log_prefix, s->node,
+            s->service);
+} /* }}} void ls_connect */
+
+/* Sends from the output buffer until it is empty or the socket is full. */
+static void ls_send(line_sender_t *s) /* {{{ */
+{
+  while (s->out_pos < s->out_len) {
+    ssize_t status = send(s->fd, s->out + s->out_pos, s->out_len - s->out_pos,
+                          MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return;
+
+      if (s->log_send_errors) {
+        char errbuf[1024];
+        ERROR("%s: Sending to %s:%s failed: %s", s->log_prefix, s->node,
+              s->service, sstrerror(errno, errbuf, sizeof(errbuf)));
+      }
+      ls_disconnect(s);
+      s->next_connect = cdtime();
+      return;
+    }
+
+    if (s->socktype == SOCK_DGRAM)
+      s->out_pos = s->out_len;
+    else
+      s->out_pos += (size_t)status;
+  }
+
+  s->out_pos = 0;
+  s->out_len = 0;
+} /* }}} void ls_send */
+
+/* Handles readable sockets: the protocols are one-way, so anything received
+ * is discarded; end-of-file means the peer closed the connection. */
+static void ls_receive(line_sender_t *s) /* {{{ */
+{
+  char buffer[4096];
+
+  while (s->fd >= 0) {
+    ssize_t status = recv(s->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (status > 0)
+      continue;
+    if ((status < 0) &&
+        ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)))
+      return;
+
+    if (s->log_send_errors) {
+      char errbuf[1024];
+      WARNING("%s: Connection to %s:%s closed: %s", s->log_prefix, s->node,
+              s->service,
+              (status == 0) ? "closed by peer"
+                            : sstrerror(errno, errbuf, sizeof(errbuf)));
+    }
+    ls_disconnect(s);
+    s->next_connect = cdtime();
+  }
+} /* }}} void ls_receive */
+
+static void *ls_thread(void *arg) /* {{{ */
+{
+  line_sender_t *s = arg;
+
+  pthread_mutex_lock(&s->lock);
+  while (42) {
+    ls_spill_refill_nolock(s);
+
+    size_t pending = ls_pending_nolock(s);
+    if (pending == 0)
+      s->flush_requested = 0;
+
+    _Bool shutdown = s->shutdown;
+    _Bool ready = (s->queue_len > 0) &&
+                  (s->flush_requested || shutdown ||
+                   (pending >= s->send_threshold));
+    cdtime_t now = cdtime();
+
+    s->stop_time = s->shutdown_deadline;
+    if (shutdown &&
+        (((pending == 0) && (s->out_len == 0)) || (now >= s->stop_time)))
+      break;
+
+    _Bool progress = 0;
+    if ((s->fd >= 0) && (s->out_len == 0) && ready) {
+      ls_take_nolock(s);
+      progress = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if ((s->fd >= 0) && (s->reconnect_interval > 0) && (s->out_len == 0) &&
+        ((now - s->connect_time) >= s->reconnect_interval)) {
+      INFO("%s: Closing the connection to %s:%s after %.3f seconds.",
+           s->log_prefix, s->node, s->service,
+           CDTIME_T_TO_DOUBLE(now - s->connect_time));
+      ls_disconnect(s);
+      s->next_connect = now;
+    }
+
+    _Bool want_connection = ready || (s->out_len > 0);
+    if ((s->fd < 0) && want_connection &&
+        (shutdown || (now >= s->next_connect))) {
+      ls_connect(s);
+      /* Make one last attempt when shutting down, but do not wait for the
+       * destination to come back. */
+      if ((s->fd < 0) && shutdown) {
+        pthread_mutex_lock(&s->lock);
+        break;
+      }
+      progress = (s->fd >= 0);
+    }
+
+    if ((s->fd >= 0) && (s->out_len > 0)) {
+      ls_send(s);
+      if (s->out_len == 0)
+        progress = 1;
+    }
+
+    if (progress) {
+      pthread_mutex_lock(&s->lock);
+      continue;
+    }
+
+    /* Wait for new data, the socket, or the next deadline. */
+    cdtime_t deadline = 0;
+    if ((s->fd < 0) && want_connection)
+      deadline = s->next_connect;
+    if ((s->fd >= 0) && (s->reconnect_interval > 0))
+      deadline = s->connect_time + s->reconnect_interval;
+    if (s->stop_time != 0)
+      if ((deadline == 0) || (s->stop_time < deadline))
+        deadline = s->stop_time;
+
+    int timeout = -1;
+    if (deadline != 0) {
+      now = cdtime();
+      timeout = (deadline > now) ? (int)CDTIME_T_TO_MS(deadline - now) + 1 : 0;
+    }
+
+    struct pollfd pfd[2] = {
+        {.fd = s->wakeup_fd[0], .events = POLLIN},
+        {.fd = s->fd, .events = POLLIN | ((s->out_len > 0) ? POLLOUT : 0)},
+    };
+    int status = poll(pfd, (s->fd >= 0) ? 2 : 1, timeout);
+
+    if ((status > 0) && (s->fd >= 0) &&
+        (pfd[1].revents & (POLLIN | POLLERR | POLLHUP)))
+      ls_receive(s);
+
+    pthread_mutex_lock(&s->lock);
+    if ((status > 0) && (pfd[0].revents & POLLIN)) {
+      char buffer[64];
+      while (read(s->wakeup_fd[0], buffer, sizeof(buffer)) > 0)
+        /* drain */;
+      s->wakeup_pending = 0;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  ls_disconnect(s);
+  return NULL;
+} /* }}} void *ls_thread */
+
+static int ls_start_nolock(line_sender_t *s) /* {{{ */
+{
+  int status = plugin_thread_create(&s->thread, /* attr = */ NULL, ls_thread,
+                                    s, s->thread_name);
+  if (status != 0) {
+    char errbuf[1024];
+    ERROR("%s: Starting the I/O thread failed: %s", s->log_prefix,
+          sstrerror(status, errbuf, sizeof(errbuf)));
+    return status;
+  }
+
+  s->thread_running = 1;
+  return 0;
+} /* }}} int ls_start_nolock */
+
+line_sender_t *line_sender_create(line_sender_options_t const *opts) /* {{{ */
+{
+  if ((opts->node == NULL) || (opts->service == NULL) ||
+      (opts->queue_size == 0))
+    return NULL;
+
+  line_sender_t *s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->fd = -1;
+  s->spill_fd = -1;
+  s->wakeup_fd[0] = -1;
+  s->wakeup_fd[1] = -1;
+  pthread_mutex_init(&s->lock, /* attr = */ NULL);
+  C_COMPLAIN_INIT(&s->drop_complaint);
+  C_COMPLAIN_INIT(&s->connect_complaint);
+
+  s->log_prefix = strdup(opts->log_prefix ? opts->log_prefix : "line sender");
+  s->thread_name =
+      strdup(opts->thread_name ? opts->thread_name : "line sender");
+  s->node = strdup(opts->node);
+  s->service = strdup(opts->service);
+  s->socktype = opts->socktype;
+  s->send_threshold = (opts->send_threshold > 0) ? opts->send_threshold : 1;
+  s->reconnect_min = opts->reconnect_min;
+  s->reconnect_max = opts->reconnect_max;
+  if (s->reconnect_max < s->reconnect_min)
+    s->reconnect_max = s->reconnect_min;
+  s->reconnect_interval = opts->reconnect_interval;
+  s->resolve_interval = opts->resolve_interval;
+  s->resolve_jitter = opts->resolve_jitter;
+  s->log_send_errors = opts->log_send_errors;
+
+  s->queue_size = opts->queue_size;
+  s->queue = malloc(s->queue_size);
+
+  if ((s->log_prefix == NULL) || (s->thread_name == NULL) ||
+      (s->node == NULL) || (s->service == NULL) || (s->queue == NULL)) {
+    ERROR("line_sender_create: Allocating memory failed.");
+    line_sender_destroy(s);
+    return NULL;
+  }
+
+  if (pipe(s->wakeup_fd) != 0) {
+    char errbuf[1024];
+    ERROR("%s: pipe failed: %s", s->log_prefix,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    s->wakeup_fd[0] = s->wakeup_fd[1] = -1;
+    line_sender_destroy(s);
+    return NULL;
+  }
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(s->wakeup_fd); i++) {
+    int flags = fcntl(s->wakeup_fd[i], F_GETFL);
+    fcntl(s->wakeup_fd[i], F_SETFL, flags | O_NONBLOCK);
+    fcntl(s->wakeup_fd[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  if (opts->spill_file != NULL) {
+    s->spill_file = strdup(opts->spill_file);
+    s->spill_size = opts->spill_size;
+    if ((s->spill_file != NULL) && (check_create_dir(s->spill_file) == 0))
+      s->spill_fd = open(s->spill_file,
+                         O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (s->spill_fd < 0) {
+      char errbuf[1024];
+      ERROR("%s: Opening the spill file \"%s\" failed: %s", s->log_prefix,
+            opts->spill_file, sstrerror(errno, errbuf, sizeof(errbuf)));
+      line_sender_destroy(s);
+      return NULL;
+    }
+  }
+
+  return s;
+} /* }}} line_sender_t *line_sender_create */
+
+void line_sender_destroy(line_sender_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  pthread_mutex_lock(&s->lock);
+  if (s->thread_running) {
+    s->shutdown = 1;
+    s->shutdown_deadline = cdtime() + LS_SHUTDOWN_TIMEOUT;
+    s->wakeup_pending = 0;
+    ls_wakeup_nolock(s);
+    pthread_mutex_unlock(&s->lock);
+
+    pthread_join(s->thread, /* retval = */ NULL);
+
+    pthread_mutex_lock(&s->lock);
+    s->thread_running = 0;
+  }
+
+  size_t unsent = ls_pending_nolock(s) + (s->out_len - s->out_pos);
+  if (unsent > 0)
+    WARNING("%s: Dropping %zu bytes which could not be sent to %s:%s.",
+            s->log_prefix, unsent, s->node, s->service);
+  pthread_mutex_unlock(&s->lock);
+
+  if (s->fd >= 0)
+    close(s->fd);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(s->wakeup_fd); i++)
+    if (s->wakeup_fd[i] >= 0)
+      close(s->wakeup_fd[i]);
+  if (s->spill_fd >= 0) {
+    close(s->spill_fd);
+    unlink(s->spill_file);
+  }
+  if (s->ai != NULL)
+    freeaddrinfo(s->ai);
+
+  pthread_mutex_destroy(&s->lock);
+  sfree(s->spill_file);
+  sfree(s->queue);
+  sfree(s->service);
+  sfree(s->node);
+  sfree(s->thread_name);
+  sfree(s->log_prefix);
+  sfree(s);
+} /* }}} void line_sender_destroy */
+
+int line_sender_enqueue(line_sender_t *s, char const *data, /* {{{ */
+                        size_t len) {
+  if (len == 0)
+    return 0;
+
+  pthread_mutex_lock(&s->lock);
+
+  if (!s->thread_running) {
+    int status = ls_start_nolock(s);
+    if (status != 0) {
+      pthread_mutex_unlock(&s->lock);
+      return status;
+    }
+  }
+
+  if (ls_pending_nolock(s) == 0)
+    s->queue_time = cdtime();
+
+  int status;
+  if ((s->spill_read == s->spill_write) &&
+      ((s->queue_len + len) <= s->queue_size)) {
+    ls_ring_put(s, data, len);
+    status = 0;
+  } else {
+    status = ls_spill_put_nolock(s, data, len);
+  }
+
+  if (status != 0) {
+    s->dropped += len;
+    c_complain(LOG_WARNING, &s->drop_complaint,
+               "%s: The queue for %s:%s is full, dropping data. %" PRIu64
+               " bytes have been dropped so far.",
+               s->log_prefix, s->node, s->service, s->dropped);
+  } else {
+    c_release(LOG_INFO, &s->drop_complaint,
+              "%s: The queue for %s:%s accepts data again.", s->log_prefix,
+              s->node, s->service);
+    if (ls_pending_nolock(s) >= s->send_threshold)
+      ls_wakeup_nolock(s);
+  }
+
+  pthread_mutex_unlock(&s->lock);
+  return status;
+} /* }}} int line_sender_enqueue */
+
+int line_sender_flush(line_sender_t *s, cdtime_t timeout) /* {{{ */
+{
+  pthread_mutex_lock(&s->lock);
+
+  /* timeout == 0  =>  flush unconditionally */
+  if ((ls_pending_nolock(s) > 0) &&
+      ((timeout == 0) || ((s->queue_time + timeout) <= cdtime()))) {
+    s->flush_requested = 1;
+    ls_wakeup_nolock(s);
+  }
+
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+} /* }}} int line_sender_flush */
@@ -0,0 +1,141 @@
+/**
+ * collectd - src/utils_line_sender.h
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_LINE_SENDER_H
+#define UTILS_LINE_SENDER_H 1
+
+#include "collectd.h"
+
+/*
+ * Asynchronous transport for line based protocols, such as the ones spoken by
+ * Graphite and OpenTSDB. Write callbacks enqueue preformatted lines, which
+ * never blocks on the network: a dedicated thread per sender connects, sends
+ * and reconnects with an exponential backoff. Lines are queued in a bounded
+ * memory buffer and, optionally, a spill file on disk when that is full. If
+ * both are full, lines are dropped.
+ */
+
+/*
+ * Data types
+ */
+struct line_sender_s;
+typedef struct line_sender_s line_sender_t;
+
+struct line_sender_options_s {
+  /* Used in log messages, e.g. "write_graphite plugin". */
+  char const *log_prefix;
+  /* Name of the I/O thread, at most 15 characters. */
+  char const *thread_name;
+
+  char const *node;
+  char const *service;
+  int socktype; /* SOCK_STREAM or SOCK_DGRAM */
+
+  /* Bytes queued in memory. */
+  size_t queue_size;
+  /* If not NULL, lines are appended to this file when the memory queue is
+   * full, up to `spill_size' bytes. The file is truncated when created. */
+  char const *spill_file;
+  size_t spill_size;
+
+  /* Data is only sent once this many bytes are queued or after
+   * `line_sender_flush'. For datagram sockets, this is also the maximum size
+   * of a datagram; lines are never split across datagrams, longer lines
+   * are dropped. */
+  size_t send_threshold;
+
+  /* Delay before the first reconnect attempt. It is doubled after each
+   * failure, up to `reconnect_max'. */
+  cdtime_t reconnect_min;
+  cdtime_t reconnect_max;
+  /* If non-zero, the connection is closed and reopened after this time, e.g.
+   * to pick up changes of a load balanced address. */
+  cdtime_t reconnect_interval;
+  /* If non-zero, resolved addresses are reused for this time, plus a random
+   * jitter of up to `resolve_jitter'. Otherwise, every connect resolves. */
+  cdtime_t resolve_interval;
+  cdtime_t resolve_jitter;
+
+  _Bool log_send_errors;
+};
+typedef struct line_sender_options_s line_sender_options_t;
+
+#define LINE_SENDER_OPTIONS_INIT                                               \
+  {                                                                            \
+    .socktype = SOCK_STREAM, .queue_size = 1048576, .spill_size = 67108864,    \
+    .send_threshold = 1428, .reconnect_min = TIME_T_TO_CDTIME_T_STATIC(1),     \
+    .reconnect_max = TIME_T_TO_CDTIME_T_STATIC(60), .log_send_errors = 1,      \
+  }
+
+/*
+ * Prototypes
+ */
+/*
+ * NAME
+ *  line_sender_create
+ *
+ * DESCRIPTION
+ *  Allocates a sender for the destination described by `opts'. The strings
+ *  are copied. The I/O thread is started with the first enqueued line.
+ *
+ * RETURN VALUE
+ *  A line_sender_t-pointer upon success or NULL upon failure.
+ */
+line_sender_t *line_sender_create(line_sender_options_t const *opts);
+
+/*
+ * NAME
+ *  line_sender_destroy
+ *
+ * DESCRIPTION
+ *  Stops the I/O thread and frees the sender. Queued data is sent if the
+ *  destination is reachable within a few seconds, and dropped otherwise.
+ */
+void line_sender_destroy(line_sender_t *s);
+
+/*
+ * NAME
+ *  line_sender_enqueue
+ *
+ * DESCRIPTION
+ *  Queues `len' bytes of `data', which should consist of complete lines.
+ *  The data is queued completely or not at all. Thread safe.
+ *
+ * RETURN VALUE
+ *  Zero upon success, ENOBUFS if the queue is full and the data was dropped,
+ *  or another errno value if the I/O thread could not be started.
+ */
+int line_sender_enqueue(line_sender_t *s, char const *data, size_t len);
+
+/*
+ * NAME
+ *  line_sender_flush
+ *
+ * DESCRIPTION
+ *  Asks the I/O thread to send all queued data, if the oldest of it was
+ *  queued at least `timeout' ago or `timeout' is zero. Does not wait for the
+ *  data to be sent.
+ */
+int line_sender_flush(line_sender_t *s, cdtime_t timeout);
+
+#endif /* UTILS_LINE_SENDER_H */
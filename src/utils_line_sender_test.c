@@ -0,0 +1,276 @@
+/**
+ * collectd - src/utils_line_sender_test.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/* testing.h goes first, so that utils_time.h declares cdtime_mock. */
+#include "testing.h"
+#include "utils_line_sender.c" /* sic */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define SPILL_FILE "test_utils_line_sender.spill"
+
+/* Opens a socket bound to the loopback address. If "port" is zero, an unused
+ * port is picked and returned in "service". */
+static int open_local(int socktype, unsigned short port, char *service,
+                      size_t service_size) {
+  struct sockaddr_in sa = {
+      .sin_family = AF_INET,
+      .sin_port = htons(port),
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  socklen_t sa_len = sizeof(sa);
+
+  int fd = socket(AF_INET, socktype, 0);
+  if (fd < 0)
+    return -1;
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+      ((socktype == SOCK_STREAM) && (listen(fd, 4) != 0)) ||
+      (getsockname(fd, (struct sockaddr *)&sa, &sa_len) != 0)) {
+    close(fd);
+    return -1;
+  }
+
+  snprintf(service, service_size, "%hu", ntohs(sa.sin_port));
+  return fd;
+}
+
+/* Reads until "len" bytes have been received or nothing arrives for five
+ * seconds. For datagram sockets, reads a single datagram. */
+static size_t read_timeout(int fd, char *buffer, size_t len) {
+  size_t done = 0;
+
+  while (done < len) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, 5000) <= 0)
+      break;
+
+    ssize_t status = recv(fd, buffer + done, len - done, 0);
+    if (status <= 0)
+      break;
+    done += (size_t)status;
+
+    int type = SOCK_STREAM;
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &(socklen_t){sizeof(type)});
+    if (type == SOCK_DGRAM)
+      break;
+  }
+
+  return done;
+}
+
+DEF_TEST(ring) {
+  line_sender_options_t opts = LINE_SENDER_OPTIONS_INIT;
+  opts.node = "localhost";
+  opts.service = "0";
+  opts.queue_size = 16;
+
+  line_sender_t *s;
+  CHECK_NOT_NULL(s = line_sender_create(&opts));
+
+  char buffer[32] = "";
+  ls_ring_put(s, "abcdefghij", 10);
+  EXPECT_EQ_INT(10, (int)ls_ring_peek(s, buffer, sizeof(buffer)));
+  ls_ring_consume(s, 8);
+
+  /* Six bytes fit at the end of the ring, four wrap around. */
+  ls_ring_put(s, "0123456789", 10);
+  EXPECT_EQ_INT(8, (int)s->queue_head);
+  EXPECT_EQ_INT(12, (int)s->queue_len);
+
+  memset(buffer, 0, sizeof(buffer));
+  EXPECT_EQ_INT(12, (int)ls_ring_peek(s, buffer, sizeof(buffer)));
+  EXPECT_EQ_STR("ij0123456789", buffer);
+
+  memset(buffer, 0, sizeof(buffer));
+  EXPECT_EQ_INT(4, (int)ls_ring_peek(s, buffer, 4));
+  EXPECT_EQ_STR("ij01", buffer);
+
+  ls_ring_consume(s, 12);
+  EXPECT_EQ_INT(0, (int)s->queue_len);
+  EXPECT_EQ_INT(0, (int)s->queue_head);
+
+  line_sender_destroy(s);
+  return 0;
+}
+
+DEF_TEST(take_datagram) {
+  line_sender_options_t opts = LINE_SENDER_OPTIONS_INIT;
+  opts.node = "localhost";
+  opts.service = "0";
+  opts.socktype = SOCK_DGRAM;
+  opts.queue_size = 16;
+  opts.send_threshold = 8;
+  opts.log_send_errors = 0;
+
+  line_sender_t *s;
+  CHECK_NOT_NULL(s = line_sender_create(&opts));
+
+  ls_ring_put(s, "ab\n0123456789\nx\n", 16);
+
+  /* Only complete lines go into a datagram. */
+  ls_take_nolock(s);
+  EXPECT_EQ_INT(3, (int)s->out_len);
+  OK(memcmp("ab\n", s->out, 3) == 0);
+
+  /* The next line is longer than a datagram and dropped. */
+  ls_take_nolock(s);
+  EXPECT_EQ_INT(0, (int)s->out_len);
+  EXPECT_EQ_INT(2, (int)s->queue_len);
+  OK(!s->drop_line);
+
+  ls_take_nolock(s);
+  EXPECT_EQ_INT(2, (int)s->out_len);
+  OK(memcmp("x\n", s->out, 2) == 0);
+
+  /* A long line whose end is not queued yet is dropped in two steps. */
+  ls_ring_consume(s, s->queue_len);
+  ls_ring_put(s, "0123456789", 10);
+  ls_take_nolock(s);
+  OK(s->drop_line);
+  EXPECT_EQ_INT(0, (int)s->queue_len);
+  ls_ring_put(s, "abc\nok\n", 7);
+  ls_take_nolock(s);
+  OK(!s->drop_line);
+  EXPECT_EQ_INT(0, (int)s->out_len);
+  ls_take_nolock(s);
+  EXPECT_EQ_INT(3, (int)s->out_len);
+  OK(memcmp("ok\n", s->out, 3) == 0);
+
+  line_sender_destroy(s);
+  return 0;
+}
+
+DEF_TEST(spill_and_reconnect) {
+  char service[16];
+  int fd;
+
+  /* Pick a port, but don't listen on it yet. */
+  CHECK_ZERO((fd = open_local(SOCK_STREAM, 0, service, sizeof(service))) < 0);
+  close(fd);
+
+  line_sender_options_t opts = LINE_SENDER_OPTIONS_INIT;
+  opts.node = "127.0.0.1";
+  opts.service = service;
+  opts.queue_size = 16;
+  opts.spill_file = SPILL_FILE;
+  opts.spill_size = 64;
+  opts.send_threshold = 4096;
+  opts.reconnect_min = TIME_T_TO_CDTIME_T(1);
+  opts.reconnect_max = TIME_T_TO_CDTIME_T(1);
+  opts.log_send_errors = 0;
+
+  line_sender_t *s;
+  CHECK_NOT_NULL(s = line_sender_create(&opts));
+
+  /* Two lines fit into memory, the next eight into the spill file. */
+  char expect[81] = "";
+  for (int i = 0; i < 10; i++) {
+    char line[16];
+    snprintf(line, sizeof(line), "line-%02d\n", i);
+    EXPECT_EQ_INT(0, line_sender_enqueue(s, line, strlen(line)));
+    strncat(expect, line, sizeof(expect) - strlen(expect) - 1);
+  }
+  EXPECT_EQ_INT(ENOBUFS, line_sender_enqueue(s, "dropped\n", 8));
+
+  pthread_mutex_lock(&s->lock);
+  EXPECT_EQ_INT(16, (int)s->queue_len);
+  EXPECT_EQ_INT(64, (int)(s->spill_write - s->spill_read));
+  pthread_mutex_unlock(&s->lock);
+
+  /* The first connect fails, the next one is due in a second. */
+  line_sender_flush(s, 0);
+  usleep(100000);
+
+  CHECK_ZERO((fd = open_local(SOCK_STREAM, (unsigned short)atoi(service),
+                              service, sizeof(service))) < 0);
+  cdtime_mock += TIME_T_TO_CDTIME_T(2);
+
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  OK(poll(&pfd, 1, 5000) == 1);
+  int conn = accept(fd, NULL, NULL);
+  OK(conn >= 0);
+
+  /* Everything queued while the destination was down arrives in order. */
+  char buffer[128] = "";
+  EXPECT_EQ_INT(80, (int)read_timeout(conn, buffer, 80));
+  EXPECT_EQ_STR(expect, buffer);
+
+  line_sender_destroy(s);
+  OK(access(SPILL_FILE, F_OK) != 0);
+
+  close(conn);
+  close(fd);
+  return 0;
+}
+
+DEF_TEST(datagram) {
+  char service[16];
+  int fd;
+
+  CHECK_ZERO((fd = open_local(SOCK_DGRAM, 0, service, sizeof(service))) < 0);
+
+  line_sender_options_t opts = LINE_SENDER_OPTIONS_INIT;
+  opts.node = "127.0.0.1";
+  opts.service = service;
+  opts.socktype = SOCK_DGRAM;
+  opts.send_threshold = 32;
+  opts.log_send_errors = 0;
+
+  line_sender_t *s;
+  CHECK_NOT_NULL(s = line_sender_create(&opts));
+
+  char data[128];
+  char long_line[64];
+  memset(long_line, 'x', sizeof(long_line) - 2);
+  long_line[sizeof(long_line) - 2] = '\n';
+  long_line[sizeof(long_line) - 1] = 0;
+  snprintf(data, sizeof(data), "short line 1\n%sshort line 2\n", long_line);
+
+  EXPECT_EQ_INT(0, line_sender_enqueue(s, data, strlen(data)));
+  line_sender_flush(s, 0);
+
+  char buffer[128] = "";
+  EXPECT_EQ_INT(13, (int)read_timeout(fd, buffer, sizeof(buffer) - 1));
+  EXPECT_EQ_STR("short line 1\n", buffer);
+
+  memset(buffer, 0, sizeof(buffer));
+  EXPECT_EQ_INT(13, (int)read_timeout(fd, buffer, sizeof(buffer) - 1));
+  EXPECT_EQ_STR("short line 2\n", buffer);
+
+  line_sender_destroy(s);
+  close(fd);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(ring);
+  RUN_TEST(take_datagram);
+  RUN_TEST(spill_and_reconnect);
+  RUN_TEST(datagram);
+
+  END_TEST;
+}
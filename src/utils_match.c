@@ -30,6 +30,7 @@
 #include "plugin.h"
 
 #include "utils_match.h"
+#include "utils_multimatch.h"
 
 #include <regex.h>
 
@@ -41,36 +42,27 @@ struct cu_match_s {
   regex_t excluderegex;
   int flags;
 
+  /* A string every matching line contains, or NULL. Used by match sets. */
+  char *literal;
+
   int (*callback)(const char *str, char *const *matches, size_t matches_num,
                   void *user_data);
   void *user_data;
   void (*free)(void *user_data);
 };
 
+struct cu_match_set_s {
+  cu_match_t **matches;
+  int *literal_ids; /* ID in `literals', or -1 if the match has no literal */
+  size_t matches_num;
+
+  cu_multimatch_t *literals;
+  uint64_t *found;
+};
+
 /*
  * Private functions
  */
-static char *match_substr(const char *str, int begin, int end) {
-  char *ret;
-  size_t ret_len;
-
-  if ((begin < 0) || (end < 0) || (begin >= end))
-    return NULL;
-  if ((size_t)end > (strlen(str) + 1)) {
-    ERROR("utils_match: match_substr: `end' points after end of string.");
-    return NULL;
-  }
-
-  ret_len = end - begin;
-  ret = malloc(ret_len + 1);
-  if (ret == NULL) {
-    ERROR("utils_match: match_substr: malloc failed.");
-    return NULL;
-  }
-
-  sstrncpy(ret, str + begin, ret_len + 1);
-  return ret;
-} /* char *match_substr */
 
 static int default_callback(const char __attribute__((unused)) * str,
                             char *const *matches, size_t matches_num,
@@ -248,6 +240,12 @@ match_create_callback(const char *regex, const char *excluderegex,
     obj->flags |= UTILS_MATCH_FLAGS_EXCLUDE_REGEX;
   }
 
+  {
+    char literal[256];
+    if (multimatch_literal(regex, literal, sizeof(literal)) > 0)
+      obj->literal = strdup(literal);
+  }
+
   obj->callback = callback;
   obj->user_data = user_data;
   obj->free = free_user_data;
@@ -310,6 +308,7 @@ void match_destroy(cu_match_t *obj) {
   if ((obj->user_data != NULL) && (obj->free != NULL))
     (*obj->free)(obj->user_data);
 
+  sfree(obj->literal);
   sfree(obj);
 } /* void match_destroy */
 
@@ -318,6 +317,11 @@ int match_apply(cu_match_t *obj, const char *str) {
   regmatch_t re_match[32];
   char *matches[32] = {0};
   size_t matches_num;
+  /* All (sub-)matches are copied into one buffer, which is only allocated if
+   * they don't fit onto the stack. */
+  char buffer[4096];
+  char *substrings = buffer;
+  size_t substrings_size = 0;
 
   if ((obj == NULL) || (str == NULL))
     return -1;
@@ -342,29 +346,46 @@ int match_apply(cu_match_t *obj, const char *str) {
 
   for (matches_num = 0; matches_num < STATIC_ARRAY_SIZE(matches);
        matches_num++) {
-    if ((re_match[matches_num].rm_so < 0) || (re_match[matches_num].rm_eo < 0))
-      break;
+    regmatch_t *m = re_match + matches_num;
 
-    matches[matches_num] = match_substr(str, re_match[matches_num].rm_so,
-                                        re_match[matches_num].rm_eo);
-    if (matches[matches_num] == NULL) {
+    if ((m->rm_so < 0) || (m->rm_eo < 0))
+      break;
+    /* Empty (sub-)matches are an error, as they have always been. */
+    if (m->rm_so >= m->rm_eo) {
       status = -1;
       break;
     }
+    substrings_size += (size_t)(m->rm_eo - m->rm_so) + 1;
+  }
+
+  if ((status == 0) && (substrings_size > sizeof(buffer))) {
+    substrings = malloc(substrings_size);
+    if (substrings == NULL)
+      status = -1;
   }
 
   if (status != 0) {
-    ERROR("utils_match: match_apply: match_substr failed.");
+    ERROR("utils_match: match_apply: copying the (sub-)matches failed.");
   } else {
+    char *ptr = substrings;
+
+    for (size_t i = 0; i < matches_num; i++) {
+      size_t len = (size_t)(re_match[i].rm_eo - re_match[i].rm_so);
+
+      memcpy(ptr, str + re_match[i].rm_so, len);
+      ptr[len] = 0;
+      matches[i] = ptr;
+      ptr += len + 1;
+    }
+
     status = obj->callback(str, matches, matches_num, obj->user_data);
     if (status != 0) {
       ERROR("utils_match: match_apply: callback failed.");
     }
   }
 
-  for (size_t i = 0; i < matches_num; i++) {
-    sfree(matches[i]);
-  }
+  if (substrings != buffer)
+    sfree(substrings);
 
   return status;
 } /* int match_apply */
@@ -374,3 +395,97 @@ void *match_get_user_data(cu_match_t *obj) {
     return NULL;
   return obj->user_data;
 } /* void *match_get_user_data */
+
+cu_match_set_t *match_set_create(void) {
+  cu_match_set_t *set;
+
+  set = calloc(1, sizeof(*set));
+  if (set == NULL)
+    return NULL;
+
+  set->literals = multimatch_create();
+  if (set->literals == NULL) {
+    sfree(set);
+    return NULL;
+  }
+
+  return set;
+} /* cu_match_set_t *match_set_create */
+
+void match_set_destroy(cu_match_set_t *set) {
+  if (set == NULL)
+    return;
+
+  multimatch_destroy(set->literals);
+  sfree(set->matches);
+  sfree(set->literal_ids);
+  sfree(set->found);
+  sfree(set);
+} /* void match_set_destroy */
+
+int match_set_add(cu_match_set_t *set, cu_match_t *match) {
+  cu_match_t **matches;
+  int *literal_ids;
+  int id = -1;
+
+  if ((set == NULL) || (match == NULL))
+    return -1;
+
+  matches = realloc(set->matches, (set->matches_num + 1) * sizeof(*matches));
+  if (matches == NULL)
+    return -1;
+  set->matches = matches;
+
+  literal_ids =
+      realloc(set->literal_ids, (set->matches_num + 1) * sizeof(*literal_ids));
+  if (literal_ids == NULL)
+    return -1;
+  set->literal_ids = literal_ids;
+
+  if (match->literal != NULL) {
+    id = multimatch_add(set->literals, match->literal);
+    if (id >= 0) {
+      uint64_t *found;
+
+      found = realloc(set->found, ((size_t)id / 64 + 1) * sizeof(*found));
+      if (found == NULL)
+        return -1;
+      set->found = found;
+    } else {
+      /* Without a literal, the match is simply applied to every string. */
+      id = -1;
+    }
+  }
+
+  set->matches[set->matches_num] = match;
+  set->literal_ids[set->matches_num] = id;
+  set->matches_num++;
+
+  return 0;
+} /* int match_set_add */
+
+int match_set_apply(cu_match_set_t *set, const char *str) {
+  _Bool scanned;
+  int ret = 0;
+
+  if ((set == NULL) || (str == NULL))
+    return -1;
+
+  scanned = (multimatch_size(set->literals) == 0) ||
+            (multimatch_scan(set->literals, str, set->found) == 0);
+
+  for (size_t i = 0; i < set->matches_num; i++) {
+    int id = set->literal_ids[i];
+    int status;
+
+    if (scanned && (id >= 0) &&
+        !(set->found[id / 64] & (((uint64_t)1) << (id % 64))))
+      continue;
+
+    status = match_apply(set->matches[i], str);
+    if (status != 0)
+      ret = status;
+  }
+
+  return ret;
+} /* int match_set_apply */
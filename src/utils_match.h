@@ -68,6 +68,9 @@
 struct cu_match_s;
 typedef struct cu_match_s cu_match_t;
 
+struct cu_match_set_s;
+typedef struct cu_match_set_s cu_match_set_t;
+
 struct cu_match_value_s {
   int ds_type;
   value_t value;
@@ -176,4 +179,48 @@ int match_apply(cu_match_t *obj, const char *str);
  */
 void *match_get_user_data(cu_match_t *obj);
 
+/*
+ * NAME
+ *  match_set_create
+ *
+ * DESCRIPTION
+ *  Creates an empty set of `cu_match_t' objects that are applied to the same
+ *  strings. Each string is scanned only once for the literal text all
+ *  regular expressions require, and only the matches whose literal occurs
+ *  are applied with `match_apply'. Matches without such a literal are always
+ *  applied.
+ */
+cu_match_set_t *match_set_create(void);
+
+/*
+ * NAME
+ *  match_set_destroy
+ *
+ * DESCRIPTION
+ *  Frees the set. The matches that were added are NOT destroyed.
+ */
+void match_set_destroy(cu_match_set_t *set);
+
+/*
+ * NAME
+ *  match_set_add
+ *
+ * DESCRIPTION
+ *  Adds `match' to the set. Matches are applied in the order they have been
+ *  added.
+ */
+int match_set_add(cu_match_set_t *set, cu_match_t *match);
+
+/*
+ * NAME
+ *  match_set_apply
+ *
+ * DESCRIPTION
+ *  Has the same effect as calling `match_apply' for every match in the set.
+ *
+ * RETURN VALUE
+ *  Zero upon success, or the last non-zero status of `match_apply'.
+ */
+int match_set_apply(cu_match_set_t *set, const char *str);
+
 #endif /* UTILS_MATCH_H */
@@ -0,0 +1,391 @@
+/**
+ * collectd - src/utils_multimatch.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_multimatch.h"
+
+/* An Aho-Corasick automaton over all literals, stored as a complete DFA so
+ * that scanning costs one table lookup per byte. Bytes are mapped to classes
+ * first; all bytes not used by any literal share class zero, which keeps the
+ * table small. */
+struct cu_multimatch_s {
+  char **literals;
+  size_t literals_num;
+
+  /* Built by multimatch_build(); `delta' is NULL if the automaton is stale. */
+  uint8_t classes[256];
+  size_t classes_num;
+  int32_t *delta;  /* states_num * classes_num transitions */
+  int32_t *output; /* ID of the literal ending in a state, or -1 */
+  int32_t *dict;   /* next state with an output on the failure path, or 0 */
+  size_t states_num;
+};
+
+/*
+ * Literal extraction
+ */
+/* Returns the index following the bracket expression starting at `i', or
+ * zero if it is not terminated. */
+static size_t skip_bracket(const char *re, size_t i) /* {{{ */
+{
+  i++;
+  if (re[i] == '^')
+    i++;
+  if (re[i] == ']')
+    i++;
+
+  while ((re[i] != 0) && (re[i] != ']')) {
+    if ((re[i] == '[') &&
+        ((re[i + 1] == ':') || (re[i + 1] == '.') || (re[i + 1] == '='))) {
+      char end[3] = {re[i + 1], ']', 0};
+      const char *ptr = strstr(re + i + 2, end);
+      if (ptr == NULL)
+        return 0;
+      i = (size_t)(ptr - re) + 2;
+      continue;
+    }
+    i++;
+  }
+
+  if (re[i] == 0)
+    return 0;
+  return i + 1;
+} /* }}} size_t skip_bracket */
+
+/* Returns the index following the group starting at `i', or zero if it is
+ * not terminated. */
+static size_t skip_group(const char *re, size_t i) /* {{{ */
+{
+  int depth = 0;
+
+  while (re[i] != 0) {
+    if (re[i] == '\\') {
+      if (re[i + 1] == 0)
+        return 0;
+      i += 2;
+    } else if (re[i] == '[') {
+      i = skip_bracket(re, i);
+      if (i == 0)
+        return 0;
+    } else if (re[i] == '(') {
+      depth++;
+      i++;
+    } else if (re[i] == ')') {
+      depth--;
+      i++;
+      if (depth == 0)
+        return i;
+    } else {
+      i++;
+    }
+  }
+
+  return 0;
+} /* }}} size_t skip_group */
+
+size_t multimatch_literal(const char *regex, /* {{{ */
+                          char *buffer, size_t buffer_size) {
+  char *cur;
+  char *best;
+  size_t cur_len = 0;
+  size_t best_len = 0;
+  _Bool prev_literal = 0;
+  size_t len;
+  size_t i = 0;
+  _Bool fail = 0;
+
+  if ((regex == NULL) || (buffer == NULL) || (buffer_size == 0))
+    return 0;
+  buffer[0] = 0;
+
+  len = strlen(regex);
+  cur = malloc(len + 1);
+  best = malloc(len + 1);
+  if ((cur == NULL) || (best == NULL)) {
+    free(cur);
+    free(best);
+    return 0;
+  }
+
+#define END_RUN                                                                \
+  do {                                                                         \
+    if (cur_len > best_len) {                                                  \
+      memcpy(best, cur, cur_len);                                              \
+      best_len = cur_len;                                                      \
+    }                                                                          \
+    cur_len = 0;                                                               \
+    prev_literal = 0;                                                          \
+  } while (0)
+
+  while ((i < len) && !fail) {
+    char c = regex[i];
+
+    switch (c) {
+    case '\\':
+      /* Only escaped special characters are literals; GNU extensions such as
+       * \w or \< and back-references are not. */
+      if ((regex[i + 1] != 0) &&
+          (strchr(".[](){}*+?|^$\\", regex[i + 1]) != NULL)) {
+        cur[cur_len++] = regex[i + 1];
+        prev_literal = 1;
+        i += 2;
+      } else {
+        END_RUN;
+        i += (regex[i + 1] != 0) ? 2 : 1;
+      }
+      break;
+    case '.':
+    case '^':
+    case '$':
+    case '+':
+      END_RUN;
+      i++;
+      break;
+    case '[':
+      END_RUN;
+      i = skip_bracket(regex, i);
+      fail = (i == 0);
+      break;
+    case '(':
+      /* The group may be optional or contain alternatives. */
+      END_RUN;
+      i = skip_group(regex, i);
+      fail = (i == 0);
+      break;
+    case '*':
+    case '?':
+    case '{':
+      /* The preceding character may not occur at all. */
+      if (prev_literal)
+        cur_len--;
+      END_RUN;
+      if (c == '{') {
+        const char *ptr = strchr(regex + i, '}');
+        if (ptr == NULL)
+          fail = 1;
+        else
+          i = (size_t)(ptr - regex) + 1;
+      } else {
+        i++;
+      }
+      break;
+    case '|':
+    case ')':
+      /* Alternatives at the top level: nothing is required. */
+      fail = 1;
+      break;
+    default:
+      cur[cur_len++] = c;
+      prev_literal = 1;
+      i++;
+    }
+  }
+  END_RUN;
+
+#undef END_RUN
+
+  if (fail)
+    best_len = 0;
+  if (best_len >= buffer_size)
+    best_len = buffer_size - 1;
+  memcpy(buffer, best, best_len);
+  buffer[best_len] = 0;
+
+  free(cur);
+  free(best);
+  return best_len;
+} /* }}} size_t multimatch_literal */
+
+/*
+ * Automaton
+ */
+static void multimatch_invalidate(cu_multimatch_t *mm) /* {{{ */
+{
+  free(mm->delta);
+  free(mm->output);
+  free(mm->dict);
+  mm->delta = NULL;
+  mm->output = NULL;
+  mm->dict = NULL;
+  mm->states_num = 0;
+} /* }}} void multimatch_invalidate */
+
+static int multimatch_build(cu_multimatch_t *mm) /* {{{ */
+{
+  size_t states_max = 1;
+  int32_t *fail;
+  int32_t *queue;
+  size_t queue_head = 0;
+  size_t queue_tail = 0;
+  size_t cn;
+
+  memset(mm->classes, 0, sizeof(mm->classes));
+  mm->classes_num = 1;
+  for (size_t i = 0; i < mm->literals_num; i++) {
+    for (const unsigned char *p = (unsigned char *)mm->literals[i]; *p != 0;
+         p++) {
+      if (mm->classes[*p] == 0)
+        mm->classes[*p] = (uint8_t)mm->classes_num++;
+      states_max++;
+    }
+  }
+  cn = mm->classes_num;
+
+  mm->delta = calloc(states_max * cn, sizeof(*mm->delta));
+  mm->output = malloc(states_max * sizeof(*mm->output));
+  mm->dict = calloc(states_max, sizeof(*mm->dict));
+  fail = calloc(states_max, sizeof(*fail));
+  queue = malloc(states_max * sizeof(*queue));
+  if ((mm->delta == NULL) || (mm->output == NULL) || (mm->dict == NULL) ||
+      (fail == NULL) || (queue == NULL)) {
+    free(fail);
+    free(queue);
+    multimatch_invalidate(mm);
+    return ENOMEM;
+  }
+  for (size_t i = 0; i < states_max; i++)
+    mm->output[i] = -1;
+
+  /* Build the trie. Transitions to the root (zero) mean "no edge" here. */
+  mm->states_num = 1;
+  for (size_t i = 0; i < mm->literals_num; i++) {
+    int32_t s = 0;
+    for (const unsigned char *p = (unsigned char *)mm->literals[i]; *p != 0;
+         p++) {
+      int32_t *t = mm->delta + (size_t)s * cn + mm->classes[*p];
+      if (*t == 0)
+        *t = (int32_t)mm->states_num++;
+      s = *t;
+    }
+    mm->output[s] = (int32_t)i;
+  }
+
+  /* Breadth first, so the failure state of each state is complete before the
+   * state itself is visited. */
+  for (size_t c = 1; c < cn; c++)
+    if (mm->delta[c] != 0)
+      queue[queue_tail++] = mm->delta[c];
+
+  while (queue_head < queue_tail) {
+    int32_t s = queue[queue_head++];
+    int32_t *row = mm->delta + (size_t)s * cn;
+    int32_t *fail_row = mm->delta + (size_t)fail[s] * cn;
+
+    for (size_t c = 1; c < cn; c++) {
+      int32_t t = row[c];
+
+      if (t == 0) {
+        row[c] = fail_row[c];
+        continue;
+      }
+
+      fail[t] = fail_row[c];
+      mm->dict[t] = (mm->output[fail[t]] >= 0) ? fail[t] : mm->dict[fail[t]];
+      queue[queue_tail++] = t;
+    }
+  }
+
+  free(fail);
+  free(queue);
+  return 0;
+} /* }}} int multimatch_build */
+
+cu_multimatch_t *multimatch_create(void) /* {{{ */
+{
+  return calloc(1, sizeof(cu_multimatch_t));
+} /* }}} cu_multimatch_t *multimatch_create */
+
+void multimatch_destroy(cu_multimatch_t *mm) /* {{{ */
+{
+  if (mm == NULL)
+    return;
+
+  multimatch_invalidate(mm);
+  for (size_t i = 0; i < mm->literals_num; i++)
+    free(mm->literals[i]);
+  free(mm->literals);
+  free(mm);
+} /* }}} void multimatch_destroy */
+
+int multimatch_add(cu_multimatch_t *mm, const char *literal) /* {{{ */
+{
+  char **tmp;
+
+  if ((mm == NULL) || (literal == NULL) || (literal[0] == 0))
+    return -EINVAL;
+
+  for (size_t i = 0; i < mm->literals_num; i++)
+    if (strcmp(mm->literals[i], literal) == 0)
+      return (int)i;
+
+  tmp = realloc(mm->literals, (mm->literals_num + 1) * sizeof(*mm->literals));
+  if (tmp == NULL)
+    return -ENOMEM;
+  mm->literals = tmp;
+
+  mm->literals[mm->literals_num] = strdup(literal);
+  if (mm->literals[mm->literals_num] == NULL)
+    return -ENOMEM;
+
+  multimatch_invalidate(mm);
+  return (int)mm->literals_num++;
+} /* }}} int multimatch_add */
+
+size_t multimatch_size(const cu_multimatch_t *mm) /* {{{ */
+{
+  return (mm != NULL) ? mm->literals_num : 0;
+} /* }}} size_t multimatch_size */
+
+int multimatch_scan(cu_multimatch_t *mm, const char *str, /* {{{ */
+                    uint64_t *found) {
+  int32_t s = 0;
+
+  if ((mm == NULL) || (str == NULL) || (found == NULL))
+    return EINVAL;
+
+  memset(found, 0, ((mm->literals_num + 63) / 64) * sizeof(*found));
+  if (mm->literals_num == 0)
+    return 0;
+
+  if (mm->delta == NULL) {
+    int status = multimatch_build(mm);
+    if (status != 0)
+      return status;
+  }
+
+  for (const unsigned char *p = (const unsigned char *)str; *p != 0; p++) {
+    int32_t u;
+
+    s = mm->delta[(size_t)s * mm->classes_num + mm->classes[*p]];
+
+    u = (mm->output[s] >= 0) ? s : mm->dict[s];
+    while (u != 0) {
+      int32_t id = mm->output[u];
+      found[id / 64] |= ((uint64_t)1) << (id % 64);
+      u = mm->dict[u];
+    }
+  }
+
+  return 0;
+} /* }}} int multimatch_scan */
@@ -0,0 +1,112 @@
+/**
+ * collectd - src/utils_multimatch.h
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_MULTIMATCH_H
+#define UTILS_MULTIMATCH_H 1
+
+#include "collectd.h"
+
+/*
+ * Data types
+ */
+struct cu_multimatch_s;
+typedef struct cu_multimatch_s cu_multimatch_t;
+
+/*
+ * Prototypes
+ */
+/*
+ * NAME
+ *  multimatch_literal
+ *
+ * DESCRIPTION
+ *  Finds a literal string that every string matched by the POSIX extended
+ *  regular expression `regex' must contain, e.g. "served: " for
+ *  "^Requests served: ([0-9]+)". Strings that don't contain the literal can
+ *  be rejected without calling regexec(3). The analysis is conservative: if
+ *  in doubt, no literal is returned. It assumes the regular expression is not
+ *  compiled with REG_ICASE.
+ *
+ * RETURN VALUE
+ *  The length of the literal copied to `buffer', which may be truncated to
+ *  `buffer_size' - 1 bytes, or zero if there is no such literal.
+ */
+size_t multimatch_literal(const char *regex, char *buffer, size_t buffer_size);
+
+/*
+ * NAME
+ *  multimatch_create
+ *
+ * DESCRIPTION
+ *  Creates an empty set of literals which are searched for all at once, by
+ *  scanning each string only once. The set is not thread safe.
+ */
+cu_multimatch_t *multimatch_create(void);
+
+/*
+ * NAME
+ *  multimatch_destroy
+ *
+ * DESCRIPTION
+ *  Frees the set and all internal resources.
+ */
+void multimatch_destroy(cu_multimatch_t *mm);
+
+/*
+ * NAME
+ *  multimatch_add
+ *
+ * DESCRIPTION
+ *  Adds the non-empty `literal' to the set. Adding a literal that is already
+ *  part of the set returns the existing ID.
+ *
+ * RETURN VALUE
+ *  The ID of the literal, counting from zero, or less than zero upon failure.
+ */
+int multimatch_add(cu_multimatch_t *mm, const char *literal);
+
+/*
+ * NAME
+ *  multimatch_size
+ *
+ * RETURN VALUE
+ *  The number of distinct literals in the set.
+ */
+size_t multimatch_size(const cu_multimatch_t *mm);
+
+/*
+ * NAME
+ *  multimatch_scan
+ *
+ * DESCRIPTION
+ *  Searches `str' for all literals of the set. For each literal that occurs
+ *  in `str', the bit with the literal's ID is set in `found', which must
+ *  hold at least (multimatch_size() + 63) / 64 words and is cleared first.
+ *  The automaton is built with the first scan after literals were added.
+ *
+ * RETURN VALUE
+ *  Zero upon success, non-zero if building the automaton failed.
+ */
+int multimatch_scan(cu_multimatch_t *mm, const char *str, uint64_t *found);
+
+#endif /* UTILS_MULTIMATCH_H */
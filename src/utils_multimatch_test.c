@@ -0,0 +1,144 @@
+/**
+ * collectd - src/utils_multimatch_test.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "testing.h"
+#include "utils_multimatch.h"
+
+#include <regex.h>
+
+DEF_TEST(literal) {
+  struct {
+    const char *regex;
+    const char *want;
+  } cases[] = {
+      {"^Requests served: ([0-9]+)", "Requests served: "},
+      {"foo", "foo"},
+      {"ab*cdef", "cdef"},
+      {"abcd?ef", "abc"},
+      {"abc+def", "abc"},
+      {"x{2,3}yz", "yz"},
+      {"a\\.b\\[c", "a.b[c"},
+      {"st=\\w+ code", " code"},
+      {"(optional)?tail", "tail"},
+      {"[[:digit:]]+ ms$", " ms"},
+      {"[]abc] long", " long"},
+      {"one|two", ""},
+      {"^(a|b)$", ""},
+      {".*", ""},
+      {"unterminated[", ""},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    char buffer[64];
+
+    printf("## Case %zu: %s\n", i, cases[i].regex);
+    EXPECT_EQ_UINT64(strlen(cases[i].want),
+                     multimatch_literal(cases[i].regex, buffer, sizeof(buffer)));
+    EXPECT_EQ_STR(cases[i].want, buffer);
+  }
+
+  /* Literals are truncated to the buffer. */
+  {
+    char buffer[4];
+    EXPECT_EQ_UINT64(3, multimatch_literal("abcdef", buffer, sizeof(buffer)));
+    EXPECT_EQ_STR("abc", buffer);
+  }
+
+  return 0;
+}
+
+DEF_TEST(scan) {
+  const char *literals[] = {"he", "she", "his", "hers", "served"};
+  struct {
+    const char *str;
+    uint64_t want;
+  } cases[] = {
+      {"ushers", 0x0b},          /* he, she, hers */
+      {"this", 0x04},            /* his */
+      {"", 0x00},                /* nothing */
+      {"Requests served", 0x10}, /* served */
+      {"xyz", 0x00},
+  };
+  cu_multimatch_t *mm;
+  uint64_t found[1];
+
+  CHECK_NOT_NULL(mm = multimatch_create());
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(literals); i++)
+    EXPECT_EQ_INT((int)i, multimatch_add(mm, literals[i]));
+  /* Duplicates return the existing ID. */
+  EXPECT_EQ_INT(1, multimatch_add(mm, "she"));
+  EXPECT_EQ_UINT64(5, multimatch_size(mm));
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    printf("## Case %zu: %s\n", i, cases[i].str);
+    CHECK_ZERO(multimatch_scan(mm, cases[i].str, found));
+    EXPECT_EQ_UINT64(cases[i].want, found[0]);
+  }
+
+  /* Adding a literal rebuilds the automaton. */
+  EXPECT_EQ_INT(5, multimatch_add(mm, "us"));
+  CHECK_ZERO(multimatch_scan(mm, "ushers", found));
+  EXPECT_EQ_UINT64(0x2b, found[0]);
+
+  multimatch_destroy(mm);
+  return 0;
+}
+
+/* Every string a regular expression matches must contain its literal. */
+DEF_TEST(consistency) {
+  const char *regexen[] = {"^GET /([a-z]+) HTTP", "took ([0-9.]+) ?ms",
+                           "err(or)?: [A-Z]+", "a+b*c?d"};
+  const char *lines[] = {"GET /index HTTP/1.1", "request took 12.5ms",
+                         "request took 3 ms", "error: EIO", "err: X",
+                         "aaad", "abcd", "nothing here"};
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(regexen); i++) {
+    regex_t re;
+    char literal[64];
+
+    CHECK_ZERO(regcomp(&re, regexen[i], REG_EXTENDED | REG_NOSUB));
+    multimatch_literal(regexen[i], literal, sizeof(literal));
+
+    for (size_t j = 0; j < STATIC_ARRAY_SIZE(lines); j++) {
+      if (regexec(&re, lines[j], 0, NULL, 0) != 0)
+        continue;
+      printf("## %s matches %s\n", regexen[i], lines[j]);
+      OK(strstr(lines[j], literal) != NULL);
+    }
+
+    regfree(&re);
+  }
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(literal);
+  RUN_TEST(scan);
+  RUN_TEST(consistency);
+
+  END_TEST;
+}
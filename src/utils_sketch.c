@@ -0,0 +1,295 @@
+/**
+ * collectd - src/utils_sketch.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_sketch.h"
+
+#include <math.h>
+
+/* Magnitudes below this are counted as zero; their logarithm would need an
+ * unbounded number of buckets. */
+#define SKETCH_MIN_VALUE 1e-9
+
+/* Bucket `i' counts the magnitudes in (gamma^(i-1), gamma^i]. The array only
+ * covers the indices seen so far and is re-centered when it has to grow. */
+struct sketch_store_s {
+  uint64_t *counts;
+  int offset; /* bucket index of counts[0] */
+  size_t len;
+};
+typedef struct sketch_store_s sketch_store_t;
+
+struct sketch_s {
+  double accuracy;
+  double gamma;
+  double multiplier; /* 1 / log(gamma) */
+
+  sketch_store_t positive;
+  sketch_store_t negative; /* indexed by the magnitude */
+  uint64_t zero;
+
+  uint64_t count;
+  double min;
+  double max;
+};
+
+static int sketch_index(sketch_t const *s, double magnitude) /* {{{ */
+{
+  return (int)ceil(log(magnitude) * s->multiplier);
+} /* }}} int sketch_index */
+
+/* Returns the point of the bucket with the smallest relative distance to
+ * either edge. */
+static double sketch_value(sketch_t const *s, int index) /* {{{ */
+{
+  return 2.0 * pow(s->gamma, (double)index) / (s->gamma + 1.0);
+} /* }}} double sketch_value */
+
+/* Makes sure the buckets [lo, hi] exist. If that would exceed
+ * SKETCH_MAX_BUCKETS, the lowest buckets are folded into the lowest one that
+ * is kept; callers must clamp their index to `offset' afterwards. */
+static int sketch_store_extend(sketch_store_t *st, int lo, int hi) /* {{{ */
+{
+  if (st->len > 0) {
+    int cur_hi = st->offset + (int)st->len - 1;
+    if ((lo >= st->offset) && (hi <= cur_hi))
+      return 0;
+    if (st->offset < lo)
+      lo = st->offset;
+    if (cur_hi > hi)
+      hi = cur_hi;
+  }
+
+  int64_t want = (int64_t)hi - (int64_t)lo + 1;
+  size_t len;
+  int offset;
+  if (want >= SKETCH_MAX_BUCKETS) {
+    len = SKETCH_MAX_BUCKETS;
+    offset = hi - (SKETCH_MAX_BUCKETS - 1);
+  } else {
+    /* Leave some slack on both sides so a drifting range does not
+     * reallocate on every value. */
+    len = ((size_t)want + 63) & ~((size_t)63);
+    if (len > SKETCH_MAX_BUCKETS)
+      len = SKETCH_MAX_BUCKETS;
+    offset = lo - (int)((len - (size_t)want) / 2);
+  }
+
+  uint64_t *counts = calloc(len, sizeof(*counts));
+  if (counts == NULL)
+    return ENOMEM;
+
+  for (size_t i = 0; i < st->len; i++) {
+    int index = st->offset + (int)i;
+    if (index < offset)
+      index = offset;
+    counts[index - offset] += st->counts[i];
+  }
+
+  free(st->counts);
+  st->counts = counts;
+  st->offset = offset;
+  st->len = len;
+  return 0;
+} /* }}} int sketch_store_extend */
+
+static int sketch_store_add(sketch_store_t *st, int index, /* {{{ */
+                            uint64_t n) {
+  int status = sketch_store_extend(st, index, index);
+  if (status != 0)
+    return status;
+
+  if (index < st->offset)
+    index = st->offset;
+  st->counts[index - st->offset] += n;
+  return 0;
+} /* }}} int sketch_store_add */
+
+static int sketch_store_merge(sketch_store_t *dst, /* {{{ */
+                              sketch_store_t const *src) {
+  size_t first = 0;
+  while ((first < src->len) && (src->counts[first] == 0))
+    first++;
+  if (first == src->len)
+    return 0;
+
+  size_t last = src->len - 1;
+  while (src->counts[last] == 0)
+    last--;
+
+  int status = sketch_store_extend(dst, src->offset + (int)first,
+                                   src->offset + (int)last);
+  if (status != 0)
+    return status;
+
+  for (size_t i = first; i <= last; i++) {
+    int index = src->offset + (int)i;
+    if (index < dst->offset)
+      index = dst->offset;
+    dst->counts[index - dst->offset] += src->counts[i];
+  }
+  return 0;
+} /* }}} int sketch_store_merge */
+
+sketch_t *sketch_create(double accuracy) /* {{{ */
+{
+  if (!(accuracy > 0.0) || !(accuracy < 1.0))
+    return NULL;
+
+  sketch_t *s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->accuracy = accuracy;
+  s->gamma = (1.0 + accuracy) / (1.0 - accuracy);
+  s->multiplier = 1.0 / log(s->gamma);
+  s->min = NAN;
+  s->max = NAN;
+
+  return s;
+} /* }}} sketch_t *sketch_create */
+
+void sketch_destroy(sketch_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  free(s->positive.counts);
+  free(s->negative.counts);
+  free(s);
+} /* }}} void sketch_destroy */
+
+int sketch_add(sketch_t *s, double value) /* {{{ */
+{
+  /* Infinity has no bucket and would end up in min/max. */
+  if (!isfinite(value))
+    return EINVAL;
+
+  int status = 0;
+  if (value >= SKETCH_MIN_VALUE)
+    status = sketch_store_add(&s->positive, sketch_index(s, value), 1);
+  else if (value <= -SKETCH_MIN_VALUE)
+    status = sketch_store_add(&s->negative, sketch_index(s, -value), 1);
+  else
+    s->zero++;
+  if (status != 0)
+    return status;
+
+  s->count++;
+  if (isnan(s->min) || (s->min > value))
+    s->min = value;
+  if (isnan(s->max) || (s->max < value))
+    s->max = value;
+
+  return 0;
+} /* }}} int sketch_add */
+
+int sketch_merge(sketch_t *dst, sketch_t const *src) /* {{{ */
+{
+  if (dst->accuracy != src->accuracy)
+    return EINVAL;
+  if (src->count == 0)
+    return 0;
+
+  int status = sketch_store_merge(&dst->positive, &src->positive);
+  if (status == 0)
+    status = sketch_store_merge(&dst->negative, &src->negative);
+  if (status != 0)
+    return status;
+
+  dst->zero += src->zero;
+  dst->count += src->count;
+  if (isnan(dst->min) || (dst->min > src->min))
+    dst->min = src->min;
+  if (isnan(dst->max) || (dst->max < src->max))
+    dst->max = src->max;
+
+  return 0;
+} /* }}} int sketch_merge */
+
+void sketch_reset(sketch_t *s) /* {{{ */
+{
+  if (s->positive.len > 0)
+    memset(s->positive.counts, 0,
+           s->positive.len * sizeof(*s->positive.counts));
+  if (s->negative.len > 0)
+    memset(s->negative.counts, 0,
+           s->negative.len * sizeof(*s->negative.counts));
+  s->zero = 0;
+  s->count = 0;
+  s->min = NAN;
+  s->max = NAN;
+} /* }}} void sketch_reset */
+
+uint64_t sketch_count(sketch_t const *s) /* {{{ */
+{
+  return s->count;
+} /* }}} uint64_t sketch_count */
+
+double sketch_percentile(sketch_t const *s, double percent) /* {{{ */
+{
+  if ((s->count == 0) || !(percent >= 0.0) || !(percent <= 100.0))
+    return NAN;
+
+  if (percent == 0.0)
+    return s->min;
+  if (percent == 100.0)
+    return s->max;
+
+  double rank = (percent / 100.0) * ((double)(s->count - 1));
+  uint64_t sum = 0;
+  double ret = s->max;
+  _Bool found = 0;
+
+  /* Walk the values in ascending order: large negative magnitudes first. */
+  for (size_t i = s->negative.len; (i > 0) && !found; i--) {
+    sum += s->negative.counts[i - 1];
+    if ((double)sum > rank) {
+      ret = -sketch_value(s, s->negative.offset + (int)(i - 1));
+      found = 1;
+    }
+  }
+
+  if (!found) {
+    sum += s->zero;
+    if ((double)sum > rank) {
+      ret = 0.0;
+      found = 1;
+    }
+  }
+
+  for (size_t i = 0; (i < s->positive.len) && !found; i++) {
+    sum += s->positive.counts[i];
+    if ((double)sum > rank) {
+      ret = sketch_value(s, s->positive.offset + (int)i);
+      found = 1;
+    }
+  }
+
+  if (ret < s->min)
+    ret = s->min;
+  if (ret > s->max)
+    ret = s->max;
+  return ret;
+} /* }}} double sketch_percentile */
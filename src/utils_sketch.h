@@ -0,0 +1,110 @@
+/**
+ * collectd - src/utils_sketch.h
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_SKETCH_H
+#define UTILS_SKETCH_H 1
+
+#include "collectd.h"
+
+/* Upper bound on the number of buckets kept per sign. When a sketch would
+ * grow beyond this, the buckets closest to zero are folded together, so only
+ * the smallest magnitudes lose accuracy. */
+#ifndef SKETCH_MAX_BUCKETS
+#define SKETCH_MAX_BUCKETS 2048
+#endif
+
+/*
+ * Data types
+ */
+struct sketch_s;
+typedef struct sketch_s sketch_t;
+
+/*
+ * Prototypes
+ */
+/*
+ * NAME
+ *  sketch_create
+ *
+ * DESCRIPTION
+ *  Allocates a quantile sketch. Values are counted in logarithmically sized
+ *  buckets, so every quantile is reported with a relative error of at most
+ *  `accuracy' (e.g. 0.01 for 1%), independent of the distribution. Two
+ *  sketches created with the same accuracy can be merged without losing
+ *  precision. Sketches are not thread safe.
+ *
+ * RETURN VALUE
+ *  A sketch_t-pointer upon success or NULL upon failure.
+ */
+sketch_t *sketch_create(double accuracy);
+
+void sketch_destroy(sketch_t *s);
+
+/*
+ * NAME
+ *  sketch_add
+ *
+ * DESCRIPTION
+ *  Counts `value'. Memory is only allocated when a value falls outside the
+ *  range of buckets seen so far.
+ *
+ * RETURN VALUE
+ *  Zero upon success, EINVAL if `value' is NaN or infinite and ENOMEM if the
+ *  bucket array could not be grown.
+ */
+int sketch_add(sketch_t *s, double value);
+
+/*
+ * NAME
+ *  sketch_merge
+ *
+ * DESCRIPTION
+ *  Adds all values counted by `src' to `dst'. Both sketches must have been
+ *  created with the same accuracy.
+ *
+ * RETURN VALUE
+ *  Zero upon success, EINVAL if the accuracies differ and ENOMEM on
+ *  allocation failure.
+ */
+int sketch_merge(sketch_t *dst, sketch_t const *src);
+
+/* Forgets all values but keeps the allocated buckets for reuse. */
+void sketch_reset(sketch_t *s);
+
+uint64_t sketch_count(sketch_t const *s);
+
+/*
+ * NAME
+ *  sketch_percentile
+ *
+ * DESCRIPTION
+ *  Returns the value below which `percent' percent of the counted values
+ *  fall. The result is clamped to the smallest and largest value added.
+ *
+ * RETURN VALUE
+ *  The estimated value, or NaN if the sketch is empty or `percent' is not
+ *  within [0, 100].
+ */
+double sketch_percentile(sketch_t const *s, double percent);
+
+#endif /* UTILS_SKETCH_H */
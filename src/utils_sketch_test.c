@@ -0,0 +1,191 @@
+/**
+ * collectd - src/utils_sketch_test.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "testing.h"
+#include "utils_sketch.h"
+
+#include <math.h>
+
+#define ACCURACY 0.01
+
+DEF_TEST(percentile) {
+  sketch_t *s;
+  CHECK_NOT_NULL(s = sketch_create(ACCURACY));
+
+  EXPECT_EQ_INT(0, (int)sketch_count(s));
+  OK(isnan(sketch_percentile(s, 50.0)));
+
+  int status = 0;
+  for (int i = 1; i <= 10000; i++)
+    status |= sketch_add(s, (double)i);
+  EXPECT_EQ_INT(0, status);
+  EXPECT_EQ_UINT64(10000, sketch_count(s));
+
+  struct {
+    double percent;
+    double want;
+  } cases[] = {
+      {0.0, 1.0},      {10.0, 1000.0}, {50.0, 5000.0},
+      {90.0, 9000.0},  {99.0, 9900.0}, {99.9, 9990.0},
+      {100.0, 10000.0},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    double got = sketch_percentile(s, cases[i].percent);
+    printf("## case %zu: percentile(%g) = %g, want %g\n", i, cases[i].percent,
+           got, cases[i].want);
+    OK(fabs(got - cases[i].want) <= 1.0 + ACCURACY * cases[i].want);
+  }
+
+  OK(isnan(sketch_percentile(s, -1.0)));
+  OK(isnan(sketch_percentile(s, 101.0)));
+
+  sketch_reset(s);
+  EXPECT_EQ_INT(0, (int)sketch_count(s));
+  OK(isnan(sketch_percentile(s, 50.0)));
+
+  sketch_destroy(s);
+  return 0;
+}
+
+DEF_TEST(signs) {
+  sketch_t *s;
+  CHECK_NOT_NULL(s = sketch_create(ACCURACY));
+
+  /* 100 values each of -1000, 0 and 1000 */
+  int status = 0;
+  for (int i = 0; i < 100; i++) {
+    status |= sketch_add(s, -1000.0);
+    status |= sketch_add(s, 0.0);
+    status |= sketch_add(s, 1000.0);
+  }
+  EXPECT_EQ_INT(0, status);
+
+  EXPECT_EQ_INT(-1000, (int)sketch_percentile(s, 0.0));
+  OK(fabs(sketch_percentile(s, 20.0) + 1000.0) <= 1000.0 * ACCURACY);
+  EXPECT_EQ_INT(0, (int)sketch_percentile(s, 50.0));
+  OK(fabs(sketch_percentile(s, 80.0) - 1000.0) <= 1000.0 * ACCURACY);
+  EXPECT_EQ_INT(1000, (int)sketch_percentile(s, 100.0));
+
+  sketch_destroy(s);
+  return 0;
+}
+
+DEF_TEST(merge) {
+  sketch_t *all;
+  sketch_t *parts[4];
+
+  CHECK_NOT_NULL(all = sketch_create(ACCURACY));
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(parts); i++)
+    CHECK_NOT_NULL(parts[i] = sketch_create(ACCURACY));
+
+  /* Spread a wide range of values over the parts, so the merge has to grow
+   * and re-center the destination. */
+  int status = 0;
+  for (int i = 0; i < 40000; i++) {
+    double v = exp((double)(i % 997) / 40.0) - 20.0;
+    status |= sketch_add(all, v);
+    status |= sketch_add(parts[i % 4], v);
+  }
+  EXPECT_EQ_INT(0, status);
+
+  sketch_t *merged;
+  CHECK_NOT_NULL(merged = sketch_create(ACCURACY));
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(parts); i++)
+    CHECK_ZERO(sketch_merge(merged, parts[i]));
+
+  EXPECT_EQ_UINT64(sketch_count(all), sketch_count(merged));
+  for (double p = 0.0; p <= 100.0; p += 2.5) {
+    _Bool equal = (sketch_percentile(all, p) == sketch_percentile(merged, p));
+    EXPECT_EQ_INT(1, equal);
+  }
+
+  sketch_t *other;
+  CHECK_NOT_NULL(other = sketch_create(2 * ACCURACY));
+  EXPECT_EQ_INT(EINVAL, sketch_merge(merged, other));
+  sketch_destroy(other);
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(parts); i++)
+    sketch_destroy(parts[i]);
+  sketch_destroy(merged);
+  sketch_destroy(all);
+  return 0;
+}
+
+DEF_TEST(bounded) {
+  sketch_t *s;
+  CHECK_NOT_NULL(s = sketch_create(ACCURACY));
+
+  /* Far more magnitudes than SKETCH_MAX_BUCKETS can hold: the smallest
+   * ones are folded together, the large ones stay accurate. */
+  int status = 0;
+  for (int e = -9; e <= 300; e++)
+    status |= sketch_add(s, pow(10.0, (double)e));
+  EXPECT_EQ_INT(0, status);
+
+  double want = 1e300;
+  double got = sketch_percentile(s, 100.0);
+  OK(fabs(got - want) <= want * ACCURACY);
+
+  want = 1e290;
+  got = sketch_percentile(s, 100.0 * 299.0 / 309.0);
+  OK(fabs(got - want) <= want * ACCURACY);
+
+  /* Folded buckets still come out in order. */
+  OK(sketch_percentile(s, 0.0) <= sketch_percentile(s, 1.0));
+
+  sketch_destroy(s);
+  return 0;
+}
+
+DEF_TEST(non_finite) {
+  sketch_t *s;
+  CHECK_NOT_NULL(s = sketch_create(ACCURACY));
+
+  EXPECT_EQ_INT(0, sketch_add(s, 1.0));
+  EXPECT_EQ_INT(EINVAL, sketch_add(s, NAN));
+  EXPECT_EQ_INT(EINVAL, sketch_add(s, INFINITY));
+  EXPECT_EQ_INT(EINVAL, sketch_add(s, -INFINITY));
+  EXPECT_EQ_INT(0, sketch_add(s, 3.0));
+
+  /* Rejected values neither count nor move min and max. */
+  EXPECT_EQ_DOUBLE(1.0, sketch_percentile(s, 0.0));
+  OK(fabs(sketch_percentile(s, 100.0) - 3.0) <= 3.0 * ACCURACY);
+  OK(fabs(sketch_percentile(s, 50.0) - 1.0) <= 1.0 * ACCURACY);
+
+  sketch_destroy(s);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(percentile);
+  RUN_TEST(signs);
+  RUN_TEST(merge);
+  RUN_TEST(bounded);
+  RUN_TEST(non_finite);
+
+  END_TEST;
+}
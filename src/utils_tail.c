@@ -39,6 +39,12 @@ struct cu_tail_s {
   char *file;
   FILE *fh;
   struct stat stat;
+
+  /* Where to continue when the file is opened for the first time; set by
+   * cu_tail_set_position(). */
+  _Bool have_start;
+  uint64_t start_inode;
+  uint64_t start_offset;
 };
 
 static int cu_tail_reopen(cu_tail_t *obj) {
@@ -87,6 +93,28 @@ static int cu_tail_reopen(cu_tail_t *obj) {
     return -1;
   }
 
+  /* Continue at a saved position instead. If the file has been replaced or
+   * truncated since, everything in it is new. */
+  if (obj->have_start && (obj->stat.st_ino == 0)) {
+    off_t offset = 0;
+
+    if (((uint64_t)stat_buf.st_ino == obj->start_inode) &&
+        ((uint64_t)stat_buf.st_size >= obj->start_offset))
+      offset = (off_t)obj->start_offset;
+
+    obj->have_start = 0;
+    seek_end = 0;
+
+    status = fseeko(fh, offset, SEEK_SET);
+    if (status != 0) {
+      char errbuf[1024];
+      ERROR("utils_tail: fseeko (%s) failed: %s", obj->file,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      fclose(fh);
+      return -1;
+    }
+  }
+
   if (seek_end != 0) {
     status = fseek(fh, 0, SEEK_END);
     if (status != 0) {
@@ -233,3 +261,83 @@ int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
 
   return status;
 } /* int cu_tail_read */
+
+ssize_t cu_tail_read_chunk(cu_tail_t *obj, char *buf, size_t buflen) {
+  size_t len;
+  int status;
+
+  if (buflen < 1) {
+    ERROR("utils_tail: cu_tail_read_chunk: buflen too small: %zu bytes.",
+          buflen);
+    return -1;
+  }
+
+  if (obj->fh == NULL) {
+    status = cu_tail_reopen(obj);
+    if (status < 0)
+      return status;
+  }
+  assert(obj->fh != NULL);
+
+  clearerr(obj->fh);
+  len = fread(buf, 1, buflen, obj->fh);
+  if (len > 0)
+    return (ssize_t)len;
+
+  /* Same rotation and truncation handling as in cu_tail_readline. */
+  if (ferror(obj->fh) != 0) {
+    fclose(obj->fh);
+    obj->fh = NULL;
+  }
+
+  status = cu_tail_reopen(obj);
+  if (status < 0)
+    return status;
+  else if (status > 0)
+    return 0;
+
+  len = fread(buf, 1, buflen, obj->fh);
+  if (len > 0)
+    return (ssize_t)len;
+
+  if (ferror(obj->fh) != 0) {
+    char errbuf[1024];
+    WARNING("utils_tail: fread (%s) returned an error: %s", obj->file,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+    fclose(obj->fh);
+    obj->fh = NULL;
+    return -1;
+  }
+
+  return 0;
+} /* ssize_t cu_tail_read_chunk */
+
+int cu_tail_get_position(cu_tail_t *obj, uint64_t *ret_inode,
+                         uint64_t *ret_offset) {
+  off_t offset;
+
+  if ((obj == NULL) || (obj->fh == NULL))
+    return -1;
+
+  offset = ftello(obj->fh);
+  if (offset < 0)
+    return -1;
+
+  *ret_inode = (uint64_t)obj->stat.st_ino;
+  *ret_offset = (uint64_t)offset;
+  return 0;
+} /* int cu_tail_get_position */
+
+int cu_tail_set_position(cu_tail_t *obj, uint64_t inode, uint64_t offset) {
+  if (obj == NULL)
+    return -1;
+
+  /* Only meaningful before the file has been opened. */
+  if (obj->fh != NULL)
+    return -1;
+
+  obj->have_start = 1;
+  obj->start_inode = inode;
+  obj->start_offset = offset;
+  return 0;
+} /* int cu_tail_set_position */
@@ -85,4 +85,40 @@ int cu_tail_readline(cu_tail_t *obj, char *buf, int buflen);
 int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
                  void *data);
 
+/*
+ * cu_tail_read_chunk
+ *
+ * Reads up to `buflen' bytes of whatever has been appended to the file,
+ * without looking for line boundaries. Rotated and truncated files are
+ * handled like in `cu_tail_readline'; data of two files is never returned by
+ * one call.
+ *
+ * Returns the number of bytes read, zero at EOF and a negative value on
+ * error.
+ */
+ssize_t cu_tail_read_chunk(cu_tail_t *obj, char *buf, size_t buflen);
+
+/*
+ * cu_tail_get_position
+ *
+ * Returns the inode and read offset of the currently open file, e.g. to
+ * persist them across restarts.
+ *
+ * Returns 0 when successful and non-zero if no file is open.
+ */
+int cu_tail_get_position(cu_tail_t *obj, uint64_t *ret_inode,
+                         uint64_t *ret_offset);
+
+/*
+ * cu_tail_set_position
+ *
+ * Makes the first open of the file continue at `offset' instead of at the
+ * end, if the file still has inode `inode' and is at least `offset' bytes
+ * long. Otherwise the file is read from the beginning. Must be called before
+ * the first read.
+ *
+ * Returns 0 when successful and non-zero otherwise.
+ */
+int cu_tail_set_position(cu_tail_t *obj, uint64_t inode, uint64_t offset);
+
 #endif /* UTILS_TAIL_H */
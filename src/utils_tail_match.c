@@ -63,6 +63,7 @@ struct cu_tail_match_s {
   cdtime_t interval;
   cu_tail_match_match_t *matches;
   size_t matches_num;
+  cu_match_set_t *match_set;
 };
 
 /*
@@ -177,8 +178,7 @@ static int tail_callback(void *data, char *buf,
                          int __attribute__((unused)) buflen) {
   cu_tail_match_t *obj = (cu_tail_match_t *)data;
 
-  for (size_t i = 0; i < obj->matches_num; i++)
-    match_apply(obj->matches[i].match, buf);
+  match_set_apply(obj->match_set, buf);
 
   return 0;
 } /* int tail_callback */
@@ -205,6 +205,13 @@ cu_tail_match_t *tail_match_create(const char *filename) {
     return NULL;
   }
 
+  obj->match_set = match_set_create();
+  if (obj->match_set == NULL) {
+    cu_tail_destroy(obj->tail);
+    sfree(obj);
+    return NULL;
+  }
+
   return obj;
 } /* cu_tail_match_t *tail_match_create */
 
@@ -217,6 +224,9 @@ void tail_match_destroy(cu_tail_match_t *obj) {
     obj->tail = NULL;
   }
 
+  match_set_destroy(obj->match_set);
+  obj->match_set = NULL;
+
   for (size_t i = 0; i < obj->matches_num; i++) {
     cu_tail_match_match_t *match = obj->matches + i;
     if (match->match != NULL) {
@@ -246,6 +256,10 @@ int tail_match_add_match(cu_tail_match_t *obj, cu_match_t *match,
     return -1;
 
   obj->matches = temp;
+
+  if (match_set_add(obj->match_set, match) != 0)
+    return -1;
+
   obj->matches_num++;
 
   DEBUG("tail_match_add_match interval %lf",
@@ -68,6 +68,34 @@ struct identifier_match_s {
 };
 typedef struct identifier_match_s identifier_match_t;
 
+/* The memo is cleared when it grows beyond this many series. */
+#define LU_MEMO_MAX 262144
+
+struct user_class_s;
+typedef struct user_class_s user_class_t;
+struct user_obj_s;
+typedef struct user_obj_s user_obj_t;
+
+struct lu_target_s {
+  user_class_t *user_class;
+  user_obj_t *user_obj;
+};
+typedef struct lu_target_s lu_target_t;
+
+/* The user objects a series has been resolved to. Once a series has been
+ * seen, lookup_search() calls their callbacks directly, without matching the
+ * identifier against the user classes again. */
+struct lu_memo_s;
+typedef struct lu_memo_s lu_memo_t;
+struct lu_memo_s {
+  uint64_t series_id;
+  char *name; /* guards against collisions of the series ID */
+  lu_memo_t *next;
+
+  size_t targets_num;
+  lu_target_t targets[];
+};
+
 struct lookup_s {
   c_avl_tree_t *by_type_tree;
 
@@ -75,9 +103,17 @@ struct lookup_s {
   lookup_obj_callback_t cb_user_obj;
   lookup_free_class_callback_t cb_free_class;
   lookup_free_obj_callback_t cb_free_obj;
+
+  /* Hash table of lu_memo_t, keyed by series ID. */
+  pthread_rwlock_t memo_lock;
+  lu_memo_t **memo;
+  size_t memo_size; /* power of two */
+  size_t memo_num;
+  /* Incremented by lookup_add(), so that series resolved before a class was
+   * added aren't memoized without it. */
+  unsigned int memo_generation;
 };
 
-struct user_obj_s;
 typedef struct user_obj_s user_obj_t;
 struct user_obj_s {
   void *user_obj;
@@ -92,7 +128,6 @@ struct user_class_s {
   identifier_match_t match;
   user_obj_t *user_obj_list; /* list of user_obj */
 };
-typedef struct user_class_s user_class_t;
 
 struct user_class_list_s;
 typedef struct user_class_list_s user_class_list_t;
@@ -107,6 +142,15 @@ struct by_type_entry_s {
 };
 typedef struct by_type_entry_s by_type_entry_t;
 
+/* Collects the targets of a series while it is resolved for the first time. */
+struct lu_targets_s {
+  lu_target_t *targets;
+  size_t num;
+  size_t size;
+  _Bool incomplete; /* if set, the series can't be memoized */
+};
+typedef struct lu_targets_s lu_targets_t;
+
 /*
  * Private functions
  */
@@ -265,11 +309,51 @@ static user_obj_t *lu_find_user_obj(user_class_t *user_class, /* {{{ */
   return NULL;
 } /* }}} user_obj_t *lu_find_user_obj */
 
+/* Calls the user object callback. Returns zero on success, a negative value
+ * to abort the search and a positive value on other errors. */
+static int lu_call_user_obj(lookup_t *obj, /* {{{ */
+                            data_set_t const *ds, value_list_t const *vl,
+                            user_class_t *user_class, user_obj_t *user_obj) {
+  int status;
+
+  status = obj->cb_user_obj(ds, vl, user_class->user_class, user_obj->user_obj);
+  if (status != 0) {
+    ERROR("utils_vl_lookup: The user object callback failed with status %i.",
+          status);
+    /* Returning a negative value means: abort! */
+    if (status < 0)
+      return status;
+    else
+      return 1;
+  }
+
+  return 0;
+} /* }}} int lu_call_user_obj */
+
+static int lu_targets_add(lu_targets_t *targets, /* {{{ */
+                          user_class_t *user_class, user_obj_t *user_obj) {
+  if (targets->num == targets->size) {
+    size_t size = (targets->size == 0) ? 4 : 2 * targets->size;
+    lu_target_t *tmp = realloc(targets->targets, size * sizeof(*tmp));
+    if (tmp == NULL) {
+      ERROR("utils_vl_lookup: realloc failed.");
+      return ENOMEM;
+    }
+    targets->targets = tmp;
+    targets->size = size;
+  }
+
+  targets->targets[targets->num].user_class = user_class;
+  targets->targets[targets->num].user_obj = user_obj;
+  targets->num++;
+  return 0;
+} /* }}} int lu_targets_add */
+
 static int lu_handle_user_class(lookup_t *obj, /* {{{ */
                                 data_set_t const *ds, value_list_t const *vl,
-                                user_class_t *user_class) {
+                                user_class_t *user_class,
+                                lu_targets_t *targets) {
   user_obj_t *user_obj;
-  int status;
 
   assert(strcmp(vl->type, user_class->match.type.str) == 0);
   assert(user_class->match.plugin.is_regex ||
@@ -295,31 +379,24 @@ static int lu_handle_user_class(lookup_t *obj, /* {{{ */
   }
   pthread_mutex_unlock(&user_class->lock);
 
-  status = obj->cb_user_obj(ds, vl, user_class->user_class, user_obj->user_obj);
-  if (status != 0) {
-    ERROR("utils_vl_lookup: The user object callback failed with status %i.",
-          status);
-    /* Returning a negative value means: abort! */
-    if (status < 0)
-      return status;
-    else
-      return 1;
-  }
+  if (lu_targets_add(targets, user_class, user_obj) != 0)
+    targets->incomplete = 1;
 
-  return 0;
+  return lu_call_user_obj(obj, ds, vl, user_class, user_obj);
 } /* }}} int lu_handle_user_class */
 
 static int lu_handle_user_class_list(lookup_t *obj, /* {{{ */
                                      data_set_t const *ds,
                                      value_list_t const *vl,
-                                     user_class_list_t *user_class_list) {
+                                     user_class_list_t *user_class_list,
+                                     lu_targets_t *targets) {
   user_class_list_t *ptr;
   int retval = 0;
 
   for (ptr = user_class_list; ptr != NULL; ptr = ptr->next) {
     int status;
 
-    status = lu_handle_user_class(obj, ds, vl, &ptr->entry);
+    status = lu_handle_user_class(obj, ds, vl, &ptr->entry, targets);
     if (status < 0)
       return status;
     else if (status == 0)
@@ -329,6 +406,147 @@ static int lu_handle_user_class_list(lookup_t *obj, /* {{{ */
   return retval;
 } /* }}} int lu_handle_user_class_list */
 
+/*
+ * Memoization
+ */
+/* memo_lock must be held when calling this function */
+static lu_memo_t *lu_memo_get(lookup_t *obj, uint64_t series_id, /* {{{ */
+                              value_list_t const *vl) {
+  if (obj->memo == NULL)
+    return NULL;
+
+  for (lu_memo_t *m = obj->memo[series_id & (obj->memo_size - 1)]; m != NULL;
+       m = m->next) {
+    if ((m->series_id == series_id) && series_name_matches(m->name, vl))
+      return m;
+  }
+
+  return NULL;
+} /* }}} lu_memo_t *lu_memo_get */
+
+/* memo_lock must be held for writing when calling this function */
+static void lu_memo_clear(lookup_t *obj) /* {{{ */
+{
+  if (obj->memo == NULL)
+    return;
+
+  for (size_t i = 0; i < obj->memo_size; i++) {
+    lu_memo_t *m = obj->memo[i];
+    while (m != NULL) {
+      lu_memo_t *next = m->next;
+      sfree(m->name);
+      sfree(m);
+      m = next;
+    }
+  }
+
+  sfree(obj->memo);
+  obj->memo_size = 0;
+  obj->memo_num = 0;
+} /* }}} void lu_memo_clear */
+
+/* memo_lock must be held for writing when calling this function */
+static int lu_memo_grow(lookup_t *obj) /* {{{ */
+{
+  size_t size = (obj->memo_size == 0) ? 256 : 2 * obj->memo_size;
+  lu_memo_t **memo;
+
+  memo = calloc(size, sizeof(*memo));
+  if (memo == NULL) {
+    ERROR("utils_vl_lookup: calloc failed.");
+    return ENOMEM;
+  }
+
+  for (size_t i = 0; i < obj->memo_size; i++) {
+    lu_memo_t *m = obj->memo[i];
+    while (m != NULL) {
+      lu_memo_t *next = m->next;
+      size_t bucket = m->series_id & (size - 1);
+
+      m->next = memo[bucket];
+      memo[bucket] = m;
+      m = next;
+    }
+  }
+
+  sfree(obj->memo);
+  obj->memo = memo;
+  obj->memo_size = size;
+  return 0;
+} /* }}} int lu_memo_grow */
+
+static void lu_memo_insert(lookup_t *obj, uint64_t series_id, /* {{{ */
+                           value_list_t const *vl,
+                           lu_targets_t const *targets,
+                           unsigned int generation) {
+  char name[6 * DATA_MAX_NAME_LEN];
+  lu_memo_t *m;
+  size_t bucket;
+
+  if (FORMAT_VL(name, sizeof(name), vl) != 0)
+    return;
+
+  m = calloc(1, sizeof(*m) + targets->num * sizeof(m->targets[0]));
+  if (m == NULL)
+    return;
+  m->series_id = series_id;
+  m->name = strdup(name);
+  if (m->name == NULL) {
+    sfree(m);
+    return;
+  }
+  m->targets_num = targets->num;
+  if (targets->num > 0)
+    memcpy(m->targets, targets->targets,
+           targets->num * sizeof(m->targets[0]));
+
+  pthread_rwlock_wrlock(&obj->memo_lock);
+
+  /* Another thread may have resolved the same series in the meantime. */
+  if ((generation != obj->memo_generation) ||
+      (lu_memo_get(obj, series_id, vl) != NULL)) {
+    pthread_rwlock_unlock(&obj->memo_lock);
+    sfree(m->name);
+    sfree(m);
+    return;
+  }
+
+  if (obj->memo_num >= LU_MEMO_MAX)
+    lu_memo_clear(obj);
+
+  if ((obj->memo_num >= obj->memo_size) && (lu_memo_grow(obj) != 0)) {
+    pthread_rwlock_unlock(&obj->memo_lock);
+    sfree(m->name);
+    sfree(m);
+    return;
+  }
+
+  bucket = series_id & (obj->memo_size - 1);
+  m->next = obj->memo[bucket];
+  obj->memo[bucket] = m;
+  obj->memo_num++;
+
+  pthread_rwlock_unlock(&obj->memo_lock);
+} /* }}} void lu_memo_insert */
+
+/* memo_lock must be held when calling this function */
+static int lu_memo_apply(lookup_t *obj, /* {{{ */
+                         data_set_t const *ds, value_list_t const *vl,
+                         lu_memo_t const *m) {
+  int retval = 0;
+
+  for (size_t i = 0; i < m->targets_num; i++) {
+    int status = lu_call_user_obj(obj, ds, vl, m->targets[i].user_class,
+                                  m->targets[i].user_obj);
+    if (status < 0)
+      return status;
+    else if (status == 0)
+      retval++;
+  }
+
+  return retval;
+} /* }}} int lu_memo_apply */
+
 static by_type_entry_t *lu_search_by_type(lookup_t *obj, /* {{{ */
                                           char const *type,
                                           _Bool allocate_if_missing) {
@@ -537,6 +755,8 @@ lookup_t *lookup_create(lookup_class_callback_t cb_user_class, /* {{{ */
   obj->cb_free_class = cb_free_class;
   obj->cb_free_obj = cb_free_obj;
 
+  pthread_rwlock_init(&obj->memo_lock, /* attr = */ NULL);
+
   return obj;
 } /* }}} lookup_t *lookup_create */
 
@@ -563,6 +783,9 @@ void lookup_destroy(lookup_t *obj) /* {{{ */
   c_avl_destroy(obj->by_type_tree);
   obj->by_type_tree = NULL;
 
+  lu_memo_clear(obj);
+  pthread_rwlock_destroy(&obj->memo_lock);
+
   sfree(obj);
 } /* }}} void lookup_destroy */
 
@@ -587,6 +810,12 @@ int lookup_add(lookup_t *obj, /* {{{ */
   user_class_obj->entry.user_obj_list = NULL;
   user_class_obj->next = NULL;
 
+  /* Series seen so far may match the new class, too. */
+  pthread_rwlock_wrlock(&obj->memo_lock);
+  lu_memo_clear(obj);
+  obj->memo_generation++;
+  pthread_rwlock_unlock(&obj->memo_lock);
+
   return lu_add_by_plugin(by_type, user_class_obj);
 } /* }}} int lookup_add */
 
@@ -595,32 +824,60 @@ int lookup_search(lookup_t *obj, /* {{{ */
                   data_set_t const *ds, value_list_t const *vl) {
   by_type_entry_t *by_type = NULL;
   user_class_list_t *user_class_list = NULL;
+  lu_targets_t targets = {0};
+  uint64_t series_id;
+  unsigned int generation;
+  lu_memo_t *m;
   int retval = 0;
   int status;
 
   if ((obj == NULL) || (ds == NULL) || (vl == NULL))
     return -EINVAL;
 
-  by_type = lu_search_by_type(obj, vl->type, /* allocate = */ 0);
-  if (by_type == NULL)
-    return 0;
+  series_id = VL_SERIES_ID(vl);
 
-  status =
-      c_avl_get(by_type->by_plugin_tree, vl->plugin, (void *)&user_class_list);
-  if (status == 0) {
-    status = lu_handle_user_class_list(obj, ds, vl, user_class_list);
-    if (status < 0)
-      return status;
-    retval += status;
+  /* The lock is held while the callbacks run, so that the user objects
+   * aren't freed from under us. */
+  pthread_rwlock_rdlock(&obj->memo_lock);
+  m = lu_memo_get(obj, series_id, vl);
+  if (m != NULL) {
+    status = lu_memo_apply(obj, ds, vl, m);
+    pthread_rwlock_unlock(&obj->memo_lock);
+    return status;
   }
+  generation = obj->memo_generation;
+  pthread_rwlock_unlock(&obj->memo_lock);
 
-  if (by_type->wildcard_plugin_list != NULL) {
-    status =
-        lu_handle_user_class_list(obj, ds, vl, by_type->wildcard_plugin_list);
-    if (status < 0)
-      return status;
-    retval += status;
+  by_type = lu_search_by_type(obj, vl->type, /* allocate = */ 0);
+  if (by_type != NULL) {
+    status = c_avl_get(by_type->by_plugin_tree, vl->plugin,
+                       (void *)&user_class_list);
+    if (status == 0) {
+      status = lu_handle_user_class_list(obj, ds, vl, user_class_list,
+                                         &targets);
+      if (status < 0) {
+        sfree(targets.targets);
+        return status;
+      }
+      retval += status;
+    }
+
+    if (by_type->wildcard_plugin_list != NULL) {
+      status = lu_handle_user_class_list(
+          obj, ds, vl, by_type->wildcard_plugin_list, &targets);
+      if (status < 0) {
+        sfree(targets.targets);
+        return status;
+      }
+      retval += status;
+    }
   }
 
+  /* Series that don't match any class are remembered, too: they are the
+   * common case. */
+  if (!targets.incomplete)
+    lu_memo_insert(obj, series_id, vl, &targets, generation);
+  sfree(targets.targets);
+
   return retval;
 } /* }}} lookup_search */
@@ -231,12 +231,53 @@ DEF_TEST(regex) {
   return 0;
 }
 
+DEF_TEST(memo) {
+  lookup_t *obj;
+  CHECK_NOT_NULL(obj = lookup_create(lookup_class_callback, lookup_obj_callback,
+                                     (void *)free, (void *)free));
+
+  checked_lookup_add(obj, "/.*/", "/^cpu$/", "/.*/", "test", "/.*/",
+                     LU_GROUP_BY_HOST);
+
+  /* The second search of a series is answered from the memo. */
+  EXPECT_EQ_INT(1, checked_lookup_search(obj, "host0", "cpu", "0", "test",
+                                         "user", /* expect new = */ 1));
+  EXPECT_EQ_INT(1, checked_lookup_search(obj, "host0", "cpu", "0", "test",
+                                         "user", /* expect new = */ 0));
+  EXPECT_EQ_STR("host0", last_obj_ident.host);
+
+  /* Series that don't match are remembered as such. */
+  EXPECT_EQ_INT(0, checked_lookup_search(obj, "host0", "memory", "", "test",
+                                         "used", /* expect new = */ 0));
+  EXPECT_EQ_INT(0, checked_lookup_search(obj, "host0", "memory", "", "test",
+                                         "used", /* expect new = */ 0));
+
+  /* Adding a class invalidates the memo. */
+  checked_lookup_add(obj, "/.*/", "memory", "", "test", "/.*/",
+                     LU_GROUP_BY_HOST);
+  EXPECT_EQ_INT(1, checked_lookup_search(obj, "host0", "memory", "", "test",
+                                         "used", /* expect new = */ 1));
+  EXPECT_EQ_INT(1, checked_lookup_search(obj, "host0", "memory", "", "test",
+                                         "used", /* expect new = */ 0));
+  EXPECT_EQ_STR("memory", last_class_ident.plugin);
+
+  /* Errors of the user callback are reported for memoized series, too. */
+  OK(checked_lookup_search(obj, "host1", "cpu", "failure", "test", "user",
+                           /* expect new = */ 1) < 0);
+  OK(checked_lookup_search(obj, "host1", "cpu", "failure", "test", "user",
+                           /* expect new = */ 0) < 0);
+
+  lookup_destroy(obj);
+  return 0;
+}
+
 int main(int argc, char **argv) /* {{{ */
 {
   RUN_TEST(group_by_specific_host);
   RUN_TEST(group_by_any_host);
   RUN_TEST(multiple_lookups);
   RUN_TEST(regex);
+  RUN_TEST(memo);
 
   END_TEST;
 } /* }}} int main */
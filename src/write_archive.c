@@ -0,0 +1,808 @@
+/**
+ * collectd - src/write_archive.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_gorilla.h"
+
+#include <sys/mman.h>
+
+/*
+ * Every series is stored in its own file, "<DataDir>/<identifier>.arc". The
+ * file is a header followed by fixed size chunks which are filled one after
+ * the other. Each chunk holds a timestamp column and one column per data
+ * source, compressed with utils_gorilla, and a small header with the time
+ * range and the encoder states. Since chunks are appended in time order,
+ * the chunk headers form an index that is binary searched by queries.
+ *
+ * Files are memory mapped and written in place; the kernel writes the pages
+ * back. Integers are stored in the host's byte order.
+ */
+
+#define WA_MAGIC "CDARCHV1"
+#define WA_VERSION 1
+#define WA_HEADER_SIZE 512
+#define WA_MAX_DS 64
+/* Number of chunks the file grows by when the last one is full. */
+#define WA_GROW_CHUNKS 16
+
+#define WA_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+/*
+ * Private types
+ */
+struct wa_header_s {
+  char magic[8];
+  uint32_t version;
+  uint32_t ds_num;
+  uint32_t chunk_size;
+  uint32_t time_size;  /* bytes of the timestamp column */
+  uint32_t value_size; /* bytes of each value column */
+  uint32_t pad;
+  uint64_t chunks_num; /* chunks in use, the last one is appended to */
+  uint8_t ds_type[WA_MAX_DS];
+};
+typedef struct wa_header_s wa_header_t;
+
+/* Times are stored in milliseconds. The columns start at WA_ALIGN(sizeof
+ * (wa_chunk_t) + ds_num * sizeof (gorilla_value_t)). */
+struct wa_chunk_s {
+  int64_t first;
+  int64_t last;
+  gorilla_time_t time;
+  gorilla_value_t value[];
+};
+typedef struct wa_chunk_s wa_chunk_t;
+
+struct wa_series_s {
+  char *filename;
+  pthread_mutex_t lock;
+
+  uint8_t *map; /* NULL if not mapped */
+  size_t map_size;
+  _Bool writable;
+
+  /* Set if the file does not match the data set; it is not mapped again
+   * until it has been replaced. */
+  _Bool broken;
+  dev_t broken_dev;
+  ino_t broken_ino;
+
+  /* LRU list of the mapped series, most recently used first */
+  struct wa_series_s *prev;
+  struct wa_series_s *next;
+};
+typedef struct wa_series_s wa_series_t;
+
+/*
+ * Private variables
+ */
+static char *datadir = NULL;
+static size_t chunk_base = 4096;
+static size_t max_open_files = 1024;
+
+/* Series by identifier. The lock protects the tree and the LRU list; the
+ * mappings are protected by the lock of each series. Series are only removed
+ * at shutdown, the least recently used mapping is unmapped when more than
+ * `max_open_files' are mapped. */
+static c_avl_tree_t *series = NULL;
+static wa_series_t *series_head = NULL;
+static wa_series_t *series_tail = NULL;
+static size_t series_mapped = 0;
+static pthread_mutex_t series_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static wa_header_t *wa_header(wa_series_t const *s) /* {{{ */
+{
+  return (wa_header_t *)s->map;
+} /* }}} wa_header_t *wa_header */
+
+static size_t wa_chunk_header_size(wa_header_t const *h) /* {{{ */
+{
+  return WA_ALIGN(sizeof(wa_chunk_t) + h->ds_num * sizeof(gorilla_value_t));
+} /* }}} size_t wa_chunk_header_size */
+
+static wa_chunk_t *wa_chunk(wa_series_t const *s, uint64_t idx) /* {{{ */
+{
+  wa_header_t const *h = wa_header(s);
+  return (wa_chunk_t *)(s->map + WA_HEADER_SIZE + idx * h->chunk_size);
+} /* }}} wa_chunk_t *wa_chunk */
+
+static uint8_t *wa_column(wa_header_t const *h, wa_chunk_t *c, /* {{{ */
+                          size_t column) {
+  uint8_t *data = (uint8_t *)c + wa_chunk_header_size(h);
+  if (column == 0)
+    return data;
+  return data + h->time_size + (column - 1) * h->value_size;
+} /* }}} uint8_t *wa_column */
+
+/* Entries written before a crash may be missing from some columns, so only
+ * the rows present in all of them are used. */
+static uint32_t wa_chunk_rows(wa_header_t const *h, /* {{{ */
+                              wa_chunk_t const *c) {
+  uint32_t rows = c->time.count;
+  for (size_t i = 0; i < h->ds_num; i++)
+    if (c->value[i].count < rows)
+      rows = c->value[i].count;
+  return rows;
+} /* }}} uint32_t wa_chunk_rows */
+
+static void wa_series_unmap(wa_series_t *s) /* {{{ */
+{
+  if (s->map == NULL)
+    return;
+
+  if (s->writable)
+    msync(s->map, s->map_size, MS_SYNC);
+  munmap(s->map, s->map_size);
+  s->map = NULL;
+  s->map_size = 0;
+} /* }}} void wa_series_unmap */
+
+static void wa_series_destroy(wa_series_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  wa_series_unmap(s);
+  pthread_mutex_destroy(&s->lock);
+  sfree(s->filename);
+  sfree(s);
+} /* }}} void wa_series_destroy */
+
+static int wa_map(wa_series_t *s, int fd, size_t size) /* {{{ */
+{
+  int prot = PROT_READ | (s->writable ? PROT_WRITE : 0);
+  void *map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    char errbuf[1024];
+    ERROR("write_archive plugin: mmap (%s) failed: %s", s->filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  if (s->map != NULL)
+    munmap(s->map, s->map_size);
+  s->map = map;
+  s->map_size = size;
+  return 0;
+} /* }}} int wa_map */
+
+/* Checks the header of a mapped file and, if `ds' is not NULL, that it was
+ * created for that data set. */
+static int wa_check_header(wa_series_t const *s, /* {{{ */
+                           data_set_t const *ds) {
+  wa_header_t const *h = wa_header(s);
+
+  if ((s->map_size < WA_HEADER_SIZE) ||
+      (memcmp(h->magic, WA_MAGIC, sizeof(h->magic)) != 0) ||
+      (h->version != WA_VERSION)) {
+    ERROR("write_archive plugin: %s is not an archive file.", s->filename);
+    return -1;
+  }
+
+  if ((h->ds_num == 0) || (h->ds_num > WA_MAX_DS) ||
+      (h->chunk_size < wa_chunk_header_size(h) + h->time_size +
+                           h->ds_num * h->value_size) ||
+      (h->chunks_num > (s->map_size - WA_HEADER_SIZE) / h->chunk_size)) {
+    ERROR("write_archive plugin: The header of %s is corrupt.", s->filename);
+    return -1;
+  }
+
+  if (ds == NULL)
+    return 0;
+
+  _Bool match = (h->ds_num == ds->ds_num);
+  for (size_t i = 0; match && (i < ds->ds_num); i++)
+    match = (h->ds_type[i] == (uint8_t)ds->ds[i].type);
+  if (!match) {
+    ERROR("write_archive plugin: %s was created for different data sources "
+          "than those of type \"%s\". Move the file away to start a new one.",
+          s->filename, ds->type);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int wa_check_header */
+
+static int wa_create_file(wa_series_t *s, int fd, /* {{{ */
+                          data_set_t const *ds) {
+  size_t time_size = WA_ALIGN(chunk_base / 4);
+  size_t value_size = WA_ALIGN(chunk_base - time_size);
+
+  wa_header_t h = {
+      .version = WA_VERSION,
+      .ds_num = (uint32_t)ds->ds_num,
+      .time_size = (uint32_t)time_size,
+      .value_size = (uint32_t)value_size,
+  };
+  memcpy(h.magic, WA_MAGIC, sizeof(h.magic));
+  h.chunk_size = (uint32_t)(wa_chunk_header_size(&h) + time_size +
+                            ds->ds_num * value_size);
+  for (size_t i = 0; i < ds->ds_num; i++)
+    h.ds_type[i] = (uint8_t)ds->ds[i].type;
+
+  size_t size = WA_HEADER_SIZE + WA_GROW_CHUNKS * (size_t)h.chunk_size;
+  if (ftruncate(fd, (off_t)size) != 0) {
+    char errbuf[1024];
+    ERROR("write_archive plugin: ftruncate (%s) failed: %s", s->filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  if (wa_map(s, fd, size) != 0)
+    return -1;
+
+  memcpy(s->map, &h, sizeof(h));
+  return 0;
+} /* }}} int wa_create_file */
+
+/* Allocates the series of `identifier' without mapping its file. */
+static wa_series_t *wa_series_create(char const *identifier) /* {{{ */
+{
+  char filename[PATH_MAX];
+  if (datadir != NULL)
+    snprintf(filename, sizeof(filename), "%s/%s.arc", datadir, identifier);
+  else
+    snprintf(filename, sizeof(filename), "%s.arc", identifier);
+
+  wa_series_t *s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->filename = strdup(filename);
+  if (s->filename == NULL) {
+    sfree(s);
+    return NULL;
+  }
+  pthread_mutex_init(&s->lock, /* attr = */ NULL);
+  return s;
+} /* }}} wa_series_t *wa_series_create */
+
+/* Maps the file of `s'. If `ds' is not NULL, the file is opened for writing
+ * and created if it does not exist. A file that does not match `ds' is
+ * remembered and only checked again once it has been replaced. */
+static int wa_series_map(wa_series_t *s, data_set_t const *ds) /* {{{ */
+{
+  if ((ds != NULL) && (ds->ds_num > WA_MAX_DS)) {
+    ERROR("write_archive plugin: Type \"%s\" has %zu data sources, "
+          "at most %d are supported.",
+          ds->type, ds->ds_num, WA_MAX_DS);
+    return -1;
+  }
+
+  struct stat statbuf = {0};
+  if (s->broken) {
+    if ((stat(s->filename, &statbuf) == 0) &&
+        (statbuf.st_dev == s->broken_dev) && (statbuf.st_ino == s->broken_ino))
+      return -1;
+    s->broken = 0;
+  }
+
+  if ((ds != NULL) && (check_create_dir(s->filename) != 0))
+    return -1;
+
+  int fd =
+      open(s->filename, (ds != NULL) ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+  if (fd < 0) {
+    if ((ds != NULL) || (errno != ENOENT)) {
+      char errbuf[1024];
+      ERROR("write_archive plugin: open (%s) failed: %s", s->filename,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+    }
+    return -1;
+  }
+
+  s->writable = (ds != NULL);
+
+  int status = fstat(fd, &statbuf);
+  if (status != 0) {
+    char errbuf[1024];
+    ERROR("write_archive plugin: stat (%s) failed: %s", s->filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+  } else if ((statbuf.st_size == 0) && s->writable) {
+    status = wa_create_file(s, fd, ds);
+  } else if (statbuf.st_size < WA_HEADER_SIZE) {
+    ERROR("write_archive plugin: %s is not an archive file.", s->filename);
+    s->broken = 1;
+    status = -1;
+  } else {
+    status = wa_map(s, fd, (size_t)statbuf.st_size);
+    if ((status == 0) && (wa_check_header(s, ds) != 0)) {
+      s->broken = 1;
+      status = -1;
+    }
+  }
+
+  /* The mapping stays valid after closing the file. */
+  close(fd);
+
+  if (s->broken) {
+    s->broken_dev = statbuf.st_dev;
+    s->broken_ino = statbuf.st_ino;
+  }
+  if (status != 0)
+    wa_series_unmap(s);
+  return status;
+} /* }}} int wa_series_map */
+
+static void wa_series_unlink(wa_series_t *s) /* {{{ */
+{
+  if (s->prev != NULL)
+    s->prev->next = s->next;
+  else
+    series_head = s->next;
+  if (s->next != NULL)
+    s->next->prev = s->prev;
+  else
+    series_tail = s->prev;
+  s->prev = s->next = NULL;
+} /* }}} void wa_series_unlink */
+
+static void wa_series_push(wa_series_t *s) /* {{{ */
+{
+  s->prev = NULL;
+  s->next = series_head;
+  if (series_head != NULL)
+    series_head->prev = s;
+  series_head = s;
+  if (series_tail == NULL)
+    series_tail = s;
+} /* }}} void wa_series_push */
+
+/* Returns the series of `identifier' with its file mapped for writing and its
+ * lock held, unmapping the least recently used series if too many are mapped.
+ * Must hold series_lock when calling. */
+static wa_series_t *wa_series_get(char const *identifier, /* {{{ */
+                                  data_set_t const *ds) {
+  wa_series_t *s = NULL;
+  if (c_avl_get(series, identifier, (void *)&s) != 0) {
+    s = wa_series_create(identifier);
+    char *key = (s != NULL) ? strdup(identifier) : NULL;
+    if ((key == NULL) || (c_avl_insert(series, key, s) != 0)) {
+      ERROR("write_archive plugin: Adding %s to the index failed.",
+            identifier);
+      sfree(key);
+      wa_series_destroy(s);
+      return NULL;
+    }
+  }
+
+  pthread_mutex_lock(&s->lock);
+  _Bool mapped = (s->map != NULL);
+  int status = mapped ? 0 : wa_series_map(s, ds);
+  pthread_mutex_unlock(&s->lock);
+  if (status != 0)
+    return NULL;
+
+  if (mapped)
+    wa_series_unlink(s);
+  else
+    series_mapped++;
+  wa_series_push(s);
+
+  /* Only one series is locked at a time. Since `s' is the most recently used
+   * one and series_lock is held, it is neither unmapped here nor by another
+   * thread before it is locked again. */
+  while ((series_mapped > max_open_files) && (series_tail != s)) {
+    wa_series_t *lru = series_tail;
+    pthread_mutex_lock(&lru->lock);
+    wa_series_unmap(lru);
+    pthread_mutex_unlock(&lru->lock);
+    wa_series_unlink(lru);
+    series_mapped--;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  return s;
+} /* }}} wa_series_t *wa_series_get */
+
+/* Starts a new chunk at time `t', growing the file if required. */
+static wa_chunk_t *wa_chunk_new(wa_series_t *s, int64_t t) /* {{{ */
+{
+  wa_header_t *h = wa_header(s);
+  size_t need = WA_HEADER_SIZE + (size_t)(h->chunks_num + 1) * h->chunk_size;
+
+  if (need > s->map_size) {
+    size_t size = s->map_size + WA_GROW_CHUNKS * (size_t)h->chunk_size;
+
+    int fd = open(s->filename, O_RDWR);
+    if (fd < 0) {
+      char errbuf[1024];
+      ERROR("write_archive plugin: open (%s) failed: %s", s->filename,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      return NULL;
+    }
+
+    int status = ftruncate(fd, (off_t)size);
+    if (status != 0) {
+      char errbuf[1024];
+      ERROR("write_archive plugin: ftruncate (%s) failed: %s", s->filename,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+    } else {
+      status = wa_map(s, fd, size);
+    }
+    close(fd);
+    if (status != 0)
+      return NULL;
+    h = wa_header(s);
+  }
+
+  wa_chunk_t *c = wa_chunk(s, h->chunks_num);
+  memset(c, 0, h->chunk_size);
+  c->first = t;
+  c->last = t;
+  h->chunks_num++;
+  return c;
+} /* }}} wa_chunk_t *wa_chunk_new */
+
+/* Appends one row to `c'. The encoder states are only updated if all columns
+ * had room. */
+static int wa_chunk_append(wa_header_t const *h, wa_chunk_t *c, /* {{{ */
+                           int64_t t, data_set_t const *ds,
+                           value_list_t const *vl) {
+  gorilla_time_t time = c->time;
+  gorilla_value_t value[WA_MAX_DS];
+
+  if (gorilla_time_append(&time, wa_column(h, c, 0), h->time_size, t) != 0)
+    return ENOSPC;
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    uint64_t bits;
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      memcpy(&bits, &vl->values[i].gauge, sizeof(bits));
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      bits = (uint64_t)vl->values[i].derive;
+    else if (ds->ds[i].type == DS_TYPE_COUNTER)
+      bits = (uint64_t)vl->values[i].counter;
+    else
+      bits = (uint64_t)vl->values[i].absolute;
+
+    value[i] = c->value[i];
+    if (gorilla_value_append(&value[i], wa_column(h, c, i + 1), h->value_size,
+                             bits) != 0)
+      return ENOSPC;
+  }
+
+  c->time = time;
+  memcpy(c->value, value, ds->ds_num * sizeof(*value));
+  c->last = t;
+  return 0;
+} /* }}} int wa_chunk_append */
+
+static int wa_series_append(wa_series_t *s, data_set_t const *ds, /* {{{ */
+                            value_list_t const *vl) {
+  wa_header_t *h = wa_header(s);
+  int64_t t = (int64_t)CDTIME_T_TO_MS(vl->time);
+
+  wa_chunk_t *c = NULL;
+  if (h->chunks_num > 0) {
+    c = wa_chunk(s, h->chunks_num - 1);
+    if (t <= c->last) {
+      DEBUG("write_archive plugin: Dropping value for %s: time %" PRIi64
+            " is not after %" PRIi64 ".",
+            s->filename, t, c->last);
+      return 0;
+    }
+    if (wa_chunk_append(h, c, t, ds, vl) == 0)
+      return 0;
+  }
+
+  c = wa_chunk_new(s, t);
+  if (c == NULL)
+    return -1;
+  h = wa_header(s);
+
+  if (wa_chunk_append(h, c, t, ds, vl) != 0) {
+    ERROR("write_archive plugin: A single value does not fit into an empty "
+          "chunk of %s.",
+          s->filename);
+    return -1;
+  }
+  return 0;
+} /* }}} int wa_series_append */
+
+/* Calls `result' for all rows of `s' within [start, end]. */
+static int wa_series_query(wa_series_t *s, data_set_t const *ds, /* {{{ */
+                           value_list_t *vl, int64_t start, int64_t end,
+                           plugin_query_result_cb result, void *arg) {
+  wa_header_t const *h = wa_header(s);
+
+  if (h->ds_num != ds->ds_num) {
+    ERROR("write_archive plugin: %s has %" PRIu32 " data sources, "
+          "but type \"%s\" has %zu.",
+          s->filename, h->ds_num, ds->type, ds->ds_num);
+    return EINVAL;
+  }
+
+  /* Another process may have grown the file after it was mapped. */
+  uint64_t chunks_num = h->chunks_num;
+  if (chunks_num > (s->map_size - WA_HEADER_SIZE) / h->chunk_size)
+    chunks_num = (s->map_size - WA_HEADER_SIZE) / h->chunk_size;
+
+  /* Find the first chunk ending at or after `start'. */
+  uint64_t lo = 0;
+  uint64_t hi = chunks_num;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (wa_chunk(s, mid)->last < start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  value_t values[WA_MAX_DS];
+  vl->values = values;
+  vl->values_len = ds->ds_num;
+
+  for (uint64_t idx = lo; idx < chunks_num; idx++) {
+    wa_chunk_t *c = wa_chunk(s, idx);
+    if (c->first > end)
+      break;
+
+    gorilla_reader_t time;
+    gorilla_reader_t value[WA_MAX_DS];
+    gorilla_time_reader_init(&time, wa_column(h, c, 0), &c->time);
+    for (size_t i = 0; i < ds->ds_num; i++)
+      gorilla_value_reader_init(&value[i], wa_column(h, c, i + 1),
+                                &c->value[i]);
+
+    uint32_t rows = wa_chunk_rows(h, c);
+    for (uint32_t row = 0; row < rows; row++) {
+      int64_t t;
+      int status = gorilla_time_next(&time, &t);
+
+      for (size_t i = 0; (status == 0) && (i < ds->ds_num); i++) {
+        uint64_t bits;
+        status = gorilla_value_next(&value[i], &bits);
+        if (ds->ds[i].type == DS_TYPE_GAUGE)
+          memcpy(&values[i].gauge, &bits, sizeof(bits));
+        else if (ds->ds[i].type == DS_TYPE_DERIVE)
+          values[i].derive = (derive_t)bits;
+        else if (ds->ds[i].type == DS_TYPE_COUNTER)
+          values[i].counter = (counter_t)bits;
+        else
+          values[i].absolute = (absolute_t)bits;
+      }
+      if (status != 0) {
+        ERROR("write_archive plugin: Chunk %" PRIu64 " of %s is corrupt.",
+              idx, s->filename);
+        break;
+      }
+
+      if (t < start)
+        continue;
+      if (t > end)
+        break;
+
+      vl->time = MS_TO_CDTIME_T(t);
+      status = (*result)(ds, vl, arg);
+      if (status != 0)
+        return status;
+    }
+  }
+
+  return 0;
+} /* }}} int wa_series_query */
+
+static int wa_config(oconfig_item_t *ci) /* {{{ */
+{
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+    int status = 0;
+
+    if (strcasecmp("DataDir", child->key) == 0) {
+      status = cf_util_get_string(child, &datadir);
+      if (status == 0) {
+        size_t len = strlen(datadir);
+        while ((len > 0) && (datadir[len - 1] == '/'))
+          datadir[--len] = 0;
+        if (len == 0)
+          sfree(datadir);
+      }
+    } else if (strcasecmp("ChunkSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && ((tmp < 256) || (tmp > (1 << 24)))) {
+        ERROR("write_archive plugin: \"ChunkSize\" must be between 256 and "
+              "16777216.");
+        status = -1;
+      }
+      if (status == 0)
+        chunk_base = (size_t)tmp;
+    } else if (strcasecmp("MaxOpenFiles", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 1)) {
+        ERROR("write_archive plugin: \"MaxOpenFiles\" must be greater than "
+              "zero.");
+        status = -1;
+      }
+      if (status == 0)
+        max_open_files = (size_t)tmp;
+    } else {
+      WARNING("write_archive plugin: Ignoring unknown config option \"%s\".",
+              child->key);
+    }
+
+    if (status != 0)
+      return -1;
+  }
+
+  return 0;
+} /* }}} int wa_config */
+
+static int wa_init(void) /* {{{ */
+{
+  pthread_mutex_lock(&series_lock);
+  if (series == NULL)
+    series = c_avl_create((int (*)(const void *, const void *))strcmp);
+  pthread_mutex_unlock(&series_lock);
+
+  if (series == NULL) {
+    ERROR("write_archive plugin: c_avl_create failed.");
+    return -1;
+  }
+  return 0;
+} /* }}} int wa_init */
+
+static int wa_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
+                    user_data_t __attribute__((unused)) * user_data) {
+  char identifier[6 * DATA_MAX_NAME_LEN];
+
+  if (strcmp(ds->type, vl->type) != 0) {
+    ERROR("write_archive plugin: DS type does not match value list type");
+    return -1;
+  }
+
+  if (FORMAT_VL(identifier, sizeof(identifier), vl) != 0)
+    return -1;
+
+  pthread_mutex_lock(&series_lock);
+  if (series == NULL) {
+    pthread_mutex_unlock(&series_lock);
+    return -1;
+  }
+
+  /* Series are only removed at shutdown, so `s' stays valid. */
+  wa_series_t *s = wa_series_get(identifier, ds);
+  pthread_mutex_unlock(&series_lock);
+  if (s == NULL)
+    return -1;
+
+  int status = wa_series_append(s, ds, vl);
+  pthread_mutex_unlock(&s->lock);
+
+  return status;
+} /* }}} int wa_write */
+
+static int wa_flush(cdtime_t __attribute__((unused)) timeout, /* {{{ */
+                    const char *identifier,
+                    user_data_t __attribute__((unused)) * user_data) {
+  int status = 0;
+
+  pthread_mutex_lock(&series_lock);
+  if (series == NULL) {
+    pthread_mutex_unlock(&series_lock);
+    return 0;
+  }
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(series);
+  char *key;
+  wa_series_t *s;
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&s) == 0) {
+    if ((identifier != NULL) && (strcmp(identifier, key) != 0))
+      continue;
+
+    pthread_mutex_lock(&s->lock);
+    if ((s->map != NULL) && (msync(s->map, s->map_size, MS_ASYNC) != 0)) {
+      char errbuf[1024];
+      ERROR("write_archive plugin: msync (%s) failed: %s", s->filename,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      status = -1;
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+  c_avl_iterator_destroy(iter);
+
+  pthread_mutex_unlock(&series_lock);
+  return status;
+} /* }}} int wa_flush */
+
+static int wa_query(const char *identifier, cdtime_t start, /* {{{ */
+                    cdtime_t end, plugin_query_result_cb result, void *arg,
+                    user_data_t __attribute__((unused)) * user_data) {
+  value_list_t vl = VALUE_LIST_INIT;
+  if (parse_identifier_vl(identifier, &vl) != 0)
+    return EINVAL;
+
+  data_set_t const *ds = plugin_get_ds(vl.type);
+  if (ds == NULL)
+    return ENOENT;
+
+  int64_t start_ms = (int64_t)CDTIME_T_TO_MS(start);
+  int64_t end_ms = (int64_t)CDTIME_T_TO_MS(end);
+
+  pthread_mutex_lock(&series_lock);
+  wa_series_t *s = NULL;
+  if ((series != NULL) && (c_avl_get(series, identifier, (void *)&s) == 0)) {
+    pthread_mutex_lock(&s->lock);
+    pthread_mutex_unlock(&series_lock);
+
+    if (s->map != NULL) {
+      int status = wa_series_query(s, ds, &vl, start_ms, end_ms, result, arg);
+      pthread_mutex_unlock(&s->lock);
+      return status;
+    }
+    pthread_mutex_unlock(&s->lock);
+  } else {
+    pthread_mutex_unlock(&series_lock);
+  }
+
+  /* Not mapped by the writer: read the file directly. */
+  s = wa_series_create(identifier);
+  if (s == NULL)
+    return ENOMEM;
+  if (wa_series_map(s, /* ds = */ NULL) != 0) {
+    wa_series_destroy(s);
+    return ENOENT;
+  }
+
+  int status = wa_series_query(s, ds, &vl, start_ms, end_ms, result, arg);
+  wa_series_destroy(s);
+  return status;
+} /* }}} int wa_query */
+
+static int wa_shutdown(void) /* {{{ */
+{
+  pthread_mutex_lock(&series_lock);
+  if (series != NULL) {
+    char *key;
+    wa_series_t *s;
+    while (c_avl_pick(series, (void *)&key, (void *)&s) == 0) {
+      sfree(key);
+      wa_series_destroy(s);
+    }
+    c_avl_destroy(series);
+    series = NULL;
+    series_head = series_tail = NULL;
+    series_mapped = 0;
+  }
+  pthread_mutex_unlock(&series_lock);
+
+  return 0;
+} /* }}} int wa_shutdown */
+
+void module_register(void) {
+  plugin_register_complex_config("write_archive", wa_config);
+  plugin_register_init("write_archive", wa_init);
+  plugin_register_write("write_archive", wa_write, /* user_data = */ NULL);
+  plugin_register_flush("write_archive", wa_flush, /* user_data = */ NULL);
+  plugin_register_query("write_archive", wa_query, /* user_data = */ NULL);
+  plugin_register_shutdown("write_archive", wa_shutdown);
+} /* void module_register */
@@ -47,10 +47,8 @@
 #include "common.h"
 #include "plugin.h"
 
-#include "utils_complain.h"
 #include "utils_format_graphite.h"
-
-#include <netdb.h>
+#include "utils_line_sender.h"
 
 #ifndef WG_DEFAULT_NODE
 #define WG_DEFAULT_NODE "localhost"
@@ -81,12 +79,22 @@
 #define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T(1)
 #endif
 
+#ifndef WG_DEFAULT_RECONNECT_MAX_INTERVAL
+#define WG_DEFAULT_RECONNECT_MAX_INTERVAL TIME_T_TO_CDTIME_T(60)
+#endif
+
+#ifndef WG_DEFAULT_BUFFER_SIZE
+#define WG_DEFAULT_BUFFER_SIZE (1024 * 1024)
+#endif
+
+#ifndef WG_DEFAULT_SPILL_SIZE
+#define WG_DEFAULT_SPILL_SIZE (64 * 1024 * 1024)
+#endif
+
 /*
  * Private variables
  */
 struct wg_callback {
-  int sock_fd;
-
   char *name;
 
   char *node;
@@ -99,195 +107,22 @@ struct wg_callback {
 
   unsigned int format_flags;
 
-  char send_buf[WG_SEND_BUF_SIZE];
-  size_t send_buf_free;
-  size_t send_buf_fill;
-  cdtime_t send_buf_init_time;
-
-  pthread_mutex_t send_lock;
-  c_complain_t init_complaint;
-  cdtime_t last_connect_time;
-
   /* Force reconnect useful for load balanced environments */
-  cdtime_t last_reconnect_time;
   cdtime_t reconnect_interval;
-  _Bool reconnect_interval_reached;
-};
-
-/* wg_force_reconnect_check closes cb->sock_fd when it was open for longer
- * than cb->reconnect_interval. Must hold cb->send_lock when calling. */
-static void wg_force_reconnect_check(struct wg_callback *cb) {
-  cdtime_t now;
-
-  if (cb->reconnect_interval == 0)
-    return;
-
-  /* check if address changes if addr_timeout */
-  now = cdtime();
-  if ((now - cb->last_reconnect_time) < cb->reconnect_interval)
-    return;
+  cdtime_t reconnect_max_interval;
 
-  /* here we should close connection on next */
-  close(cb->sock_fd);
-  cb->sock_fd = -1;
-  cb->last_reconnect_time = now;
-  cb->reconnect_interval_reached = 1;
+  size_t buffer_size;
+  char *spill_file;
+  size_t spill_size;
 
-  INFO("write_graphite plugin: Connection closed after %.3f seconds.",
-       CDTIME_T_TO_DOUBLE(now - cb->last_reconnect_time));
-}
+  /* Lines are sent by the sender's own thread, so a slow or unreachable
+   * Carbon server does not block the write threads. */
+  line_sender_t *sender;
+};
 
 /*
  * Functions
  */
-static void wg_reset_buffer(struct wg_callback *cb) {
-  memset(cb->send_buf, 0, sizeof(cb->send_buf));
-  cb->send_buf_free = sizeof(cb->send_buf);
-  cb->send_buf_fill = 0;
-  cb->send_buf_init_time = cdtime();
-}
-
-static int wg_send_buffer(struct wg_callback *cb) {
-  ssize_t status;
-
-  if (cb->sock_fd < 0)
-    return -1;
-
-  status = swrite(cb->sock_fd, cb->send_buf, strlen(cb->send_buf));
-  if (status != 0) {
-    if (cb->log_send_errors) {
-      char errbuf[1024];
-      ERROR("write_graphite plugin: send to %s:%s (%s) failed with status %zi "
-            "(%s)",
-            cb->node, cb->service, cb->protocol, status,
-            sstrerror(errno, errbuf, sizeof(errbuf)));
-    }
-
-    close(cb->sock_fd);
-    cb->sock_fd = -1;
-
-    return -1;
-  }
-
-  return 0;
-}
-
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock(cdtime_t timeout, struct wg_callback *cb) {
-  int status;
-
-  DEBUG("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
-        "send_buf_fill = %zu;",
-        (double)timeout, cb->send_buf_fill);
-
-  /* timeout == 0  => flush unconditionally */
-  if (timeout > 0) {
-    cdtime_t now;
-
-    now = cdtime();
-    if ((cb->send_buf_init_time + timeout) > now)
-      return 0;
-  }
-
-  if (cb->send_buf_fill == 0) {
-    cb->send_buf_init_time = cdtime();
-    return 0;
-  }
-
-  status = wg_send_buffer(cb);
-  wg_reset_buffer(cb);
-
-  return status;
-}
-
-static int wg_callback_init(struct wg_callback *cb) {
-  struct addrinfo *ai_list;
-  cdtime_t now;
-  int status;
-
-  char connerr[1024] = "";
-
-  if (cb->sock_fd > 0)
-    return 0;
-
-  /* Don't try to reconnect too often. By default, one reconnection attempt
-   * is made per second. */
-  now = cdtime();
-  if ((now - cb->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
-    return EAGAIN;
-  cb->last_connect_time = now;
-
-  struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
-                              .ai_flags = AI_ADDRCONFIG};
-
-  if (0 == strcasecmp("tcp", cb->protocol))
-    ai_hints.ai_socktype = SOCK_STREAM;
-  else
-    ai_hints.ai_socktype = SOCK_DGRAM;
-
-  status = getaddrinfo(cb->node, cb->service, &ai_hints, &ai_list);
-  if (status != 0) {
-    ERROR("write_graphite plugin: getaddrinfo (%s, %s, %s) failed: %s",
-          cb->node, cb->service, cb->protocol, gai_strerror(status));
-    return -1;
-  }
-
-  assert(ai_list != NULL);
-  for (struct addrinfo *ai_ptr = ai_list; ai_ptr != NULL;
-       ai_ptr = ai_ptr->ai_next) {
-    cb->sock_fd =
-        socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
-    if (cb->sock_fd < 0) {
-      char errbuf[1024];
-      snprintf(connerr, sizeof(connerr), "failed to open socket: %s",
-               sstrerror(errno, errbuf, sizeof(errbuf)));
-      continue;
-    }
-
-    set_sock_opts(cb->sock_fd);
-
-    status = connect(cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
-    if (status != 0) {
-      char errbuf[1024];
-      snprintf(connerr, sizeof(connerr), "failed to connect to remote "
-                                         "host: %s",
-               sstrerror(errno, errbuf, sizeof(errbuf)));
-      close(cb->sock_fd);
-      cb->sock_fd = -1;
-      continue;
-    }
-
-    break;
-  }
-
-  freeaddrinfo(ai_list);
-
-  if (cb->sock_fd < 0) {
-    if (connerr[0] == '\0')
-      /* this should not happen but try to get a message anyway */
-      sstrerror(errno, connerr, sizeof(connerr));
-    c_complain(LOG_ERR, &cb->init_complaint,
-               "write_graphite plugin: Connecting to %s:%s via %s failed. "
-               "The last error was: %s",
-               cb->node, cb->service, cb->protocol, connerr);
-    return -1;
-  } else {
-    c_release(LOG_INFO, &cb->init_complaint,
-              "write_graphite plugin: Successfully connected to %s:%s via %s.",
-              cb->node, cb->service, cb->protocol);
-  }
-
-  /* wg_force_reconnect_check does not flush the buffer before closing a
-   * sending socket, so only call wg_reset_buffer() if the socket was closed
-   * for a different reason (tracked in cb->reconnect_interval_reached). */
-  if (!cb->reconnect_interval_reached || (cb->send_buf_free == 0))
-    wg_reset_buffer(cb);
-  else
-    cb->reconnect_interval_reached = 0;
-
-  return 0;
-}
-
 static void wg_callback_free(void *data) {
   struct wg_callback *cb;
 
@@ -296,14 +131,8 @@ static void wg_callback_free(void *data) {
 
   cb = data;
 
-  pthread_mutex_lock(&cb->send_lock);
-
-  wg_flush_nolock(/* timeout = */ 0, cb);
-
-  if (cb->sock_fd >= 0) {
-    close(cb->sock_fd);
-    cb->sock_fd = -1;
-  }
+  /* Sends what is still queued, if the server is reachable. */
+  line_sender_destroy(cb->sender);
 
   sfree(cb->name);
   sfree(cb->node);
@@ -311,9 +140,7 @@ static void wg_callback_free(void *data) {
   sfree(cb->service);
   sfree(cb->prefix);
   sfree(cb->postfix);
-
-  pthread_mutex_unlock(&cb->send_lock);
-  pthread_mutex_destroy(&cb->send_lock);
+  sfree(cb->spill_file);
 
   sfree(cb);
 }
@@ -322,75 +149,13 @@ static int wg_flush(cdtime_t timeout,
                     const char *identifier __attribute__((unused)),
                     user_data_t *user_data) {
   struct wg_callback *cb;
-  int status;
 
   if (user_data == NULL)
     return -EINVAL;
 
   cb = user_data->data;
 
-  pthread_mutex_lock(&cb->send_lock);
-
-  if (cb->sock_fd < 0) {
-    status = wg_callback_init(cb);
-    if (status != 0) {
-      /* An error message has already been printed. */
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
-    }
-  }
-
-  status = wg_flush_nolock(timeout, cb);
-  pthread_mutex_unlock(&cb->send_lock);
-
-  return status;
-}
-
-static int wg_send_message(char const *message, struct wg_callback *cb) {
-  int status;
-  size_t message_len;
-
-  message_len = strlen(message);
-
-  pthread_mutex_lock(&cb->send_lock);
-
-  wg_force_reconnect_check(cb);
-
-  if (cb->sock_fd < 0) {
-    status = wg_callback_init(cb);
-    if (status != 0) {
-      /* An error message has already been printed. */
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
-    }
-  }
-
-  if (message_len >= cb->send_buf_free) {
-    status = wg_flush_nolock(/* timeout = */ 0, cb);
-    if (status != 0) {
-      pthread_mutex_unlock(&cb->send_lock);
-      return status;
-    }
-  }
-
-  /* Assert that we have enough space for this message. */
-  assert(message_len < cb->send_buf_free);
-
-  /* `message_len + 1' because `message_len' does not include the
-   * trailing null byte. Neither does `send_buffer_fill'. */
-  memcpy(cb->send_buf + cb->send_buf_fill, message, message_len + 1);
-  cb->send_buf_fill += message_len;
-  cb->send_buf_free -= message_len;
-
-  DEBUG("write_graphite plugin: [%s]:%s (%s) buf %zu/%zu (%.1f %%) \"%s\"",
-        cb->node, cb->service, cb->protocol, cb->send_buf_fill,
-        sizeof(cb->send_buf),
-        100.0 * ((double)cb->send_buf_fill) / ((double)sizeof(cb->send_buf)),
-        message);
-
-  pthread_mutex_unlock(&cb->send_lock);
-
-  return 0;
+  return line_sender_flush(cb->sender, timeout);
 }
 
 static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
@@ -409,9 +174,10 @@ static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
   if (status != 0) /* error message has been printed already. */
     return status;
 
-  /* Send the message to graphite */
-  status = wg_send_message(buffer, cb);
-  if (status != 0) /* error message has been printed already. */
+  /* Queue the message for graphite. If the queue is full, the sender
+   * complains about the dropped data. */
+  status = line_sender_enqueue(cb->sender, buffer, strlen(buffer));
+  if (status != 0)
     return status;
 
   return 0;
@@ -457,6 +223,24 @@ static int config_set_char(char *dest, oconfig_item_t *ci) {
   return 0;
 }
 
+static int wg_config_size(oconfig_item_t *ci, size_t *ret_size) {
+  int size = 0;
+  int status;
+
+  status = cf_util_get_int(ci, &size);
+  if (status != 0)
+    return status;
+
+  if (size < WG_SEND_BUF_SIZE) {
+    ERROR("write_graphite plugin: The \"%s\" option must be at least %d.",
+          ci->key, WG_SEND_BUF_SIZE);
+    return -1;
+  }
+
+  *ret_size = (size_t)size;
+  return 0;
+}
+
 static int wg_config_node(oconfig_item_t *ci) {
   struct wg_callback *cb;
   char callback_name[DATA_MAX_NAME_LEN];
@@ -467,14 +251,15 @@ static int wg_config_node(oconfig_item_t *ci) {
     ERROR("write_graphite plugin: calloc failed.");
     return -1;
   }
-  cb->sock_fd = -1;
   cb->name = NULL;
   cb->node = strdup(WG_DEFAULT_NODE);
   cb->service = strdup(WG_DEFAULT_SERVICE);
   cb->protocol = strdup(WG_DEFAULT_PROTOCOL);
-  cb->last_reconnect_time = cdtime();
   cb->reconnect_interval = 0;
-  cb->reconnect_interval_reached = 0;
+  cb->reconnect_max_interval = WG_DEFAULT_RECONNECT_MAX_INTERVAL;
+  cb->buffer_size = WG_DEFAULT_BUFFER_SIZE;
+  cb->spill_file = NULL;
+  cb->spill_size = WG_DEFAULT_SPILL_SIZE;
   cb->log_send_errors = WG_DEFAULT_LOG_SEND_ERRORS;
   cb->prefix = NULL;
   cb->postfix = NULL;
@@ -490,9 +275,6 @@ static int wg_config_node(oconfig_item_t *ci) {
     }
   }
 
-  pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
-  C_COMPLAIN_INIT(&cb->init_complaint);
-
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
 
@@ -510,6 +292,14 @@ static int wg_config_node(oconfig_item_t *ci) {
       }
     } else if (strcasecmp("ReconnectInterval", child->key) == 0)
       cf_util_get_cdtime(child, &cb->reconnect_interval);
+    else if (strcasecmp("ReconnectMaxInterval", child->key) == 0)
+      cf_util_get_cdtime(child, &cb->reconnect_max_interval);
+    else if (strcasecmp("BufferSize", child->key) == 0)
+      status = wg_config_size(child, &cb->buffer_size);
+    else if (strcasecmp("SpillFile", child->key) == 0)
+      cf_util_get_string(child, &cb->spill_file);
+    else if (strcasecmp("SpillSize", child->key) == 0)
+      status = wg_config_size(child, &cb->spill_size);
     else if (strcasecmp("LogSendErrors", child->key) == 0)
       cf_util_get_boolean(child, &cb->log_send_errors);
     else if (strcasecmp("Prefix", child->key) == 0)
@@ -552,6 +342,30 @@ static int wg_config_node(oconfig_item_t *ci) {
     snprintf(callback_name, sizeof(callback_name), "write_graphite/%s",
              cb->name);
 
+  line_sender_options_t opts = LINE_SENDER_OPTIONS_INIT;
+  opts.log_prefix = "write_graphite plugin";
+  opts.thread_name = "write_graphite";
+  opts.node = cb->node;
+  opts.service = cb->service;
+  opts.socktype =
+      (strcasecmp("TCP", cb->protocol) == 0) ? SOCK_STREAM : SOCK_DGRAM;
+  opts.queue_size = cb->buffer_size;
+  opts.spill_file = cb->spill_file;
+  opts.spill_size = cb->spill_size;
+  opts.send_threshold = WG_SEND_BUF_SIZE;
+  opts.reconnect_min = WG_MIN_RECONNECT_INTERVAL;
+  opts.reconnect_max = cb->reconnect_max_interval;
+  opts.reconnect_interval = cb->reconnect_interval;
+  opts.log_send_errors = cb->log_send_errors;
+
+  cb->sender = line_sender_create(&opts);
+  if (cb->sender == NULL) {
+    ERROR("write_graphite plugin: Creating the sender for %s failed.",
+          callback_name);
+    wg_callback_free(cb);
+    return -1;
+  }
+
   plugin_register_write(callback_name, wg_write,
                         &(user_data_t){
                             .data = cb, .free_func = wg_callback_free,
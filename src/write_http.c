@@ -27,10 +27,14 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_complain.h"
 #include "utils_format_json.h"
 #include "utils_format_kairosdb.h"
 
 #include <curl/curl.h>
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #ifndef WRITE_HTTP_DEFAULT_BUFFER_SIZE
 #define WRITE_HTTP_DEFAULT_BUFFER_SIZE 4096
@@ -40,9 +44,48 @@
 #define WRITE_HTTP_DEFAULT_PREFIX "collectd"
 #endif
 
+#ifndef WRITE_HTTP_DEFAULT_QUEUE_SIZE
+#define WRITE_HTTP_DEFAULT_QUEUE_SIZE 64
+#endif
+
+#ifndef WRITE_HTTP_DEFAULT_MAX_RETRIES
+#define WRITE_HTTP_DEFAULT_MAX_RETRIES 3
+#endif
+
+/* Upper bound for the delay between two attempts to send a batch. */
+#define WRITE_HTTP_MAX_BACKOFF TIME_T_TO_CDTIME_T_STATIC(60)
+
 /*
  * Private variables
  */
+/* A formatted request body waiting to be sent. Batches are recycled through
+ * the callback's free list, including their buffers. */
+struct wh_batch_s {
+  char *data;
+  size_t size;
+  size_t len;
+
+  /* Compressed copy of `data', created when the batch is first sent. */
+  uint8_t *zdata;
+  size_t zsize;
+  size_t zlen;
+
+  int retries;
+  cdtime_t next_try;
+
+  struct wh_batch_s *next;
+};
+typedef struct wh_batch_s wh_batch_t;
+
+/* One easy handle of the sender thread. The handles are kept for the lifetime
+ * of the callback, so connections to the server are reused. */
+struct wh_request_s {
+  CURL *curl;
+  wh_batch_t *batch; /* NULL if idle */
+  char curl_errbuf[CURL_ERROR_SIZE];
+};
+typedef struct wh_request_s wh_request_t;
+
 struct wh_callback_s {
   char *name;
 
@@ -71,9 +114,15 @@ struct wh_callback_s {
   _Bool send_metrics;
   _Bool send_notifications;
 
-  CURL *curl;
+#define WH_COMPRESS_NONE 0
+#define WH_COMPRESS_GZIP 1
+#define WH_COMPRESS_DEFLATE 2
+  int compression;
+
   struct curl_slist *headers;
-  char curl_errbuf[CURL_ERROR_SIZE];
+  /* `headers' followed by the headers implied by `format' and
+   * `compression'. Created by wh_callback_init(). */
+  struct curl_slist *request_headers;
 
   char *send_buffer;
   size_t send_buffer_size;
@@ -85,19 +134,41 @@ struct wh_callback_s {
 
   int data_ttl;
   char *metrics_prefix;
+
+  /* Full buffers are handed to the sender thread through `queue_head', so
+   * the write threads never wait for the server. The queue holds at most
+   * `queue_size' batches; when it is full, the oldest batch is dropped. */
+  wh_batch_t *queue_head;
+  wh_batch_t *queue_tail;
+  size_t queue_len;
+  int queue_size;
+  wh_batch_t *free_batches;
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  c_complain_t queue_complaint;
+
+  int max_retries;
+
+  CURLM *multi;
+  wh_request_t *requests;
+  int requests_num;
+
+  pthread_t sender_thread;
+  _Bool sender_running;
+  _Bool sender_stop;
 };
 typedef struct wh_callback_s wh_callback_t;
 
 static char **http_attrs;
 static size_t http_attrs_num;
 
-static void wh_log_http_error(wh_callback_t *cb) {
+static void wh_log_http_error(wh_callback_t *cb, CURL *curl) {
   if (!cb->log_http_error)
     return;
 
   long http_code = 0;
 
-  curl_easy_getinfo(cb->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 
   if (http_code != 200)
     INFO("write_http plugin: HTTP Error code: %lu", http_code);
@@ -119,70 +190,483 @@ static void wh_reset_buffer(wh_callback_t *cb) /* {{{ */
   }
 } /* }}} wh_reset_buffer */
 
-/* must hold cb->send_lock when calling */
-static int wh_post_nolock(wh_callback_t *cb, char const *data) /* {{{ */
+static void wh_batch_free(wh_batch_t *b) /* {{{ */
 {
-  int status = 0;
+  while (b != NULL) {
+    wh_batch_t *next = b->next;
 
-  curl_easy_setopt(cb->curl, CURLOPT_URL, cb->location);
-  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDS, data);
-  status = curl_easy_perform(cb->curl);
+    sfree(b->data);
+    sfree(b->zdata);
+    sfree(b);
 
-  wh_log_http_error(cb);
+    b = next;
+  }
+} /* }}} void wh_batch_free */
+
+/* Returns an unused batch with room for at least `size' bytes. If all batches
+ * are queued and the queue is full, the oldest one is dropped and reused.
+ * Must hold cb->queue_lock when calling. */
+static wh_batch_t *wh_batch_get_nolock(wh_callback_t *cb, /* {{{ */
+                                       size_t size) {
+  wh_batch_t *b = cb->free_batches;
+
+  if (b != NULL) {
+    cb->free_batches = b->next;
+  } else if ((cb->queue_len >= (size_t)cb->queue_size) &&
+             (cb->queue_head != NULL)) {
+    b = cb->queue_head;
+    cb->queue_head = b->next;
+    if (cb->queue_head == NULL)
+      cb->queue_tail = NULL;
+    cb->queue_len--;
+
+    c_complain(LOG_WARNING, &cb->queue_complaint,
+               "write_http plugin: The send queue of \"%s\" is full, "
+               "dropping data. Is the server at %s slow or unavailable?",
+               cb->name, cb->location);
+  } else {
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+      return NULL;
+  }
 
-  if (status != CURLE_OK) {
-    ERROR("write_http plugin: curl_easy_perform failed with "
-          "status %i: %s",
-          status, cb->curl_errbuf);
+  if (b->size < size) {
+    char *tmp = realloc(b->data, size);
+    if (tmp == NULL) {
+      wh_batch_free(b);
+      return NULL;
+    }
+    b->data = tmp;
+    b->size = size;
   }
-  return status;
-} /* }}} wh_post_nolock */
 
-static int wh_callback_init(wh_callback_t *cb) /* {{{ */
+  b->len = 0;
+  b->zlen = 0;
+  b->retries = 0;
+  b->next_try = 0;
+  b->next = NULL;
+  return b;
+} /* }}} wh_batch_t *wh_batch_get_nolock */
+
+/* Must hold cb->queue_lock when calling. */
+static void wh_batch_enqueue_nolock(wh_callback_t *cb, /* {{{ */
+                                    wh_batch_t *b) {
+  b->next = NULL;
+  if (cb->queue_tail == NULL)
+    cb->queue_head = b;
+  else
+    cb->queue_tail->next = b;
+  cb->queue_tail = b;
+  cb->queue_len++;
+
+  if (cb->queue_len < (size_t)cb->queue_size)
+    c_release(LOG_INFO, &cb->queue_complaint,
+              "write_http plugin: The send queue of \"%s\" has room again.",
+              cb->name);
+  pthread_cond_signal(&cb->queue_cond);
+} /* }}} void wh_batch_enqueue_nolock */
+
+/* Hands the content of the send buffer to the sender thread. The buffer is
+ * swapped with the (empty) buffer of a recycled batch rather than copied.
+ * Must hold cb->send_lock when calling. */
+static int wh_enqueue_buffer_nolock(wh_callback_t *cb) /* {{{ */
 {
-  if (cb->curl != NULL)
-    return 0;
+  pthread_mutex_lock(&cb->queue_lock);
 
-  cb->curl = curl_easy_init();
-  if (cb->curl == NULL) {
-    ERROR("curl plugin: curl_easy_init failed.");
+  wh_batch_t *b = wh_batch_get_nolock(cb, cb->send_buffer_size);
+  if (b == NULL) {
+    pthread_mutex_unlock(&cb->queue_lock);
+    ERROR("write_http plugin: Allocating a batch failed.");
+    return ENOMEM;
+  }
+
+  char *data = b->data;
+  size_t size = b->size;
+
+  b->data = cb->send_buffer;
+  b->size = cb->send_buffer_size;
+  b->len = cb->send_buffer_fill;
+
+  cb->send_buffer = data;
+  cb->send_buffer_size = size;
+
+  wh_batch_enqueue_nolock(cb, b);
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  return 0;
+} /* }}} int wh_enqueue_buffer_nolock */
+
+static int wh_enqueue_string(wh_callback_t *cb, char const *data) /* {{{ */
+{
+  size_t len = strlen(data);
+
+  pthread_mutex_lock(&cb->queue_lock);
+
+  wh_batch_t *b = wh_batch_get_nolock(
+      cb, (len + 1 > cb->send_buffer_size) ? len + 1 : cb->send_buffer_size);
+  if (b == NULL) {
+    pthread_mutex_unlock(&cb->queue_lock);
+    ERROR("write_http plugin: Allocating a batch failed.");
+    return ENOMEM;
+  }
+
+  memcpy(b->data, data, len + 1);
+  b->len = len;
+
+  wh_batch_enqueue_nolock(cb, b);
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  return 0;
+} /* }}} int wh_enqueue_string */
+
+#if HAVE_LIBZ
+/* Compresses the batch's data into `zdata' using the configured encoding. */
+static int wh_compress(wh_callback_t *cb, wh_batch_t *b) /* {{{ */
+{
+  z_stream z = {0};
+
+  /* 16 added to the window bits selects the gzip instead of the zlib format,
+   * which is what HTTP calls "deflate". */
+  int window_bits = (cb->compression == WH_COMPRESS_GZIP) ? 15 + 16 : 15;
+  int status = deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits,
+                            /* memLevel = */ 8, Z_DEFAULT_STRATEGY);
+  if (status != Z_OK)
     return -1;
+
+  size_t size = (size_t)deflateBound(&z, (uLong)b->len);
+  if (b->zsize < size) {
+    uint8_t *tmp = realloc(b->zdata, size);
+    if (tmp == NULL) {
+      deflateEnd(&z);
+      return ENOMEM;
+    }
+    b->zdata = tmp;
+    b->zsize = size;
+  }
+
+  z.next_in = (Bytef *)b->data;
+  z.avail_in = (uInt)b->len;
+  z.next_out = b->zdata;
+  z.avail_out = (uInt)b->zsize;
+
+  status = deflate(&z, Z_FINISH);
+  deflateEnd(&z);
+  if (status != Z_STREAM_END)
+    return -1;
+
+  b->zlen = b->zsize - z.avail_out;
+  return 0;
+} /* }}} int wh_compress */
+#endif /* HAVE_LIBZ */
+
+static CURL *wh_curl_create(wh_callback_t *cb, char *errbuf) /* {{{ */
+{
+  CURL *curl = curl_easy_init();
+  if (curl == NULL) {
+    ERROR("curl plugin: curl_easy_init failed.");
+    return NULL;
   }
 
   if (cb->low_speed_limit > 0 && cb->low_speed_time > 0) {
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_LIMIT,
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT,
                      (long)(cb->low_speed_limit * cb->low_speed_time));
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_TIME,
-                     (long)cb->low_speed_time);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)cb->low_speed_time);
   }
 
 #ifdef HAVE_CURLOPT_TIMEOUT_MS
   if (cb->timeout > 0)
-    curl_easy_setopt(cb->curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
 #endif
 
-  curl_easy_setopt(cb->curl, CURLOPT_NOSIGNAL, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
-
-  cb->headers = curl_slist_append(cb->headers, "Accept:  */*");
-  if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
-    cb->headers =
-        curl_slist_append(cb->headers, "Content-Type: application/json");
-  else
-    cb->headers = curl_slist_append(cb->headers, "Content-Type: text/plain");
-  cb->headers = curl_slist_append(cb->headers, "Expect:");
-  curl_easy_setopt(cb->curl, CURLOPT_HTTPHEADER, cb->headers);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(curl, CURLOPT_URL, cb->location);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, cb->request_headers);
 
-  curl_easy_setopt(cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
-  curl_easy_setopt(cb->curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_MAXREDIRS, 50L);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 50L);
 
   if (cb->user != NULL) {
 #ifdef HAVE_CURLOPT_USERNAME
-    curl_easy_setopt(cb->curl, CURLOPT_USERNAME, cb->user);
-    curl_easy_setopt(cb->curl, CURLOPT_PASSWORD,
+    curl_easy_setopt(curl, CURLOPT_USERNAME, cb->user);
+    curl_easy_setopt(curl, CURLOPT_PASSWORD,
                      (cb->pass == NULL) ? "" : cb->pass);
 #else
+    curl_easy_setopt(curl, CURLOPT_USERPWD, cb->credentials);
+#endif
+    curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+  }
+
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
+  curl_easy_setopt(curl, CURLOPT_SSLVERSION, cb->sslversion);
+  if (cb->cacert != NULL)
+    curl_easy_setopt(curl, CURLOPT_CAINFO, cb->cacert);
+  if (cb->capath != NULL)
+    curl_easy_setopt(curl, CURLOPT_CAPATH, cb->capath);
+
+  if (cb->clientkey != NULL && cb->clientcert != NULL) {
+    curl_easy_setopt(curl, CURLOPT_SSLKEY, cb->clientkey);
+    curl_easy_setopt(curl, CURLOPT_SSLCERT, cb->clientcert);
+
+    if (cb->clientkeypass != NULL)
+      curl_easy_setopt(curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+  }
+
+  return curl;
+} /* }}} CURL *wh_curl_create */
+
+/* Called by the sender thread when a request has finished or could not be
+ * started. Failed batches are put back at the head of the queue to keep the
+ * order and are retried with an exponentially growing delay. */
+static void wh_request_done(wh_callback_t *cb, wh_request_t *r, /* {{{ */
+                            _Bool success) {
+  wh_batch_t *b = r->batch;
+  r->batch = NULL;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  if (success || cb->sender_stop || (b->retries >= cb->max_retries)) {
+    if (!success)
+      ERROR("write_http plugin: Giving up sending %zu bytes to %s after %d "
+            "attempt(s).",
+            b->len, cb->location, b->retries + 1);
+
+    b->next = cb->free_batches;
+    cb->free_batches = b;
+  } else {
+    cdtime_t backoff = WRITE_HTTP_MAX_BACKOFF;
+    if (b->retries < 6)
+      backoff = TIME_T_TO_CDTIME_T_STATIC(1) << b->retries;
+    if (backoff > WRITE_HTTP_MAX_BACKOFF)
+      backoff = WRITE_HTTP_MAX_BACKOFF;
+
+    b->retries++;
+    b->next_try = cdtime() + backoff;
+
+    b->next = cb->queue_head;
+    cb->queue_head = b;
+    if (cb->queue_tail == NULL)
+      cb->queue_tail = b;
+    cb->queue_len++;
+  }
+  pthread_mutex_unlock(&cb->queue_lock);
+} /* }}} void wh_request_done */
+
+static void wh_request_start(wh_callback_t *cb, wh_request_t *r) /* {{{ */
+{
+  wh_batch_t *b = r->batch;
+  void const *data = b->data;
+  size_t len = b->len;
+
+#if HAVE_LIBZ
+  if (cb->compression != WH_COMPRESS_NONE) {
+    if ((b->zlen == 0) && (wh_compress(cb, b) != 0)) {
+      ERROR("write_http plugin: Compressing %zu bytes failed.", b->len);
+      wh_request_done(cb, r, /* success = */ 0);
+      return;
+    }
+    data = b->zdata;
+    len = b->zlen;
+  }
+#endif
+
+  r->curl_errbuf[0] = 0;
+  curl_easy_setopt(r->curl, CURLOPT_POSTFIELDSIZE, (long)len);
+  curl_easy_setopt(r->curl, CURLOPT_POSTFIELDS, data);
+
+  CURLMcode status = curl_multi_add_handle(cb->multi, r->curl);
+  if (status != CURLM_OK) {
+    ERROR("write_http plugin: curl_multi_add_handle failed: %s",
+          curl_multi_strerror(status));
+    wh_request_done(cb, r, /* success = */ 0);
+  }
+} /* }}} void wh_request_start */
+
+/* Collects the requests finished by curl_multi_perform(). Returns the number
+ * of finished requests. */
+static int wh_requests_collect(wh_callback_t *cb) /* {{{ */
+{
+  CURLMsg *msg;
+  int msgs_left;
+  int done = 0;
+
+  while ((msg = curl_multi_info_read(cb->multi, &msgs_left)) != NULL) {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    wh_request_t *r = NULL;
+    CURLcode result = msg->data.result;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&r);
+    curl_multi_remove_handle(cb->multi, msg->easy_handle);
+
+    long http_code = 0;
+    curl_easy_getinfo(r->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    wh_log_http_error(cb, r->curl);
+
+    _Bool success = 1;
+    if (result != CURLE_OK) {
+      ERROR("write_http plugin: curl_easy_perform failed with "
+            "status %i: %s",
+            result, r->curl_errbuf);
+      success = 0;
+    } else if ((http_code >= 500) || (http_code == 429)) {
+      /* The server is (temporarily) unable to handle the request. Other
+       * errors would not go away by sending the same data again. */
+      success = 0;
+    }
+
+    wh_request_done(cb, r, success);
+    done++;
+  }
+
+  return done;
+} /* }}} int wh_requests_collect */
+
+static void *wh_sender_thread(void *arg) /* {{{ */
+{
+  wh_callback_t *cb = arg;
+  int active = 0;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  while (42) {
+    cdtime_t now = cdtime();
+
+    /* Start sending the queued batches that are due on all idle handles. */
+    for (int i = 0; (i < cb->requests_num) && (cb->queue_head != NULL); i++) {
+      wh_request_t *r = cb->requests + i;
+      wh_batch_t *b = cb->queue_head;
+
+      if (r->batch != NULL)
+        continue;
+      if (!cb->sender_stop && (b->next_try > now))
+        break;
+
+      cb->queue_head = b->next;
+      if (cb->queue_head == NULL)
+        cb->queue_tail = NULL;
+      cb->queue_len--;
+      r->batch = b;
+
+      pthread_mutex_unlock(&cb->queue_lock);
+      wh_request_start(cb, r);
+      pthread_mutex_lock(&cb->queue_lock);
+      if (r->batch != NULL)
+        active++;
+    }
+
+    if (active == 0) {
+      if (cb->queue_head == NULL) {
+        /* All data is sent before the thread exits. */
+        if (cb->sender_stop)
+          break;
+        pthread_cond_wait(&cb->queue_cond, &cb->queue_lock);
+      } else if (!cb->sender_stop) {
+        /* Wait for the backoff of the first batch to expire. */
+        struct timespec ts = CDTIME_T_TO_TIMESPEC(cb->queue_head->next_try);
+        pthread_cond_timedwait(&cb->queue_cond, &cb->queue_lock, &ts);
+      }
+      continue;
+    }
+
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    int running = 0;
+    curl_multi_perform(cb->multi, &running);
+    active -= wh_requests_collect(cb);
+    if (running > 0)
+      curl_multi_wait(cb->multi, /* extra_fds = */ NULL, 0,
+                      /* timeout_ms = */ 100, /* numfds = */ NULL);
+
+    pthread_mutex_lock(&cb->queue_lock);
+  } /* while (42) */
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  return NULL;
+} /* }}} void *wh_sender_thread */
+
+static int wh_headers_append(struct curl_slist **headers, /* {{{ */
+                             char const *header) {
+  struct curl_slist *temp = curl_slist_append(*headers, header);
+  if (temp == NULL)
+    return -1;
+
+  *headers = temp;
+  return 0;
+} /* }}} int wh_headers_append */
+
+/* Creates the list of headers sent with each request. */
+static struct curl_slist *wh_headers_create(wh_callback_t const *cb) /* {{{ */
+{
+  char const *defaults[4];
+  size_t defaults_num = 0;
+
+  defaults[defaults_num++] = "Accept:  */*";
+  if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
+    defaults[defaults_num++] = "Content-Type: application/json";
+  else
+    defaults[defaults_num++] = "Content-Type: text/plain";
+  if (cb->compression == WH_COMPRESS_GZIP)
+    defaults[defaults_num++] = "Content-Encoding: gzip";
+  else if (cb->compression == WH_COMPRESS_DEFLATE)
+    defaults[defaults_num++] = "Content-Encoding: deflate";
+  defaults[defaults_num++] = "Expect:";
+
+  struct curl_slist *headers = NULL;
+  int status = 0;
+  for (struct curl_slist *h = cb->headers; (h != NULL) && (status == 0);
+       h = h->next)
+    status = wh_headers_append(&headers, h->data);
+  for (size_t i = 0; (i < defaults_num) && (status == 0); i++)
+    status = wh_headers_append(&headers, defaults[i]);
+
+  if (status != 0) {
+    curl_slist_free_all(headers);
+    return NULL;
+  }
+
+  return headers;
+} /* }}} struct curl_slist *wh_headers_create */
+
+/* Frees everything created by wh_callback_init(). The sender thread must not
+ * be running. */
+static void wh_callback_deinit(wh_callback_t *cb) /* {{{ */
+{
+  for (int i = 0; (cb->requests != NULL) && (i < cb->requests_num); i++) {
+    if (cb->requests[i].curl != NULL)
+      curl_easy_cleanup(cb->requests[i].curl);
+  }
+  sfree(cb->requests);
+
+  if (cb->multi != NULL) {
+    curl_multi_cleanup(cb->multi);
+    cb->multi = NULL;
+  }
+
+  if (cb->request_headers != NULL) {
+    curl_slist_free_all(cb->request_headers);
+    cb->request_headers = NULL;
+  }
+
+  sfree(cb->credentials);
+} /* }}} void wh_callback_deinit */
+
+/* Creates the curl handles and starts the sender thread. Must hold
+ * cb->send_lock when calling. On failure, everything created so far is freed
+ * again, so the next call starts over. */
+static int wh_callback_init(wh_callback_t *cb) /* {{{ */
+{
+  if (cb->multi != NULL)
+    return 0;
+
+  cb->request_headers = wh_headers_create(cb);
+  if (cb->request_headers == NULL) {
+    ERROR("write_http plugin: Creating the request headers failed.");
+    return -1;
+  }
+
+#ifndef HAVE_CURLOPT_USERNAME
+  if (cb->user != NULL) {
     size_t credentials_size;
 
     credentials_size = strlen(cb->user) + 2;
@@ -192,37 +676,55 @@ static int wh_callback_init(wh_callback_t *cb) /* {{{ */
     cb->credentials = malloc(credentials_size);
     if (cb->credentials == NULL) {
       ERROR("curl plugin: malloc failed.");
+      wh_callback_deinit(cb);
       return -1;
     }
 
     snprintf(cb->credentials, credentials_size, "%s:%s", cb->user,
              (cb->pass == NULL) ? "" : cb->pass);
-    curl_easy_setopt(cb->curl, CURLOPT_USERPWD, cb->credentials);
+  }
 #endif
-    curl_easy_setopt(cb->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+
+  cb->requests = calloc(cb->requests_num, sizeof(*cb->requests));
+  if (cb->requests == NULL) {
+    ERROR("write_http plugin: calloc failed.");
+    wh_callback_deinit(cb);
+    return -1;
   }
 
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
-  curl_easy_setopt(cb->curl, CURLOPT_SSLVERSION, cb->sslversion);
-  if (cb->cacert != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAINFO, cb->cacert);
-  if (cb->capath != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAPATH, cb->capath);
+  for (int i = 0; i < cb->requests_num; i++) {
+    wh_request_t *r = cb->requests + i;
 
-  if (cb->clientkey != NULL && cb->clientcert != NULL) {
-    curl_easy_setopt(cb->curl, CURLOPT_SSLKEY, cb->clientkey);
-    curl_easy_setopt(cb->curl, CURLOPT_SSLCERT, cb->clientcert);
+    r->curl = wh_curl_create(cb, r->curl_errbuf);
+    if (r->curl == NULL) {
+      wh_callback_deinit(cb);
+      return -1;
+    }
+    curl_easy_setopt(r->curl, CURLOPT_PRIVATE, r);
+  }
 
-    if (cb->clientkeypass != NULL)
-      curl_easy_setopt(cb->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+  cb->multi = curl_multi_init();
+  if (cb->multi == NULL) {
+    ERROR("write_http plugin: curl_multi_init failed.");
+    wh_callback_deinit(cb);
+    return -1;
+  }
+
+  int status = plugin_thread_create(&cb->sender_thread, /* attr = */ NULL,
+                                    wh_sender_thread, cb, "write_http send");
+  if (status != 0) {
+    ERROR("write_http plugin: Starting the sender thread failed.");
+    wh_callback_deinit(cb);
+    return -1;
   }
+  cb->sender_running = 1;
 
   wh_reset_buffer(cb);
 
   return 0;
 } /* }}} int wh_callback_init */
 
+/* must hold cb->send_lock when calling */
 static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
 {
   int status;
@@ -246,7 +748,7 @@ static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
       return 0;
     }
 
-    status = wh_post_nolock(cb, cb->send_buffer);
+    status = wh_enqueue_buffer_nolock(cb);
     wh_reset_buffer(cb);
   } else if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB) {
     if (cb->send_buffer_fill <= 2) {
@@ -263,7 +765,7 @@ static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
       return status;
     }
 
-    status = wh_post_nolock(cb, cb->send_buffer);
+    status = wh_enqueue_buffer_nolock(cb);
     wh_reset_buffer(cb);
   } else {
     ERROR("write_http: wh_flush_nolock: "
@@ -312,21 +814,34 @@ static void wh_callback_free(void *data) /* {{{ */
   if (cb->send_buffer != NULL)
     wh_flush_nolock(/* timeout = */ 0, cb);
 
-  if (cb->curl != NULL) {
-    curl_easy_cleanup(cb->curl);
-    cb->curl = NULL;
+  /* The sender thread sends everything still queued before exiting, without
+   * retrying failed requests. */
+  if (cb->sender_running) {
+    pthread_mutex_lock(&cb->queue_lock);
+    cb->sender_stop = 1;
+    pthread_cond_signal(&cb->queue_cond);
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    pthread_join(cb->sender_thread, /* retval = */ NULL);
+    cb->sender_running = 0;
   }
 
+  wh_callback_deinit(cb);
+
   if (cb->headers != NULL) {
     curl_slist_free_all(cb->headers);
     cb->headers = NULL;
   }
 
+  wh_batch_free(cb->queue_head);
+  wh_batch_free(cb->free_batches);
+  pthread_mutex_destroy(&cb->queue_lock);
+  pthread_cond_destroy(&cb->queue_cond);
+
   sfree(cb->name);
   sfree(cb->location);
   sfree(cb->user);
   sfree(cb->pass);
-  sfree(cb->credentials);
   sfree(cb->cacert);
   sfree(cb->capath);
   sfree(cb->clientkey);
@@ -469,14 +984,10 @@ static int wh_write_kairosdb(const data_set_t *ds,
   int status;
 
   pthread_mutex_lock(&cb->send_lock);
-
-  if (cb->curl == NULL) {
-    status = wh_callback_init(cb);
-    if (status != 0) {
-      ERROR("write_http plugin: wh_callback_init failed.");
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
-    }
+  if (wh_callback_init(cb) != 0) {
+    ERROR("write_http plugin: wh_callback_init failed.");
+    pthread_mutex_unlock(&cb->send_lock);
+    return -1;
   }
 
   status = format_kairosdb_value_list(
@@ -561,11 +1072,9 @@ static int wh_notify(notification_t const *n, user_data_t *ud) /* {{{ */
     pthread_mutex_unlock(&cb->send_lock);
     return -1;
   }
-
-  status = wh_post_nolock(cb, alert);
   pthread_mutex_unlock(&cb->send_lock);
 
-  return status;
+  return wh_enqueue_string(cb, alert);
 } /* }}} int wh_notify */
 
 static int config_set_format(wh_callback_t *cb, /* {{{ */
@@ -594,6 +1103,42 @@ static int config_set_format(wh_callback_t *cb, /* {{{ */
   return 0;
 } /* }}} int config_set_format */
 
+static int config_set_compression(wh_callback_t *cb, /* {{{ */
+                                  oconfig_item_t *ci) {
+  char *string;
+
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING)) {
+    WARNING("write_http plugin: The `%s' config option "
+            "needs exactly one string argument.",
+            ci->key);
+    return -1;
+  }
+
+  string = ci->values[0].value.string;
+  if (strcasecmp("None", string) == 0)
+    cb->compression = WH_COMPRESS_NONE;
+  else if (strcasecmp("Gzip", string) == 0)
+    cb->compression = WH_COMPRESS_GZIP;
+  else if (strcasecmp("Deflate", string) == 0)
+    cb->compression = WH_COMPRESS_DEFLATE;
+  else {
+    ERROR("write_http plugin: Invalid compression: %s", string);
+    return -1;
+  }
+
+#if !HAVE_LIBZ
+  if (cb->compression != WH_COMPRESS_NONE) {
+    ERROR("write_http plugin: Compression `%s' is not supported: collectd "
+          "was built without zlib.",
+          string);
+    cb->compression = WH_COMPRESS_NONE;
+    return -1;
+  }
+#endif
+
+  return 0;
+} /* }}} int config_set_compression */
+
 static int wh_config_append_string(const char *name,
                                    struct curl_slist **dest, /* {{{ */
                                    oconfig_item_t *ci) {
@@ -635,6 +1180,11 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   cb->send_metrics = 1;
   cb->send_notifications = 0;
   cb->data_ttl = 0;
+  cb->compression = WH_COMPRESS_NONE;
+  cb->queue_size = WRITE_HTTP_DEFAULT_QUEUE_SIZE;
+  cb->max_retries = WRITE_HTTP_DEFAULT_MAX_RETRIES;
+  cb->requests_num = 1;
+  C_COMPLAIN_INIT(&cb->queue_complaint);
   cb->metrics_prefix = strdup(WRITE_HTTP_DEFAULT_PREFIX);
 
   if (cb->metrics_prefix == NULL) {
@@ -644,6 +1194,8 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   }
 
   pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
+  pthread_mutex_init(&cb->queue_lock, /* attr = */ NULL);
+  pthread_cond_init(&cb->queue_cond, /* attr = */ NULL);
 
   cf_util_get_string(ci, &cb->name);
 
@@ -755,6 +1307,14 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int(child, &cb->data_ttl);
     } else if (strcasecmp("Prefix", child->key) == 0) {
       status = cf_util_get_string(child, &cb->metrics_prefix);
+    } else if (strcasecmp("Compression", child->key) == 0) {
+      status = config_set_compression(cb, child);
+    } else if (strcasecmp("QueueSize", child->key) == 0) {
+      status = cf_util_get_int(child, &cb->queue_size);
+    } else if (strcasecmp("MaxRetries", child->key) == 0) {
+      status = cf_util_get_int(child, &cb->max_retries);
+    } else if (strcasecmp("ParallelRequests", child->key) == 0) {
+      status = cf_util_get_int(child, &cb->requests_num);
     } else {
       ERROR("write_http plugin: Invalid configuration "
             "option: %s.",
@@ -788,6 +1348,22 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   if (strlen(cb->metrics_prefix) == 0)
     sfree(cb->metrics_prefix);
 
+  if (cb->queue_size < 1) {
+    ERROR("write_http plugin: Ignoring invalid QueueSize setting (%d).",
+          cb->queue_size);
+    cb->queue_size = WRITE_HTTP_DEFAULT_QUEUE_SIZE;
+  }
+  if (cb->max_retries < 0) {
+    ERROR("write_http plugin: Ignoring invalid MaxRetries setting (%d).",
+          cb->max_retries);
+    cb->max_retries = WRITE_HTTP_DEFAULT_MAX_RETRIES;
+  }
+  if (cb->requests_num < 1) {
+    ERROR("write_http plugin: Ignoring invalid ParallelRequests setting (%d).",
+          cb->requests_num);
+    cb->requests_num = 1;
+  }
+
   if (cb->low_speed_limit > 0)
     cb->low_speed_time = CDTIME_T_TO_TIME_T(plugin_get_interval());
 
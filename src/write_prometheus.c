@@ -35,6 +35,9 @@
 #include "prometheus.pb-c.h"
 
 #include <microhttpd.h>
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #include <netdb.h>
 #include <sys/socket.h>
@@ -44,15 +47,98 @@
 #define PROMETHEUS_DEFAULT_STALENESS_DELTA TIME_T_TO_CDTIME_T_STATIC(300)
 #endif
 
-#define VARINT_UINT32_BYTES 5
+#define VARINT_UINT64_BYTES 10
+
+/* Keys of the protobuf fields written by sample_format_protobuf(), i.e. the
+ * field number shifted left by three, or'ed with the wire type. */
+#define PROTO_KEY_FAMILY_METRIC 0x22  /* MetricFamily.metric, length-delim. */
+#define PROTO_KEY_METRIC_GAUGE 0x12   /* Metric.gauge, length-delimited */
+#define PROTO_KEY_METRIC_COUNTER 0x1a /* Metric.counter, length-delimited */
+#define PROTO_KEY_METRIC_TIMESTAMP 0x30 /* Metric.timestamp_ms, varint */
+#define PROTO_KEY_VALUE 0x09          /* Gauge.value, Counter.value, 64 bit */
+/* Largest value and timestamp encoded by sample_format_protobuf(). */
+#define PROTO_SAMPLE_SIZE (11 + 1 + VARINT_UINT64_BYTES)
 
 #define CONTENT_TYPE_PROTO                                                     \
   "application/vnd.google.protobuf; proto=io.prometheus.client.MetricFamily; " \
   "encoding=delimited"
 #define CONTENT_TYPE_TEXT "text/plain; version=0.0.4"
 
+/* Growable buffer, usable wherever protobuf-c expects a ProtobufCBuffer. */
+typedef struct {
+  ProtobufCBuffer base;
+  uint8_t *data;
+  size_t len;
+  size_t size;
+  _Bool failed;
+} prom_buffer_t;
+
+/* Metrics and metric families are allocated with some additional state used to
+ * cache the parts of their serialized form that don't change with the value.
+ * The protobuf message is the first member, so pointers to the message can be
+ * converted to pointers to the container. */
+typedef struct {
+  Io__Prometheus__Client__Metric m;
+  /* The constant part of the metric's line in the text format, i.e.
+   * 'name{labels} ', and the metric's labels in protobuf format. Created on
+   * first use. */
+  char *text_prefix;
+  prom_buffer_t proto_prefix;
+} prom_metric_t;
+
+/* The serialized form of a metric family in one format. It is cached in the
+ * family until the family's version changes; scrapes hold a reference while
+ * using it without "metrics_lock". */
+typedef struct {
+  uint64_t version;
+  prom_buffer_t data;
+  int refcount;
+} prom_fragment_t;
+
+typedef struct {
+  Io__Prometheus__Client__MetricFamily fam;
+  /* The HELP and TYPE lines, and the family without its metrics in protobuf
+   * format. Created on first use. */
+  char *text_header;
+  prom_buffer_t proto_header;
+  /* Incremented whenever a value or the set of metrics changes. */
+  uint64_t version;
+  /* The serialized family in the text and the protobuf format. */
+  prom_fragment_t *fragments[2];
+} prom_family_t;
+
+/* Values are copied out of "metrics" while holding "metrics_lock" and formatted
+ * after releasing it. The copies are kept back to back in a buffer, each one
+ * followed by "prefix_len" bytes: the header of a family or the prefix of a
+ * metric. */
+typedef struct {
+  _Bool family;
+  _Bool gauge;
+  _Bool has_timestamp_ms;
+  double value;
+  int64_t timestamp_ms;
+  size_t prefix_len;
+} prom_sample_t;
+
+/* A complete exposition in one format. Responses are sent from a snapshot
+ * without holding "metrics_lock"; it is freed when the last response using it
+ * has been sent and a newer snapshot has replaced it. */
+typedef struct {
+  uint64_t generation;
+  prom_buffer_t data;
+  prom_buffer_t gzip; /* compressed on first request */
+  int refcount;
+} prom_snapshot_t;
+
 static c_avl_tree_t *metrics;
 static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Incremented whenever a metric family or a metric is added or removed. Value
+ * changes are tracked per family, see prom_family_t. */
+static uint64_t metrics_generation;
+
+/* The current snapshot of the text and the protobuf format. */
+static prom_snapshot_t *snapshots[2];
+static pthread_mutex_t snapshots_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static unsigned short httpd_port = 9103;
 static struct MHD_Daemon *httpd;
@@ -61,9 +147,9 @@ static cdtime_t staleness_delta = PROMETHEUS_DEFAULT_STALENESS_DELTA;
 
 /* Unfortunately, protoc-c doesn't export it's implementation of varint, so we
  * need to implement our own. */
-static size_t varint(uint8_t buffer[static VARINT_UINT32_BYTES],
-                     uint32_t value) {
-  for (size_t i = 0; i < VARINT_UINT32_BYTES; i++) {
+static size_t varint(uint8_t buffer[static VARINT_UINT64_BYTES],
+                     uint64_t value) {
+  for (size_t i = 0; i < VARINT_UINT64_BYTES; i++) {
     buffer[i] = (uint8_t)(value & 0x7f);
     value >>= 7;
 
@@ -76,30 +162,38 @@ static size_t varint(uint8_t buffer[static VARINT_UINT32_BYTES],
   return 0;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
- * to a buffer in ProtoBuf format. It prefixes each protobuf with its encoded
- * size, the so called "delimited" format. */
-static void format_protobuf(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
+static void prom_buffer_append(ProtobufCBuffer *buffer, size_t len,
+                               uint8_t const *data) {
+  prom_buffer_t *b = (prom_buffer_t *)buffer;
+  if (b->failed)
+    return;
 
-  char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
-  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    /* Prometheus uses a message length prefix to determine where one
-     * MetricFamily ends and the next begins. This delimiter is encoded as a
-     * "varint", which is common in Protobufs. */
-    uint8_t delim[VARINT_UINT32_BYTES] = {0};
-    size_t delim_len = varint(
-        delim,
-        (uint32_t)io__prometheus__client__metric_family__get_packed_size(fam));
-    buffer->append(buffer, delim_len, delim);
+  if ((b->size - b->len) < len) {
+    size_t size = (b->size > 0) ? b->size : 4096;
+    while ((size - b->len) < len)
+      size *= 2;
 
-    io__prometheus__client__metric_family__pack_to_buffer(fam, buffer);
+    uint8_t *tmp = realloc(b->data, size);
+    if (tmp == NULL) {
+      b->failed = 1;
+      return;
+    }
+    b->data = tmp;
+    b->size = size;
   }
-  c_avl_iterator_destroy(iter);
 
-  pthread_mutex_unlock(&metrics_lock);
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+static void prom_buffer_init(prom_buffer_t *b) {
+  memset(b, 0, sizeof(*b));
+  b->base.append = prom_buffer_append;
+}
+
+static void prom_buffer_free(prom_buffer_t *b) {
+  sfree(b->data);
+  prom_buffer_init(b);
 }
 
 static char const *escape_label_value(char *buffer, size_t buffer_size,
@@ -173,58 +267,503 @@ static char *format_labels(char *buffer, size_t buffer_size,
   return buffer;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
- * to a buffer in plain text format. */
-static void format_text(ProtobufCBuffer *buffer) {
+/* metric_family_prepare creates the parts of the serialized form of a metric
+ * family and its metrics that don't change with the values, if they don't
+ * exist yet. Must be called with "metrics_lock" held. */
+static int metric_family_prepare(prom_family_t *pf, _Bool want_proto) {
+  Io__Prometheus__Client__MetricFamily *fam = &pf->fam;
+
+  if (want_proto && (pf->proto_header.len == 0)) {
+    /* The family's metrics are appended by samples_format_protobuf(). */
+    Io__Prometheus__Client__MetricFamily header = *fam;
+    header.n_metric = 0;
+    header.metric = NULL;
+    io__prometheus__client__metric_family__pack_to_buffer(
+        &header, &pf->proto_header.base);
+    if (pf->proto_header.failed) {
+      prom_buffer_free(&pf->proto_header);
+      return ENOMEM;
+    }
+  } else if (!want_proto && (pf->text_header == NULL)) {
+    pf->text_header = ssnprintf_alloc(
+        "# HELP %s %s\n# TYPE %s %s\n", fam->name, fam->help, fam->name,
+        (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE) ? "gauge"
+                                                                  : "counter");
+    if (pf->text_header == NULL)
+      return ENOMEM;
+  }
+
+  for (size_t i = 0; i < fam->n_metric; i++) {
+    prom_metric_t *pm = (prom_metric_t *)fam->metric[i];
+
+    if (want_proto && (pm->proto_prefix.len == 0)) {
+      /* Everything but the value and the timestamp, which are appended by
+       * sample_format_protobuf(). */
+      Io__Prometheus__Client__Metric labels = pm->m;
+      labels.gauge = NULL;
+      labels.counter = NULL;
+      labels.has_timestamp_ms = 0;
+      io__prometheus__client__metric__pack_to_buffer(&labels,
+                                                     &pm->proto_prefix.base);
+      if (pm->proto_prefix.failed) {
+        prom_buffer_free(&pm->proto_prefix);
+        return ENOMEM;
+      }
+    } else if (!want_proto && (pm->text_prefix == NULL)) {
+      char labels[4096];
+      pm->text_prefix =
+          ssnprintf_alloc("%s{%s} ", fam->name,
+                          format_labels(labels, sizeof(labels), &pm->m));
+      if (pm->text_prefix == NULL)
+        return ENOMEM;
+    }
+  }
+
+  return 0;
+}
+
+static void sample_append(prom_buffer_t *samples, prom_sample_t const *s,
+                          uint8_t const *prefix) {
+  samples->base.append(&samples->base, sizeof(*s), (uint8_t const *)s);
+  samples->base.append(&samples->base, s->prefix_len, prefix);
+}
+
+/* sample_next reads the sample at "*pos" and advances "*pos" to the next one.
+ * Returns the bytes following the sample. */
+static uint8_t const *sample_next(prom_buffer_t const *samples, size_t *pos,
+                                  prom_sample_t *s) {
+  memcpy(s, samples->data + *pos, sizeof(*s));
+  uint8_t const *prefix = samples->data + *pos + sizeof(*s);
+  *pos += sizeof(*s) + s->prefix_len;
+  return prefix;
+}
+
+/* metric_family_copy appends a family and the values of its metrics to
+ * "samples". Must be called with "metrics_lock" held. */
+static void metric_family_copy(prom_buffer_t *samples, prom_family_t *pf,
+                               _Bool want_proto) {
+  Io__Prometheus__Client__MetricFamily *fam = &pf->fam;
+
+  if (metric_family_prepare(pf, want_proto) != 0) {
+    samples->failed = 1;
+    return;
+  }
+
+  prom_sample_t header = {.family = 1};
+  if (want_proto) {
+    header.prefix_len = pf->proto_header.len;
+    sample_append(samples, &header, pf->proto_header.data);
+  } else {
+    header.prefix_len = strlen(pf->text_header);
+    sample_append(samples, &header, (uint8_t *)pf->text_header);
+  }
+
+  for (size_t i = 0; i < fam->n_metric; i++) {
+    prom_metric_t *pm = (prom_metric_t *)fam->metric[i];
+    Io__Prometheus__Client__Metric *m = &pm->m;
+
+    prom_sample_t s = {
+        .gauge = (m->gauge != NULL),
+        .has_timestamp_ms = m->has_timestamp_ms,
+        .timestamp_ms = m->timestamp_ms,
+    };
+    if (m->gauge != NULL)
+      s.value = m->gauge->value;
+    else if (m->counter != NULL)
+      s.value = m->counter->value;
+    else /* allocating the value failed in metric_update() */
+      continue;
+
+    if (want_proto) {
+      s.prefix_len = pm->proto_prefix.len;
+      sample_append(samples, &s, pm->proto_prefix.data);
+    } else {
+      s.prefix_len = strlen(pm->text_prefix);
+      sample_append(samples, &s, (uint8_t *)pm->text_prefix);
+    }
+  }
+}
+
+/* samples_format_text serializes the metric families copied to "samples"
+ * between "pos" and "end" in plain text format. */
+static void samples_format_text(prom_buffer_t *out,
+                                prom_buffer_t const *samples, size_t pos,
+                                size_t end) {
+  ProtobufCBuffer *buffer = &out->base;
+  char line[1024];
+
+  while (pos < end) {
+    prom_sample_t s;
+    uint8_t const *prefix = sample_next(samples, &pos, &s);
+
+    buffer->append(buffer, s.prefix_len, prefix);
+    if (s.family)
+      continue;
+
+    char timestamp_ms[24] = "";
+    if (s.has_timestamp_ms)
+      snprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64,
+               s.timestamp_ms);
+
+    if (s.gauge)
+      snprintf(line, sizeof(line), GAUGE_FORMAT "%s\n", s.value, timestamp_ms);
+    else
+      snprintf(line, sizeof(line), "%.0f%s\n", s.value, timestamp_ms);
+
+    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  }
+}
+
+/* sample_format_protobuf encodes the part of a Metric message following its
+ * labels, i.e. the value and the timestamp. Returns the number of bytes written
+ * to "buffer". */
+static size_t sample_format_protobuf(uint8_t buffer[static PROTO_SAMPLE_SIZE],
+                                     prom_sample_t const *s) {
+  uint64_t bits;
+  memcpy(&bits, &s->value, sizeof(bits));
+
+  size_t len = 0;
+  buffer[len++] = s->gauge ? PROTO_KEY_METRIC_GAUGE : PROTO_KEY_METRIC_COUNTER;
+  buffer[len++] = 1 + sizeof(bits); /* size of the Gauge or Counter message */
+  buffer[len++] = PROTO_KEY_VALUE;
+  for (size_t i = 0; i < sizeof(bits); i++)
+    buffer[len++] = (uint8_t)(bits >> (8 * i)); /* little endian */
+
+  if (s->has_timestamp_ms) {
+    buffer[len++] = PROTO_KEY_METRIC_TIMESTAMP;
+    len += varint(buffer + len, (uint64_t)s->timestamp_ms);
+  }
+
+  return len;
+}
+
+/* samples_format_protobuf serializes the metric families copied to "samples"
+ * between "pos" and "end" in ProtoBuf format. Each family is prefixed with its
+ * encoded size, the so called "delimited" format. */
+static void samples_format_protobuf(prom_buffer_t *out,
+                                    prom_buffer_t const *samples, size_t pos,
+                                    size_t end) {
+  ProtobufCBuffer *buffer = &out->base;
+  uint8_t value[PROTO_SAMPLE_SIZE];
+  uint8_t varint_buffer[VARINT_UINT64_BYTES];
+
+  while (pos < end) {
+    prom_sample_t fs;
+    uint8_t const *header = sample_next(samples, &pos, &fs);
+    assert(fs.family);
+
+    /* Prometheus uses a message length prefix to determine where one
+     * MetricFamily ends and the next begins, so the size of the family's
+     * metrics is computed first. */
+    size_t fam_len = fs.prefix_len;
+    size_t fam_end = pos;
+    while (fam_end < end) {
+      prom_sample_t s;
+      size_t next = fam_end;
+      sample_next(samples, &next, &s);
+      if (s.family)
+        break;
+
+      size_t m_len = s.prefix_len + sample_format_protobuf(value, &s);
+      fam_len += 1 + varint(varint_buffer, m_len) + m_len;
+      fam_end = next;
+    }
+
+    buffer->append(buffer, varint(varint_buffer, fam_len), varint_buffer);
+    buffer->append(buffer, fs.prefix_len, header);
+
+    while (pos < fam_end) {
+      prom_sample_t s;
+      uint8_t const *labels = sample_next(samples, &pos, &s);
+      size_t value_len = sample_format_protobuf(value, &s);
+
+      uint8_t key = PROTO_KEY_FAMILY_METRIC;
+      buffer->append(buffer, 1, &key);
+      buffer->append(buffer,
+                     varint(varint_buffer, s.prefix_len + value_len),
+                     varint_buffer);
+      buffer->append(buffer, s.prefix_len, labels);
+      buffer->append(buffer, value_len, value);
+    }
+  }
+}
+
+/* metrics_changed is called when a metric family or a metric is added or
+ * removed. Must be called with "metrics_lock" held. */
+static void metrics_changed(void) { metrics_generation++; }
+
+static void fragment_release(prom_fragment_t *f) {
+  if (f == NULL)
+    return;
+
+  if (__atomic_sub_fetch(&f->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
+  prom_buffer_free(&f->data);
+  sfree(f);
+}
+
+static void snapshot_release(prom_snapshot_t *s) {
+  if (s == NULL)
+    return;
+
+  if (__atomic_sub_fetch(&s->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
+  prom_buffer_free(&s->data);
+  prom_buffer_free(&s->gzip);
+  sfree(s);
+}
+
+/* A metric family as seen by a scrape: either its cached fragment, or the
+ * range of its values in the copied samples if it changed since it was last
+ * serialized. In the latter case "fragment" is created by the scrape. */
+typedef struct {
+  prom_family_t *pf;
+  prom_fragment_t *fragment;
+  _Bool changed;
+  uint64_t version;
+  size_t samples_begin;
+  size_t samples_end;
+} prom_scrape_t;
+
+/* snapshot_create serializes all metric families in "metrics". Families which
+ * didn't change since the last scrape are taken from their cached fragment.
+ * For the others only the values are copied while holding "metrics_lock"; they
+ * are formatted after releasing it, so writes are not blocked by a scrape.
+ * Returns "prev" if nothing changed since it was created. */
+static prom_snapshot_t *snapshot_create(_Bool want_proto,
+                                        prom_snapshot_t *prev) {
+  int format = want_proto ? 1 : 0;
+  prom_snapshot_t *s = NULL;
+  size_t changed_num = 0;
+
+  prom_buffer_t samples;
+  prom_buffer_init(&samples);
+
   pthread_mutex_lock(&metrics_lock);
+  uint64_t generation = metrics_generation;
 
+  size_t fams_num = (size_t)c_avl_size(metrics);
+  prom_scrape_t *fams = calloc((fams_num > 0) ? fams_num : 1, sizeof(*fams));
+  if (fams == NULL) {
+    pthread_mutex_unlock(&metrics_lock);
+    ERROR("write_prometheus plugin: calloc failed.");
+    return NULL;
+  }
+
+  size_t i = 0;
   char *unused_name;
   Io__Prometheus__Client__MetricFamily *fam;
   c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    char line[1024]; /* 4x DATA_MAX_NAME_LEN? */
-
-    snprintf(line, sizeof(line), "# HELP %s %s\n", fam->name, fam->help);
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  while ((i < fams_num) &&
+         (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0)) {
+    prom_family_t *pf = (prom_family_t *)fam;
+    prom_fragment_t *f = pf->fragments[format];
+
+    fams[i].pf = pf;
+    if ((f != NULL) && (f->version == pf->version)) {
+      __atomic_add_fetch(&f->refcount, 1, __ATOMIC_ACQ_REL);
+      fams[i].fragment = f;
+    } else {
+      fams[i].changed = 1;
+      fams[i].version = pf->version;
+      fams[i].samples_begin = samples.len;
+      metric_family_copy(&samples, pf, want_proto);
+      fams[i].samples_end = samples.len;
+      changed_num++;
+    }
+    i++;
+  }
+  c_avl_iterator_destroy(iter);
 
-    snprintf(line, sizeof(line), "# TYPE %s %s\n", fam->name,
-             (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-                 ? "gauge"
-                 : "counter");
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  pthread_mutex_unlock(&metrics_lock);
 
-    for (size_t i = 0; i < fam->n_metric; i++) {
-      Io__Prometheus__Client__Metric *m = fam->metric[i];
+  if ((prev != NULL) && (prev->generation == generation) &&
+      (changed_num == 0)) {
+    s = prev;
+    goto out;
+  }
 
-      char labels[4096];
+  if (samples.failed)
+    goto failed;
 
-      char timestamp_ms[24] = "";
-      if (m->has_timestamp_ms)
-        snprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64,
-                 m->timestamp_ms);
-
-      if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-        snprintf(line, sizeof(line), "%s{%s} " GAUGE_FORMAT "%s\n", fam->name,
-                 format_labels(labels, sizeof(labels), m), m->gauge->value,
-                 timestamp_ms);
-      else /* if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER) */
-        snprintf(line, sizeof(line), "%s{%s} %.0f%s\n", fam->name,
-                 format_labels(labels, sizeof(labels), m), m->counter->value,
-                 timestamp_ms);
-
-      buffer->append(buffer, strlen(line), (uint8_t *)line);
+  size_t len = 0;
+  for (i = 0; i < fams_num; i++) {
+    if (!fams[i].changed) {
+      len += fams[i].fragment->data.len;
+      continue;
     }
+
+    prom_fragment_t *f = calloc(1, sizeof(*f));
+    if (f == NULL)
+      goto failed;
+    prom_buffer_init(&f->data);
+    f->version = fams[i].version;
+    f->refcount = 1;
+    fams[i].fragment = f;
+
+    if (want_proto)
+      samples_format_protobuf(&f->data, &samples, fams[i].samples_begin,
+                              fams[i].samples_end);
+    else
+      samples_format_text(&f->data, &samples, fams[i].samples_begin,
+                          fams[i].samples_end);
+    if (f->data.failed)
+      goto failed;
+    len += f->data.len;
   }
-  c_avl_iterator_destroy(iter);
 
-  char server[1024];
-  snprintf(server, sizeof(server), "\n# collectd/write_prometheus %s at %s\n",
-           PACKAGE_VERSION, hostname_g);
-  buffer->append(buffer, strlen(server), (uint8_t *)server);
+  s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    goto failed;
+  prom_buffer_init(&s->data);
+  prom_buffer_init(&s->gzip);
+  s->generation = generation;
+  s->refcount = 1;
+
+  char server[1024] = "";
+  if (!want_proto)
+    snprintf(server, sizeof(server), "\n# collectd/write_prometheus %s at %s\n",
+             PACKAGE_VERSION, hostname_g);
+
+  s->data.data = malloc(len + strlen(server));
+  if (s->data.data != NULL)
+    s->data.size = len + strlen(server);
+
+  for (i = 0; i < fams_num; i++)
+    s->data.base.append(&s->data.base, fams[i].fragment->data.len,
+                        fams[i].fragment->data.data);
+  s->data.base.append(&s->data.base, strlen(server), (uint8_t *)server);
+
+  if (s->data.failed) {
+    snapshot_release(s);
+    s = NULL;
+    goto failed;
+  }
 
+  /* Cache the new fragments. If families were added or removed meanwhile,
+   * "pf" may have been freed; the next scrape formats them again. */
+  pthread_mutex_lock(&metrics_lock);
+  if (metrics_generation == generation) {
+    for (i = 0; i < fams_num; i++) {
+      if (!fams[i].changed)
+        continue;
+
+      fragment_release(fams[i].pf->fragments[format]);
+      __atomic_add_fetch(&fams[i].fragment->refcount, 1, __ATOMIC_ACQ_REL);
+      fams[i].pf->fragments[format] = fams[i].fragment;
+    }
+  }
   pthread_mutex_unlock(&metrics_lock);
+  goto out;
+
+failed:
+  ERROR("write_prometheus plugin: Allocating memory for the response "
+        "failed.");
+
+out:
+  for (i = 0; i < fams_num; i++)
+    fragment_release(fams[i].fragment);
+  sfree(fams);
+  prom_buffer_free(&samples);
+  return s;
 }
 
+#if HAVE_LIBZ
+/* snapshot_compress fills the "gzip" buffer of a snapshot. */
+static int snapshot_compress(prom_snapshot_t *s) {
+  z_stream z = {0};
+
+  /* 16 added to the window bits selects the gzip format. */
+  int status = deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, 15 + 16,
+                            /* memLevel = */ 8, Z_DEFAULT_STRATEGY);
+  if (status != Z_OK)
+    return -1;
+
+  size_t size = (size_t)deflateBound(&z, (uLong)s->data.len);
+  uint8_t *data = malloc(size);
+  if (data == NULL) {
+    deflateEnd(&z);
+    return ENOMEM;
+  }
+
+  z.next_in = s->data.data;
+  z.avail_in = (uInt)s->data.len;
+  z.next_out = data;
+  z.avail_out = (uInt)size;
+
+  status = deflate(&z, Z_FINISH);
+  deflateEnd(&z);
+  if (status != Z_STREAM_END) {
+    ERROR("write_prometheus plugin: deflate() failed with status %d.", status);
+    sfree(data);
+    return -1;
+  }
+
+  s->gzip.data = data;
+  s->gzip.size = size;
+  s->gzip.len = size - z.avail_out;
+  return 0;
+}
+#endif /* HAVE_LIBZ */
+
+/* snapshot_get returns the current snapshot in the requested format, creating
+ * a new one if the metrics changed since it was created. The caller must
+ * release the returned snapshot. */
+static prom_snapshot_t *snapshot_get(_Bool want_proto, _Bool want_gzip) {
+  pthread_mutex_lock(&snapshots_lock);
+
+  prom_snapshot_t *s = snapshots[want_proto ? 1 : 0];
+  prom_snapshot_t *new_s = snapshot_create(want_proto, s);
+  if ((new_s != NULL) && (new_s != s)) {
+    /* Responses still being sent from the old snapshot hold a reference. */
+    snapshot_release(s);
+    snapshots[want_proto ? 1 : 0] = s = new_s;
+  }
+
+  if (s == NULL) {
+    pthread_mutex_unlock(&snapshots_lock);
+    return NULL;
+  }
+
+#if HAVE_LIBZ
+  /* A failed compression is retried with the next request; this one is sent
+   * uncompressed. */
+  if (want_gzip && (s->gzip.data == NULL))
+    snapshot_compress(s);
+#endif
+
+  __atomic_add_fetch(&s->refcount, 1, __ATOMIC_ACQ_REL);
+  pthread_mutex_unlock(&snapshots_lock);
+  return s;
+}
+
+#if defined(MHD_VERSION) && MHD_VERSION >= 0x00090000
+static ssize_t http_read_buffer(prom_buffer_t const *b, uint64_t pos,
+                                char *buf, size_t max) {
+  if (pos >= b->len)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+
+  size_t len = b->len - (size_t)pos;
+  if (len > max)
+    len = max;
+
+  memcpy(buf, b->data + pos, len);
+  return (ssize_t)len;
+}
+
+static ssize_t http_read_data(void *cls, uint64_t pos, char *buf, size_t max) {
+  return http_read_buffer(&((prom_snapshot_t *)cls)->data, pos, buf, max);
+}
+
+static ssize_t http_read_gzip(void *cls, uint64_t pos, char *buf, size_t max) {
+  return http_read_buffer(&((prom_snapshot_t *)cls)->gzip, pos, buf, max);
+}
+
+static void http_free_snapshot(void *cls) { snapshot_release(cls); }
+#endif
+
 /* http_handler is the callback called by the microhttpd library. It essentially
  * handles all HTTP request aspects and creates an HTTP response. */
 static int http_handler(void *cls, struct MHD_Connection *connection,
@@ -250,29 +789,47 @@ static int http_handler(void *cls, struct MHD_Connection *connection,
       (accept != NULL) &&
       (strstr(accept, "application/vnd.google.protobuf") != NULL);
 
-  uint8_t scratch[4096] = {0};
-  ProtobufCBufferSimple simple = PROTOBUF_C_BUFFER_SIMPLE_INIT(scratch);
-  ProtobufCBuffer *buffer = (ProtobufCBuffer *)&simple;
+#if HAVE_LIBZ
+  char const *encoding = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  _Bool want_gzip = (encoding != NULL) && (strstr(encoding, "gzip") != NULL);
+#else
+  _Bool want_gzip = 0;
+#endif
 
-  if (want_proto)
-    format_protobuf(buffer);
-  else
-    format_text(buffer);
+  prom_snapshot_t *s = snapshot_get(want_proto, want_gzip);
+  if (s == NULL)
+    return MHD_NO;
 
-#if defined(MHD_VERSION) && MHD_VERSION >= 0x00090500
-  struct MHD_Response *res = MHD_create_response_from_buffer(
-      simple.len, simple.data, MHD_RESPMEM_MUST_COPY);
+  if (s->gzip.data == NULL)
+    want_gzip = 0;
+  prom_buffer_t const *b = want_gzip ? &s->gzip : &s->data;
+
+#if defined(MHD_VERSION) && MHD_VERSION >= 0x00090000
+  /* The response is sent straight from the snapshot, which is released by
+   * http_free_snapshot() once microhttpd is done with it. */
+  struct MHD_Response *res = MHD_create_response_from_callback(
+      b->len, /* block size = */ 32 * 1024,
+      want_gzip ? http_read_gzip : http_read_data, s, http_free_snapshot);
+  if (res == NULL) {
+    snapshot_release(s);
+    return MHD_NO;
+  }
 #else
   struct MHD_Response *res = MHD_create_response_from_data(
-      simple.len, simple.data, /* must_free = */ 0, /* must_copy = */ 1);
+      b->len, b->data, /* must_free = */ 0, /* must_copy = */ 1);
+  snapshot_release(s);
+  if (res == NULL)
+    return MHD_NO;
 #endif
   MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_TYPE,
                           want_proto ? CONTENT_TYPE_PROTO : CONTENT_TYPE_TEXT);
+  if (want_gzip)
+    MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_ENCODING, "gzip");
 
   int status = MHD_queue_response(connection, MHD_HTTP_OK, res);
 
   MHD_destroy_response(res);
-  PROTOBUF_C_BUFFER_SIMPLE_CLEAR(&simple);
   return status;
 }
 
@@ -347,7 +904,10 @@ static void metric_destroy(Io__Prometheus__Client__Metric *msg) {
   sfree(msg->gauge);
   sfree(msg->counter);
 
-  sfree(msg);
+  prom_metric_t *pm = (prom_metric_t *)msg;
+  sfree(pm->text_prefix);
+  prom_buffer_free(&pm->proto_prefix);
+  sfree(pm);
 }
 
 /* metric_cmp compares two metrics. It's prototype makes it easy to use with
@@ -486,10 +1046,12 @@ static char *meta_to_tags(char *key, meta_data_t *meta)
  */
 static Io__Prometheus__Client__Metric *
 metric_clone(Io__Prometheus__Client__Metric const *orig, value_list_t const *vl) {
-  Io__Prometheus__Client__Metric *copy = calloc(1, sizeof(*copy));
-  if (copy == NULL)
+  prom_metric_t *pm = calloc(1, sizeof(*pm));
+  if (pm == NULL)
     return NULL;
+  Io__Prometheus__Client__Metric *copy = &pm->m;
   io__prometheus__client__metric__init(copy);
+  prom_buffer_init(&pm->proto_prefix);
 
   int num_labels = orig->n_label;
   int num_keys = 0;
@@ -646,6 +1208,8 @@ metric_family_delete_metric(Io__Prometheus__Client__MetricFamily *fam,
     return ENOENT;
 
   metric_destroy(fam->metric[i]);
+  ((prom_family_t *)fam)->version++;
+  metrics_changed();
   if ((fam->n_metric - 1) > i)
     memmove(&fam->metric[i], &fam->metric[i + 1],
             ((fam->n_metric - 1) - i) * sizeof(fam->metric[i]));
@@ -691,6 +1255,7 @@ metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
     metric_destroy(new_metric);
     return NULL;
   }
+  metrics_changed();
 
   return new_metric;
 }
@@ -704,6 +1269,7 @@ static int metric_family_update(Io__Prometheus__Client__MetricFamily *fam,
   if (m == NULL)
     return -1;
 
+  ((prom_family_t *)fam)->version++;
   return metric_update(m, vl->values[ds_index], ds->ds[ds_index].type, vl->time,
                        vl->interval);
 }
@@ -721,17 +1287,24 @@ static void metric_family_destroy(Io__Prometheus__Client__MetricFamily *msg) {
   }
   sfree(msg->metric);
 
-  sfree(msg);
+  prom_family_t *pf = (prom_family_t *)msg;
+  sfree(pf->text_header);
+  prom_buffer_free(&pf->proto_header);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(pf->fragments); i++)
+    fragment_release(pf->fragments[i]);
+  sfree(pf);
 }
 
 /* metric_family_create allocates and initializes a new metric family. */
 static Io__Prometheus__Client__MetricFamily *
 metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
                      size_t ds_index) {
-  Io__Prometheus__Client__MetricFamily *msg = calloc(1, sizeof(*msg));
-  if (msg == NULL)
+  prom_family_t *pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
     return NULL;
+  Io__Prometheus__Client__MetricFamily *msg = &pf->fam;
   io__prometheus__client__metric_family__init(msg);
+  prom_buffer_init(&pf->proto_header);
 
   msg->name = name;
 
@@ -827,6 +1400,7 @@ metric_family_get(data_set_t const *ds, value_list_t const *vl, size_t ds_index,
     metric_family_destroy(fam);
     return NULL;
   }
+  metrics_changed();
 
   return fam;
 }
@@ -1074,6 +1648,13 @@ static int prom_shutdown() {
   }
   pthread_mutex_unlock(&metrics_lock);
 
+  pthread_mutex_lock(&snapshots_lock);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(snapshots); i++) {
+    snapshot_release(snapshots[i]);
+    snapshots[i] = NULL;
+  }
+  pthread_mutex_unlock(&snapshots_lock);
+
   return 0;
 }
 
@@ -13,25 +13,83 @@
 #include "utils_tail.h"
 #include "scribe_capi.h"
 #include "unixsock.h"
-#include "utils_avltree.h"
-#include "utils_format_graphite.h"
 #include <stdbool.h>
 
 #define SCRIBE_BUF_SIZE 8192
 
 static char *scribe_config_file = NULL;
 
-static char *metrics_buffer = NULL;
 static int metric_buffer_size = 1<<20; //1mb
-static c_avl_tree_t *write_cache;
-static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Rate-limit cache: remembers when each series/data source was last sent to
+ * Scribe. Entries are keyed by a 64-bit identity hash and spread over a fixed
+ * number of independently locked open-addressing tables, so write threads
+ * only contend when they hit the same stripe. */
+#define SCRIBE_CACHE_STRIPES 64
+#define SCRIBE_CACHE_INITIAL_SIZE 64
+
+typedef struct {
+    uint64_t hash; /* 0 marks an empty slot */
+    cdtime_t last_write; /* 0 after a failed send */
+    cdtime_t last_seen;
+} scribe_cache_slot_t;
+
+typedef struct {
+    pthread_mutex_t      lock;
+    scribe_cache_slot_t *slots;
+    size_t               capacity; /* power of two */
+    size_t               size;
+    cdtime_t             last_sweep;
+} scribe_cache_stripe_t;
+
+static scribe_cache_stripe_t write_cache[SCRIBE_CACHE_STRIPES];
+static cdtime_t cache_timeout = 0;
+
+/* Batching: 0 means every metric is sent as its own Scribe message. */
+static int batch_size = 0;
+static cdtime_t batch_timeout = 0;
+
+/* Every write thread formats into its own buffer, so concurrent writers never
+ * share a lock on the hot path. The per-batch lock is only contended by the
+ * flush and read callbacks which drain aged batches. */
+struct scribe_batch_s {
+    pthread_mutex_t       lock;
+    insights_encoder_t    enc;
+    cdtime_t              first_time;
+    struct scribe_batch_s *next;
+};
+
+typedef struct scribe_batch_s scribe_batch_t;
+
+static pthread_key_t batch_key;
+static _Bool batch_key_created = 0;
+static scribe_batch_t *batch_list = NULL;
+static pthread_mutex_t batch_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Tailed files are read in large chunks; lines are split with memchr() and
+ * shipped in batches like metrics. Lines longer than SCRIBE_TAIL_MAX_LINE are
+ * sent in pieces. */
+#define SCRIBE_TAIL_CHUNK_SIZE 65536
+#define SCRIBE_TAIL_MAX_LINE (128 * 1024)
 
 struct instance_definition_s {
     char                 *instance;
     char                 *path;
+    char                 *position_file;
     cu_tail_t            *tail;
     cdtime_t              interval;
     ssize_t               time_from;
+
+    /* Read-ahead buffer; keeps an incomplete last line between reads. */
+    char                 *buffer;
+    size_t                fill;
+    size_t                size;
+    insights_encoder_t    enc;
+
+    /* Last position written to position_file. */
+    uint64_t              saved_inode;
+    uint64_t              saved_offset;
+
     struct instance_definition_s *next;
 };
 
@@ -40,33 +98,299 @@ typedef struct instance_definition_s instance_definition_t;
 static instance_definition_t *tailed_files[1024];
 static int num_tailed_files = 0;
 
-static int compare_callback(void const *v0, void const *v1) {
-  assert(v0 != NULL);
-  assert(v1 != NULL);
+static int scribe_encoder_send(insights_encoder_t *enc)
+{
+    int r;
+
+    if (enc->count == 0)
+        return (0);
+
+    r = insights_encoder_finalize(enc, batch_size > 0);
 
-  return strcmp(v0, v1);
+    if (r == 0 && is_scribe_initialized())
+        scribe_log(enc->buffer, "insights");
+    else if (r != 0)
+        WARNING("write_scribe plugin: Dropping %zu insights, finalize failed "
+                "with status %i.", enc->count, r);
+
+    insights_encoder_reset(enc);
+    return (r);
 }
 
-static int scribe_write_messages (const data_set_t *ds, const value_list_t *vl)
+/* Must hold b->lock */
+static int scribe_batch_flush_nolock(scribe_batch_t *b)
+{
+    return scribe_encoder_send(&b->enc);
+}
+
+static scribe_batch_t *scribe_batch_get(void)
+{
+    scribe_batch_t *b = pthread_getspecific(batch_key);
+
+    if (b != NULL)
+        return (b);
+
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+        return (NULL);
+
+    /* Starts small and grows up to the maximum message size on demand. */
+    if (insights_encoder_init(&b->enc, SCRIBE_BUF_SIZE, metric_buffer_size) != 0) {
+        sfree(b);
+        return (NULL);
+    }
+
+    pthread_mutex_init(&b->lock, NULL);
+
+    pthread_mutex_lock(&batch_list_lock);
+    b->next = batch_list;
+    batch_list = b;
+    pthread_mutex_unlock(&batch_list_lock);
+
+    pthread_setspecific(batch_key, b);
+    return (b);
+}
+
+/* Appends one data source of a value list to the calling thread's batch and
+ * sends the batch once it exceeds BatchSize or is older than BatchTimeout. */
+static int scribe_batch_append(scribe_batch_t *b,
+        const data_set_t *ds, const value_list_t *vl, int ds_idx,
+        int history_length, gauge_t *history_values)
+{
+    int r;
+
+    pthread_mutex_lock(&b->lock);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        r = insights_encoder_add_value_list(&b->enc, ds, vl, 0, ds_idx,
+                history_length, history_values);
+
+        /* Buffer full: ship what we have and retry with an empty buffer. */
+        if (r == -ENOMEM && b->enc.count > 0) {
+            scribe_batch_flush_nolock(b);
+            continue;
+        }
+        break;
+    }
+
+    if (r != 0) {
+        pthread_mutex_unlock(&b->lock);
+        return (r);
+    }
+
+    if (b->enc.count == 1)
+        b->first_time = cdtime();
+
+    if (batch_size == 0 || b->enc.fill >= (size_t) batch_size ||
+            (batch_timeout > 0 && (cdtime() - b->first_time) >= batch_timeout))
+        scribe_batch_flush_nolock(b);
+
+    pthread_mutex_unlock(&b->lock);
+    return (0);
+}
+
+/* Flushes all batches older than `timeout'. A timeout of zero flushes
+ * unconditionally. */
+static void scribe_batch_flush_all(cdtime_t timeout)
+{
+    cdtime_t now = cdtime();
+
+    pthread_mutex_lock(&batch_list_lock);
+    for (scribe_batch_t *b = batch_list; b != NULL; b = b->next) {
+        pthread_mutex_lock(&b->lock);
+        if (b->enc.count > 0 && (timeout == 0 || (now - b->first_time) >= timeout))
+            scribe_batch_flush_nolock(b);
+        pthread_mutex_unlock(&b->lock);
+    }
+    pthread_mutex_unlock(&batch_list_lock);
+}
+
+static void scribe_batch_destroy_all(void)
+{
+    pthread_mutex_lock(&batch_list_lock);
+    while (batch_list != NULL) {
+        scribe_batch_t *b = batch_list;
+        batch_list = b->next;
+
+        pthread_mutex_lock(&b->lock);
+        scribe_batch_flush_nolock(b);
+        pthread_mutex_unlock(&b->lock);
+
+        pthread_mutex_destroy(&b->lock);
+        insights_encoder_destroy(&b->enc);
+        sfree(b);
+    }
+    pthread_mutex_unlock(&batch_list_lock);
+}
+
+/* Mixes the data source index into the series ID (splitmix64 finalizer).
+ * Never returns zero, which marks empty slots. */
+static uint64_t scribe_ds_hash(uint64_t series_id, int ds_idx)
+{
+    uint64_t h = series_id + 0x9e3779b97f4a7c15ULL * (uint64_t)(ds_idx + 1);
+
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    return (h != 0) ? h : 1;
+}
+
+static scribe_cache_slot_t *scribe_cache_probe(scribe_cache_slot_t *slots,
+        size_t capacity, uint64_t hash)
+{
+    size_t mask = capacity - 1;
+
+    for (size_t i = (size_t) hash & mask; ; i = (i + 1) & mask) {
+        if (slots[i].hash == hash || slots[i].hash == 0)
+            return &slots[i];
+    }
+}
+
+/* Rehashes a stripe into a table of `capacity' slots, dropping every entry
+ * not seen since `expire_before'. Must hold s->lock. */
+static int scribe_cache_rehash(scribe_cache_stripe_t *s, size_t capacity,
+        cdtime_t expire_before)
+{
+    scribe_cache_slot_t *slots = calloc(capacity, sizeof(*slots));
+    size_t size = 0;
+
+    if (slots == NULL)
+        return (-1);
+
+    for (size_t i = 0; i < s->capacity; i++) {
+        scribe_cache_slot_t *old = &s->slots[i];
+
+        if (old->hash == 0 || old->last_seen < expire_before)
+            continue;
+
+        *scribe_cache_probe(slots, capacity, old->hash) = *old;
+        size++;
+    }
+
+    sfree(s->slots);
+    s->slots = slots;
+    s->capacity = capacity;
+    s->size = size;
+
+    return (0);
+}
+
+/* Periodically drops series which have not been written for CacheTimeout and
+ * shrinks the stripe if it became mostly empty. Must hold s->lock. */
+static void scribe_cache_sweep(scribe_cache_stripe_t *s, cdtime_t now)
+{
+    size_t capacity = s->capacity;
+    size_t live = 0;
+
+    s->last_sweep = now;
+    if (s->slots == NULL || now < cache_timeout)
+        return;
+
+    for (size_t i = 0; i < s->capacity; i++)
+        if (s->slots[i].hash != 0 && s->slots[i].last_seen >= now - cache_timeout)
+            live++;
+
+    if (live == s->size)
+        return;
+
+    while (capacity > SCRIBE_CACHE_INITIAL_SIZE && live * 8 < capacity)
+        capacity /= 2;
+
+    scribe_cache_rehash(s, capacity, now - cache_timeout);
+}
+
+/* Returns true if the data source identified by `hash' has been written less
+ * than the configured update interval ago; otherwise records `time' as the
+ * last write. `time' is the value's timestamp and only used for the update
+ * interval; entries are aged by the local clock, so out-of-order or skewed
+ * timestamps cannot trigger sweeps or expire entries early. */
+static bool scribe_cache_check(uint64_t hash, cdtime_t time, int update_interval,
+        bool *first_write)
+{
+    scribe_cache_stripe_t *s = &write_cache[hash >> 58];
+    scribe_cache_slot_t *slot;
+    cdtime_t now = cdtime();
+
+    pthread_mutex_lock(&s->lock);
+
+    if (s->last_sweep == 0)
+        s->last_sweep = now;
+    else if (now - s->last_sweep >= cache_timeout)
+        scribe_cache_sweep(s, now);
+
+    /* Keep the load factor below 3/4 */
+    if (s->slots == NULL || (s->size + 1) * 4 > s->capacity * 3) {
+        size_t capacity = (s->slots == NULL) ? SCRIBE_CACHE_INITIAL_SIZE
+                                             : s->capacity * 2;
+        if (scribe_cache_rehash(s, capacity, 0) != 0) {
+            pthread_mutex_unlock(&s->lock);
+            *first_write = true;
+            return false;
+        }
+    }
+
+    slot = scribe_cache_probe(s->slots, s->capacity, hash);
+
+    if (slot->hash == 0) {
+        slot->hash = hash;
+        slot->last_write = 0;
+        s->size++;
+    }
+    slot->last_seen = now;
+
+    *first_write = (slot->last_write == 0);
+
+    // Within interval so wait nothing todo...
+    if (!*first_write &&
+            ((time >> 30) - (slot->last_write >> 30)) < (cdtime_t) update_interval) {
+        pthread_mutex_unlock(&s->lock);
+        return true;
+    }
+
+    slot->last_write = time;
+    pthread_mutex_unlock(&s->lock);
+    return false;
+}
+
+/* Forget about the last write so a value that failed to be sent is retried on
+ * the next write instead of after the update interval. */
+static void scribe_cache_forget(uint64_t hash)
 {
-    pthread_mutex_lock(&metrics_lock);
+    scribe_cache_stripe_t *s = &write_cache[hash >> 58];
 
-    char *buffer = metrics_buffer;
-    const size_t bsize = metric_buffer_size;
-    size_t   bfree = bsize;
-    size_t   bfill = 0;
+    pthread_mutex_lock(&s->lock);
+    if (s->slots != NULL) {
+        scribe_cache_slot_t *slot = scribe_cache_probe(s->slots, s->capacity, hash);
+        if (slot->hash == hash)
+            slot->last_write = 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
 
+static void scribe_cache_destroy(void)
+{
+    for (size_t i = 0; i < SCRIBE_CACHE_STRIPES; i++) {
+        scribe_cache_stripe_t *s = &write_cache[i];
+
+        pthread_mutex_lock(&s->lock);
+        sfree(s->slots);
+        s->capacity = 0;
+        s->size = 0;
+        s->last_sweep = 0;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static int scribe_write_messages (const data_set_t *ds, const value_list_t *vl)
+{
     if (!is_scribe_initialized())
-    {
-        pthread_mutex_unlock(&metrics_lock);
         return -1;
-    }
 
     if (0 != strcmp (ds->type, vl->type))
     {
         ERROR ("scribe_write plugin: DS type does not match "
                 "value list type");
-        pthread_mutex_unlock(&metrics_lock);
         return -1;
     }
 
@@ -84,7 +408,6 @@ static int scribe_write_messages (const data_set_t *ds, const value_list_t *vl)
 
        if (status == 0)
        {
-          pthread_mutex_unlock(&metrics_lock);
           //Filter flag found
           return 0;
        }
@@ -101,117 +424,67 @@ static int scribe_write_messages (const data_set_t *ds, const value_list_t *vl)
        }
     }
 
+    scribe_batch_t *batch = scribe_batch_get();
+    if (batch == NULL)
+    {
+        ERROR("write_scribe plugin: Unable to allocate write buffer");
+        return -ENOMEM;
+    }
+
+    int update_interval = get_scribe_metric_update_interval_secs();
+    uint64_t series_id = (update_interval > 0) ? VL_SERIES_ID(vl) : 0;
+
     //one metric at a time (in collectd they can be combined)
     for (int i = 0; i < ds->ds_num; i++) {
 
-        /* Check last time we wrote to this key */
-        char const *ds_name = ds->ds[i].name;
-        char key[10 * DATA_MAX_NAME_LEN];
+        /* Check last time we wrote to this data source */
+        uint64_t hash = 0;
+        bool first_write = false;
+        int r;
 
-        /* Copy the identifier to `key' and escape it. */
-        int r = gr_format_name(key, sizeof(key), vl, ds_name, "", "", '.', 0);
-        if (r != 0) {
-            ERROR("format_graphite: error with gr_format_name");
-            pthread_mutex_unlock(&metrics_lock);
-            return r;
+        if (update_interval > 0)
+        {
+            hash = scribe_ds_hash(series_id, i);
+            if (scribe_cache_check(hash, vl->time, update_interval, &first_write))
+                continue;
         }
 
-        bool first_write = false;
-        cdtime_t *last_write = NULL;
-        char *key_copy = NULL;
-        if (get_scribe_metric_update_interval_secs() > 0)
+        /* Send on to Scribe */
+        r = scribe_batch_append(batch, ds, vl, i, 0, NULL);
+        if (r != 0)
         {
-            if (c_avl_remove(write_cache, key, (void *)&key_copy, (void *)&last_write) == 0)
-            {
-                // Within interval so wait nothing todo...
-                if (((vl->time >> 30) - (*last_write >> 30)) < get_scribe_metric_update_interval_secs())
-                {
-                    r = c_avl_insert(write_cache, key_copy, last_write);
-                    if (r != 0)
-                        WARNING("Error adding key %s to write_cache", key);
-
-                    continue;
-                }
-            }
+            if (update_interval > 0)
+                scribe_cache_forget(hash);
+            continue;
+        }
 
-            // New key, allocate for cache otherwise reuse existing memory
-            if (last_write == NULL) {
-                first_write = true;
-                last_write = malloc(sizeof(cdtime_t));
-                key_copy = strdup(key);
-            }
+        //If series tell collectd to keep the last N points
+        if (!is_series || update_interval <= 0 || first_write)
+            continue;
 
-            *last_write = vl->time;
-        }
+        int history_length = CDTIME_T_TO_MS(vl->interval) / 1000;
 
-        /* Send on to Scribe */
-        memset (buffer, 0, bsize);
+        //Might not be able to make a series if interval is >= scribe interval
+        if (history_length <= 0 || history_length >= update_interval)
+            continue;
 
-        r = format_insights_initialize(buffer, &bfill, &bfree);
-        if (r == 0)
-            r = format_insights_value_list(buffer, &bfill, &bfree, ds, vl, 0, NULL, 0, 0, NULL, i, i+1, 0, NULL);
-        if (r == 0)
-            r = format_insights_finalize(buffer, &bfill, &bfree);
+        history_length = update_interval / history_length;
 
-        if (strlen(buffer) > 0 && r == 0)
-        {
-            scribe_log(buffer, "insights");
+        gauge_t *history_values = calloc(history_length * ds->ds_num, sizeof(gauge_t));
+        if (history_values == NULL)
+            continue;
 
-            if (last_write != NULL)
-            {
-                r = c_avl_insert(write_cache, key_copy, last_write);
-                if (r != 0)
-                    WARNING("Error adding key %s to write_cache", key);
-
-                 //If series tell collectd to keep the last N points
-                 if (is_series)
-                 {
-                    int history_length = CDTIME_T_TO_MS(vl->interval) / 1000;
-                    
-                    //Might not be able to make a series if interval is >= scribe interval
-                    if (history_length < get_scribe_metric_update_interval_secs())
-                    {
-                        history_length = get_scribe_metric_update_interval_secs() / history_length;
-
-                        size_t histmemsz = sizeof(gauge_t) * history_length * ds->ds_num;
-                        gauge_t *history_values = malloc(histmemsz);
-                        memset(history_values, 0, histmemsz);
-
-                        if(0 == uc_get_history(ds, vl, history_values, history_length, ds->ds_num)) {
-                            memset (buffer, 0, bsize);
-                            bfill = 0;
-                            bfree = bsize;
-
-                            if (!first_write) {
-                                r = format_insights_initialize(buffer, &bfill, &bfree);
-
-                                if (r == 0)
-                                    r = format_insights_value_list(buffer, &bfill, &bfree, ds, vl, 0, NULL, 0, 0, NULL, i, i+1, history_length, history_values);
-                            
-                                if (r == 0)
-                                    r = format_insights_finalize(buffer, &bfill, &bfree);
-                        
-                                if (r == 0)
-                                    scribe_log(buffer, "insights");
-
-                                if (r != 0)
-                                    WARNING("Problem writing %s %d %lu", key, r, bfree);
-                            }
-                        }
-
-                        sfree(history_values);
-                    }
-                 }
-            }
-        }
-        else
-        {
-            sfree(key_copy);
-            sfree(last_write);
+        if (0 == uc_get_history(ds, vl, history_values, history_length, ds->ds_num)) {
+            r = scribe_batch_append(batch, ds, vl, i, history_length, history_values);
+            if (r != 0)
+                WARNING("Problem writing series %s/%s-%s/%s-%s: %d", vl->host,
+                        vl->plugin, vl->plugin_instance, vl->type,
+                        vl->type_instance, r);
         }
+
+        sfree(history_values);
     }
 
-    pthread_mutex_unlock(&metrics_lock);
     return (0);
 } /* int wl_write_messages */
 
@@ -222,6 +495,21 @@ static int scribe_write (const data_set_t *ds, const value_list_t *vl,
     return (status);
 }
 
+static int scribe_flush (cdtime_t timeout,
+        const char *identifier __attribute__((unused)),
+        user_data_t *user_data __attribute__((unused)))
+{
+    scribe_batch_flush_all(timeout);
+    return (0);
+}
+
+/* Ships batches of write threads that have gone quiet. */
+static int scribe_batch_read (user_data_t *ud __attribute__((unused)))
+{
+    scribe_batch_flush_all(batch_timeout);
+    return (0);
+}
+
 static int scribe_init(void)
 {
     srand(time(NULL) ^ getpid());
@@ -237,14 +525,27 @@ static int scribe_init(void)
     }
 
     new_scribe2(scribe_config_file);
-    write_cache = c_avl_create(compare_callback);
-    if (write_cache == NULL) {
-        ERROR("Error creating write_cache");
-        return -1;
+
+    for (size_t i = 0; i < SCRIBE_CACHE_STRIPES; i++)
+        pthread_mutex_init(&write_cache[i].lock, NULL);
+
+    /* Drop series which have not been seen for a while. */
+    if (cache_timeout == 0) {
+        cdtime_t update_interval = TIME_T_TO_CDTIME_T(get_scribe_metric_update_interval_secs());
+        cache_timeout = 10 * plugin_get_interval();
+        if (cache_timeout < 10 * update_interval)
+            cache_timeout = 10 * update_interval;
+    }
+
+    if (!batch_key_created) {
+        if (pthread_key_create(&batch_key, NULL) != 0) {
+            ERROR("write_scribe plugin: pthread_key_create failed");
+            return -1;
+        }
+        batch_key_created = 1;
     }
 
     us_init();
-    metrics_buffer = malloc(metric_buffer_size);
 
     return (0);
 }
@@ -260,17 +561,20 @@ static void scribe_instance_definition_destroy(void *arg){
         cu_tail_destroy (id->tail);
     id->tail = NULL;
 
+    insights_encoder_destroy(&id->enc);
+    sfree(id->buffer);
     sfree(id->instance);
     sfree(id->path);
+    sfree(id->position_file);
     sfree(id);
 }
 
 static int scribe_shutdown()
 {
-    pthread_mutex_lock(&metrics_lock);
-
     us_shutdown_listener();
 
+    scribe_batch_destroy_all();
+
     for (int i = 0; i < num_tailed_files; i++)
     {
         scribe_instance_definition_destroy((void *)tailed_files[i]);
@@ -280,25 +584,143 @@ static int scribe_shutdown()
     if (is_scribe_initialized())
         delete_scribe();
 
-    if (write_cache != NULL)
-    {
-        void *key;
-        void *value;
-        while (c_avl_pick(write_cache, &key, &value) == 0) {
-            sfree(key);
-            sfree(value);
+    scribe_cache_destroy();
+
+    return (0);
+}
+
+
+static void scribe_tail_load_position(instance_definition_t *id)
+{
+    unsigned long long inode;
+    unsigned long long offset;
+    FILE *fh;
+
+    if (id->position_file == NULL)
+        return;
+
+    fh = fopen(id->position_file, "r");
+    if (fh == NULL) {
+        if (errno != ENOENT) {
+            char errbuf[1024];
+            WARNING("write_scribe plugin: Opening \"%s\" failed: %s",
+                    id->position_file, sstrerror(errno, errbuf, sizeof(errbuf)));
         }
+        return;
+    }
 
-        c_avl_destroy(write_cache);
-        write_cache = NULL;
+    if (fscanf(fh, "%llu %llu", &inode, &offset) == 2) {
+        id->saved_inode = (uint64_t) inode;
+        id->saved_offset = (uint64_t) offset;
+        cu_tail_set_position(id->tail, id->saved_inode, id->saved_offset);
+    } else {
+        WARNING("write_scribe plugin: Ignoring malformed position file \"%s\".",
+                id->position_file);
     }
 
-    sfree(metrics_buffer);
-    pthread_mutex_unlock(&metrics_lock);
+    fclose(fh);
+}
 
-    return (0);
+/* Records how far the file has been shipped: everything up to the start of
+ * the incomplete line still held in the buffer. */
+static void scribe_tail_save_position(instance_definition_t *id)
+{
+    char tmp_file[PATH_MAX];
+    uint64_t inode;
+    uint64_t offset;
+    FILE *fh;
+
+    if (id->position_file == NULL)
+        return;
+
+    if (cu_tail_get_position(id->tail, &inode, &offset) != 0)
+        return;
+    offset -= (offset >= id->fill) ? id->fill : offset;
+
+    if (inode == id->saved_inode && offset == id->saved_offset)
+        return;
+
+    /* Write a new file and rename it, so a crash never leaves a torn one. */
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", id->position_file);
+    fh = fopen(tmp_file, "w");
+    if (fh == NULL) {
+        char errbuf[1024];
+        ERROR("write_scribe plugin: Opening \"%s\" failed: %s", tmp_file,
+                sstrerror(errno, errbuf, sizeof(errbuf)));
+        return;
+    }
+
+    fprintf(fh, "%llu %llu\n", (unsigned long long) inode,
+            (unsigned long long) offset);
+    if (fclose(fh) != 0 || rename(tmp_file, id->position_file) != 0) {
+        char errbuf[1024];
+        ERROR("write_scribe plugin: Writing \"%s\" failed: %s",
+                id->position_file, sstrerror(errno, errbuf, sizeof(errbuf)));
+        return;
+    }
+
+    id->saved_inode = inode;
+    id->saved_offset = offset;
 }
 
+static void scribe_tail_add_line(instance_definition_t *id, char *line,
+        size_t len)
+{
+    int r = 0;
+
+    /* Remove newlines at the end of line. */
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        len--;
+
+    if (len == 0)
+        return;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        r = insights_encoder_add_log(&id->enc, line, len,
+                (id->instance != NULL) ? id->instance : id->path);
+
+        /* Buffer full: ship what we have and retry with an empty buffer. */
+        if (r == -ENOMEM && id->enc.count > 0) {
+            scribe_encoder_send(&id->enc);
+            continue;
+        }
+        break;
+    }
+
+    if (r != 0) {
+        WARNING("write_scribe plugin: File \"%s\": Dropping a %zu byte line, "
+                "encoding failed with status %i.", id->path, len, r);
+        return;
+    }
+
+    if (batch_size == 0 || id->enc.fill >= (size_t) batch_size)
+        scribe_encoder_send(&id->enc);
+}
+
+/* Hands all complete lines in the buffer to the encoder and keeps the
+ * incomplete rest. */
+static void scribe_tail_split_lines(instance_definition_t *id)
+{
+    char *start = id->buffer;
+    char *end = id->buffer + id->fill;
+    char *newline;
+
+    while ((newline = memchr(start, '\n', end - start)) != NULL) {
+        scribe_tail_add_line(id, start, newline - start);
+        start = newline + 1;
+    }
+
+    if (start == id->buffer && id->fill >= SCRIBE_TAIL_MAX_LINE) {
+        WARNING("write_scribe plugin: File \"%s\": Line longer than %i bytes, "
+                "sending it in pieces.", id->path, SCRIBE_TAIL_MAX_LINE);
+        scribe_tail_add_line(id, id->buffer, id->fill);
+        start = end;
+    }
+
+    id->fill = end - start;
+    if (id->fill > 0 && start != id->buffer)
+        memmove(id->buffer, start, id->fill);
+}
 
 static int scribe_tail_read (user_data_t *ud) {
     instance_definition_t *id;
@@ -313,55 +735,90 @@ static int scribe_tail_read (user_data_t *ud) {
                     id->path);
             return (-1);
         }
+        scribe_tail_load_position(id);
     }
 
-    while (1)
+    if (id->buffer == NULL)
     {
-        char buffer[SCRIBE_BUF_SIZE + 512];
-        char log_buffer[SCRIBE_BUF_SIZE];
-        size_t   bfree = sizeof(buffer);
-        size_t   bfill = 0;
-        int status;
-
-        status = cu_tail_readline (id->tail, log_buffer, (int) sizeof(log_buffer));
-        if (status != 0)
+        id->buffer = malloc(SCRIBE_TAIL_CHUNK_SIZE);
+        if (id->buffer == NULL)
+            return (-1);
+        id->size = SCRIBE_TAIL_CHUNK_SIZE;
+        id->fill = 0;
+
+        if (insights_encoder_init(&id->enc, SCRIBE_BUF_SIZE, metric_buffer_size) != 0)
         {
-            ERROR ("scribe_write plugin: File \"%s\": cu_tail_readline failed "
-                    "with status %i.", id->path, status);
+            sfree(id->buffer);
             return (-1);
         }
+    }
 
-        int buffer_len = strlen (log_buffer);
-        if (buffer_len == 0)
-            break;
+    if (!is_scribe_initialized())
+        return (0);
+
+    while (1)
+    {
+        uint64_t inode_before = 0;
+        uint64_t inode_after = 0;
+        uint64_t offset;
+        ssize_t status;
 
-        /* Remove newlines at the end of line. */
-        while (buffer_len > 0) {
-            if ((log_buffer[buffer_len - 1] == '\n') || (log_buffer[buffer_len - 1] == '\r')) {
-                log_buffer[buffer_len - 1] = 0;
-                buffer_len--;
-            } else {
+        /* Make room for a long line, up to the limit. */
+        if (id->fill == id->size && id->size < SCRIBE_TAIL_MAX_LINE)
+        {
+            char *tmp = realloc(id->buffer, 2 * id->size);
+            if (tmp == NULL)
+            {
+                ERROR ("write_scribe plugin: realloc failed.");
                 break;
             }
+            id->buffer = tmp;
+            id->size *= 2;
         }
 
+        cu_tail_get_position(id->tail, &inode_before, &offset);
 
-        if (!is_scribe_initialized())
+        status = cu_tail_read_chunk (id->tail, id->buffer + id->fill,
+                id->size - id->fill);
+        if (status < 0)
+        {
+            ERROR ("scribe_write plugin: File \"%s\": cu_tail_read_chunk failed "
+                    "with status %zi.", id->path, status);
+            break;
+        }
+        if (status == 0)
             break;
 
-        //one metric at a time (in collectd they can be combined)
-        memset (buffer, 0, sizeof (buffer));
+        /* The file was rotated: the last line of the old file will never be
+         * completed, ship it on its own. */
+        cu_tail_get_position(id->tail, &inode_after, &offset);
+        if (inode_before != 0 && inode_before != inode_after && id->fill > 0)
+        {
+            size_t old_fill = id->fill;
 
-        int r = format_insights_initialize(buffer, &bfill, &bfree);
-        if (r == 0)
-            r = format_insights_log(buffer, &bfill, &bfree, log_buffer, id->instance);
-        if (r == 0)
-            r = format_insights_finalize(buffer, &bfill, &bfree);
+            scribe_tail_add_line(id, id->buffer, old_fill);
+            memmove(id->buffer, id->buffer + old_fill, (size_t) status);
+            id->fill = 0;
+        }
+
+        id->fill += (size_t) status;
+        scribe_tail_split_lines(id);
 
-        if (strlen(buffer) > 0 && r == 0)
-            scribe_log(buffer, "insights");
+        /* Restore the chunk size once a long line has been handled. */
+        if (id->fill == 0 && id->size > SCRIBE_TAIL_CHUNK_SIZE)
+        {
+            char *tmp = realloc(id->buffer, SCRIBE_TAIL_CHUNK_SIZE);
+            if (tmp != NULL)
+            {
+                id->buffer = tmp;
+                id->size = SCRIBE_TAIL_CHUNK_SIZE;
+            }
+        }
     }
 
+    scribe_encoder_send(&id->enc);
+    scribe_tail_save_position(id);
+
     return (0);
 }
 
@@ -401,6 +858,8 @@ static int scribe_config_add_file_tail(oconfig_item_t *ci)
           status = cf_util_get_string(option, &id->instance);
       else if (strcasecmp("Interval", option->key) == 0)
           cf_util_get_cdtime(option, &id->interval);
+      else if (strcasecmp("PositionFile", option->key) == 0)
+          status = cf_util_get_string(option, &id->position_file);
       else {
           WARNING("scribe_write plugin: Option `%s' not allowed here.", option->key);
           status = -1;
@@ -453,6 +912,12 @@ static int scribe_config(oconfig_item_t *ci)
             status = cf_util_get_string (child, &scribe_config_file);
         else if (strcasecmp("File", child->key) == 0)
             scribe_config_add_file_tail(child);
+        else if (strcasecmp("BatchSize", child->key) == 0)
+            status = cf_util_get_int (child, &batch_size);
+        else if (strcasecmp("BatchTimeout", child->key) == 0)
+            status = cf_util_get_cdtime (child, &batch_timeout);
+        else if (strcasecmp("CacheTimeout", child->key) == 0)
+            status = cf_util_get_cdtime (child, &cache_timeout);
         else
             WARNING("write_scribe plugin: Ignoring config option `%s'.", child->key);
 
@@ -468,6 +933,20 @@ static int scribe_config(oconfig_item_t *ci)
         return -10;
     }
 
+    if (batch_size < 0 || batch_size > metric_buffer_size / 2)
+    {
+        ERROR("write_scribe plugin: BatchSize must be between 0 and %i",
+                metric_buffer_size / 2);
+        return -1;
+    }
+
+    if (batch_size > 0 && batch_timeout == 0)
+        batch_timeout = plugin_get_interval();
+
+    if (batch_size > 0)
+        plugin_register_complex_read(NULL, "write_scribe/batch",
+                scribe_batch_read, batch_timeout, NULL);
+
     //config unixsock
     return us_config_complex(ci);
 }
@@ -478,6 +957,7 @@ void module_register (void)
     plugin_register_complex_config("write_scribe", scribe_config);
     plugin_register_shutdown("write_scribe", scribe_shutdown);
     plugin_register_write ("write_scribe", scribe_write, NULL);
+    plugin_register_flush ("write_scribe", scribe_flush, NULL);
 }
 
 /* vim: set sw=4 ts=4 sts=4 tw=78 et : */
@@ -46,9 +46,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_cache.h"
-#include "utils_random.h"
-
-#include <netdb.h>
+#include "utils_line_sender.h"
 
 #ifndef WT_DEFAULT_NODE
 #define WT_DEFAULT_NODE "localhost"
@@ -67,14 +65,26 @@
 #define WT_SEND_BUF_SIZE 1428
 #endif
 
+#ifndef WT_MIN_RECONNECT_INTERVAL
+#define WT_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T(1)
+#endif
+
+#ifndef WT_DEFAULT_RECONNECT_MAX_INTERVAL
+#define WT_DEFAULT_RECONNECT_MAX_INTERVAL TIME_T_TO_CDTIME_T(60)
+#endif
+
+#ifndef WT_DEFAULT_BUFFER_SIZE
+#define WT_DEFAULT_BUFFER_SIZE (1024 * 1024)
+#endif
+
+#ifndef WT_DEFAULT_SPILL_SIZE
+#define WT_DEFAULT_SPILL_SIZE (64 * 1024 * 1024)
+#endif
+
 /*
  * Private variables
  */
 struct wt_callback {
-  struct addrinfo *ai;
-  cdtime_t ai_last_update;
-  int sock_fd;
-
   char *node;
   char *service;
   char *host_tags;
@@ -82,16 +92,14 @@ struct wt_callback {
   _Bool store_rates;
   _Bool always_append_ds;
 
-  char send_buf[WT_SEND_BUF_SIZE];
-  size_t send_buf_free;
-  size_t send_buf_fill;
-  cdtime_t send_buf_init_time;
+  cdtime_t reconnect_max_interval;
+  size_t buffer_size;
+  char *spill_file;
+  size_t spill_size;
 
-  pthread_mutex_t send_lock;
-
-  _Bool connect_failed_log_enabled;
-  int connect_dns_failed_attempts_remaining;
-  cdtime_t next_random_ttl;
+  /* Lines are sent by the sender's own thread, so a slow or unreachable
+   * TSD does not block the write threads. */
+  line_sender_t *sender;
 };
 
 static cdtime_t resolve_interval = 0;
@@ -100,166 +108,6 @@ static cdtime_t resolve_jitter = 0;
 /*
  * Functions
  */
-static void wt_reset_buffer(struct wt_callback *cb) {
-  memset(cb->send_buf, 0, sizeof(cb->send_buf));
-  cb->send_buf_free = sizeof(cb->send_buf);
-  cb->send_buf_fill = 0;
-  cb->send_buf_init_time = cdtime();
-}
-
-static int wt_send_buffer(struct wt_callback *cb) {
-  ssize_t status = 0;
-
-  status = swrite(cb->sock_fd, cb->send_buf, strlen(cb->send_buf));
-  if (status != 0) {
-    char errbuf[1024];
-    ERROR("write_tsdb plugin: send failed with status %zi (%s)", status,
-          sstrerror(errno, errbuf, sizeof(errbuf)));
-
-    close(cb->sock_fd);
-    cb->sock_fd = -1;
-
-    return -1;
-  }
-
-  return 0;
-}
-
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wt_flush_nolock(cdtime_t timeout, struct wt_callback *cb) {
-  int status;
-
-  DEBUG("write_tsdb plugin: wt_flush_nolock: timeout = %.3f; "
-        "send_buf_fill = %zu;",
-        (double)timeout, cb->send_buf_fill);
-
-  /* timeout == 0  => flush unconditionally */
-  if (timeout > 0) {
-    cdtime_t now;
-
-    now = cdtime();
-    if ((cb->send_buf_init_time + timeout) > now)
-      return 0;
-  }
-
-  if (cb->send_buf_fill == 0) {
-    cb->send_buf_init_time = cdtime();
-    return 0;
-  }
-
-  status = wt_send_buffer(cb);
-  wt_reset_buffer(cb);
-
-  return status;
-}
-
-static cdtime_t new_random_ttl() {
-  if (resolve_jitter == 0)
-    return 0;
-
-  return (cdtime_t)cdrand_range(0, (long)resolve_jitter);
-}
-
-static int wt_callback_init(struct wt_callback *cb) {
-  int status;
-  cdtime_t now;
-
-  const char *node = cb->node ? cb->node : WT_DEFAULT_NODE;
-  const char *service = cb->service ? cb->service : WT_DEFAULT_SERVICE;
-
-  if (cb->sock_fd > 0)
-    return 0;
-
-  now = cdtime();
-  if (cb->ai) {
-    /* When we are here, we still have the IP in cache.
-     * If we have remaining attempts without calling the DNS, we update the
-     * last_update date so we keep the info until next time.
-     * If there is no more attempts, we need to flush the cache.
-     */
-
-    if ((cb->ai_last_update + resolve_interval + cb->next_random_ttl) < now) {
-      cb->next_random_ttl = new_random_ttl();
-      if (cb->connect_dns_failed_attempts_remaining > 0) {
-        /* Warning : this is run under send_lock mutex.
-         * This is why we do not use another mutex here.
-         * */
-        cb->ai_last_update = now;
-        cb->connect_dns_failed_attempts_remaining--;
-      } else {
-        freeaddrinfo(cb->ai);
-        cb->ai = NULL;
-      }
-    }
-  }
-
-  if (cb->ai == NULL) {
-    if ((cb->ai_last_update + resolve_interval + cb->next_random_ttl) >= now) {
-      DEBUG("write_tsdb plugin: too many getaddrinfo(%s, %s) failures", node,
-            service);
-      return -1;
-    }
-    cb->ai_last_update = now;
-    cb->next_random_ttl = new_random_ttl();
-
-    struct addrinfo ai_hints = {
-        .ai_family = AF_UNSPEC,
-        .ai_flags = AI_ADDRCONFIG,
-        .ai_socktype = SOCK_STREAM,
-    };
-
-    status = getaddrinfo(node, service, &ai_hints, &cb->ai);
-    if (status != 0) {
-      if (cb->ai) {
-        freeaddrinfo(cb->ai);
-        cb->ai = NULL;
-      }
-      if (cb->connect_failed_log_enabled) {
-        ERROR("write_tsdb plugin: getaddrinfo(%s, %s) failed: %s", node,
-              service, gai_strerror(status));
-        cb->connect_failed_log_enabled = 0;
-      }
-      return -1;
-    }
-  }
-
-  assert(cb->ai != NULL);
-  for (struct addrinfo *ai = cb->ai; ai != NULL; ai = ai->ai_next) {
-    cb->sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-    if (cb->sock_fd < 0)
-      continue;
-
-    set_sock_opts(cb->sock_fd);
-
-    status = connect(cb->sock_fd, ai->ai_addr, ai->ai_addrlen);
-    if (status != 0) {
-      close(cb->sock_fd);
-      cb->sock_fd = -1;
-      continue;
-    }
-
-    break;
-  }
-
-  if (cb->sock_fd < 0) {
-    char errbuf[1024];
-    ERROR("write_tsdb plugin: Connecting to %s:%s failed. "
-          "The last error was: %s",
-          node, service, sstrerror(errno, errbuf, sizeof(errbuf)));
-    return -1;
-  }
-
-  if (0 == cb->connect_failed_log_enabled) {
-    WARNING("write_tsdb plugin: Connecting to %s:%s succeeded.", node, service);
-    cb->connect_failed_log_enabled = 1;
-  }
-  cb->connect_dns_failed_attempts_remaining = 1;
-
-  wt_reset_buffer(cb);
-
-  return 0;
-}
-
 static void wt_callback_free(void *data) {
   struct wt_callback *cb;
 
@@ -268,19 +116,13 @@ static void wt_callback_free(void *data) {
 
   cb = data;
 
-  pthread_mutex_lock(&cb->send_lock);
-
-  wt_flush_nolock(0, cb);
-
-  close(cb->sock_fd);
-  cb->sock_fd = -1;
+  /* Sends what is still queued, if the TSD is reachable. */
+  line_sender_destroy(cb->sender);
 
   sfree(cb->node);
   sfree(cb->service);
   sfree(cb->host_tags);
-
-  pthread_mutex_unlock(&cb->send_lock);
-  pthread_mutex_destroy(&cb->send_lock);
+  sfree(cb->spill_file);
 
   sfree(cb);
 }
@@ -289,28 +131,13 @@ static int wt_flush(cdtime_t timeout,
                     const char *identifier __attribute__((unused)),
                     user_data_t *user_data) {
   struct wt_callback *cb;
-  int status;
 
   if (user_data == NULL)
     return -EINVAL;
 
   cb = user_data->data;
 
-  pthread_mutex_lock(&cb->send_lock);
-
-  if (cb->sock_fd < 0) {
-    status = wt_callback_init(cb);
-    if (status != 0) {
-      ERROR("write_tsdb plugin: wt_callback_init failed.");
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
-    }
-  }
-
-  status = wt_flush_nolock(timeout, cb);
-  pthread_mutex_unlock(&cb->send_lock);
-
-  return status;
+  return line_sender_flush(cb->sender, timeout);
 }
 
 static int wt_format_values(char *ret, size_t ret_len, int ds_num,
@@ -449,7 +276,6 @@ static int wt_send_message(const char *key, const char *value, cdtime_t time,
     } else if (status < 0) {
       ERROR("write_tsdb plugin: tags metadata get failure");
       sfree(temp);
-      pthread_mutex_unlock(&cb->send_lock);
       return status;
     } else {
       tags = temp;
@@ -471,42 +297,8 @@ static int wt_send_message(const char *key, const char *value, cdtime_t time,
     return -1;
   }
 
-  pthread_mutex_lock(&cb->send_lock);
-
-  if (cb->sock_fd < 0) {
-    status = wt_callback_init(cb);
-    if (status != 0) {
-      ERROR("write_tsdb plugin: wt_callback_init failed.");
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
-    }
-  }
-
-  if (message_len >= cb->send_buf_free) {
-    status = wt_flush_nolock(0, cb);
-    if (status != 0) {
-      pthread_mutex_unlock(&cb->send_lock);
-      return status;
-    }
-  }
-
-  /* Assert that we have enough space for this message. */
-  assert(message_len < cb->send_buf_free);
-
-  /* `message_len + 1' because `message_len' does not include the
-   * trailing null byte. Neither does `send_buffer_fill'. */
-  memcpy(cb->send_buf + cb->send_buf_fill, message, message_len + 1);
-  cb->send_buf_fill += message_len;
-  cb->send_buf_free -= message_len;
-
-  DEBUG("write_tsdb plugin: [%s]:%s buf %zu/%zu (%.1f %%) \"%s\"", cb->node,
-        cb->service, cb->send_buf_fill, sizeof(cb->send_buf),
-        100.0 * ((double)cb->send_buf_fill) / ((double)sizeof(cb->send_buf)),
-        message);
-
-  pthread_mutex_unlock(&cb->send_lock);
-
-  return 0;
+  /* If the queue is full, the sender complains about the dropped data. */
+  return line_sender_enqueue(cb->sender, message, message_len);
 }
 
 static int wt_write_messages(const data_set_t *ds, const value_list_t *vl,
@@ -549,8 +341,10 @@ static int wt_write_messages(const data_set_t *ds, const value_list_t *vl,
     /* Send the message to tsdb */
     status = wt_send_message(key, values, vl->time, cb, vl->host, vl->meta);
     if (status != 0) {
-      ERROR("write_tsdb plugin: error with "
-            "wt_send_message");
+      /* A full queue has been reported by the sender already. */
+      if (status != ENOBUFS)
+        ERROR("write_tsdb plugin: error with "
+              "wt_send_message");
       return status;
     }
   }
@@ -573,6 +367,24 @@ static int wt_write(const data_set_t *ds, const value_list_t *vl,
   return status;
 }
 
+static int wt_config_size(oconfig_item_t *ci, size_t *ret_size) {
+  int size = 0;
+  int status;
+
+  status = cf_util_get_int(ci, &size);
+  if (status != 0)
+    return status;
+
+  if (size < WT_SEND_BUF_SIZE) {
+    ERROR("write_tsdb plugin: The \"%s\" option must be at least %d.",
+          ci->key, WT_SEND_BUF_SIZE);
+    return -1;
+  }
+
+  *ret_size = (size_t)size;
+  return 0;
+}
+
 static int wt_config_tsd(oconfig_item_t *ci) {
   struct wt_callback *cb;
   char callback_name[DATA_MAX_NAME_LEN];
@@ -582,11 +394,9 @@ static int wt_config_tsd(oconfig_item_t *ci) {
     ERROR("write_tsdb plugin: calloc failed.");
     return -1;
   }
-  cb->sock_fd = -1;
-  cb->connect_failed_log_enabled = 1;
-  cb->next_random_ttl = new_random_ttl();
-
-  pthread_mutex_init(&cb->send_lock, NULL);
+  cb->reconnect_max_interval = WT_DEFAULT_RECONNECT_MAX_INTERVAL;
+  cb->buffer_size = WT_DEFAULT_BUFFER_SIZE;
+  cb->spill_size = WT_DEFAULT_SPILL_SIZE;
 
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
@@ -601,6 +411,14 @@ static int wt_config_tsd(oconfig_item_t *ci) {
       cf_util_get_boolean(child, &cb->store_rates);
     else if (strcasecmp("AlwaysAppendDS", child->key) == 0)
       cf_util_get_boolean(child, &cb->always_append_ds);
+    else if (strcasecmp("ReconnectMaxInterval", child->key) == 0)
+      cf_util_get_cdtime(child, &cb->reconnect_max_interval);
+    else if (strcasecmp("BufferSize", child->key) == 0)
+      wt_config_size(child, &cb->buffer_size);
+    else if (strcasecmp("SpillFile", child->key) == 0)
+      cf_util_get_string(child, &cb->spill_file);
+    else if (strcasecmp("SpillSize", child->key) == 0)
+      wt_config_size(child, &cb->spill_size);
     else {
       ERROR("write_tsdb plugin: Invalid configuration "
             "option: %s.",
@@ -612,6 +430,29 @@ static int wt_config_tsd(oconfig_item_t *ci) {
            cb->node != NULL ? cb->node : WT_DEFAULT_NODE,
            cb->service != NULL ? cb->service : WT_DEFAULT_SERVICE);
 
+  line_sender_options_t opts = LINE_SENDER_OPTIONS_INIT;
+  opts.log_prefix = "write_tsdb plugin";
+  opts.thread_name = "write_tsdb";
+  opts.node = cb->node != NULL ? cb->node : WT_DEFAULT_NODE;
+  opts.service = cb->service != NULL ? cb->service : WT_DEFAULT_SERVICE;
+  opts.socktype = SOCK_STREAM;
+  opts.queue_size = cb->buffer_size;
+  opts.spill_file = cb->spill_file;
+  opts.spill_size = cb->spill_size;
+  opts.send_threshold = WT_SEND_BUF_SIZE;
+  opts.reconnect_min = WT_MIN_RECONNECT_INTERVAL;
+  opts.reconnect_max = cb->reconnect_max_interval;
+  opts.resolve_interval = resolve_interval;
+  opts.resolve_jitter = resolve_jitter;
+
+  cb->sender = line_sender_create(&opts);
+  if (cb->sender == NULL) {
+    ERROR("write_tsdb plugin: Creating the sender for %s failed.",
+          callback_name);
+    wt_callback_free(cb);
+    return -1;
+  }
+
   user_data_t user_data = {.data = cb, .free_func = wt_callback_free};
 
   plugin_register_write(callback_name, wt_write, &user_data);
@@ -626,15 +467,25 @@ static int wt_config(oconfig_item_t *ci) {
   if ((resolve_interval == 0) && (resolve_jitter == 0))
     resolve_interval = resolve_jitter = plugin_get_interval();
 
+  /* The resolve settings apply to all nodes, so read them first: each node's
+   * sender is created with its <Node> block. */
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
 
-    if (strcasecmp("Node", child->key) == 0)
-      wt_config_tsd(child);
-    else if (strcasecmp("ResolveInterval", child->key) == 0)
+    if (strcasecmp("ResolveInterval", child->key) == 0)
       cf_util_get_cdtime(child, &resolve_interval);
     else if (strcasecmp("ResolveJitter", child->key) == 0)
       cf_util_get_cdtime(child, &resolve_jitter);
+  }
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Node", child->key) == 0)
+      wt_config_tsd(child);
+    else if ((strcasecmp("ResolveInterval", child->key) == 0) ||
+             (strcasecmp("ResolveJitter", child->key) == 0))
+      continue; /* handled above */
     else {
       ERROR("write_tsdb plugin: Invalid configuration "
             "option: %s.",